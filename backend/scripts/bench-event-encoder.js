@@ -0,0 +1,127 @@
+// Measure the tracer's cost per event for a fixed mix of hooks.
+// Usage: node scripts/bench-event-encoder.js [--iterations N] [--runs N] [--baseline <git-ref>]
+//
+// A small driver is built against src/cpp/tracer.cpp and traces into
+// /dev/null, so the numbers are encoding and write overhead only. With
+// --baseline the same driver is also built against the tracer at that git
+// revision, for a before/after comparison. CXX picks the compiler.
+import { spawnSync } from 'child_process';
+import { mkdtempSync, mkdirSync, writeFileSync, rmSync } from 'fs';
+import { tmpdir } from 'os';
+import path from 'path';
+import { fileURLToPath } from 'url';
+
+const backendDir = path.resolve(path.dirname(fileURLToPath(import.meta.url)), '..');
+const EVENTS_PER_ITERATION = 6;
+
+// Per iteration: loop_body_start, func_enter, func_exit, assign,
+// condition_eval and loop_iteration_end.
+const DRIVER = `#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "trace.h"
+
+static int __attribute__((noinline)) step(int x) { return x * 3 + 1; }
+
+int main(int argc, char** argv) {
+    const long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    int value = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        __trace_loop_body_start(0, 12);
+        value = step(value) & 0xffff;
+        __trace_assign(value, value, 14);
+        __trace_condition_eval(1, "value > 100 && \\"quoted\\"", value > 100, 15);
+        __trace_loop_iteration_end(0, 12);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    printf("%lld\\n", (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    return 0;
+}
+`;
+
+function parseArgs(argv) {
+    const options = { iterations: 200000, runs: 5, baseline: null };
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        if (arg === '--iterations') options.iterations = parseInt(argv[++i], 10);
+        else if (arg === '--runs') options.runs = parseInt(argv[++i], 10);
+        else if (arg === '--baseline') options.baseline = argv[++i];
+        else throw new Error(`Unknown argument: ${arg}`);
+    }
+    if (!(options.iterations > 0) || !(options.runs > 0)) throw new Error('--iterations and --runs must be positive');
+    return options;
+}
+
+function run(command, args, options = {}) {
+    const result = spawnSync(command, args, { encoding: 'utf8', ...options });
+    if (result.error) throw result.error;
+    if (result.status !== 0) {
+        throw new Error(`${command} ${args.join(' ')} failed:\n${result.stderr || result.stdout}`);
+    }
+    return result.stdout;
+}
+
+function sourcesAt(ref, dir) {
+    for (const file of ['tracer.cpp', 'trace.h']) {
+        const text = run('git', ['-C', backendDir, 'show', `${ref}:./src/cpp/${file}`], { maxBuffer: 64 * 1024 * 1024 });
+        writeFileSync(path.join(dir, file), text);
+    }
+}
+
+function build(dir, sourceDir, compiler) {
+    const driver = path.join(dir, 'driver.cpp');
+    writeFileSync(driver, DRIVER);
+    const common = ['-O2', '-std=c++17', '-fno-omit-frame-pointer', `-I${sourceDir}`];
+    const noInstrument = compiler.includes('clang') ? [] : ['-fno-instrument-functions'];
+    run(compiler, ['-c', ...common, '-finstrument-functions', driver, '-o', path.join(dir, 'driver.o')]);
+    run(compiler, ['-c', ...common, ...noInstrument, path.join(sourceDir, 'tracer.cpp'), '-o', path.join(dir, 'tracer.o')]);
+    const executable = path.join(dir, 'bench');
+    run(compiler, ['-pthread', '-rdynamic', path.join(dir, 'driver.o'), path.join(dir, 'tracer.o'),
+        '-o', executable, '-ldl']);
+    return executable;
+}
+
+// Best of `runs`, as ns per event
+function measure(executable, iterations, runs) {
+    const env = { ...process.env, TRACE_OUTPUT: '/dev/null', TRACE_SHADOW: '0' };
+    let best = Infinity;
+    for (let i = 0; i < runs; i++) {
+        const ns = Number(run(executable, [String(iterations)], { env }).trim());
+        best = Math.min(best, ns / (iterations * EVENTS_PER_ITERATION));
+    }
+    return best;
+}
+
+try {
+    const options = parseArgs(process.argv.slice(2));
+    const compiler = process.env.CXX || 'clang++';
+    const work = mkdtempSync(path.join(tmpdir(), 'bench-event-encoder-'));
+    try {
+        const builds = [{ label: 'working tree', sourceDir: path.join(backendDir, 'src', 'cpp') }];
+        if (options.baseline) {
+            const sourceDir = path.join(work, 'baseline-src');
+            mkdirSync(sourceDir);
+            sourcesAt(options.baseline, sourceDir);
+            builds.push({ label: options.baseline, sourceDir });
+        }
+
+        const results = builds.map((b, i) => {
+            const dir = path.join(work, `build-${i}`);
+            mkdirSync(dir);
+            return { label: b.label, nsPerEvent: measure(build(dir, b.sourceDir, compiler), options.iterations, options.runs) };
+        });
+
+        for (const r of results) {
+            console.log(`${r.label.padEnd(16)} ${r.nsPerEvent.toFixed(1)} ns/event`);
+        }
+        if (results.length === 2) {
+            console.log(`speedup          ${(results[1].nsPerEvent / results[0].nsPerEvent).toFixed(2)}x`);
+        }
+    } finally {
+        rmSync(work, { recursive: true, force: true });
+    }
+} catch (e) {
+    console.error('Benchmark failed:', e.message);
+    process.exit(2);
+}
@@ -0,0 +1,21 @@
+// Compare two tracer outputs and report the first semantically different event.
+// Usage: node scripts/trace-diff.js <traceA.json> <traceB.json>
+import traceDiff from '../src/services/trace-diff.service.js';
+
+const [pathA, pathB] = process.argv.slice(2);
+if (!pathA || !pathB) {
+    console.error('Usage: node scripts/trace-diff.js <traceA.json> <traceB.json>');
+    process.exit(2);
+}
+
+try {
+    const started = process.hrtime.bigint();
+    const result = await traceDiff.diffFiles(pathA, pathB);
+    const elapsedMs = Number(process.hrtime.bigint() - started) / 1e6;
+    console.log(traceDiff.formatReport(result));
+    console.log(`(compared in ${elapsedMs.toFixed(1)} ms)`);
+    process.exit(result.identical ? 0 : 1);
+} catch (e) {
+    console.error('Trace diff failed:', e.message);
+    process.exit(2);
+}
@@ -10,6 +10,7 @@ export const SOCKET_EVENTS = {
   CODE_ANALYZE_SYNTAX: 'code:analyze:syntax',
   CODE_ANALYZE_CHUNK: 'code:analyze:chunk',
   CODE_TRACE_GENERATE: 'code:trace:generate',
+  CODE_TRACE_WINDOW_REQUEST: 'code:trace:window:request',
   
   EXECUTION_INPUT_PROVIDE: 'execution:input:provide',
   EXECUTION_PAUSE: 'execution:pause',
@@ -24,6 +25,7 @@ export const SOCKET_EVENTS = {
   CODE_TRACE_CHUNK: 'code:trace:chunk',
   CODE_TRACE_COMPLETE: 'code:trace:complete',
   CODE_TRACE_ERROR: 'code:trace:error',
+  CODE_TRACE_WINDOW: 'code:trace:window',
   
   EXECUTION_INPUT_RECEIVED: 'execution:input:received',
   EXECUTION_PAUSED: 'execution:paused',
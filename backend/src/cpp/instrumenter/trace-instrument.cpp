@@ -0,0 +1,826 @@
+// backend/src/cpp/instrumenter/trace-instrument.cpp
+//
+// Source instrumenter built on Clang's AST. Rewrites one C/C++ file with the
+// trace.h hooks its statements need:
+//
+//   trace-instrument <source> -o <output> -- <compile flags>
+//
+// Hooks are placed from the AST, so each knows the exact extent of its
+// statement, the scope and type of every variable it names, and whether an
+// expression has side effects. A written value is read back from what was
+// written, after the statement; no expression of the program is evaluated
+// twice. Conditions are wrapped in hooks that return their result.
+//
+// The variables the hooks name get slot ids in a static site table written at
+// the top of the output; loop and condition ids are numbered per file. A
+// `#line 1` after the table keeps the program's line numbers.
+//
+// Built by clang-instrumenter.service.js against the bundled toolchain's Clang
+// libraries.
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace clang;
+
+static llvm::cl::OptionCategory g_category("trace-instrument options");
+static llvm::cl::opt<std::string> g_output("o", llvm::cl::desc("Instrumented source to write"),
+                                           llvm::cl::value_desc("file"), llvm::cl::Required,
+                                           llvm::cl::cat(g_category));
+
+// Array elements reported one by one for an initialized array that is not int
+static const int INIT_ELEMENT_LIMIT = 64;
+
+static std::string quoted(llvm::StringRef text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += (c == '\n' || c == '\r' || c == '\t') ? ' ' : c;
+    }
+    return out + "\"";
+}
+
+static std::string joined(const std::vector<std::string>& hooks, const char* separator) {
+    std::string out;
+    for (const std::string& hook : hooks) {
+        if (!out.empty()) out += separator;
+        out += hook;
+    }
+    return out;
+}
+
+// Hooks as statements: "a; b; "
+static std::string statements(const std::vector<std::string>& hooks) {
+    return hooks.empty() ? "" : joined(hooks, "; ") + "; ";
+}
+
+// ========== TYPES ==========
+enum class Kind {
+    None,       // not traced
+    Scalar,     // arithmetic, enum, pointer: declare/assign with its value
+    Array,      // constant array of up to three dimensions
+    Container,  // std::vector, std::basic_string
+    Layout,     // struct given a TRACE_LAYOUT by this tool
+    Object      // any other class: declared, value null
+};
+
+// ========== INSTRUMENTER ==========
+class Instrumenter {
+public:
+    Instrumenter(ASTContext& ctx, Rewriter& rw)
+        : ctx(ctx), sm(ctx.getSourceManager()), lo(ctx.getLangOpts()), rw(rw), policy(lo) {
+        policy.SuppressTagKeyword = true;
+    }
+
+    void translation_unit();
+
+    void function(FunctionDecl* fn);
+
+private:
+    struct Site {
+        std::string name;
+        std::string type;
+        unsigned line;
+    };
+
+    // A loop being rewritten; `continue` ends an iteration of a while/do
+    // loop before its body's end, where iteration_end is
+    struct Loop {
+        unsigned id;
+        unsigned line;
+        bool endsAtContinue;
+    };
+
+    ASTContext& ctx;
+    SourceManager& sm;
+    const LangOptions& lo;
+    Rewriter& rw;
+    PrintingPolicy policy;
+
+    std::vector<Site> sites;
+    std::map<const VarDecl*, unsigned> slots;
+    std::set<const RecordDecl*> layouts;
+    std::vector<Loop> loops;
+    const FunctionDecl* current = nullptr;
+    unsigned nextLoop = 0;
+    unsigned nextCondition = 0;
+    unsigned nextIndex = 0;
+
+    // ---- source positions ----
+
+    bool in_main(SourceLocation loc) const {
+        return loc.isValid() && loc.isFileID() && sm.isInMainFile(loc);
+    }
+
+    bool editable(const Stmt* s) const {
+        return s && in_main(s->getBeginLoc()) && in_main(s->getEndLoc());
+    }
+
+    unsigned line_of(SourceLocation loc) const { return sm.getSpellingLineNumber(loc); }
+
+    SourceLocation end_of(const Stmt* s) const {
+        return Lexer::getLocForEndOfToken(s->getEndLoc(), 0, sm, lo);
+    }
+
+    // Just past a statement: after its ';' when it ends with one
+    SourceLocation after(const Stmt* s) const {
+        const SourceLocation end = s->getEndLoc();
+        Token token;
+        if (!Lexer::getRawToken(end, token, sm, lo) && token.is(tok::semi)) return end_of(s);
+        const SourceLocation semi = Lexer::findLocationAfterToken(end, tok::semi, sm, lo, false);
+        return semi.isValid() ? semi : end_of(s);
+    }
+
+    // Source of an expression, to be repeated on one line inside a hook.
+    // Empty when it cannot be: it spans lines or holds a comment.
+    std::string text_of(const Stmt* s) const {
+        if (!editable(s)) return "";
+        const std::string text =
+            Lexer::getSourceText(CharSourceRange::getTokenRange(s->getSourceRange()), sm, lo).str();
+        if (text.find('\n') != std::string::npos || text.find("//") != std::string::npos ||
+            text.find("/*") != std::string::npos) {
+            return "";
+        }
+        return text;
+    }
+
+    void insert(SourceLocation loc, const std::string& text) {
+        if (!text.empty()) rw.InsertTextAfter(loc, text);
+    }
+
+    // ---- variables ----
+
+    unsigned slot_of(const VarDecl* var) {
+        auto it = slots.find(var);
+        if (it != slots.end()) return it->second;
+        const unsigned slot = (unsigned)sites.size();
+        sites.push_back({var->getName().str(), var->getType().getAsString(policy), line_of(var->getLocation())});
+        slots[var] = slot;
+        return slot;
+    }
+
+    static bool is_container(const RecordDecl* record) {
+        if (!record->isInStdNamespace() || !record->getIdentifier()) return false;
+        const llvm::StringRef name = record->getName();
+        return name == "vector" || name == "basic_string";
+    }
+
+    Kind kind_of(QualType type) const {
+        if (type.isNull() || type->isDependentType() || type->isReferenceType()) return Kind::None;
+        if (type->isConstantArrayType()) return Kind::Array;
+        if (type->isArrayType() || type->isMemberPointerType()) return Kind::None;
+        if (type->isScalarType()) return Kind::Scalar;
+        if (const RecordDecl* record = type->getAsRecordDecl()) {
+            if (is_container(record)) return Kind::Container;
+            if (layouts.count(record->getCanonicalDecl())) return Kind::Layout;
+            return Kind::Object;
+        }
+        return Kind::None;
+    }
+
+    // The variable an expression names, looking through parentheses and casts
+    static const VarDecl* variable(const Expr* e, const DeclRefExpr** ref = nullptr) {
+        const auto* r = dyn_cast<DeclRefExpr>(e->IgnoreParenImpCasts());
+        if (ref) *ref = r;
+        return r ? dyn_cast<VarDecl>(r->getDecl()) : nullptr;
+    }
+
+    std::string snapshot(const std::string& object, bool pointer, unsigned line) const {
+        return "__trace_struct_snapshot(" + object + ", " + (pointer ? "&*(" : "&(") + object + "), " +
+               std::to_string(line) + ")";
+    }
+
+    // pointer_alias after a pointer took the address of a variable or an array
+    std::string alias(const std::string& name, const Expr* value, unsigned line) const {
+        if (!value) return "";
+        value = value->IgnoreParens();
+        bool decayed = false;
+        if (const auto* cast = dyn_cast<ImplicitCastExpr>(value)) {
+            decayed = cast->getCastKind() == CK_ArrayToPointerDecay;
+            value = cast->getSubExpr()->IgnoreParens();
+        }
+        const auto* address = dyn_cast<UnaryOperator>(value);
+        if (decayed ? !isa<DeclRefExpr>(value) : !(address && address->getOpcode() == UO_AddrOf)) return "";
+        return "__trace_pointer_alias(" + name + ", " + name + ", " + (decayed ? "true" : "false") + ", " +
+               std::to_string(line) + ")";
+    }
+
+    // ---- declarations ----
+
+    // Dimensions of a constant array of up to three, and its element type
+    bool array_shape(QualType type, int dims[3], QualType& element) const {
+        int n = 0;
+        dims[0] = dims[1] = dims[2] = 0;
+        while (const ConstantArrayType* array = ctx.getAsConstantArrayType(type)) {
+            if (n == 3) return false;
+            dims[n++] = (int)array->getSize().getZExtValue();
+            type = array->getElementType();
+        }
+        element = type;
+        return n > 0;
+    }
+
+    void array_hooks(const VarDecl* var, const std::string& name, unsigned line, std::vector<std::string>& hooks) {
+        int dims[3];
+        QualType element;
+        if (!array_shape(var->getType(), dims, element)) return;
+        const Kind kind = kind_of(element);
+        if (kind != Kind::Scalar && kind != Kind::Layout && kind != Kind::Object) return;
+        const std::string base = element.getUnqualifiedType().getAsString(policy);
+        if (base.find('(') != std::string::npos) return;  // unnamed types
+
+        const std::string L = std::to_string(line);
+        const std::string shape = std::to_string(dims[0]) + ", " + std::to_string(dims[1]) + ", " +
+                                  std::to_string(dims[2]) + ", " + L + ")";
+        // A comma in the type would split the macro arguments
+        if (base.find(',') != std::string::npos) {
+            hooks.push_back("__trace_array_create_named(" + name + ", " + quoted(base) + ", " + shape);
+        } else {
+            hooks.push_back("__trace_array_create(" + name + ", " + base + ", " + shape);
+        }
+
+        const Expr* init = var->getInit();
+        if (!init || kind != Kind::Scalar) return;
+        init = init->IgnoreParenImpCasts();
+        if (const auto* literal = dyn_cast<StringLiteral>(init)) {
+            const std::string text = text_of(literal);
+            if (element->isCharType() && !text.empty()) {
+                hooks.push_back("__trace_array_init_string(" + name + ", " + text + ", " + L + ")");
+            }
+        } else if (isa<InitListExpr>(init) && dims[1] == 0) {
+            if (element->isSpecificBuiltinType(BuiltinType::Int)) {
+                hooks.push_back("__trace_array_init(" + name + ", " + name + ", " + std::to_string(dims[0]) + ", " + L + ")");
+            } else {
+                for (int i = 0; i < dims[0] && i < INIT_ELEMENT_LIMIT; ++i) {
+                    const std::string k = std::to_string(i);
+                    hooks.push_back("__trace_array_index_assign_1d(" + name + ", " + k + ", " + name + "[" + k + "], " + L + ")");
+                }
+            }
+        }
+    }
+
+    // Hooks for a variable a statement declares, to follow that statement
+    void declare(const VarDecl* var, std::vector<std::string>& hooks) {
+        if (!var->isLocalVarDecl() || var->isStaticLocal() || !var->getIdentifier()) return;
+        const std::string name = var->getName().str();
+        const unsigned line = line_of(var->getLocation());
+        const std::string L = std::to_string(line);
+
+        switch (kind_of(var->getType())) {
+        case Kind::Scalar: {
+            const char* hook = var->hasInit() ? "__trace_declare_init_at(" : "__trace_declare_at(";
+            hooks.push_back(hook + std::to_string(slot_of(var)) + ", " + name + ")");
+            if (var->getType()->isPointerType()) {
+                const std::string pointed = alias(name, var->getInit(), line);
+                if (!pointed.empty()) hooks.push_back(pointed);
+            }
+            break;
+        }
+        case Kind::Array:
+            array_hooks(var, name, line, hooks);
+            break;
+        case Kind::Container:
+            hooks.push_back("__trace_container_declare(" + name + ", " + L + ")");
+            break;
+        case Kind::Layout:
+            hooks.push_back("__trace_declare_at(" + std::to_string(slot_of(var)) + ", " + name + ")");
+            if (var->hasInit()) hooks.push_back(snapshot(name, false, line));
+            break;
+        case Kind::Object:
+            hooks.push_back("__trace_declare_at(" + std::to_string(slot_of(var)) + ", " + name + ")");
+            break;
+        case Kind::None:
+            break;
+        }
+    }
+
+    // ---- writes ----
+
+    void add(std::vector<std::string>& hooks, const std::string& hook) {
+        if (hook.empty()) return;
+        for (const std::string& h : hooks) {
+            if (h == hook) return;
+        }
+        hooks.push_back(hook);
+    }
+
+    // A container or struct object changed by a member call or operator
+    void object_write(const Expr* object, std::vector<std::string>& hooks, unsigned line) {
+        const DeclRefExpr* ref;
+        const VarDecl* var = variable(object, &ref);
+        if (!var) return;
+        const std::string text = text_of(ref);
+        if (text.empty()) return;
+        const Kind kind = kind_of(var->getType().getNonReferenceType());
+        if (kind == Kind::Container) add(hooks, "__trace_container(" + text + ", " + std::to_string(line) + ")");
+        else if (kind == Kind::Layout) add(hooks, snapshot(text, false, line));
+    }
+
+    void array_write(const ArraySubscriptExpr* element, std::vector<std::string>& hooks, unsigned line) {
+        if (kind_of(element->getType()) != Kind::Scalar) return;
+        std::vector<const Expr*> indices;
+        const Expr* base = element;
+        while (const auto* subscript = dyn_cast<ArraySubscriptExpr>(base)) {
+            indices.insert(indices.begin(), subscript->getIdx());
+            base = subscript->getBase()->IgnoreParenImpCasts();
+        }
+        const DeclRefExpr* ref;
+        if (!variable(base, &ref) || indices.size() > 3) return;
+
+        std::string args = text_of(ref);
+        std::string value = args;
+        std::vector<std::pair<const Expr*, std::string>> captures;
+        for (const Expr* index : indices) {
+            const std::string text = text_of(index);
+            if (text.empty() || index->HasSideEffects(ctx)) return;
+            // The hook runs after the statement, when `i` may no longer be
+            // the index the subscript used (`a[i] = 1, i = 2`), so a
+            // non-constant index is kept as the subscript evaluates it.
+            std::string used = text;
+            if (!index->isEvaluatable(ctx)) {
+                used = "__trace_indices[" + std::to_string(nextIndex + captures.size()) + "]";
+                captures.push_back({index, used});
+            }
+            args += ", " + used;
+            value += "[" + used + "]";
+        }
+        for (const auto& capture : captures) {
+            insert(capture.first->getBeginLoc(), "(" + capture.second + " = (");
+            insert(end_of(capture.first), "))");
+        }
+        nextIndex += (unsigned)captures.size();
+        add(hooks, "__trace_array_index_assign_" + std::to_string(indices.size()) + "d(" + args + ", " + value +
+                   ", " + std::to_string(line) + ")");
+    }
+
+    // E.f or E->f written: a snapshot of E, or *E, when its struct has a layout
+    void member_write(const MemberExpr* member, std::vector<std::string>& hooks, unsigned line) {
+        const Expr* object = member->getBase()->IgnoreParenImpCasts();
+        const QualType type = member->isArrow() ? object->getType()->getPointeeType() : object->getType();
+        if (kind_of(type) != Kind::Layout || isa<CXXThisExpr>(object) || object->HasSideEffects(ctx)) return;
+        const std::string text = text_of(object);
+        if (!text.empty()) add(hooks, snapshot(text, member->isArrow(), line));
+    }
+
+    void write(const Expr* target, const Expr* value, std::vector<std::string>& hooks, unsigned line) {
+        const Expr* e = target->IgnoreParenImpCasts();
+        const DeclRefExpr* ref;
+        if (const VarDecl* var = variable(e, &ref)) {
+            const std::string text = text_of(ref);
+            if (text.empty()) return;
+            const QualType type = var->getType().getNonReferenceType();
+            switch (kind_of(type)) {
+            case Kind::Scalar:
+                add(hooks, "__trace_assign_at(" + std::to_string(slot_of(var)) + ", " + text + ", " +
+                           std::to_string(line) + ")");
+                if (type->isPointerType()) add(hooks, alias(text, value, line));
+                break;
+            case Kind::Container:
+            case Kind::Layout:
+                object_write(ref, hooks, line);
+                break;
+            default:
+                break;
+            }
+        } else if (const auto* element = dyn_cast<ArraySubscriptExpr>(e)) {
+            array_write(element, hooks, line);
+        } else if (const auto* member = dyn_cast<MemberExpr>(e)) {
+            member_write(member, hooks, line);
+        } else if (const auto* deref = dyn_cast<UnaryOperator>(e)) {
+            const DeclRefExpr* pointer;
+            if (deref->getOpcode() != UO_Deref || !variable(deref->getSubExpr(), &pointer)) return;
+            const std::string text = text_of(pointer);
+            if (!text.empty() && kind_of(deref->getType()) == Kind::Scalar) {
+                add(hooks, "__trace_pointer_deref_write(" + text + ", *" + text + ", " + std::to_string(line) + ")");
+            }
+        } else if (const auto* call = dyn_cast<CXXOperatorCallExpr>(e)) {
+            if (call->getOperator() == OO_Subscript && call->getNumArgs() > 0) object_write(call->getArg(0), hooks, line);
+        }
+    }
+
+    // What an expression writes, to be read back once it has run. Lambda
+    // bodies are left alone.
+    void writes(const Stmt* s, std::vector<std::string>& hooks, unsigned line) {
+        if (!s || isa<LambdaExpr>(s)) return;
+        if (const auto* op = dyn_cast<BinaryOperator>(s)) {
+            if (op->isAssignmentOp()) write(op->getLHS(), op->getRHS(), hooks, line);
+        } else if (const auto* op = dyn_cast<UnaryOperator>(s)) {
+            if (op->isIncrementDecrementOp()) write(op->getSubExpr(), nullptr, hooks, line);
+        } else if (const auto* call = dyn_cast<CXXOperatorCallExpr>(s)) {
+            const OverloadedOperatorKind op = call->getOperator();
+            if ((call->isAssignmentOp() || op == OO_PlusPlus || op == OO_MinusMinus) && call->getNumArgs() > 0) {
+                write(call->getArg(0), nullptr, hooks, line);
+            }
+        } else if (const auto* call = dyn_cast<CXXMemberCallExpr>(s)) {
+            const CXXMethodDecl* method = call->getMethodDecl();
+            if (method && !method->isConst() && call->getImplicitObjectArgument()) {
+                object_write(call->getImplicitObjectArgument(), hooks, line);
+            }
+        }
+        for (const Stmt* child : s->children()) writes(child, hooks, line);
+    }
+
+    // ---- statements ----
+
+    // A statement's body, given braces if it has none, with hooks at its
+    // start and end
+    void body(Stmt* s, const std::string& start, const std::string& end) {
+        if (!editable(s)) return;
+        if (auto* block = dyn_cast<CompoundStmt>(s)) {
+            if (!start.empty()) insert(block->getLBracLoc().getLocWithOffset(1), " " + start);
+            statement(block);
+            insert(block->getRBracLoc(), end);
+            return;
+        }
+        insert(s->getBeginLoc(), "{ " + start);
+        statement(s);
+        insert(after(s), " " + end + "}");
+    }
+
+    void statement(Stmt* s) {
+        if (!editable(s)) return;
+        if (auto* block = dyn_cast<CompoundStmt>(s)) {
+            for (Stmt* child : block->body()) statement(child);
+        } else if (auto* decl = dyn_cast<DeclStmt>(s)) {
+            std::vector<std::string> hooks;
+            for (Decl* d : decl->decls()) {
+                auto* var = dyn_cast<VarDecl>(d);
+                if (!var) continue;
+                writes(var->getInit(), hooks, line_of(var->getLocation()));
+                declare(var, hooks);
+            }
+            if (!hooks.empty()) insert(after(s), " " + statements(hooks));
+        } else if (auto* e = dyn_cast<Expr>(s)) {
+            std::vector<std::string> hooks;
+            writes(e, hooks, line_of(e->getBeginLoc()));
+            if (!hooks.empty()) insert(after(s), " " + statements(hooks));
+        } else if (auto* branch = dyn_cast<IfStmt>(s)) {
+            if_statement(branch, "if");
+        } else if (auto* loop = dyn_cast<ForStmt>(s)) {
+            for_loop(loop);
+        } else if (auto* loop = dyn_cast<WhileStmt>(s)) {
+            while_loop(loop);
+        } else if (auto* loop = dyn_cast<DoStmt>(s)) {
+            do_loop(loop);
+        } else if (auto* loop = dyn_cast<CXXForRangeStmt>(s)) {
+            range_loop(loop);
+        } else if (auto* ret = dyn_cast<ReturnStmt>(s)) {
+            return_statement(ret);
+        } else if (isa<BreakStmt>(s) || isa<ContinueStmt>(s)) {
+            jump(s);
+        } else if (auto* choice = dyn_cast<SwitchStmt>(s)) {
+            statement(choice->getBody());
+        } else if (auto* label = dyn_cast<SwitchCase>(s)) {
+            statement(label->getSubStmt());
+        } else if (auto* label = dyn_cast<LabelStmt>(s)) {
+            statement(label->getSubStmt());
+        } else if (auto* attempt = dyn_cast<CXXTryStmt>(s)) {
+            statement(attempt->getTryBlock());
+            for (unsigned i = 0; i < attempt->getNumHandlers(); ++i) {
+                statement(attempt->getHandler(i)->getHandlerBlock());
+            }
+        }
+    }
+
+    void if_statement(IfStmt* s, const char* type) {
+        const unsigned id = nextCondition++;
+        const unsigned line = line_of(s->getBeginLoc());
+        const std::string I = std::to_string(id);
+
+        Expr* cond = s->getCond();
+        if (cond && !s->isConstexpr() && !s->getConditionVariable()) {
+            const std::string text = text_of(cond);
+            if (!text.empty()) {
+                insert(cond->getBeginLoc(), "__trace_condition_test(" + I + ", " + quoted(text) + ", (");
+                insert(end_of(cond), ") ? 1 : 0, __FILE__, " + std::to_string(line) + ")");
+            }
+        }
+
+        body(s->getThen(), "__trace_branch_taken(" + I + ", \"" + type + "\", " + std::to_string(line) + "); ", "");
+        if (Stmt* other = s->getElse()) {
+            if (auto* next = dyn_cast<IfStmt>(other)) {
+                if_statement(next, "else-if");
+            } else {
+                body(other, "__trace_branch_taken(" + I + ", \"else\", " + std::to_string(line_of(s->getElseLoc())) +
+                            "); ", "");
+            }
+        }
+    }
+
+    void loop_condition(Expr* cond, unsigned id, unsigned line) {
+        if (!editable(cond)) return;
+        insert(cond->getBeginLoc(), "__trace_loop_test(" + std::to_string(id) + ", (");
+        insert(end_of(cond), ") ? 1 : 0, __FILE__, " + std::to_string(line) + ")");
+    }
+
+    std::string loop_hook(const char* name, const Loop& loop) const {
+        return std::string("__trace_loop_") + name + "(" + std::to_string(loop.id) + ", " + std::to_string(loop.line) + ")";
+    }
+
+    void for_loop(ForStmt* s) {
+        const Loop loop = {nextLoop++, line_of(s->getBeginLoc()), false};
+        const std::string L = std::to_string(loop.line);
+
+        // Hooks for the init statement. Declarations move in front of the
+        // loop, inside a block of their own, so their hooks can follow them.
+        std::string opening;
+        std::string closing;
+        Stmt* init = s->getInit();
+        if (editable(init)) {
+            std::vector<std::string> hooks;
+            if (auto* decl = dyn_cast<DeclStmt>(init)) {
+                for (Decl* d : decl->decls()) {
+                    if (auto* var = dyn_cast<VarDecl>(d)) {
+                        writes(var->getInit(), hooks, loop.line);
+                        declare(var, hooks);
+                    }
+                }
+                // Rewritten text: index captures may already sit inside it
+                const CharSourceRange range = CharSourceRange::getCharRange(init->getBeginLoc(), after(init));
+                const std::string text = rw.getRewrittenText(range);
+                if (!hooks.empty() && text.find('\n') == std::string::npos && text.find("//") == std::string::npos) {
+                    rw.ReplaceText(range, ";");
+                    opening = "{ " + text + " " + statements(hooks);
+                    closing = "}";
+                }
+            } else if (auto* e = dyn_cast<Expr>(init)) {
+                writes(e, hooks, loop.line);
+                if (!hooks.empty()) insert(end_of(e), ", " + joined(hooks, ", "));
+            }
+        }
+        insert(s->getBeginLoc(), opening + "__trace_loop_start(" + std::to_string(loop.id) + ", \"for\", " + L + "); ");
+
+        if (s->getCond() && !s->getConditionVariable()) loop_condition(s->getCond(), loop.id, loop.line);
+
+        // The iteration ends where `continue` goes: in the increment
+        Expr* inc = s->getInc();
+        if (!inc) {
+            insert(s->getRParenLoc(), loop_hook("iteration_end", loop));
+        } else if (editable(inc)) {
+            std::vector<std::string> hooks;
+            writes(inc, hooks, loop.line);
+            insert(inc->getBeginLoc(), loop_hook("iteration_end", loop) + ", (");
+            insert(end_of(inc), ")" + (hooks.empty() ? "" : ", " + joined(hooks, ", ")));
+        }
+
+        loops.push_back(loop);
+        body(s->getBody(), loop_hook("body_start", loop) + "; ", "");
+        loops.pop_back();
+        insert(after(s), " " + loop_hook("end", loop) + "; " + closing);
+    }
+
+    void while_loop(WhileStmt* s) {
+        const Loop loop = {nextLoop++, line_of(s->getBeginLoc()), true};
+        insert(s->getBeginLoc(),
+               "__trace_loop_start(" + std::to_string(loop.id) + ", \"while\", " + std::to_string(loop.line) + "); ");
+        if (!s->getConditionVariable()) loop_condition(s->getCond(), loop.id, loop.line);
+
+        loops.push_back(loop);
+        body(s->getBody(), loop_hook("body_start", loop) + "; ", loop_hook("iteration_end", loop) + "; ");
+        loops.pop_back();
+        insert(after(s), " " + loop_hook("end", loop) + "; ");
+    }
+
+    void do_loop(DoStmt* s) {
+        const Loop loop = {nextLoop++, line_of(s->getBeginLoc()), true};
+        insert(s->getBeginLoc(),
+               "__trace_loop_start(" + std::to_string(loop.id) + ", \"do-while\", " + std::to_string(loop.line) + "); ");
+
+        loops.push_back(loop);
+        body(s->getBody(), loop_hook("body_start", loop) + "; ", loop_hook("iteration_end", loop) + "; ");
+        loops.pop_back();
+
+        loop_condition(s->getCond(), loop.id, line_of(s->getWhileLoc()));
+        insert(after(s), " " + loop_hook("end", loop) + "; ");
+    }
+
+    void range_loop(CXXForRangeStmt* s) {
+        const Loop loop = {nextLoop++, line_of(s->getBeginLoc()), true};
+        insert(s->getBeginLoc(),
+               "__trace_loop_start(" + std::to_string(loop.id) + ", \"for\", " + std::to_string(loop.line) + "); ");
+
+        std::vector<std::string> start = {loop_hook("body_start", loop)};
+        if (const VarDecl* var = s->getLoopVariable()) declare(var, start);
+
+        loops.push_back(loop);
+        body(s->getBody(), statements(start), loop_hook("iteration_end", loop) + "; ");
+        loops.pop_back();
+        insert(after(s), " " + loop_hook("end", loop) + "; ");
+    }
+
+    void jump(Stmt* s) {
+        const bool isContinue = isa<ContinueStmt>(s);
+        const unsigned line = line_of(s->getBeginLoc());
+        std::string hooks = std::string("__trace_control_flow(\"") + (isContinue ? "continue" : "break") + "\", " +
+                            std::to_string(line) + "); ";
+        if (isContinue && !loops.empty() && loops.back().endsAtContinue) {
+            hooks += loop_hook("iteration_end", loops.back()) + "; ";
+        }
+        insert(s->getBeginLoc(), hooks);
+    }
+
+    // Builtin results are traced on their way out by __trace_returning;
+    // other scalars, when reading them again has no side effects, by a
+    // return hook in front of the statement
+    void return_statement(ReturnStmt* s) {
+        Expr* value = s->getRetValue();
+        if (!current || !editable(value)) return;
+        const QualType type = current->getReturnType();
+        if (type->isDependentType() || type->isVoidType()) return;
+        const std::string L = std::to_string(line_of(s->getBeginLoc()));
+
+        if (type->isBuiltinType()) {
+            const std::string name = type.getCanonicalType().getAsString(policy);
+            insert(value->getBeginLoc(), "__trace_returning<" + name + ">(");
+            insert(end_of(value), ", " + quoted(name) + ", __FILE__, " + L + ")");
+        } else if (kind_of(type) == Kind::Scalar && !value->HasSideEffects(ctx)) {
+            const std::string text = text_of(value);
+            if (text.empty()) return;
+            insert(s->getBeginLoc(), "__trace_return(" + text + ", " + quoted(type.getAsString(policy)) + ", \"\", " + L + "); ");
+        }
+    }
+
+    void prologue() {
+        std::string text = "#include \"trace.h\"\n";
+        if (!sites.empty()) {
+            text += "static const __trace_site __trace_sites[] __attribute__((unused)) = {";
+            for (const Site& site : sites) {
+                text += " { " + quoted(site.name) + ", " + quoted(site.type) + ", __FILE__, " +
+                        std::to_string(site.line) + " },";
+            }
+            text += " };\n";
+        }
+        if (nextIndex > 0) {
+            text += "static __thread long long __trace_indices[" + std::to_string(nextIndex) +
+                    "] __attribute__((unused));\n";
+        }
+        text += "#line 1\n";
+        rw.InsertTextBefore(sm.getLocForStartOfFile(sm.getMainFileID()), text);
+    }
+
+    // ---- struct layouts ----
+
+    bool has_layout(const RecordDecl* record) const {
+        if (!record->isThisDeclarationADefinition() || record->isUnion() ||
+            !record->getDeclContext()->isTranslationUnit() || !in_main(record->getBeginLoc()) ||
+            !in_main(record->getEndLoc())) {
+            return false;
+        }
+        if (const auto* cxx = dyn_cast<CXXRecordDecl>(record)) {
+            if (cxx->getDescribedClassTemplate() || isa<ClassTemplateSpecializationDecl>(cxx) ||
+                !cxx->isStandardLayout()) {
+                return false;
+            }
+        }
+        bool any = false;
+        for (const FieldDecl* field : record->fields()) {
+            if (field->isBitField() || !field->getIdentifier() || field->getType()->isReferenceType() ||
+                field->getAccess() == AS_private || field->getAccess() == AS_protected) {
+                return false;
+            }
+            any = true;
+        }
+        return any;
+    }
+
+    // TRACE_LAYOUT for each plain struct at file scope, on the line of the
+    // declaration after it so no line moves
+    void struct_layouts() {
+        std::vector<Decl*> decls;
+        for (Decl* d : ctx.getTranslationUnitDecl()->decls()) {
+            if (in_main(d->getBeginLoc())) decls.push_back(d);
+        }
+        for (size_t i = 0; i < decls.size(); ++i) {
+            const auto* record = dyn_cast<RecordDecl>(decls[i]);
+            if (!record || !has_layout(record)) continue;
+            const IdentifierInfo* id = record->getIdentifier();
+            if (!id && record->getTypedefNameForAnonDecl()) id = record->getTypedefNameForAnonDecl()->getIdentifier();
+            if (!id) continue;
+
+            const std::string name = id->getName().str();
+            std::string fields;
+            for (const FieldDecl* field : record->fields()) {
+                fields += ", TRACE_FIELD(" + name + ", " + field->getName().str() + ")";
+            }
+            const std::string layout = "TRACE_LAYOUT(" + name + fields + "); ";
+
+            const Decl* next = nullptr;
+            for (size_t j = i + 1; j < decls.size() && !next; ++j) {
+                if (sm.isBeforeInTranslationUnit(record->getEndLoc(), decls[j]->getBeginLoc())) next = decls[j];
+            }
+            if (next) insert(next->getBeginLoc(), layout);
+            else insert(sm.getLocForEndOfFile(sm.getMainFileID()), "\n" + layout + "\n");
+            layouts.insert(record->getCanonicalDecl());
+        }
+    }
+
+    friend class FunctionVisitor;
+};
+
+void Instrumenter::function(FunctionDecl* fn) {
+    auto* block = dyn_cast_or_null<CompoundStmt>(fn->getBody());
+    if (!editable(block)) return;
+    current = fn;
+
+    // Pointer parameters alias what the caller passed
+    const unsigned line = line_of(block->getLBracLoc());
+    std::vector<std::string> hooks;
+    for (const ParmVarDecl* param : fn->parameters()) {
+        if (!param->getIdentifier() || kind_of(param->getType()) != Kind::Scalar || !param->getType()->isPointerType()) {
+            continue;
+        }
+        const std::string name = param->getName().str();
+        const bool decayed = param->getOriginalType()->isArrayType();
+        hooks.push_back("__trace_pointer_alias(" + name + ", " + name + ", " + (decayed ? "true" : "false") + ", " +
+                        std::to_string(line) + ")");
+    }
+    if (!hooks.empty()) insert(block->getLBracLoc().getLocWithOffset(1), " " + statements(hooks));
+
+    statement(block);
+    current = nullptr;
+}
+
+// ========== TRAVERSAL ==========
+class FunctionVisitor : public RecursiveASTVisitor<FunctionVisitor> {
+public:
+    explicit FunctionVisitor(Instrumenter& instrumenter) : instrumenter(instrumenter) {}
+
+    bool VisitFunctionDecl(FunctionDecl* fn) {
+        // constexpr bodies cannot call the tracer
+        if (fn->doesThisDeclarationHaveABody() && !fn->isConstexpr() && !fn->isImplicit() && !fn->isDefaulted() &&
+            instrumenter.in_main(fn->getLocation())) {
+            instrumenter.function(fn);
+        }
+        return true;
+    }
+
+private:
+    Instrumenter& instrumenter;
+};
+
+void Instrumenter::translation_unit() {
+    struct_layouts();
+    FunctionVisitor(*this).TraverseDecl(ctx.getTranslationUnitDecl());
+    prologue();
+}
+
+class InstrumentConsumer : public ASTConsumer {
+public:
+    explicit InstrumentConsumer(Rewriter& rw) : rw(rw) {}
+
+    void HandleTranslationUnit(ASTContext& ctx) override {
+        if (ctx.getDiagnostics().hasErrorOccurred()) return;
+        Instrumenter(ctx, rw).translation_unit();
+    }
+
+private:
+    Rewriter& rw;
+};
+
+class InstrumentAction : public ASTFrontendAction {
+public:
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& ci, llvm::StringRef) override {
+        rw.setSourceMgr(ci.getSourceManager(), ci.getLangOpts());
+        return std::make_unique<InstrumentConsumer>(rw);
+    }
+
+    void EndSourceFileAction() override {
+        CompilerInstance& ci = getCompilerInstance();
+        if (ci.getDiagnostics().hasErrorOccurred()) return;
+        std::error_code error;
+        llvm::raw_fd_ostream out(g_output, error, llvm::sys::fs::OF_Text);
+        if (error) {
+            llvm::errs() << "trace-instrument: cannot write " << g_output << ": " << error.message() << "\n";
+            return;
+        }
+        rw.getEditBuffer(rw.getSourceMgr().getMainFileID()).write(out);
+    }
+
+private:
+    Rewriter rw;
+};
+
+int main(int argc, const char** argv) {
+    auto options = tooling::CommonOptionsParser::create(argc, argv, g_category, llvm::cl::Required);
+    if (!options) {
+        llvm::errs() << options.takeError();
+        return 2;
+    }
+    tooling::ClangTool tool(options->getCompilations(), options->getSourcePathList());
+    return tool.run(tooling::newFrontendActionFactory<InstrumentAction>().get());
+}
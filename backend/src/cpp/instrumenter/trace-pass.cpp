@@ -0,0 +1,342 @@
+// backend/src/cpp/instrumenter/trace-pass.cpp
+//
+// LLVM pass plugin tracing an optimized build. Loaded by the bundled clang:
+//
+//   clang++ -O1 -g -finstrument-functions -fpass-plugin=trace-pass.so ...
+//
+// The program is compiled unchanged; the pass runs at the end of the
+// optimizer, after mem2reg and SROA have turned locals into SSA values, and
+// takes names and lines from the debug info that survived:
+//
+//   llvm.dbg.value    a local now holds a value          -> __trace_value_site
+//   store to a local  a local kept in memory is written  -> __trace_value_site
+//   llvm.dbg.declare  an array local comes into scope    -> __trace_array_site
+//   store into it     an element is written              -> __trace_array_store_site
+//   ret               a function returns a value         -> __trace_return_site
+//
+// Calls are traced by -finstrument-functions, whose hooks clang inserts
+// before inlining, so inlined calls still show up. Only variables and
+// functions declared in the main file are traced; code inlined from headers
+// is not. Each traced variable, array and function gets a __trace_site
+// record (trace.h) in the module.
+//
+// Built by clang-instrumenter.service.js with the bundled toolchain's
+// llvm-config. Symbols resolve against the clang that loads it.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+#include <string>
+#include <vector>
+
+#include "../trace.h"
+
+using namespace llvm;
+
+// Typedefs and cv-qualifiers do not change how a value is reported
+static const DIType* strip(const DIType* type) {
+    while (auto* derived = dyn_cast_or_null<DIDerivedType>(type)) {
+        switch (derived->getTag()) {
+            case dwarf::DW_TAG_typedef:
+            case dwarf::DW_TAG_const_type:
+            case dwarf::DW_TAG_volatile_type:
+            case dwarf::DW_TAG_restrict_type:
+            case dwarf::DW_TAG_atomic_type:
+                type = derived->getBaseType();
+                break;
+            default:
+                return type;
+        }
+    }
+    return type;
+}
+
+// Type as the source spells it, e.g. "const char *"
+static std::string type_name(const DIType* type) {
+    if (!type) return "void";
+    if (auto* derived = dyn_cast<DIDerivedType>(type)) {
+        switch (derived->getTag()) {
+            case dwarf::DW_TAG_pointer_type: return type_name(derived->getBaseType()) + " *";
+            case dwarf::DW_TAG_reference_type: return type_name(derived->getBaseType()) + " &";
+            case dwarf::DW_TAG_rvalue_reference_type: return type_name(derived->getBaseType()) + " &&";
+            case dwarf::DW_TAG_const_type: return "const " + type_name(derived->getBaseType());
+            case dwarf::DW_TAG_volatile_type: return "volatile " + type_name(derived->getBaseType());
+            default: break;
+        }
+        if (!derived->getName().empty()) return derived->getName().str();
+        return type_name(derived->getBaseType());
+    }
+    return type->getName().empty() ? "?" : type->getName().str();
+}
+
+struct Scalar {
+    unsigned tag = TRACE_T_NONE;
+    bool isSigned = false;
+};
+
+// trace.h tag of a variable's type; TRACE_T_NONE for what is not a scalar
+static Scalar scalar_of(const DIType* type) {
+    Scalar s;
+    type = strip(type);
+    if (auto* basic = dyn_cast_or_null<DIBasicType>(type)) {
+        switch (basic->getEncoding()) {
+            case dwarf::DW_ATE_boolean: s.tag = TRACE_T_BOOL; break;
+            case dwarf::DW_ATE_signed_char: s.tag = TRACE_T_CHAR; s.isSigned = true; break;
+            case dwarf::DW_ATE_unsigned_char: s.tag = TRACE_T_CHAR; break;
+            case dwarf::DW_ATE_signed: s.tag = TRACE_T_I64; s.isSigned = true; break;
+            case dwarf::DW_ATE_unsigned: s.tag = TRACE_T_U64; break;
+            case dwarf::DW_ATE_float:
+                if (basic->getSizeInBits() == 32) s.tag = TRACE_T_F32;
+                else if (basic->getSizeInBits() == 64) s.tag = TRACE_T_F64;
+                break;
+            default: break;
+        }
+    } else if (auto* derived = dyn_cast_or_null<DIDerivedType>(type)) {
+        if (derived->getTag() == dwarf::DW_TAG_pointer_type) s.tag = TRACE_T_PTR;
+    } else if (auto* composite = dyn_cast_or_null<DICompositeType>(type)) {
+        if (composite->getTag() == dwarf::DW_TAG_enumeration_type) {
+            s.tag = TRACE_T_I64;
+            s.isSigned = true;
+        }
+    }
+    return s;
+}
+
+struct ArrayShape {
+    int dims[3] = { 0, 0, 0 };
+    const DIType* element = nullptr;
+};
+
+// Constant dimensions of an array type, up to three
+static bool array_shape(const DIType* type, ArrayShape& shape) {
+    auto* composite = dyn_cast_or_null<DICompositeType>(strip(type));
+    if (!composite || composite->getTag() != dwarf::DW_TAG_array_type) return false;
+    DINodeArray ranges = composite->getElements();
+    if (ranges.size() == 0 || ranges.size() > 3) return false;
+    for (unsigned i = 0; i < ranges.size(); i++) {
+        auto* range = dyn_cast<DISubrange>(ranges[i]);
+        auto* count = range ? dyn_cast_if_present<ConstantInt*>(range->getCount()) : nullptr;
+        if (!count || count->getSExtValue() <= 0) return false;
+        shape.dims[i] = (int)count->getSExtValue();
+    }
+    shape.element = composite->getBaseType();
+    return scalar_of(shape.element).tag != TRACE_T_NONE;
+}
+
+// Declared in the file being compiled rather than in a header
+static bool in_main_file(const DIScope* scope) {
+    const DISubprogram* function = nullptr;
+    if (auto* local = dyn_cast_or_null<DILocalScope>(scope)) function = local->getSubprogram();
+    if (!function || !function->getUnit() || !function->getFile()) return false;
+    const DIFile* file = function->getFile();
+    const DIFile* main = function->getUnit()->getFile();
+    return file->getFilename() == main->getFilename() && file->getDirectory() == main->getDirectory();
+}
+
+static int line_of(const Instruction* instruction, unsigned fallback) {
+    const DebugLoc& loc = instruction->getDebugLoc();
+    return (int)(loc && loc.getLine() ? loc.getLine() : fallback);
+}
+
+class TracePass : public PassInfoMixin<TracePass> {
+public:
+    PreservedAnalyses run(Module& module, ModuleAnalysisManager&) {
+        module_ = &module;
+        sites_.clear();
+        strings_.clear();
+        bool changed = false;
+        for (Function& function : module) {
+            if (!function.isDeclaration() && in_main_file(function.getSubprogram()))
+                changed |= instrument(function);
+        }
+        return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    }
+
+    static bool isRequired() { return true; }
+
+private:
+    Module* module_ = nullptr;
+    DenseMap<const MDNode*, GlobalVariable*> sites_;
+    StringMap<Constant*> strings_;
+
+    LLVMContext& context() { return module_->getContext(); }
+
+    Constant* string(StringRef text) {
+        auto it = strings_.find(text);
+        if (it != strings_.end()) return it->second;
+        Constant* data = ConstantDataArray::getString(context(), text);
+        auto* global = new GlobalVariable(*module_, data->getType(), true, GlobalValue::PrivateLinkage,
+                                          data, "__trace_str");
+        global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+        strings_[text] = global;
+        return global;
+    }
+
+    // The __trace_site record of a variable or function, one per node
+    GlobalVariable* site(const MDNode* node, StringRef name, StringRef type, StringRef file, unsigned line) {
+        auto it = sites_.find(node);
+        if (it != sites_.end()) return it->second;
+        PointerType* ptr = PointerType::getUnqual(context());
+        StructType* layout = StructType::get(context(), { ptr, ptr, ptr, Type::getInt32Ty(context()) });
+        Constant* fields[] = { string(name), string(type), string(file),
+                               ConstantInt::get(Type::getInt32Ty(context()), line) };
+        auto* global = new GlobalVariable(*module_, layout, true, GlobalValue::PrivateLinkage,
+                                          ConstantStruct::get(layout, fields), "__trace_site");
+        sites_[node] = global;
+        return global;
+    }
+
+    GlobalVariable* variable_site(const DILocalVariable* variable, const DIType* type) {
+        return site(variable, variable->getName(), type_name(type),
+                    variable->getFile() ? variable->getFile()->getFilename() : "", variable->getLine());
+    }
+
+    FunctionCallee hook(const char* name, std::initializer_list<Type*> params) {
+        return module_->getOrInsertFunction(
+            name, FunctionType::get(Type::getVoidTy(context()), ArrayRef<Type*>(params), false));
+    }
+
+    // A value as trace.h bits, or null for a type the tracer cannot show
+    static Value* bits_of(IRBuilder<>& b, Value* value, const Scalar& s) {
+        Type* type = value->getType();
+        Type* i64 = b.getInt64Ty();
+        if (s.tag == TRACE_T_NONE) return nullptr;
+        if (type->isPointerTy()) return b.CreatePtrToInt(value, i64);
+        if (type->isIntegerTy()) {
+            if (type->getIntegerBitWidth() > 64) return nullptr;
+            return s.isSigned ? b.CreateSExt(value, i64) : b.CreateZExt(value, i64);
+        }
+        if (type->isFloatTy() && s.tag == TRACE_T_F32) return b.CreateZExt(b.CreateBitCast(value, b.getInt32Ty()), i64);
+        if (type->isDoubleTy() && s.tag == TRACE_T_F64) return b.CreateBitCast(value, i64);
+        return nullptr;
+    }
+
+    void value_hook(Instruction* after, Value* value, const DILocalVariable* variable, int line) {
+        Scalar s = scalar_of(variable->getType());
+        IRBuilder<> b(after->getNextNode());
+        b.SetCurrentDebugLocation(after->getDebugLoc());
+        Value* bits = bits_of(b, value, s);
+        if (!bits) return;
+        b.CreateCall(hook("__trace_value_site", { b.getPtrTy(), b.getInt64Ty(), b.getInt32Ty(), b.getInt32Ty() }),
+                     { variable_site(variable, variable->getType()), bits, b.getInt32(s.tag), b.getInt32(line) });
+    }
+
+    bool instrument(Function& function) {
+        // Locals still in memory, by their alloca
+        DenseMap<const Value*, const DILocalVariable*> locals;
+        std::vector<DbgValueInst*> values;
+        std::vector<DbgDeclareInst*> declares;
+        std::vector<StoreInst*> stores;
+        std::vector<ReturnInst*> returns;
+        for (Instruction& instruction : instructions(function)) {
+            if (auto* value = dyn_cast<DbgValueInst>(&instruction)) {
+                values.push_back(value);
+            } else if (auto* declare = dyn_cast<DbgDeclareInst>(&instruction)) {
+                if (!in_main_file(declare->getVariable()->getScope())) continue;
+                if (auto* alloca = dyn_cast_or_null<AllocaInst>(declare->getAddress())) {
+                    locals[alloca] = declare->getVariable();
+                    declares.push_back(declare);
+                }
+            } else if (auto* store = dyn_cast<StoreInst>(&instruction)) {
+                stores.push_back(store);
+            } else if (auto* ret = dyn_cast<ReturnInst>(&instruction)) {
+                if (ret->getReturnValue()) returns.push_back(ret);
+            }
+        }
+
+        bool changed = false;
+        for (DbgValueInst* value : values) {
+            const DILocalVariable* variable = value->getVariable();
+            if (!in_main_file(variable->getScope()) || value->hasArgList() || value->isKillLocation()) continue;
+            if (value->getExpression()->getNumElements() != 0) continue;
+            value_hook(value, value->getValue(), variable, line_of(value, variable->getLine()));
+            changed = true;
+        }
+
+        for (DbgDeclareInst* declare : declares) {
+            const DILocalVariable* variable = declare->getVariable();
+            ArrayShape shape;
+            if (!array_shape(variable->getType(), shape)) continue;
+            Scalar s = scalar_of(shape.element);
+            IRBuilder<> b(declare->getNextNode());
+            b.CreateCall(hook("__trace_array_site", { b.getPtrTy(), b.getPtrTy(), b.getInt32Ty(), b.getInt32Ty(),
+                                                      b.getInt32Ty(), b.getInt64Ty(), b.getInt32Ty() }),
+                         { variable_site(variable, shape.element), declare->getAddress(),
+                           b.getInt32(shape.dims[0]), b.getInt32(shape.dims[1]), b.getInt32(shape.dims[2]),
+                           b.getInt64(strip(shape.element)->getSizeInBits() / 8), b.getInt32(s.tag) });
+            changed = true;
+        }
+
+        for (StoreInst* store : stores) {
+            Value* address = store->getPointerOperand();
+            const Value* base = getUnderlyingObject(address);
+            auto it = locals.find(base);
+            if (it == locals.end()) continue;
+            const DILocalVariable* variable = it->second;
+            int line = line_of(store, variable->getLine());
+            ArrayShape shape;
+            if (address == base && !array_shape(variable->getType(), shape)) {
+                value_hook(store, store->getValueOperand(), variable, line);
+                changed = true;
+                continue;
+            }
+            if (!array_shape(variable->getType(), shape)) continue;
+
+            Scalar s = scalar_of(shape.element);
+            uint64_t size = strip(shape.element)->getSizeInBits() / 8;
+            IRBuilder<> b(store->getNextNode());
+            b.SetCurrentDebugLocation(store->getDebugLoc());
+            Value* bits = bits_of(b, store->getValueOperand(), s);
+            if (!bits || !size) continue;
+            // With opaque pointers a store to element 0 goes straight to the alloca
+            Value* index = b.getInt64(0);
+            if (address != base) {
+                Value* offset = b.CreateSub(b.CreatePtrToInt(address, b.getInt64Ty()),
+                                            b.CreatePtrToInt(const_cast<Value*>(base), b.getInt64Ty()));
+                index = b.CreateUDiv(offset, b.getInt64(size));
+            }
+            b.CreateCall(hook("__trace_array_store_site", { b.getPtrTy(), b.getPtrTy(), b.getInt64Ty(),
+                                                            b.getInt64Ty(), b.getInt32Ty(), b.getInt32Ty() }),
+                         { variable_site(variable, shape.element), const_cast<Value*>(base),
+                           index, bits, b.getInt32(s.tag), b.getInt32(line) });
+            changed = true;
+        }
+
+        DISubprogram* subprogram = function.getSubprogram();
+        const DIType* returnType = nullptr;
+        if (auto* signature = subprogram->getType()) {
+            DITypeRefArray types = signature->getTypeArray();
+            if (types.size() > 0) returnType = types[0];
+        }
+        Scalar s = scalar_of(returnType);
+        for (ReturnInst* ret : returns) {
+            IRBuilder<> b(ret);
+            Value* bits = bits_of(b, ret->getReturnValue(), s);
+            if (!bits) continue;
+            GlobalVariable* record = site(subprogram, subprogram->getName(), type_name(returnType),
+                                          subprogram->getFilename(), subprogram->getLine());
+            b.CreateCall(hook("__trace_return_site", { b.getPtrTy(), b.getInt64Ty(), b.getInt32Ty(), b.getInt32Ty() }),
+                         { record, bits, b.getInt32(s.tag), b.getInt32(line_of(ret, subprogram->getLine())) });
+            changed = true;
+        }
+        return changed;
+    }
+};
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+    return { LLVM_PLUGIN_API_VERSION, "trace-pass", "1", [](PassBuilder& builder) {
+                 builder.registerOptimizerLastEPCallback(
+                     [](ModulePassManager& passes, OptimizationLevel) { passes.addPass(TracePass()); });
+             } };
+}
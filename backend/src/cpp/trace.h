@@ -1,8 +1,332 @@
 // backend/src/cpp/trace.h
 #pragma once
 
+#ifdef __cplusplus
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+// ========== EVENT CATEGORIES ==========
+// Bits of the tracer's gate word: the categories being recorded right now.
+#define TRACE_CAT_CALLS     0x01u   // func_enter, func_exit, return
+#define TRACE_CAT_CONTROL   0x02u   // loops, conditions, branches, blocks
+#define TRACE_CAT_VARS      0x04u   // declare, assign, var
+#define TRACE_CAT_ARRAYS    0x08u
+#define TRACE_CAT_POINTERS  0x10u
+#define TRACE_CAT_HEAP      0x20u
+#define TRACE_CAT_IO        0x40u   // stdout, stderr, stdin, sleep
+#define TRACE_CAT_ALL       0x7Fu
+#define TRACE_CAT_SKELETON  (TRACE_CAT_CALLS | TRACE_CAT_CONTROL)
+#define TRACE_GATE_LINE     0x80000000u
+
+// Finer splits of CONTROL, for TRACE_CATEGORIES only
+#define TRACE_CAT_LOOPS     0x100u
+#define TRACE_CAT_BLOCKS    0x200u
+#define TRACE_CAT_BRANCHES  0x400u  // conditions, branches, control_flow
+
+// Categories compiled into this translation unit, e.g.
+// -DTRACE_CATEGORIES="(TRACE_CAT_CALLS|TRACE_CAT_LOOPS)". The hooks of every
+// other category expand to nothing and their arguments are not evaluated.
+// func_enter/func_exit come from -finstrument-functions and stay.
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES    0xFFFFu
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern volatile unsigned int __trace_gate[];
+extern volatile unsigned int __trace_toggle[];
+#ifdef __cplusplus
+}
+#endif
+
+// The categories being recorded right now: the tracer's own gate word,
+// narrowed by the word an outside process may toggle (TRACE_TOGGLE_FILE).
+// A pending start-line trigger stays armed while toggled off.
+#define __TRACE_GATE_WORD() (__trace_gate[0] & (__trace_toggle[0] | TRACE_GATE_LINE))
+
+// A hook is only called when its category is compiled in and the gate word
+// has it (or a pending start-line trigger) set, so a paused or filtered
+// tracer costs one test per statement.
+#define __TRACE_HOOK(compiled, gate, call)                                     \
+    ((void)((((TRACE_CATEGORIES) & (compiled)) &&                              \
+             (__TRACE_GATE_WORD() & ((gate) | TRACE_GATE_LINE))) ? ((call), 0) : 0))
+
+// ========== TYPED VALUES ==========
+// Values reach the tracer as their raw bits plus a type tag chosen at compile
+// time, so doubles, chars, bools and pointers arrive exact and no float is
+// formatted to text while the program runs.
+#define TRACE_T_NONE    0u  // not a scalar (class types): recorded as null
+#define TRACE_T_I64     1u
+#define TRACE_T_U64     2u
+#define TRACE_T_F64     3u
+#define TRACE_T_F32     4u
+#define TRACE_T_CHAR    5u
+#define TRACE_T_BOOL    6u
+#define TRACE_T_PTR     7u
+#define TRACE_T_TEXT    8u  // char array inside a struct
+
+typedef struct {
+    unsigned long long bits;
+    unsigned int tag;
+} __trace_value;
+
+#define __TRACE_VALUE_FN static inline __attribute__((always_inline, no_instrument_function))
+
+#ifdef __cplusplus
+// Tag of an object of type T as it sits in memory; char arrays are text.
+// A reference is tagged as the object it names.
+template <typename T>
+__TRACE_VALUE_FN constexpr unsigned int __trace_tag_for() {
+    typedef typename std::remove_cv<typename std::remove_reference<T>::type>::type U;
+    if constexpr (std::is_same<U, bool>::value) return TRACE_T_BOOL;
+    else if constexpr (std::is_same<U, char>::value || std::is_same<U, signed char>::value ||
+                       std::is_same<U, unsigned char>::value) return TRACE_T_CHAR;
+    else if constexpr (std::is_same<U, float>::value) return TRACE_T_F32;
+    else if constexpr (std::is_floating_point<U>::value) return TRACE_T_F64;
+    else if constexpr (std::is_enum<U>::value) return TRACE_T_I64;
+    else if constexpr (std::is_integral<U>::value) return std::is_signed<U>::value ? TRACE_T_I64 : TRACE_T_U64;
+    else if constexpr (std::is_pointer<U>::value || std::is_null_pointer<U>::value) return TRACE_T_PTR;
+    else if constexpr (std::is_array<U>::value &&
+                       __trace_tag_for<typename std::remove_extent<U>::type>() == TRACE_T_CHAR) return TRACE_T_TEXT;
+    else return TRACE_T_NONE;
+}
+
+// A value passed by the program; an array passes as its address.
+template <typename T>
+__TRACE_VALUE_FN __trace_value __trace_value_of(const T& v) {
+    typedef typename std::remove_cv<T>::type U;
+    __trace_value r = { 0, std::is_array<U>::value ? TRACE_T_PTR : __trace_tag_for<U>() };
+    if constexpr (std::is_pointer<U>::value || std::is_array<U>::value || std::is_null_pointer<U>::value) {
+        r.bits = (unsigned long long)(uintptr_t)v;
+    } else if constexpr (std::is_same<U, float>::value) {
+        uint32_t b;
+        memcpy(&b, &v, sizeof(b));
+        r.bits = b;
+    } else if constexpr (std::is_floating_point<U>::value) {
+        const double d = (double)v;
+        memcpy(&r.bits, &d, sizeof(d));
+    } else if constexpr (std::is_same<U, bool>::value) {
+        r.bits = v ? 1 : 0;
+    } else if constexpr (std::is_enum<U>::value || std::is_signed<U>::value) {
+        r.bits = (unsigned long long)(long long)v;
+    } else if constexpr (std::is_integral<U>::value) {
+        r.bits = (unsigned long long)v;
+    }
+    return r;
+}
+#else
+__TRACE_VALUE_FN __trace_value __trace_value_i64(long long v) {
+    __trace_value r = { (unsigned long long)v, TRACE_T_I64 };
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_u64(unsigned long long v) {
+    __trace_value r = { v, TRACE_T_U64 };
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_char(int v) {
+    __trace_value r = { (unsigned long long)(long long)v, TRACE_T_CHAR };
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_bool(bool v) {
+    __trace_value r = { v ? 1ull : 0ull, TRACE_T_BOOL };
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_f32(float v) {
+    uint32_t b;
+    memcpy(&b, &v, sizeof(b));
+    __trace_value r = { b, TRACE_T_F32 };
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_f64(double v) {
+    __trace_value r = { 0, TRACE_T_F64 };
+    memcpy(&r.bits, &v, sizeof(v));
+    return r;
+}
+__TRACE_VALUE_FN __trace_value __trace_value_ptr(const volatile void* v) {
+    __trace_value r = { (unsigned long long)(uintptr_t)v, TRACE_T_PTR };
+    return r;
+}
+// Every arithmetic type is listed, so anything else is a pointer.
+#define __trace_value_of(v) _Generic((v),                                      \
+    _Bool: __trace_value_bool,                                                 \
+    char: __trace_value_char, signed char: __trace_value_char,                 \
+    unsigned char: __trace_value_char,                                         \
+    short: __trace_value_i64, int: __trace_value_i64,                          \
+    long: __trace_value_i64, long long: __trace_value_i64,                     \
+    unsigned short: __trace_value_u64, unsigned int: __trace_value_u64,        \
+    unsigned long: __trace_value_u64, unsigned long long: __trace_value_u64,   \
+    float: __trace_value_f32, double: __trace_value_f64,                       \
+    long double: __trace_value_f64,                                            \
+    default: __trace_value_ptr)(v)
+#endif
+
+// Tag of an lvalue as it sits in memory, and of a type name. In C only
+// arithmetic types are classified.
+#ifdef __cplusplus
+#define __TRACE_TAG_OF(x) __trace_tag_for<typename std::remove_cv<typename std::remove_reference<decltype(x)>::type>::type>()
+#define __TRACE_TYPE_TAG(type) __trace_tag_for<type>()
+#else
+#define __TRACE_TAG_OF(x) _Generic((x),                                                      \
+    _Bool: TRACE_T_BOOL, char: TRACE_T_CHAR, signed char: TRACE_T_CHAR,                     \
+    unsigned char: TRACE_T_CHAR, short: TRACE_T_I64, int: TRACE_T_I64, long: TRACE_T_I64,   \
+    long long: TRACE_T_I64, unsigned short: TRACE_T_U64, unsigned int: TRACE_T_U64,         \
+    unsigned long: TRACE_T_U64, unsigned long long: TRACE_T_U64, float: TRACE_T_F32,        \
+    double: TRACE_T_F64, long double: TRACE_T_F64, default: TRACE_T_NONE)
+// A compound literal names a value of any complete type, structs included;
+// _Generic does not evaluate it.
+#define __TRACE_TYPE_TAG(type) __TRACE_TAG_OF((type){0})
+#endif
+
+// ========== STRUCT LAYOUTS ==========
+// A static descriptor per struct type lists its fields, so one hook call can
+// snapshot a whole object; the tracer reports the fields that changed since
+// the previous snapshot of the same address.
+//
+//   struct Node { int value; Node* next; };
+//   TRACE_LAYOUT(Node, TRACE_FIELD(Node, value), TRACE_FIELD(Node, next));
+//   ...
+//   n->next = m;
+//   __trace_struct_snapshot(n, &*(n), __LINE__);
+//
+// TRACE_LAYOUT belongs at file scope, after the struct. In C, TRACE_FIELD
+// classifies arithmetic fields only; give pointers and char arrays a tag with
+// TRACE_FIELD_AS, and name the layout with __trace_struct_snapshot_as.
+typedef struct {
+    const char* name;
+    unsigned int offset;
+    unsigned int size;
+    unsigned int tag;
+} __trace_field;
+
+typedef struct {
+    const char* name;
+    unsigned int size;
+    unsigned int count;
+    const __trace_field* fields;
+} __trace_layout;
+
+#define TRACE_FIELD_AS(type, member, tag) \
+    { #member, (unsigned int)offsetof(type, member), (unsigned int)sizeof(((type*)0)->member), tag }
+
+#ifdef __cplusplus
+#define TRACE_FIELD(type, member) TRACE_FIELD_AS(type, member, __TRACE_TAG_OF(((type*)0)->member))
+
+template <typename T>
+struct __trace_layout_traits {
+    __TRACE_VALUE_FN const __trace_layout* get() { return nullptr; }
+};
+
+// Layout of the object a pointer points to, or null for types without one
+template <typename T>
+__TRACE_VALUE_FN const __trace_layout* __trace_layout_of(const T*) {
+    return __trace_layout_traits<typename std::remove_cv<T>::type>::get();
+}
+
+#define TRACE_LAYOUT(type, ...)                                                     \
+    static const __trace_field __trace_fields_##type[] = { __VA_ARGS__ };          \
+    static const __trace_layout __trace_layout_##type = {                          \
+        #type, (unsigned int)sizeof(type),                                          \
+        (unsigned int)(sizeof(__trace_fields_##type) / sizeof(__trace_field)),     \
+        __trace_fields_##type };                                                    \
+    template <> struct __trace_layout_traits<type> {                                \
+        __TRACE_VALUE_FN const __trace_layout* get() { return &__trace_layout_##type; } \
+    }
+
+// For a struct whose members cannot be named here (private ones): its
+// snapshots only tell whether the object's bytes changed
+#define TRACE_LAYOUT_OPAQUE(type)                                                   \
+    static const __trace_layout __trace_layout_##type = {                          \
+        #type, (unsigned int)sizeof(type), 0, nullptr };                            \
+    template <> struct __trace_layout_traits<type> {                                \
+        __TRACE_VALUE_FN const __trace_layout* get() { return &__trace_layout_##type; } \
+    }
+#else
+#define TRACE_FIELD(type, member) TRACE_FIELD_AS(type, member, __TRACE_TAG_OF(((type*)0)->member))
+
+#define TRACE_LAYOUT(type, ...)                                                     \
+    static const __trace_field __trace_fields_##type[] = { __VA_ARGS__ };          \
+    static const __trace_layout __trace_layout_##type = {                          \
+        #type, (unsigned int)sizeof(type),                                          \
+        (unsigned int)(sizeof(__trace_fields_##type) / sizeof(__trace_field)),     \
+        __trace_fields_##type }
+
+#define TRACE_LAYOUT_OPAQUE(type)                                                   \
+    static const __trace_layout __trace_layout_##type = {                          \
+        #type, (unsigned int)sizeof(type), 0, 0 }
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __trace_struct_snapshot_loc(const char* name, const void* object, const __trace_layout* layout,
+                                 const char* file, int line);
+#ifdef __cplusplus
+}
+#endif
+
+#define __trace_struct_snapshot_as(name, ptr, type, line) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_struct_snapshot_loc(#name, (const void*)(ptr), &__trace_layout_##type, __FILE__, line))
+#ifdef __cplusplus
+#define __trace_struct_snapshot(name, ptr, line) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_struct_snapshot_loc(#name, (const void*)(ptr), __trace_layout_of(ptr), __FILE__, line))
+#endif
+
+// ========== CONTAINERS ==========
+// Anything with data(), size() and capacity() (std::vector, std::string,
+// std::basic_string) is traced through __trace_container; other types
+// compile to nothing. Struct elements are shown field by field when their
+// type has a TRACE_LAYOUT.
+#ifdef __cplusplus
+extern "C" void __trace_container_loc(const char* name, const char* kind, const void* object,
+                                      const void* data, size_t size, size_t capacity,
+                                      size_t elem_size, unsigned int elem_tag,
+                                      const __trace_layout* elem_layout,
+                                      const char* file, int line);
+
+template <typename C>
+__TRACE_VALUE_FN auto __trace_container_kind(const C* c, int) -> decltype((void)c->c_str(), (const char*)0) {
+    return "string";
+}
+template <typename C>
+__TRACE_VALUE_FN const char* __trace_container_kind(const C*, long) { return "vector"; }
+
+template <typename C>
+__TRACE_VALUE_FN auto __trace_container_of(const char* name, const C& c, const char* file, int line, int)
+    -> decltype((void)c.data(), (void)c.size(), (void)c.capacity()) {
+    typedef typename C::value_type __E;
+    __trace_container_loc(name, __trace_container_kind(&c, 0), (const void*)&c, (const void*)c.data(),
+                          c.size(), c.capacity(), sizeof(__E), __trace_tag_for<__E>(),
+                          __trace_layout_traits<__E>::get(), file, line);
+}
+template <typename C>
+__TRACE_VALUE_FN void __trace_container_of(const char*, const C&, const char*, int, long) {}
+
+extern "C" void __trace_object_declared_loc(const void* object, size_t size);
+
+#define __trace_container(c, line) \
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, __trace_container_of(#c, (c), __FILE__, line, 0))
+// At the declaration: a container left at the same address is forgotten, so
+// the new one is reported in full
+#define __trace_container_declare(c, line) \
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 (__trace_object_declared_loc((const void*)&(c), sizeof(c)), \
+                  __trace_container_of(#c, (c), __FILE__, line, 0)))
+#endif
 
 #ifdef _WIN32
 #ifdef __cplusplus
@@ -14,6 +338,7 @@ void trace_var_long_loc(const char* name, long long value, const char* file, int
 void trace_var_double_loc(const char* name, double value, const char* file, int line);
 void trace_var_ptr_loc(const char* name, void* value, const char* file, int line);
 void trace_var_str_loc(const char* name, const char* value, const char* file, int line);
+void trace_var_typed_loc(const char* name, __trace_value value, const char* file, int line);
 
 void trace_var_int(const char* name, int value);
 void trace_var_long(const char* name, long long value);
@@ -21,22 +346,24 @@ void trace_var_double(const char* name, double value);
 void trace_var_ptr(const char* name, void* value);
 void trace_var_str(const char* name, const char* value);
 
-void __trace_declare_loc(const char* name, const char* type, void* address, const char* file, int line);
-void __trace_assign_loc(const char* name, long long value, const char* file, int line);
+void __trace_declare_loc(const char* name, const char* type, void* address,
+                         size_t size, unsigned int tag, const char* file, int line);
+void __trace_assign_loc(const char* name, __trace_value value, const char* file, int line);
 
 void __trace_array_create_loc(const char* name, const char* baseType, void* address,
                                int dim1, int dim2, int dim3, bool isStack,
+                               size_t size, size_t elemSize, unsigned int elemTag,
                                const char* file, int line);
 void __trace_array_init_loc(const char* name, void* values, int count,
                              const char* file, int line);
 void __trace_array_init_string_loc(const char* name, const char* str_literal,
                                     const char* file, int line);
 void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                     long long value, const char* file, int line);
+                                     __trace_value value, const char* file, int line);
 
 void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
                                 const char* file, int line);
-void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
+void __trace_pointer_deref_write_loc(const char* ptrName, __trace_value value,
                                       const char* file, int line);
 void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
                                     const char* file, int line);
@@ -47,10 +374,9 @@ void __trace_loop_body_start_loc(int loopId, const char* file, int line);
 void __trace_loop_iteration_end_loc(int loopId, const char* file, int line);
 void __trace_loop_end_loc(int loopId, const char* file, int line);
 void __trace_loop_condition_loc(int loopId, int result, const char* file, int line);
-void __trace_return_loc(long long value, const char* returnType, const char* destinationSymbol, const char* file, int line);
+void __trace_return_loc(__trace_value value, const char* returnType, const char* destinationSymbol, const char* file, int line);
 void __trace_block_enter_loc(int blockDepth, const char* file, int line);
 void __trace_block_exit_loc(int blockDepth, const char* file, int line);
-void __trace_output_flush_loc(const char* file, int line);
 void __trace_condition_eval_loc(int conditionId, const char* expression, int result, const char* file, int line);
 void __trace_branch_taken_loc(int conditionId, const char* branchType, const char* file, int line);
 
@@ -58,59 +384,88 @@ void __trace_branch_taken_loc(int conditionId, const char* branchType, const cha
 }
 #endif
 
-#define TRACE_INT(var)    trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__)
-#define TRACE_LONG(var)   trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__)
-#define TRACE_DOUBLE(var) trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__)
-#define TRACE_PTR(var)    trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__)
-#define TRACE_STR(var)    trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__)
-#define TRACE_VAR(var)    TRACE_INT(var)
+#define TRACE_INT(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__))
+#define TRACE_LONG(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__))
+#define TRACE_DOUBLE(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__))
+#define TRACE_PTR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__))
+#define TRACE_STR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__))
+#define TRACE_VAR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_typed_loc(#var, __trace_value_of(var), __FILE__, __LINE__))
 
 #define __trace_declare(name, type, line) \
-    __trace_declare_loc(#name, #type, (void*)&(name), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_declare_loc(#name, #type, (void*)&(name), sizeof(name), __TRACE_TAG_OF(name), \
+                                     __FILE__, line))
 #define __trace_assign(name, value, line) \
-    __trace_assign_loc(#name, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_assign_loc(#name, __trace_value_of(value), __FILE__, line))
 #define __trace_array_create(name, baseType, dim1, dim2, dim3, line) \
-    __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, \
+                                          sizeof(name), sizeof(baseType), __TRACE_TYPE_TAG(baseType), \
+                                          __FILE__, line))
 #define __trace_array_init(name, values, count, line) \
-    __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line))
 #define __trace_array_init_string(name, str_literal, line) \
-    __trace_array_init_string_loc(#name, str_literal, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_init_string_loc(#name, str_literal, __FILE__, line))
 #define __trace_array_index_assign_1d(name, idx, value, line) \
-    __trace_array_index_assign_loc(#name, idx, -1, -1, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx, -1, -1, __trace_value_of(value), __FILE__, line))
 #define __trace_array_index_assign_2d(name, idx1, idx2, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, -1, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx1, idx2, -1, __trace_value_of(value), __FILE__, line))
 #define __trace_array_index_assign_3d(name, idx1, idx2, idx3, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, idx3, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx1, idx2, idx3, __trace_value_of(value), __FILE__, line))
 #define __trace_pointer_alias(name, value, decayed, line) \
-    __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line))
 #define __trace_pointer_deref_write(ptrName, value, line) \
-    __trace_pointer_deref_write_loc(#ptrName, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_deref_write_loc(#ptrName, __trace_value_of(value), __FILE__, line))
 #define __trace_pointer_heap_init(ptrName, heapAddr, line) \
-    __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line))
 #define __trace_control_flow(controlType, line) \
-    __trace_control_flow_loc(controlType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_control_flow_loc(controlType, __FILE__, line))
 #define __trace_loop_start(loopId, loopType, line) \
-    __trace_loop_start_loc(loopId, loopType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_start_loc(loopId, loopType, __FILE__, line))
 #define __trace_loop_body_start(loopId, line) \
-    __trace_loop_body_start_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_body_start_loc(loopId, __FILE__, line))
 #define __trace_loop_iteration_end(loopId, line) \
-    __trace_loop_iteration_end_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_iteration_end_loc(loopId, __FILE__, line))
 #define __trace_loop_end(loopId, line) \
-    __trace_loop_end_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_end_loc(loopId, __FILE__, line))
 #define __trace_loop_condition(loopId, result, line) \
-    __trace_loop_condition_loc(loopId, result, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_condition_loc(loopId, result, __FILE__, line))
 #define __trace_return(value, returnType, destinationSymbol, line) \
-    __trace_return_loc((long long)(value), returnType, destinationSymbol, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CALLS, TRACE_CAT_CALLS, \
+                 __trace_return_loc(__trace_value_of(value), returnType, destinationSymbol, __FILE__, line))
 #define __trace_block_enter(blockDepth, line) \
-    __trace_block_enter_loc(blockDepth, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BLOCKS, TRACE_CAT_CONTROL, \
+                 __trace_block_enter_loc(blockDepth, __FILE__, line))
 #define __trace_block_exit(blockDepth, line) \
-    __trace_block_exit_loc(blockDepth, __FILE__, line)
-#define __trace_output_flush(line) \
-    __trace_output_flush_loc(__FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BLOCKS, TRACE_CAT_CONTROL, \
+                 __trace_block_exit_loc(blockDepth, __FILE__, line))
 #define __trace_condition_eval(conditionId, expression, result, line) \
-    __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line))
 #define __trace_branch_taken(conditionId, branchType, line) \
-    __trace_branch_taken_loc(conditionId, branchType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_branch_taken_loc(conditionId, branchType, __FILE__, line))
 
 #else
 
@@ -123,6 +478,7 @@ void trace_var_long_loc(const char* name, long long value, const char* file, int
 void trace_var_double_loc(const char* name, double value, const char* file, int line);
 void trace_var_ptr_loc(const char* name, void* value, const char* file, int line);
 void trace_var_str_loc(const char* name, const char* value, const char* file, int line);
+void trace_var_typed_loc(const char* name, __trace_value value, const char* file, int line);
 
 void trace_var_int(const char* name, int value);
 void trace_var_long(const char* name, long long value);
@@ -130,22 +486,24 @@ void trace_var_double(const char* name, double value);
 void trace_var_ptr(const char* name, void* value);
 void trace_var_str(const char* name, const char* value);
 
-void __trace_declare_loc(const char* name, const char* type, void* address, const char* file, int line);
-void __trace_assign_loc(const char* name, long long value, const char* file, int line);
+void __trace_declare_loc(const char* name, const char* type, void* address,
+                         size_t size, unsigned int tag, const char* file, int line);
+void __trace_assign_loc(const char* name, __trace_value value, const char* file, int line);
 
 void __trace_array_create_loc(const char* name, const char* baseType, void* address,
                                int dim1, int dim2, int dim3, bool isStack,
+                               size_t size, size_t elemSize, unsigned int elemTag,
                                const char* file, int line);
 void __trace_array_init_loc(const char* name, void* values, int count,
                              const char* file, int line);
 void __trace_array_init_string_loc(const char* name, const char* str_literal,
                                     const char* file, int line);
 void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                     long long value, const char* file, int line);
+                                     __trace_value value, const char* file, int line);
 
 void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
                                 const char* file, int line);
-void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
+void __trace_pointer_deref_write_loc(const char* ptrName, __trace_value value,
                                       const char* file, int line);
 void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
                                     const char* file, int line);
@@ -156,10 +514,9 @@ void __trace_loop_body_start_loc(int loopId, const char* file, int line);
 void __trace_loop_iteration_end_loc(int loopId, const char* file, int line);
 void __trace_loop_end_loc(int loopId, const char* file, int line);
 void __trace_loop_condition_loc(int loopId, int result, const char* file, int line);
-void __trace_return_loc(long long value, const char* returnType, const char* destinationSymbol, const char* file, int line);
+void __trace_return_loc(__trace_value value, const char* returnType, const char* destinationSymbol, const char* file, int line);
 void __trace_block_enter_loc(int blockDepth, const char* file, int line);
 void __trace_block_exit_loc(int blockDepth, const char* file, int line);
-void __trace_output_flush_loc(const char* file, int line);
 void __trace_condition_eval_loc(int conditionId, const char* expression, int result, const char* file, int line);
 void __trace_branch_taken_loc(int conditionId, const char* branchType, const char* file, int line);
 
@@ -167,58 +524,185 @@ void __trace_branch_taken_loc(int conditionId, const char* branchType, const cha
 }
 #endif
 
-#define TRACE_INT(var)    trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__)
-#define TRACE_LONG(var)   trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__)
-#define TRACE_DOUBLE(var) trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__)
-#define TRACE_PTR(var)    trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__)
-#define TRACE_STR(var)    trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__)
-#define TRACE_VAR(var)    TRACE_INT(var)
+#define TRACE_INT(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__))
+#define TRACE_LONG(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__))
+#define TRACE_DOUBLE(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__))
+#define TRACE_PTR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__))
+#define TRACE_STR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__))
+#define TRACE_VAR(var) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, trace_var_typed_loc(#var, __trace_value_of(var), __FILE__, __LINE__))
 
 #define __trace_declare(name, type, line) \
-    __trace_declare_loc(#name, #type, (void*)&(name), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_declare_loc(#name, #type, (void*)&(name), sizeof(name), __TRACE_TAG_OF(name), \
+                                     __FILE__, line))
 #define __trace_assign(name, value, line) \
-    __trace_assign_loc(#name, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_assign_loc(#name, __trace_value_of(value), __FILE__, line))
 #define __trace_array_create(name, baseType, dim1, dim2, dim3, line) \
-    __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, \
+                                          sizeof(name), sizeof(baseType), __TRACE_TYPE_TAG(baseType), \
+                                          __FILE__, line))
 #define __trace_array_init(name, values, count, line) \
-    __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line))
 #define __trace_array_init_string(name, str_literal, line) \
-    __trace_array_init_string_loc(#name, str_literal, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_init_string_loc(#name, str_literal, __FILE__, line))
 #define __trace_array_index_assign_1d(name, idx, value, line) \
-    __trace_array_index_assign_loc(#name, idx, -1, -1, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx, -1, -1, __trace_value_of(value), __FILE__, line))
 #define __trace_array_index_assign_2d(name, idx1, idx2, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, -1, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx1, idx2, -1, __trace_value_of(value), __FILE__, line))
 #define __trace_array_index_assign_3d(name, idx1, idx2, idx3, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, idx3, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_index_assign_loc(#name, idx1, idx2, idx3, __trace_value_of(value), __FILE__, line))
 #define __trace_pointer_alias(name, value, decayed, line) \
-    __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line))
 #define __trace_pointer_deref_write(ptrName, value, line) \
-    __trace_pointer_deref_write_loc(#ptrName, (long long)(value), __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_deref_write_loc(#ptrName, __trace_value_of(value), __FILE__, line))
 #define __trace_pointer_heap_init(ptrName, heapAddr, line) \
-    __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_POINTERS, TRACE_CAT_POINTERS, \
+                 __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line))
 #define __trace_control_flow(controlType, line) \
-    __trace_control_flow_loc(controlType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_control_flow_loc(controlType, __FILE__, line))
 #define __trace_loop_start(loopId, loopType, line) \
-    __trace_loop_start_loc(loopId, loopType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_start_loc(loopId, loopType, __FILE__, line))
 #define __trace_loop_body_start(loopId, line) \
-    __trace_loop_body_start_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_body_start_loc(loopId, __FILE__, line))
 #define __trace_loop_iteration_end(loopId, line) \
-    __trace_loop_iteration_end_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_iteration_end_loc(loopId, __FILE__, line))
 #define __trace_loop_end(loopId, line) \
-    __trace_loop_end_loc(loopId, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_end_loc(loopId, __FILE__, line))
 #define __trace_loop_condition(loopId, result, line) \
-    __trace_loop_condition_loc(loopId, result, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL, \
+                 __trace_loop_condition_loc(loopId, result, __FILE__, line))
 #define __trace_return(value, returnType, destinationSymbol, line) \
-    __trace_return_loc((long long)(value), returnType, destinationSymbol, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CALLS, TRACE_CAT_CALLS, \
+                 __trace_return_loc(__trace_value_of(value), returnType, destinationSymbol, __FILE__, line))
 #define __trace_block_enter(blockDepth, line) \
-    __trace_block_enter_loc(blockDepth, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BLOCKS, TRACE_CAT_CONTROL, \
+                 __trace_block_enter_loc(blockDepth, __FILE__, line))
 #define __trace_block_exit(blockDepth, line) \
-    __trace_block_exit_loc(blockDepth, __FILE__, line)
-#define __trace_output_flush(line) \
-    __trace_output_flush_loc(__FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BLOCKS, TRACE_CAT_CONTROL, \
+                 __trace_block_exit_loc(blockDepth, __FILE__, line))
 #define __trace_condition_eval(conditionId, expression, result, line) \
-    __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line))
 #define __trace_branch_taken(conditionId, branchType, line) \
-    __trace_branch_taken_loc(conditionId, branchType, __FILE__, line)
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL, \
+                 __trace_branch_taken_loc(conditionId, branchType, __FILE__, line))
+
+#endif
+
+// ========== STATIC SITES ==========
+// Code rewritten by the Clang instrumenter (instrumenter/trace-instrument.cpp)
+// opens with one table of the variables it traces, indexed by slot ids fixed
+// at compile time:
+//
+//   static const __trace_site __trace_sites[] = { { "sum", "int", __FILE__, 4 }, ... };
+//   ...
+//   int sum = 0; __trace_declare_init_at(0, sum);
+//   sum += v;    __trace_assign_at(0, sum, 7);
+//
+// so a hook passes one pointer for the name, type, file and declaring line.
+// Conditions are traced by hooks that return their result, so each is
+// evaluated once, where the program evaluates it.
+typedef struct {
+    const char* name;
+    const char* type;
+    const char* file;
+    int line;
+} __trace_site;
 
-#endif
\ No newline at end of file
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __trace_declare_site(const __trace_site* site, void* address, size_t size, unsigned int tag);
+void __trace_declare_init_site(const __trace_site* site, void* address, size_t size, unsigned int tag,
+                               __trace_value value);
+void __trace_assign_site(const __trace_site* site, __trace_value value, int line);
+#ifdef __cplusplus
+}
+#endif
+
+#define __trace_declare_at(slot, name) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_declare_site(&__trace_sites[slot], (void*)&(name), sizeof(name), __TRACE_TAG_OF(name)))
+#define __trace_declare_init_at(slot, name) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_declare_init_site(&__trace_sites[slot], (void*)&(name), sizeof(name), \
+                                           __TRACE_TAG_OF(name), __trace_value_of(name)))
+#define __trace_assign_at(slot, name, line) \
+    __TRACE_HOOK(TRACE_CAT_VARS, TRACE_CAT_VARS, \
+                 __trace_assign_site(&__trace_sites[slot], __trace_value_of(name), line))
+
+#ifdef __cplusplus
+// __trace_array_create for element types that cannot be a macro argument,
+// such as std::pair<int, int>: the type comes from the array, its name as a
+// string
+#define __trace_array_create_named(name, baseType, dim1, dim2, dim3, line) \
+    __TRACE_HOOK(TRACE_CAT_ARRAYS, TRACE_CAT_ARRAYS, \
+                 __trace_array_create_loc(#name, baseType, (void*)(name), dim1, dim2, dim3, true, sizeof(name), \
+                                          sizeof(typename std::remove_all_extents<decltype(name)>::type), \
+                                          __TRACE_TYPE_TAG(typename std::remove_all_extents<decltype(name)>::type), \
+                                          __FILE__, line))
+#endif
+
+// for (...; __trace_loop_test(0, (i < n) ? 1 : 0, __FILE__, 12); ...)
+__TRACE_VALUE_FN int __trace_loop_test(int loopId, int result, const char* file, int line) {
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_LOOPS, TRACE_CAT_CONTROL,
+                 __trace_loop_condition_loc(loopId, result, file, line));
+    return result;
+}
+
+// if (__trace_condition_test(3, "x > 0", (x > 0) ? 1 : 0, __FILE__, 20))
+__TRACE_VALUE_FN int __trace_condition_test(int conditionId, const char* expression, int result,
+                                            const char* file, int line) {
+    __TRACE_HOOK(TRACE_CAT_CONTROL | TRACE_CAT_BRANCHES, TRACE_CAT_CONTROL,
+                 __trace_condition_eval_loc(conditionId, expression, result, file, line));
+    return result;
+}
+
+#ifdef __cplusplus
+// return __trace_returning<int>(fib(n - 1) + fib(n - 2), "int", __FILE__, 9);
+template <typename T>
+__TRACE_VALUE_FN T __trace_returning(T value, const char* returnType, const char* file, int line) {
+    __TRACE_HOOK(TRACE_CAT_CALLS, TRACE_CAT_CALLS,
+                 __trace_return_loc(__trace_value_of(value), returnType, "", file, line));
+    return value;
+}
+#endif
+
+// ========== IR SITES ==========
+// Hooks inserted by the LLVM pass (instrumenter/trace-pass.cpp) into an
+// optimized build. The pass works on values rather than source, so it passes
+// a value as its bits and tag, and describes arrays and functions with the
+// same site records: an array's site carries its element type, a function's
+// its return type.
+#ifdef __cplusplus
+extern "C" {
+#endif
+void __trace_value_site(const __trace_site* site, unsigned long long bits, unsigned int tag, int line);
+void __trace_array_site(const __trace_site* site, void* base, int dim1, int dim2, int dim3,
+                        size_t elemSize, unsigned int elemTag);
+void __trace_array_store_site(const __trace_site* site, void* base, unsigned long long index,
+                              unsigned long long bits, unsigned int tag, int line);
+void __trace_return_site(const __trace_site* site, unsigned long long bits, unsigned int tag, int line);
+#ifdef __cplusplus
+}
+#endif
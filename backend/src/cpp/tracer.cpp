@@ -74,16 +74,31 @@
         g_inside_tracer = false;       \
     } while (0)
 
+// Hooks open with a single test of the gate word: the event categories being
+// recorded right now. Outside a trace window the word is 0 and the hook
+// returns here. While a start-line trigger is armed, TRACE_GATE_LINE keeps
+// every hook that carries a line number looking for it.
+#define TRACE_GATE(category, line)                                              \
+    do {                                                                        \
+        if (!(__TRACE_GATE_WORD() & ((category) | TRACE_GATE_LINE))) return;   \
+        if (__trace_gate[0] & TRACE_GATE_LINE) check_line_trigger(line);       \
+        if (!(__TRACE_GATE_WORD() & (category))) return;                       \
+    } while (0)
+
 // ========== INCLUDES ==========
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <cstddef>
+#include <cstdarg>
 #include <algorithm>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <set>
 #include <vector>
 #include <chrono>
@@ -111,10 +126,49 @@
 #else
     #include <dlfcn.h>
     #include <cxxabi.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/mman.h>
     #include <sys/time.h>
     #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+    #include <climits>
+    #include <link.h>
+    #include <poll.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+#endif
+
+// Shadow memory diffing and JSON escaping scan with SSE2, or AVX2 when the
+// CPU has it.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #include <immintrin.h>
+    #define TRACER_SIMD_X86 1
+#endif
+
+// Program I/O capture reads stdin's FILE buffer pointers directly.
+#if defined(__linux__) && defined(__GLIBC__)
+    #include <pthread.h>
+    #include <stdio_ext.h>
+    #define TRACER_CAPTURE_IO 1
+#endif
+
+// Compressed output is a glibc fopencookie() stream.
+#if defined(__linux__) && defined(__GLIBC__)
+    #include <sys/syscall.h>
+    #define TRACER_COMPRESS 1
+#endif
+
+// Programs built with -fxray-instrument are linked with XRay's runtime, and
+// the tracer is compiled with -DTRACE_XRAY to be their handler.
+#if defined(TRACE_XRAY)
+    #include <xray/xray_interface.h>
+#endif
+
 #include "trace.h"
 
 // ========== THREAD-SAFE MUTEX WRAPPER ==========
@@ -151,6 +205,143 @@ static FILE* g_trace_file = nullptr;
 static int g_depth = 0;
 static unsigned long g_event_counter = 0;
 
+// ========== SEMANTIC ROLLING HASH ==========
+// FNV-1a over the address/timestamp-free content of every event, so two runs
+// of the same program can be compared checkpoint by checkpoint.
+static const unsigned long long SEMANTIC_HASH_SEED = 0xcbf29ce484222325ULL;
+static const unsigned long long SEMANTIC_HASH_PRIME = 0x100000001b3ULL;
+static unsigned long long g_semantic_hash = SEMANTIC_HASH_SEED;
+static unsigned long g_checkpoint_interval = 1024;  // TRACE_CHECKPOINT_INTERVAL, 0 disables
+
+// ========== SKELETON MODE / FORK CHECKPOINTS ==========
+// TRACE_MODE=skeleton records only control flow and calls. With
+// TRACE_FORK_INTERVAL=N (Linux only) the process additionally forks a frozen
+// copy of itself every N skeleton events; the copy parks on a FIFO until the
+// backend asks it to re-run a window of skeleton steps with full detail.
+static volatile bool g_record_detail = true;
+static unsigned long g_skeleton_counter = 0;     // skeleton events seen so far
+static unsigned long g_fork_interval = 0;
+static unsigned long g_next_fork_at = 0;
+static int g_checkpoint_ttl_ms = 120000;
+static char g_checkpoint_dir[4096] = ".";
+
+static bool g_window_active = false;             // resumed checkpoint or TRACE_WINDOW_TO run
+static unsigned long g_window_from = 0;
+static unsigned long g_window_to = 0;
+static char g_window_output[4096];
+
+// ========== INPUT RECORD / REPLAY ==========
+// TRACE_INPUT_LOG=<path> records the nondeterministic inputs the program sees
+// (stdin bytes, time, clock_gettime, rand/srand, getpid). A later run with
+// TRACE_REPLAY=<path> feeds the same values back, so a full-detail re-run of
+// a window (TRACE_WINDOW_FROM/TRACE_WINDOW_TO, in skeleton steps) retraces
+// exactly the recorded execution.
+static FILE* g_input_log = nullptr;
+static bool g_input_replay = false;
+static unsigned long g_inputs_recorded = 0;
+static unsigned long g_inputs_replayed = 0;
+static unsigned long g_inputs_missing = 0;    // replay log exhausted, live value used
+
+// ========== VIRTUAL TIME ==========
+// With TRACE_VIRTUAL_TIME=1 the sleep family returns at once and moves a
+// virtual clock forward instead; time() and clock_gettime() report real time
+// plus everything slept so far. Replay runs never sleep: the clock values
+// they see come from the recording.
+
+static bool g_virtual_time = false;
+static long long g_virtual_offset_ns = 0;   // total virtual sleep, atomic
+static unsigned long g_virtual_sleeps = 0;
+
+// ========== TRACE WINDOWS ==========
+// Event categories (TRACE_CAT_* in trace.h), selectable with TRACE_EVENTS
+// ("calls,control", "all,-heap")
+
+// The tracer only rewrites the gate word when a trigger changes state. It
+// stays 0 until main() starts, so static initializers cost the hooks a
+// single test. The toggle word has a page of its own so TRACE_TOGGLE_FILE
+// can map a shared file over it; another process then pauses and resumes
+// recording by writing it (0 pauses, TRACE_CAT_ALL resumes), and the hooks
+// need no polling. trace.h tests both inline, through __TRACE_GATE_WORD(),
+// before calling into a hook at all.
+extern "C" {
+volatile unsigned int __trace_gate[1] = { 0 };
+alignas(4096) volatile unsigned int __trace_toggle[4096 / sizeof(unsigned int)] = { TRACE_CAT_ALL };
+}
+
+static unsigned int g_category_mask = TRACE_CAT_ALL;
+static volatile bool g_window_open = true;        // start triggers, SIGUSR1/SIGUSR2
+static bool g_window_stopped = false;             // TRACE_MAX_EVENTS reached
+static unsigned long g_max_events = 0;
+static int g_depth_min = 0;                       // TRACE_DEPTH_MIN/MAX, 0 = unbounded
+static int g_depth_max = 0;
+static bool g_in_depth_range = true;
+static bool g_start_func_armed = false;           // TRACE_START_FUNC
+static void* g_start_func = nullptr;
+static unsigned long g_start_func_offset = 0;
+static char g_start_func_name[256];
+static volatile int g_start_line = 0;             // TRACE_START_LINE
+static bool g_frame_recorded[2048];               // call frame pushed at this depth
+
+// ========== USER CODE FILTER ==========
+// Only the user's program is traced: nothing before main() starts, no
+// library functions instantiated into the user TU (std::vector members,
+// std::sort helpers), and no heap traffic whose caller lies outside the
+// executable. What was dropped is counted in the footer.
+
+#if defined(__ELF__)
+extern "C" int trace_user_main() __asm__("main");
+static void* const g_main_func = (void*)&trace_user_main;
+#else
+static void* const g_main_func = nullptr;
+#endif
+static bool g_main_started = false;
+static bool g_filter_library = true;              // TRACE_FILTER_LIBRARY=0 keeps library code
+static bool g_frame_library[2048];                // library frame at this depth, enter not recorded
+static unsigned long g_user_text_lo = 0;          // executable segments of the main program
+static unsigned long g_user_text_hi = 0;
+static unsigned long g_user_load_base = 0;        // load bias of the main program
+
+struct FilterCounts {
+    unsigned long pre_main_calls;
+    unsigned long pre_main_heap;
+    unsigned long library_calls;
+    unsigned long library_heap;
+};
+static FilterCounts g_filtered = { 0, 0, 0, 0 };
+
+// ========== FLIGHT RECORDER ==========
+// TRACE_FLIGHT_RECORDER=N keeps only the last N events, formatted into a
+// preallocated ring of fixed-size slots, and writes them out once: on exit,
+// on a fatal signal, or when TRACE_FLIGHT_TIMEOUT (seconds) expires. Memory
+// and I/O stay constant however long the program runs.
+static const size_t FLIGHT_SLOT_SIZE = 1024;
+
+struct FlightSlot {
+    volatile unsigned int length;     // 0 while being written
+    char data[FLIGHT_SLOT_SIZE - sizeof(unsigned int)];
+};
+
+// Shadow call stack kept in plain memory so a signal handler can walk it
+struct ShadowFrame {
+    void* func;
+    void* caller;
+    void* frame;                      // frame pointer of the call, for frame snapshots
+    unsigned long event;              // event counter at entry
+};
+
+static FlightSlot* g_flight_slots = nullptr;
+static unsigned long g_flight_capacity = 0;
+static int g_flight_fd = -1;
+static volatile int g_flight_dumped = 0;
+static ShadowFrame g_shadow_stack[2048];
+
+// ========== PROGRAM I/O CAPTURE ==========
+// Program output and input become "stdout"/"stderr"/"stdin" events in the
+// trace's own sequence (TRACE_CAPTURE_IO=0 disables).
+
+static bool g_io_capture = false;
+static unsigned long g_io_events = 0;
+
 // ========== GLOBAL REENTRANCY GUARD ==========
 // Prevents infinite recursion when tracer functions are instrumented
 // Cross-platform thread-local reentrancy guard
@@ -195,9 +386,35 @@ struct CallFrame {
     std::map<std::string, PointerInfo> pointerAliases;
     std::vector<int> activeLoops;
     std::map<int, int> loopIterations;
+    std::map<std::string, __trace_value> assignedValues;  // last reported, for TRACE_ELIDE
+};
+
+struct HashCheckpoint {
+    unsigned long event;          // number of events covered by the hash
+    unsigned long long hash;
+    int depth;
+};
+
+struct ReplayQueue {
+    std::vector<long long> values;
+    size_t next = 0;
+};
+
+struct ReplayInputs {
+    ReplayQueue time, clock_sec, clock_nsec, rand, srand, pid;
+};
+
+struct ForkCheckpoint {
+    unsigned long event;          // skeleton step the frozen copy resumes at
+    long pid;
+    std::string fifo;
 };
 
-// Construct-On-First-Use accessors
+// Construct-On-First-Use accessors. State added later in this file is
+// heap-allocated on first use and deliberately never freed
+// (`static T* s = new T()`): its teardown at exit would otherwise show up as
+// program heap traffic, and finish_tracer() may still read it after
+// function-local statics are gone.
 static std::map<std::string, long long>& get_variable_values() {
     static NO_INSTRUMENT std::map<std::string, long long> s_variable_values;
     return s_variable_values;
@@ -214,9 +431,10 @@ static std::map<ArrayElementKey, long long>& get_array_element_values() {
     static NO_INSTRUMENT std::map<ArrayElementKey, long long> s_array_element_values;
     return s_array_element_values;
 }
+// Leaked for the same reason as the checkpoint lists below: the footer reads it.
 static std::set<std::string>& get_tracked_functions() {
-    static NO_INSTRUMENT std::set<std::string> s_tracked_functions;
-    return s_tracked_functions;
+    static std::set<std::string>* s_tracked_functions = new std::set<std::string>();
+    return *s_tracked_functions;
 }
 static std::string& get_current_function() {
     static NO_INSTRUMENT std::string s_current_function = "main";
@@ -230,6 +448,20 @@ static std::vector<CallFrame>& get_call_stack() {
     static NO_INSTRUMENT std::vector<CallFrame> s_call_stack;
     return s_call_stack;
 }
+// Intentionally leaked: finish_tracer() runs after function-local statics have
+// been destroyed, and the footer still needs the checkpoint list.
+static std::vector<HashCheckpoint>& get_hash_checkpoints() {
+    static std::vector<HashCheckpoint>* s_hash_checkpoints = new std::vector<HashCheckpoint>();
+    return *s_hash_checkpoints;
+}
+static std::vector<ForkCheckpoint>& get_fork_checkpoints() {
+    static std::vector<ForkCheckpoint>* s_fork_checkpoints = new std::vector<ForkCheckpoint>();
+    return *s_fork_checkpoints;
+}
+static ReplayInputs& get_replay_inputs() {
+    static ReplayInputs* s_replay_inputs = new ReplayInputs();
+    return *s_replay_inputs;
+}
 
 // Map globals to accessors to avoid mass-replace
 #define g_variable_values get_variable_values()
@@ -276,6 +508,512 @@ struct NO_INSTRUMENT TraceGuard {
     TraceGuard& operator=(const TraceGuard&) = delete;
 };
 
+// ========== SIMD SCANS ==========
+// Byte scans on the hot paths: shadow memory diffing and JSON escaping.
+// Each has a scalar version and SSE2/AVX2 versions chosen at startup.
+
+// Offset of the first differing byte of a and b, or n when they are equal
+static size_t NO_INSTRUMENT first_difference_scalar(const unsigned char* a, const unsigned char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) break;
+    }
+    for (; i < n; ++i) {
+        if (a[i] != b[i]) return i;
+    }
+    return n;
+}
+
+#if defined(TRACER_SIMD_X86)
+__attribute__((target("sse2")))
+static size_t NO_INSTRUMENT first_difference_sse2(const unsigned char* a, const unsigned char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        const unsigned int eq = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (eq != 0xFFFFu) return i + (size_t)__builtin_ctz(~eq);
+    }
+    return i + first_difference_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t NO_INSTRUMENT first_difference_avx2(const unsigned char* a, const unsigned char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        const unsigned int eq = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (eq != 0xFFFFFFFFu) return i + (size_t)__builtin_ctz(~eq);
+    }
+    return i + first_difference_scalar(a + i, b + i, n - i);
+}
+#endif
+
+// Offset of the first '"', '\\' or control byte in p[0, n), or n
+static size_t NO_INSTRUMENT json_special_scalar(const unsigned char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] == '"' || p[i] == '\\' || p[i] < 0x20) return i;
+    }
+    return n;
+}
+
+#if defined(TRACER_SIMD_X86)
+// max(x, 0x1f) == 0x1f is an unsigned x <= 0x1f, which SSE2 has no compare for
+__attribute__((target("sse2")))
+static size_t NO_INSTRUMENT json_special_sse2(const unsigned char* p, size_t n) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+                                         _mm_cmpeq_epi8(_mm_max_epu8(x, control), control));
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + json_special_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t NO_INSTRUMENT json_special_avx2(const unsigned char* p, size_t n) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        const __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, quote),
+                                                            _mm256_cmpeq_epi8(x, backslash)),
+                                            _mm256_cmpeq_epi8(_mm256_max_epu8(x, control), control));
+        const unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + json_special_scalar(p + i, n - i);
+}
+#endif
+
+// Picked once in init_tracer; the scalar versions serve anything traced
+// before that.
+static size_t (*g_first_difference)(const unsigned char*, const unsigned char*, size_t) =
+    first_difference_scalar;
+static size_t (*g_json_special)(const unsigned char*, size_t) = json_special_scalar;
+
+static void NO_INSTRUMENT select_simd_scans() {
+#if defined(TRACER_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_first_difference = first_difference_avx2;
+        g_json_special = json_special_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_first_difference = first_difference_sse2;
+        g_json_special = json_special_sse2;
+    }
+#endif
+}
+
+// ========== JSON TEXT ==========
+// Text that comes from the traced program (names, expressions, types,
+// string values) is escaped in full on its way into an event. Clean runs
+// are found by g_json_special and copied in bulk.
+
+template <typename Out>
+static void NO_INSTRUMENT json_escape(Out& out, const char* s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char* p = (const unsigned char*)s;
+    size_t i = 0;
+    while (i < n) {
+        const size_t run = g_json_special(p + i, n - i);
+        if (run) out.append(s + i, run);
+        i += run;
+        if (i == n) break;
+
+        const unsigned char c = p[i++];
+        char esc[6] = { '\\', (char)c, 0, 0, 0, 0 };
+        size_t len = 2;
+        switch (c) {
+            case '"': case '\\': break;
+            case '\n': esc[1] = 'n'; break;
+            case '\t': esc[1] = 't'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xf];
+                len = 6;
+        }
+        out.append(esc, len);
+    }
+}
+
+// Tracer-owned heap memory: the interposed allocator passes these through,
+// even when called after TRACER_GUARD_EXIT().
+static void* NO_INSTRUMENT tracer_malloc(size_t size) {
+    const bool inside = g_inside_tracer;
+    g_inside_tracer = true;
+    void* p = std::malloc(size);
+    g_inside_tracer = inside;
+    return p;
+}
+
+static void NO_INSTRUMENT tracer_free(void* p) {
+    const bool inside = g_inside_tracer;
+    g_inside_tracer = true;
+    std::free(p);
+    g_inside_tracer = inside;
+}
+
+// Digit pairs "00".."99": decimal conversion writes two digits per division
+static const char kDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes v right-aligned ending at `end`; returns the first digit
+static char* NO_INSTRUMENT encode_decimal(char* end, unsigned long long v) {
+    while (v >= 100) {
+        const unsigned int pair = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--end = kDigitPairs[pair + 1];
+        *--end = kDigitPairs[pair];
+    }
+    if (v >= 10) {
+        *--end = kDigitPairs[v * 2 + 1];
+        *--end = kDigitPairs[v * 2];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+static char* NO_INSTRUMENT encode_hex(char* end, unsigned long long v) {
+    static const char hex[] = "0123456789abcdef";
+    do {
+        *--end = hex[v & 0xf];
+        v >>= 4;
+    } while (v);
+    return end;
+}
+
+// The encoders above for any text sink with append(const char*, size_t):
+// JsonBuffer, and the std::string pieces events are assembled from.
+template <typename Out, size_t N>
+static void NO_INSTRUMENT append_literal(Out& out, const char (&literal)[N]) {
+    out.append(literal, N - 1);
+}
+
+template <typename Out>
+static void NO_INSTRUMENT append_decimal(Out& out, unsigned long long v) {
+    char digits[20];
+    const char* first = encode_decimal(digits + sizeof(digits), v);
+    out.append(first, (size_t)(digits + sizeof(digits) - first));
+}
+
+template <typename Out>
+static void NO_INSTRUMENT append_signed_decimal(Out& out, long long v) {
+    if (v < 0) {
+        out.append("-", 1);
+        append_decimal(out, 0ULL - (unsigned long long)v);
+    } else {
+        append_decimal(out, (unsigned long long)v);
+    }
+}
+
+// Lowercase hex, zero-padded to `width` digits (at most 16)
+template <typename Out>
+static void NO_INSTRUMENT append_hex_digits(Out& out, unsigned long long v, int width) {
+    char digits[16];
+    char* first = encode_hex(digits + sizeof(digits), v);
+    while (digits + sizeof(digits) - first < width && first > digits) *--first = '0';
+    out.append(first, (size_t)(digits + sizeof(digits) - first));
+}
+
+// The members of one event. It starts on the stack and only moves to the
+// heap for long text, so nothing is ever cut off.
+//
+// format() is printf with one more conversion, %j: a C string written as
+// escaped JSON string content (nullptr writes nothing). %s copies text
+// as-is and is meant for JSON the tracer built itself. Plain %d/%u/%x
+// (any length modifier), %0Nx and %p are converted here; floating point
+// and the remaining flagged forms fall back to snprintf for that one
+// conversion. Hooks on hot paths skip format() and use the append_*
+// encoders directly.
+class JsonBuffer {
+public:
+    NO_INSTRUMENT JsonBuffer() : data_(inline_), size_(0), capacity_(sizeof(inline_)) { inline_[0] = '\0'; }
+    NO_INSTRUMENT ~JsonBuffer() { if (data_ != inline_) tracer_free(data_); }
+
+    JsonBuffer(const JsonBuffer&) = delete;
+    JsonBuffer& operator=(const JsonBuffer&) = delete;
+
+    void NO_INSTRUMENT append(const char* s, size_t n) {
+        reserve(n);
+        memcpy(data_ + size_, s, n);
+        size_ += n;
+        data_[size_] = '\0';
+    }
+    void NO_INSTRUMENT append(const char* s) { append(s, strlen(s)); }
+    template <size_t N>
+    void NO_INSTRUMENT append_literal(const char (&literal)[N]) { append(literal, N - 1); }
+    void NO_INSTRUMENT append_unsigned(unsigned long long v) { append_decimal(*this, v); }
+    void NO_INSTRUMENT append_signed(long long v) { append_signed_decimal(*this, v); }
+    void NO_INSTRUMENT append_hex(unsigned long long v) { append_hex_digits(*this, v, 0); }
+    // Same text as glibc's %p
+    void NO_INSTRUMENT append_pointer(const void* p) {
+        if (!p) { append_literal("(nil)"); return; }
+        append_literal("0x");
+        append_hex((unsigned long long)(uintptr_t)p);
+    }
+    void NO_INSTRUMENT append_escaped(const char* s) { if (s) json_escape(*this, s, strlen(s)); }
+    void NO_INSTRUMENT format(const char* fmt, ...);
+
+    const char* NO_INSTRUMENT c_str() const { return data_; }
+    size_t NO_INSTRUMENT size() const { return size_; }
+    void NO_INSTRUMENT clear() { size_ = 0; data_[0] = '\0'; }
+
+private:
+    void NO_INSTRUMENT reserve(size_t n) {
+        if (size_ + n < capacity_) return;
+        size_t capacity = capacity_ * 2;
+        while (capacity <= size_ + n) capacity *= 2;
+        char* data = (char*)tracer_malloc(capacity);
+        if (!data) abort();
+        memcpy(data, data_, size_ + 1);
+        if (data_ != inline_) tracer_free(data_);
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    char* data_;
+    size_t size_;
+    size_t capacity_;
+    char inline_[512];
+};
+
+void NO_INSTRUMENT JsonBuffer::format(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const char* literal = fmt;
+    const char* p = fmt;
+    while (*p) {
+        if (*p != '%') { ++p; continue; }
+        append(literal, (size_t)(p - literal));
+
+        // One conversion: flags, width, precision, length, specifier
+        char spec[16];
+        size_t len = 0;
+        spec[len++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && len < 10) spec[len++] = *p++;
+        const size_t flags = len - 1;
+        int longs = 0;
+        bool size_t_arg = false;
+        while (*p == 'l' && len < 12) { spec[len++] = *p++; ++longs; }
+        if (*p == 'z') { spec[len++] = *p++; size_t_arg = true; }
+        const char conversion = *p ? *p++ : '\0';
+        const bool plain = flags == 0;
+        spec[len++] = conversion;
+        spec[len] = '\0';
+
+        // %0Nx: the width of a zero-padded hex field, else 0
+        int pad = 0;
+        if (flags >= 2 && spec[1] == '0') {
+            for (size_t k = 2; k <= flags && pad >= 0; ++k) {
+                pad = spec[k] >= '0' && spec[k] <= '9' ? pad * 10 + (spec[k] - '0') : -1;
+            }
+            if (pad > 16) pad = -1;
+        }
+
+        if (plain || conversion == 'p' || (conversion == 'x' && pad > 0)) {
+            bool done = true;
+            switch (conversion) {
+                case 'd': case 'i':
+                    if (size_t_arg) append_signed((long long)va_arg(args, size_t));
+                    else if (longs >= 2) append_signed(va_arg(args, long long));
+                    else if (longs == 1) append_signed(va_arg(args, long));
+                    else append_signed(va_arg(args, int));
+                    break;
+                case 'u': case 'x':
+                    {
+                        unsigned long long v;
+                        if (size_t_arg) v = va_arg(args, size_t);
+                        else if (longs >= 2) v = va_arg(args, unsigned long long);
+                        else if (longs == 1) v = va_arg(args, unsigned long);
+                        else v = va_arg(args, unsigned int);
+                        if (conversion == 'u') append_unsigned(v);
+                        else append_hex_digits(*this, v, pad);
+                    }
+                    break;
+                case 'p': append_pointer(va_arg(args, void*)); break;
+                default: done = false;
+            }
+            if (done) {
+                literal = p;
+                continue;
+            }
+        }
+
+        char piece[352];  // room for any %f of a double
+        piece[0] = '\0';
+        switch (conversion) {
+            case 'j': append_escaped(va_arg(args, const char*)); break;
+            case 's': { const char* text = va_arg(args, const char*); append(text ? text : "(null)"); break; }
+            case '%': append("%", 1); break;
+            case 'f': case 'g': case 'e': snprintf(piece, sizeof(piece), spec, va_arg(args, double)); append(piece); break;
+            case 'c': snprintf(piece, sizeof(piece), spec, va_arg(args, int)); append(piece); break;
+            case 'd': case 'i': case 'u': case 'x': case 'X':
+                if (size_t_arg) snprintf(piece, sizeof(piece), spec, va_arg(args, size_t));
+                else if (longs >= 2) snprintf(piece, sizeof(piece), spec, va_arg(args, long long));
+                else if (longs == 1) snprintf(piece, sizeof(piece), spec, va_arg(args, long));
+                else snprintf(piece, sizeof(piece), spec, va_arg(args, int));
+                append(piece);
+                break;
+            default: break;
+        }
+        literal = p;
+    }
+    append(literal, (size_t)(p - literal));
+    va_end(args);
+}
+
+// One trace event object, without the separator before it. Same bytes as
+// the "  {\"id\":%lu,\"type\":\"%s\",\"addr\":\"%p\",..." format it replaces.
+static void NO_INSTRUMENT encode_event(JsonBuffer& out, unsigned long id, const char* type, void* addr,
+                                       const char* func_name, int depth, unsigned long ts, const char* extra) {
+    out.append_literal("  {\"id\":");
+    out.append_unsigned(id);
+    out.append_literal(",\"type\":\"");
+    out.append(type);
+    out.append_literal("\",\"addr\":\"");
+    out.append_pointer(addr);
+    out.append_literal("\",\"func\":\"");
+    out.append_escaped(func_name ? func_name : "unknown");
+    out.append_literal("\",\"depth\":");
+    out.append_signed(depth);
+    out.append_literal(",\"ts\":");
+    out.append_unsigned(ts);
+    if (extra) {
+        out.append_literal(",");
+        out.append(extra);
+    }
+    out.append_literal("}");
+}
+
+// ========== STRING INTERNING ==========
+// TRACE_INTERN=1 writes the strings that repeat on nearly every event
+// ("type", "func" and the top-level "file" and "name" members) as small
+// integer ids. A string's first use puts {"intern":id,"s":"..."} into the
+// events array just ahead of the event; the backend resolves ids through a
+// lookup array (trace-intern.service.js). Ids start over with every output
+// file. Strings are keyed by their escaped text.
+
+static bool g_intern = false;
+
+static std::unordered_map<std::string_view, unsigned int>& get_intern_ids() {
+    static auto* s_intern_ids = new std::unordered_map<std::string_view, unsigned int>();
+    return *s_intern_ids;
+}
+
+static void NO_INSTRUMENT reset_interning() {
+    auto& ids = get_intern_ids();
+    for (auto& entry : ids) tracer_free(const_cast<char*>(entry.first.data()));
+    ids.clear();
+}
+
+// Id of an escaped string; a new one is announced in `records`
+static unsigned int NO_INSTRUMENT intern_string(JsonBuffer& records, const char* s, size_t n) {
+    auto& ids = get_intern_ids();
+    auto it = ids.find(std::string_view(s, n));
+    if (it != ids.end()) return it->second;
+
+    char* copy = (char*)tracer_malloc(n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    const unsigned int id = (unsigned int)ids.size();
+    ids.emplace(std::string_view(copy, n), id);
+
+    records.append_literal("{\"intern\":");
+    records.append_unsigned(id);
+    records.append_literal(",\"s\":\"");
+    records.append(copy, n);
+    records.append_literal("\"},\n");
+    return id;
+}
+
+// End of the JSON string starting after its opening quote
+static const char* NO_INSTRUMENT json_string_end(const char* p) {
+    while (*p && *p != '"') p += (*p == '\\' && p[1]) ? 2 : 1;
+    return p;
+}
+
+// Copies the members in `extra`, writing the values of the top-level
+// "file" and "name" string members as ids. Nested objects (struct fields,
+// ranges) are copied as they are.
+static void NO_INSTRUMENT append_interned_members(JsonBuffer& records, JsonBuffer& out, const char* extra) {
+    const char* copied = extra;
+    const char* p = extra;
+    int depth = 0;
+    while (*p) {
+        if (*p == '"') {
+            const char* key = p + 1;
+            const char* key_end = json_string_end(key);
+            const size_t key_length = (size_t)(key_end - key);
+            if (depth == 0 && key_end[0] == '"' && key_end[1] == ':' && key_end[2] == '"' &&
+                key_length == 4 && (memcmp(key, "file", 4) == 0 || memcmp(key, "name", 4) == 0)) {
+                const char* value = key_end + 3;
+                const char* value_end = json_string_end(value);
+                out.append(copied, (size_t)(value - 1 - copied));
+                out.append_unsigned(intern_string(records, value, (size_t)(value_end - value)));
+                p = copied = *value_end ? value_end + 1 : value_end;
+                continue;
+            }
+            p = *key_end ? key_end + 1 : key_end;
+            continue;
+        }
+        if (*p == '{' || *p == '[') ++depth;
+        else if (*p == '}' || *p == ']') --depth;
+        ++p;
+    }
+    out.append(copied, (size_t)(p - copied));
+}
+
+// encode_event() with interned strings. New strings' records are appended
+// to `out` first, each followed by ",\n", then the event itself.
+static void NO_INSTRUMENT encode_interned_event(JsonBuffer& out, unsigned long id, const char* type, void* addr,
+                                                const char* func_name, int depth, unsigned long ts,
+                                                const char* extra) {
+    JsonBuffer event;
+    event.append_literal("  {\"id\":");
+    event.append_unsigned(id);
+    event.append_literal(",\"type\":");
+    event.append_unsigned(intern_string(out, type, strlen(type)));
+    event.append_literal(",\"addr\":\"");
+    event.append_pointer(addr);
+    event.append_literal("\",\"func\":");
+    {
+        JsonBuffer func;
+        func.append_escaped(func_name ? func_name : "unknown");
+        event.append_unsigned(intern_string(out, func.c_str(), func.size()));
+    }
+    event.append_literal(",\"depth\":");
+    event.append_signed(depth);
+    event.append_literal(",\"ts\":");
+    event.append_unsigned(ts);
+    if (extra) {
+        event.append_literal(",");
+        append_interned_members(out, event, extra);
+    }
+    event.append_literal("}");
+    out.append(event.c_str(), event.size());
+}
+
 static const char* NO_INSTRUMENT demangle(const char* name) {
 #ifndef _WIN32
     if (!name) return "unknown";
@@ -298,7 +1036,105 @@ static std::string NO_INSTRUMENT json_safe_path(const char* raw) {
     if (!raw) return "";
     std::string s(raw);
     std::replace(s.begin(), s.end(), '\\', '/');
-    return s;
+    std::string escaped;
+    json_escape(escaped, s.data(), s.size());
+    return escaped;
+}
+
+// Hooks pass the user TU's __FILE__, a single string literal, so the
+// converted path is cached by pointer instead of being rebuilt (and heap
+// allocated, inside the user's heap trace) for every event.
+struct SafeFileEntry {
+    const char* raw;
+    const char* safe;
+};
+static SafeFileEntry g_safe_files[8];
+
+static const char* NO_INSTRUMENT json_safe_file(const char* raw) {
+    if (!raw) return "";
+    for (auto& e : g_safe_files) {
+        const char* cached = __atomic_load_n(&e.raw, __ATOMIC_ACQUIRE);
+        if (cached == raw) return e.safe;
+        if (!cached) {
+            const char* safe = strdup(json_safe_path(raw).c_str());
+            e.safe = safe;
+            __atomic_store_n(&e.raw, raw, __ATOMIC_RELEASE);
+            return safe;
+        }
+    }
+    // More distinct files than slots: convert into a per-thread string
+    static __thread std::string* buffer = nullptr;
+    if (!buffer) buffer = new std::string();
+    *buffer = json_safe_path(raw);
+    return buffer->c_str();
+}
+
+// ,"file":"...","line":N for a path from json_safe_file()
+static void NO_INSTRUMENT append_location(JsonBuffer& out, const char* safe_file, int line) {
+    out.append_literal(",\"file\":\"");
+    out.append(safe_file);
+    out.append_literal("\",\"line\":");
+    out.append_signed(line);
+}
+
+// The "value" member of a typed value (see trace.h), plus "vtype" for
+// anything but a signed integer. Floats keep their exact bit pattern in
+// "bits" and are decoded by the backend, so no float is formatted here.
+template <typename Out>
+static void NO_INSTRUMENT append_typed_value(Out& out, __trace_value v) {
+    switch (v.tag) {
+        case TRACE_T_I64:
+            append_literal(out, "\"value\":");
+            append_signed_decimal(out, (long long)v.bits);
+            break;
+        case TRACE_T_U64:
+            append_literal(out, "\"value\":");
+            append_decimal(out, v.bits);
+            append_literal(out, ",\"vtype\":\"u64\"");
+            break;
+        case TRACE_T_CHAR:
+            append_literal(out, "\"value\":");
+            append_signed_decimal(out, (long long)v.bits);
+            append_literal(out, ",\"vtype\":\"char\"");
+            break;
+        case TRACE_T_BOOL:
+            if (v.bits) append_literal(out, "\"value\":true,\"vtype\":\"bool\"");
+            else append_literal(out, "\"value\":false,\"vtype\":\"bool\"");
+            break;
+        case TRACE_T_PTR:
+            append_literal(out, "\"value\":\"0x");
+            append_hex_digits(out, v.bits, 0);
+            append_literal(out, "\",\"vtype\":\"ptr\"");
+            break;
+        case TRACE_T_F64:
+            append_literal(out, "\"bits\":\"");
+            append_hex_digits(out, v.bits, 16);
+            append_literal(out, "\",\"vtype\":\"f64\"");
+            break;
+        case TRACE_T_F32:
+            append_literal(out, "\"bits\":\"");
+            append_hex_digits(out, v.bits, 8);
+            append_literal(out, "\",\"vtype\":\"f32\"");
+            break;
+        default:
+            append_literal(out, "\"value\":null");
+    }
+}
+
+// Integer view of a typed value for the tracer's own bookkeeping
+static long long NO_INSTRUMENT typed_value_as_long(__trace_value v) {
+    if (v.tag == TRACE_T_F64) {
+        double d;
+        memcpy(&d, &v.bits, sizeof(d));
+        return (long long)d;
+    }
+    if (v.tag == TRACE_T_F32) {
+        float f;
+        const uint32_t b = (uint32_t)v.bits;
+        memcpy(&f, &b, sizeof(f));
+        return (long long)f;
+    }
+    return (long long)v.bits;
 }
 
 static std::string NO_INSTRUMENT normalize_function_name(const char* name) {
@@ -309,802 +1145,4667 @@ static std::string NO_INSTRUMENT normalize_function_name(const char* name) {
     return s;
 }
 
-static void NO_INSTRUMENT write_json_event(const char* type, void* addr,
-                 const char* func_name, int depth,
-                 const char* extra = nullptr);
-static void NO_INSTRUMENT write_json_event(const char* type, void* addr,
-                 const char* func_name, int depth,
-                 const char* extra) {
-    if (!g_trace_file || g_depth >= 2048) {
-        return;
-    }
+static inline void NO_INSTRUMENT semantic_hash_byte(unsigned char c) {
+    g_semantic_hash = (g_semantic_hash ^ c) * SEMANTIC_HASH_PRIME;
+}
 
-    {
-        TraceGuard guard;
+static void NO_INSTRUMENT semantic_hash_str(const char* s) {
+    if (!s) return;
+    while (*s) semantic_hash_byte((unsigned char)*s++);
+    semantic_hash_byte(0);
+}
 
-        if (g_event_counter > 0) fputs(",\n", g_trace_file);
+static inline bool NO_INSTRUMENT is_hex_digit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
 
-        fprintf(g_trace_file,
-            "  {\"id\":%lu,\"type\":\"%s\",\"addr\":\"%p\",\"func\":\"%s\",\"depth\":%d,\"ts\":%lu",
-            g_event_counter++, type, addr,
-            func_name ? func_name : "unknown",
-            depth, get_timestamp_us());
+// Hash the "extra" payload while skipping everything that legitimately differs
+// between two runs of the same program: pointer values ("0x..." / "(nil)")
+// and the per-session source path in "file".
+static void NO_INSTRUMENT semantic_hash_extra(const char* extra) {
+    static const char kFileKey[] = "\"file\":\"";
+    const size_t fileKeyLen = sizeof(kFileKey) - 1;
 
-        if (extra) fprintf(g_trace_file, ",%s", extra);
-        fputs("}", g_trace_file);
-        fflush(g_trace_file);
+    const char* p = extra;
+    while (p && *p) {
+        if (*p == '"' && strncmp(p, kFileKey, fileKeyLen) == 0) {
+            p += fileKeyLen;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) ++p;
+                ++p;
+            }
+            continue;
+        }
+        if (p[0] == '0' && p[1] == 'x') {
+            p += 2;
+            while (is_hex_digit(*p)) ++p;
+            continue;
+        }
+        if (strncmp(p, "(nil)", 5) == 0) {
+            p += 5;
+            continue;
+        }
+        semantic_hash_byte((unsigned char)*p++);
     }
+    semantic_hash_byte(0);
 }
 
-static PointerInfo* NO_INSTRUMENT findPointerInfo(const std::string& ptrName) {
-    for (auto it = get_call_stack().rbegin(); it != get_call_stack().rend(); ++it) {
-        auto pit = it->pointerAliases.find(ptrName);
-        if (pit != it->pointerAliases.end()) {
-            return &(pit->second);
-        }
-    }
-    
-    auto git = get_pointer_registry().find(ptrName);
-    if (git != get_pointer_registry().end()) {
-        return &(git->second);
+// Called with the trace mutex held, after g_event_counter has been advanced.
+static void NO_INSTRUMENT semantic_hash_event(const char* type, const char* func_name,
+                                              int depth, const char* extra) {
+    semantic_hash_str(type);
+    semantic_hash_str(func_name ? func_name : "unknown");
+    semantic_hash_byte((unsigned char)(depth & 0xFF));
+    semantic_hash_byte((unsigned char)((depth >> 8) & 0xFF));
+    if (extra) semantic_hash_extra(extra);
+
+    if (g_checkpoint_interval > 0 && g_event_counter % g_checkpoint_interval == 0) {
+        HashCheckpoint cp;
+        cp.event = g_event_counter;
+        cp.hash = g_semantic_hash;
+        cp.depth = depth;
+        get_hash_checkpoints().push_back(cp);
     }
-    
-    return nullptr;
 }
 
-extern "C" void __trace_output_flush_loc(const char* file, int line) __attribute__((no_instrument_function));
-extern "C" void __trace_output_flush_loc(const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    {
-        TraceGuard guard;
-        fflush(stdout);
-        fflush(stderr);
-        if (g_trace_file) fflush(g_trace_file);
+// Skeleton events are the control-flow/call subset kept by TRACE_MODE=skeleton.
+// The first character picks the candidates; data events that share it
+// (container, frame_snapshot) are told apart by the full name.
+static inline bool NO_INSTRUMENT is_skeleton_event(const char* type) {
+    switch (type[0]) {
+        case 'l':   // loop_*
+        case 'b':   // branch_taken, block_enter, block_exit
+        case 'r':   // return
+            return true;
+        case 'c':
+            return strcmp(type, "condition_eval") == 0 || strcmp(type, "control_flow") == 0;
+        case 'f':
+            return strcmp(type, "func_enter") == 0 || strcmp(type, "func_exit") == 0;
+        default:
+            return false;
     }
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
-                                           const char* file, int line) __attribute__((no_instrument_function));
-extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
-                                           const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"conditionId\":%d,\"expression\":\"%s\",\"result\":%d,\"file\":\"%s\",\"line\":%d",
-             conditionId, expression, result, f.c_str(), line);
-    write_json_event("condition_eval", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
-}
+// ========== TRACE WINDOW TRIGGERS ==========
+// Triggers only run on state changes (or, for calls, in the call hooks that
+// already do bookkeeping), so a closed window costs the data and control
+// hooks nothing beyond TRACE_GATE.
 
-extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
-                                         const char* file, int line) __attribute__((no_instrument_function));
-extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
-                                         const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"conditionId\":%d,\"branchType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             conditionId, branchType, f.c_str(), line);
-    write_json_event("branch_taken", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+#if defined(TRACE_XRAY)
+static void NO_INSTRUMENT xray_sync_patching();
+#endif
+
+// Only stores the gate word, so the toggle signals can call it
+static void NO_INSTRUMENT store_gate() {
+    unsigned int gate = 0;
+    if (g_main_started && g_window_open && g_in_depth_range && !g_window_stopped) {
+        gate = g_category_mask & (g_record_detail ? TRACE_CAT_ALL : TRACE_CAT_SKELETON);
+    }
+    if (g_start_line > 0) gate |= TRACE_GATE_LINE;
+    __trace_gate[0] = gate;
 }
 
-extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
-                                         void* address, int dim1, int dim2, int dim3,
-                                         bool isStack, const char* file, int line) __attribute__((no_instrument_function));
-extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
-                                         void* address, int dim1, int dim2, int dim3,
-                                         bool isStack, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    get_address_to_name()[address] = name;
+static void NO_INSTRUMENT refresh_gate() {
+    store_gate();
+#if defined(TRACE_XRAY)
+    xray_sync_patching();
+#endif
+}
 
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    
-    char dims[64];
-    if (dim3 > 0) {
-        snprintf(dims, sizeof(dims), "[%d,%d,%d]", dim1, dim2, dim3);
-    } else if (dim2 > 0) {
-        snprintf(dims, sizeof(dims), "[%d,%d]", dim1, dim2);
-    } else {
-        snprintf(dims, sizeof(dims), "[%d]", dim1);
+static void NO_INSTRUMENT check_line_trigger(int line) {
+    if (g_start_line > 0 && line != g_start_line) return;
+    if (g_start_line > 0) {
+        g_start_line = 0;
+        g_window_open = true;
     }
-    
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"baseType\":\"%s\",\"dimensions\":%s,\"isStack\":%s,\"file\":\"%s\",\"line\":%d",
-             name, baseType, dims, isStack ? "true" : "false", f.c_str(), line);
-    
-    write_json_event("array_create", address, get_current_function().c_str(), g_depth, extra);
-    
-    ArrayInfo info;
-    info.name = name;
-    info.baseType = baseType;
-    info.address = address;
-    info.dim1 = dim1;
-    info.dim2 = dim2;
-    info.dim3 = dim3;
-    info.isStack = isStack;
-    
-    get_array_registry()[address] = info;
-    TRACER_GUARD_EXIT();
+    refresh_gate();
+}
+
+static bool NO_INSTRUMENT is_start_function(void* func) {
+    if (g_start_func) return func == g_start_func;
+#ifndef _WIN32
+    Dl_info dlinfo{};
+    if (!dladdr(func, &dlinfo)) return false;
+    if (g_start_func_offset) {
+        // Offset from the module base (PIE) or absolute address (non-PIE)
+        const unsigned long addr = (unsigned long)func;
+        return addr - (unsigned long)dlinfo.dli_fbase == g_start_func_offset ||
+               addr == g_start_func_offset;
+    }
+    if (!dlinfo.dli_sname) return false;
+    const char* name = demangle(dlinfo.dli_sname);
+    const size_t n = strlen(g_start_func_name);
+    return strncmp(name, g_start_func_name, n) == 0 && (name[n] == '\0' || name[n] == '(');
+#else
+    return false;
+#endif
+}
+
+// Called by the call hooks after g_depth has been updated.
+static void NO_INSTRUMENT update_call_triggers(void* func, bool entering) {
+    bool changed = false;
+    if (entering && g_start_func_armed && is_start_function(func)) {
+        g_start_func_armed = false;
+        g_window_open = true;
+        changed = true;
+    }
+    if (g_depth_min > 0 || g_depth_max > 0) {
+        const bool inside = g_depth >= g_depth_min && (g_depth_max == 0 || g_depth <= g_depth_max);
+        if (inside != g_in_depth_range) {
+            g_in_depth_range = inside;
+            changed = true;
+        }
+    }
+    if (changed) refresh_gate();
+}
+
+static void NO_INSTRUMENT start_main() {
+    g_main_started = true;
+    refresh_gate();
+}
+
+// Library code by its qualified name: the name starts after the return type
+// (template specializations carry one) and ends at the parameter list.
+static bool NO_INSTRUMENT is_library_function(const char* name) {
+    const char* start = name;
+    int angle = 0;
+    for (const char* p = name; *p; ++p) {
+        if (angle == 0 && strncmp(p, "operator", 8) == 0) {
+            // Operator symbols such as "<<" or "->" are not brackets; a
+            // template argument list follows as "operator< <...>".
+            const char* op = p + 8;
+            // Global operator new/delete (placement forms come from <new>).
+            if (p == start && (strncmp(op, " new", 4) == 0 || strncmp(op, " delete", 7) == 0))
+                return true;
+            const char* q = op;
+            while (*q && strchr("<>=!+-*/%^&|~[]", *q)) {
+                if (*q == '<' && q > op && q[-1] != '<') break;
+                if (*q == '>' && q > op && !strchr(">-=", q[-1])) break;
+                ++q;
+            }
+            if (*q == ' ' && q[1] == '<') ++q;
+            p = q;
+            if (!*p) break;
+        }
+        if (*p == '<') ++angle;
+        else if (*p == '>' && angle > 0) --angle;
+        else if (angle == 0 && *p == ' ') start = p + 1;
+        else if (angle == 0 && *p == '(') break;
+    }
+    return strncmp(start, "std::", 5) == 0 || strncmp(start, "__gnu_cxx::", 11) == 0 ||
+           strncmp(start, "__cxxabiv1::", 12) == 0 || strncmp(start, "__gnu_debug::", 13) == 0;
+}
+
+static inline bool NO_INSTRUMENT in_user_text(void* pc) {
+    if (g_user_text_hi == 0) return true;  // unknown layout: keep everything
+    const unsigned long a = (unsigned long)pc;
+    return a >= g_user_text_lo && a < g_user_text_hi;
+}
+
+// Pre-main traffic and blocks handled by library code (callers outside the
+// executable: stdio buffers, locale and iostream setup) are counted instead
+// of recorded.
+static inline bool NO_INSTRUMENT heap_event_filtered(void* caller) {
+    if (!g_main_started) {
+        ++g_filtered.pre_main_heap;
+        return true;
+    }
+    if (!(__TRACE_GATE_WORD() & TRACE_CAT_HEAP)) return true;
+    if (g_filter_library && !in_user_text(caller)) {
+        ++g_filtered.library_heap;
+        return true;
+    }
+    return false;
+}
+
+#if defined(__linux__)
+// The first object dl_iterate_phdr reports is the main program.
+static int NO_INSTRUMENT find_user_text(struct dl_phdr_info* info, size_t, void*) {
+    g_user_load_base = (unsigned long)info->dlpi_addr;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+        if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_X)) continue;
+        const unsigned long lo = (unsigned long)(info->dlpi_addr + ph.p_vaddr);
+        const unsigned long hi = lo + (unsigned long)ph.p_memsz;
+        if (g_user_text_hi == 0 || lo < g_user_text_lo) g_user_text_lo = lo;
+        if (hi > g_user_text_hi) g_user_text_hi = hi;
+    }
+    return 1;
+}
+#endif
+
+#ifndef _WIN32
+// Patching XRay sleds is not async-signal-safe, and is not needed here:
+// the sleds stay patched until the window stops, which these never do.
+static void NO_INSTRUMENT toggle_signal_handler(int sig) {
+    g_window_open = (sig == SIGUSR1);
+    store_gate();
+}
+#endif
+
+// "calls,control" selects; "all,-heap" or "-heap" removes from everything.
+static unsigned int NO_INSTRUMENT parse_event_categories(const char* spec) {
+    static const struct { const char* name; unsigned int bits; } kCategories[] = {
+        { "all", TRACE_CAT_ALL }, { "calls", TRACE_CAT_CALLS }, { "control", TRACE_CAT_CONTROL },
+        { "vars", TRACE_CAT_VARS }, { "arrays", TRACE_CAT_ARRAYS },
+        { "pointers", TRACE_CAT_POINTERS }, { "heap", TRACE_CAT_HEAP }, { "io", TRACE_CAT_IO },
+        { "skeleton", TRACE_CAT_SKELETON }
+    };
+    unsigned int mask = (spec[0] == '-') ? TRACE_CAT_ALL : 0;
+    char token[32];
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+        const bool remove = (*spec == '-');
+        const char* name = remove ? spec + 1 : spec;
+        const size_t name_len = remove ? len - 1 : len;
+        if (name_len < sizeof(token)) {
+            memcpy(token, name, name_len);
+            token[name_len] = '\0';
+            for (const auto& c : kCategories) {
+                if (strcmp(token, c.name) != 0) continue;
+                mask = remove ? (mask & ~c.bits) : (mask | c.bits);
+            }
+        }
+        spec += len;
+        if (*spec == ',') ++spec;
+    }
+    return mask;
+}
+
+static void NO_INSTRUMENT init_trace_window() {
+    const char* events = std::getenv("TRACE_EVENTS");
+    if (events && *events) g_category_mask = parse_event_categories(events);
+
+    const char* max_events = std::getenv("TRACE_MAX_EVENTS");
+    if (max_events) g_max_events = std::strtoul(max_events, nullptr, 10);
+
+    const char* depth_min = std::getenv("TRACE_DEPTH_MIN");
+    const char* depth_max = std::getenv("TRACE_DEPTH_MAX");
+    if (depth_min) g_depth_min = atoi(depth_min);
+    if (depth_max) g_depth_max = atoi(depth_max);
+    g_in_depth_range = g_depth_min <= 0;   // nothing runs at depth 0
+
+    const char* start_line = std::getenv("TRACE_START_LINE");
+    if (start_line && atoi(start_line) > 0) {
+        g_start_line = atoi(start_line);
+        g_window_open = false;
+    }
+
+    const char* start_func = std::getenv("TRACE_START_FUNC");
+    if (start_func && *start_func) {
+        g_start_func_armed = true;
+        g_window_open = false;
+        if (strncmp(start_func, "0x", 2) == 0) {
+            g_start_func_offset = std::strtoul(start_func, nullptr, 16);
+        } else {
+#ifndef _WIN32
+            g_start_func = dlsym(RTLD_DEFAULT, start_func);
+#endif
+            snprintf(g_start_func_name, sizeof(g_start_func_name), "%s", start_func);
+        }
+    }
+
+    const char* paused = std::getenv("TRACE_START_PAUSED");
+    if (paused && strcmp(paused, "1") == 0) g_window_open = false;
+
+    refresh_gate();
+
+#ifndef _WIN32
+    const char* signals = std::getenv("TRACE_TOGGLE_SIGNALS");
+    if (signals && strcmp(signals, "1") == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = toggle_signal_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, nullptr);
+        sigaction(SIGUSR2, &sa, nullptr);
+    }
+
+    // An existing file keeps the value already in it, so a controller can
+    // create it with 0 to start paused.
+    const char* toggle_file = std::getenv("TRACE_TOGGLE_FILE");
+    if (toggle_file && *toggle_file) {
+        const int fd = open(toggle_file, O_RDWR | O_CREAT, 0600);
+        if (fd >= 0) {
+            struct stat st;
+            const unsigned int toggle = __trace_toggle[0];
+            if (fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(unsigned int)) {
+                if (pwrite(fd, &toggle, sizeof(toggle), 0) != (ssize_t)sizeof(toggle)) { /* best-effort */ }
+            }
+            if (ftruncate(fd, sizeof(__trace_toggle)) == 0) {
+                mmap((void*)__trace_toggle, sizeof(__trace_toggle), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED, fd, 0);
+            }
+            close(fd);
+        }
+    }
+#endif
+}
+
+// ========== FLIGHT RECORDER OUTPUT ==========
+
+static void NO_INSTRUMENT flight_record(const char* type, void* addr,
+                                        const char* func_name, int depth,
+                                        const char* extra) {
+    const unsigned long id = g_event_counter++;
+    FlightSlot& slot = g_flight_slots[id % g_flight_capacity];
+    slot.length = 0;
+    JsonBuffer event;
+    encode_event(event, id, type, addr, func_name, depth, get_timestamp_us(), extra);
+    int n = (int)event.size();
+    if (event.size() < sizeof(slot.data)) {
+        memcpy(slot.data, event.c_str(), event.size() + 1);
+    } else {
+        // Keep the slot valid JSON rather than storing a cut-off object
+        n = snprintf(slot.data, sizeof(slot.data),
+            "  {\"id\":%lu,\"type\":\"%s\",\"addr\":\"%p\",\"func\":\"unknown\",\"depth\":%d,\"ts\":%lu,\"truncated\":true}",
+            id, type, addr, depth, get_timestamp_us());
+    }
+    slot.length = (unsigned int)n;
+}
+
+#ifndef _WIN32
+// Async-signal-safe output: write(2) and hand-rolled number formatting only.
+static void NO_INSTRUMENT sig_write(int fd, const char* s, size_t n) {
+    while (n > 0) {
+        const ssize_t w = write(fd, s, n);
+        if (w <= 0) return;
+        s += w;
+        n -= (size_t)w;
+    }
+}
+
+static void NO_INSTRUMENT sig_write_str(int fd, const char* s) {
+    sig_write(fd, s, strlen(s));
+}
+
+static void NO_INSTRUMENT sig_write_ulong(int fd, unsigned long v) {
+    char buf[24];
+    int i = sizeof(buf);
+    do { buf[--i] = (char)('0' + v % 10); v /= 10; } while (v);
+    sig_write(fd, buf + i, sizeof(buf) - i);
+}
+
+static void NO_INSTRUMENT sig_write_ptr(int fd, const void* p) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned long v = (unsigned long)p;
+    char buf[20];
+    int i = sizeof(buf);
+    do { buf[--i] = hex[v & 0xf]; v >>= 4; } while (v);
+    buf[--i] = 'x';
+    buf[--i] = '0';
+    sig_write(fd, buf + i, sizeof(buf) - i);
+}
+
+// Oldest to newest; slots caught mid-write are skipped.
+static void NO_INSTRUMENT flight_write_events(int fd) {
+    const unsigned long total = g_event_counter;
+    const unsigned long first = total > g_flight_capacity ? total - g_flight_capacity : 0;
+    bool any = false;
+    for (unsigned long id = first; id < total; ++id) {
+        const FlightSlot& slot = g_flight_slots[id % g_flight_capacity];
+        const unsigned int len = slot.length;
+        if (len == 0 || len >= sizeof(slot.data)) continue;
+        if (any) sig_write(fd, ",\n", 2);
+        sig_write(fd, slot.data, len);
+        any = true;
+    }
+}
+
+static void NO_INSTRUMENT flight_write_summary(int fd, const char* reason) {
+    const unsigned long total = g_event_counter;
+    sig_write_str(fd, ",\"flight_recorder\":{\"capacity\":");
+    sig_write_ulong(fd, g_flight_capacity);
+    sig_write_str(fd, ",\"dropped\":");
+    sig_write_ulong(fd, total > g_flight_capacity ? total - g_flight_capacity : 0);
+    sig_write_str(fd, ",\"reason\":\"");
+    sig_write_str(fd, reason);
+    sig_write_str(fd, "\"},\"shadow_stack\":[");
+    const int depth = g_depth < 2048 ? g_depth : 2047;
+    for (int d = 1; d <= depth; ++d) {
+        if (d > 1) sig_write(fd, ",", 1);
+        sig_write_str(fd, "{\"depth\":");
+        sig_write_ulong(fd, (unsigned long)d);
+        sig_write_str(fd, ",\"func\":\"");
+        sig_write_ptr(fd, g_shadow_stack[d].func);
+        sig_write_str(fd, "\",\"caller\":\"");
+        sig_write_ptr(fd, g_shadow_stack[d].caller);
+        sig_write_str(fd, "\",\"enter_event\":");
+        sig_write_ulong(fd, g_shadow_stack[d].event);
+        sig_write_str(fd, "}");
+    }
+    sig_write_str(fd, "]");
+}
+
+static const char* NO_INSTRUMENT flight_signal_name(int sig) {
+    switch (sig) {
+        case SIGSEGV: return "SIGSEGV";
+        case SIGABRT: return "SIGABRT";
+        case SIGFPE:  return "SIGFPE";
+        case SIGBUS:  return "SIGBUS";
+        case SIGALRM: return "timeout";
+        case SIGTERM: return "SIGTERM";
+        default:      return "signal";
+    }
+}
+
+static void NO_INSTRUMENT flight_signal_handler(int sig) {
+    if (g_flight_dumped++ == 0 && g_flight_fd >= 0) {
+        g_tracer_disabled = true;
+        flight_write_events(g_flight_fd);
+        sig_write_str(g_flight_fd, "\n],\"total_events\":");
+        sig_write_ulong(g_flight_fd, g_event_counter);
+        flight_write_summary(g_flight_fd, flight_signal_name(sig));
+        sig_write_str(g_flight_fd, "}\n");
+    }
+    // Let the original disposition report the crash or timeout
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void NO_INSTRUMENT init_flight_recorder(unsigned long capacity) {
+    g_flight_slots = (FlightSlot*)std::calloc(capacity, sizeof(FlightSlot));
+    if (!g_flight_slots) return;
+    g_flight_capacity = capacity;
+    g_flight_fd = fileno(g_trace_file);
+
+    // Stack overflows are a common crash; the handler needs its own stack
+    static char s_alt_stack[64 * 1024];
+    stack_t ss;
+    ss.ss_sp = s_alt_stack;
+    ss.ss_size = sizeof(s_alt_stack);
+    ss.ss_flags = 0;
+    sigaltstack(&ss, nullptr);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = flight_signal_handler;
+    sa.sa_flags = SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    const int signals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGBUS, SIGTERM };
+    for (int sig : signals) sigaction(sig, &sa, nullptr);
+
+    // SIGALRM is only ours when the tracer armed the alarm; a program's own
+    // alarm() keeps whatever handler it installs
+    const char* timeout = std::getenv("TRACE_FLIGHT_TIMEOUT");
+    if (timeout && atoi(timeout) > 0) {
+        sigaction(SIGALRM, &sa, nullptr);
+        alarm((unsigned int)atoi(timeout));
+    }
+}
+#endif
+
+static void NO_INSTRUMENT finish_window();
+static void NO_INSTRUMENT maybe_fork_checkpoint();
+#if defined(TRACER_CAPTURE_IO)
+static void NO_INSTRUMENT capture_program_io();
+#endif
+
+#if defined(TRACER_COMPRESS)
+struct ColumnOutput;
+static ColumnOutput* g_columns = nullptr;
+static void NO_INSTRUMENT columns_record(unsigned long id, const char* type, void* addr, const char* func_name,
+                                         int depth, unsigned long ts, const char* extra);
+#endif
+
+// One encoded event, with the ",\n" that separates it from the one before
+static void NO_INSTRUMENT emit_event(JsonBuffer& out, unsigned long id, const char* type, void* addr,
+                                     const char* func_name, int depth, unsigned long ts, const char* extra) {
+    if (id > 0) out.append_literal(",\n");
+    if (g_intern) encode_interned_event(out, id, type, addr, func_name, depth, ts, extra);
+    else encode_event(out, id, type, addr, func_name, depth, ts, extra);
+}
+
+// An event kept back from the file for a while
+struct PendingEvent {
+    const char* type;
+    void* addr;
+    std::string func;
+    int depth;
+    unsigned long id;
+    unsigned long ts;
+    bool has_extra;
+    std::string extra;
+};
+
+static void NO_INSTRUMENT write_output(const JsonBuffer& out) {
+    if (out.size() == 0) return;
+    fwrite(out.c_str(), 1, out.size(), g_trace_file);
+    fflush(g_trace_file);
+}
+
+// ========== LOOP ITERATION TEMPLATES ==========
+// TRACE_TEMPLATES=1 writes loop iterations that repeat the shape of an
+// earlier one as a template instance. An iteration is the run of events
+// from a loop_body_start up to the next loop_body_start or loop_end (at
+// most ITERATION_LIMIT events). Its shape is the events' text without ids
+// and timestamps, each number outside a string replaced by '#'. When two
+// iterations in a row have the same shape, the numbers that differ between
+// them become the template's holes:
+//   {"template":T,"text":"[{\"type\":\"loop_body_start\",...,\"iteration\":#},...]"}
+// and from then on each iteration of that shape whose other numbers match
+// is written as
+//   {"tpl":T,"id":<first id>,"ts":<first ts>,"v":[<holes>],"dt":[<ts - first ts per event>]}
+// Ids inside go up by one per event, or by "events" after a call_ref. The
+// backend expands instances when it reads the trace
+// (trace-templates.service.js). A run killed by a signal loses the
+// iteration being collected.
+
+static bool g_templates = false;
+static unsigned long g_template_count = 0;     // definitions written
+static unsigned long g_template_instances = 0;
+
+static const size_t ITERATION_LIMIT = 64;
+static const size_t TEMPLATE_TABLE_LIMIT = 4096;
+
+struct LoopTemplate {
+    unsigned long id;
+    std::vector<std::string> numbers;  // of the iteration it was made from
+    std::vector<bool> holes;
+};
+
+struct IterationShape {
+    std::string shape;
+    std::vector<std::string> numbers;
+    bool valid = false;
+};
+
+static bool g_iteration_open = false;
+
+static std::vector<PendingEvent>& get_iteration_events() {
+    static auto* s_events = new std::vector<PendingEvent>();
+    return *s_events;
+}
+static IterationShape& get_previous_iteration() {
+    static auto* s_previous = new IterationShape();
+    return *s_previous;
+}
+static std::unordered_map<std::string, LoopTemplate>& get_loop_templates() {
+    static auto* s_templates = new std::unordered_map<std::string, LoopTemplate>();
+    return *s_templates;
+}
+
+// Appends `text` to `shape` with every number outside a string replaced by
+// '#', collecting the numbers
+static void NO_INSTRUMENT split_numbers(const char* text, size_t n, std::string& shape,
+                                        std::vector<std::string>& numbers) {
+    bool in_string = false;
+    size_t i = 0;
+    while (i < n) {
+        const char c = text[i];
+        if (in_string) {
+            shape += c;
+            if (c == '\\' && i + 1 < n) shape += text[++i];
+            else if (c == '"') in_string = false;
+            ++i;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            const size_t start = i++;
+            while (i < n && (strchr("0123456789.eE+-", text[i]) != nullptr)) ++i;
+            numbers.emplace_back(text + start, i - start);
+            shape += '#';
+        } else {
+            if (c == '"') in_string = true;
+            shape += c;
+            ++i;
+        }
+    }
+}
+
+static void NO_INSTRUMENT close_iteration(JsonBuffer& out) {
+    auto& events = get_iteration_events();
+    g_iteration_open = false;
+    if (events.empty()) return;
+
+    IterationShape current;
+    current.valid = true;
+    current.shape = "[";
+    for (size_t i = 0; i < events.size(); ++i) {
+        const PendingEvent& e = events[i];
+        JsonBuffer text;
+        text.format("%s{\"type\":\"%s\",\"addr\":\"%p\",\"func\":\"%j\",\"depth\":%d",
+                    i > 0 ? "," : "", e.type, e.addr, e.func.c_str(), e.depth);
+        if (e.has_extra) text.format(",%s", e.extra.c_str());
+        text.append_literal("}");
+        split_numbers(text.c_str(), text.size(), current.shape, current.numbers);
+    }
+    current.shape += "]";
+
+    auto& templates = get_loop_templates();
+    IterationShape& previous = get_previous_iteration();
+    auto it = templates.find(current.shape);
+    bool matches = it != templates.end();
+    for (size_t i = 0; matches && i < current.numbers.size(); ++i) {
+        if (!it->second.holes[i] && it->second.numbers[i] != current.numbers[i]) matches = false;
+    }
+
+    if (!matches && previous.valid && previous.shape == current.shape &&
+        (it != templates.end() || templates.size() < TEMPLATE_TABLE_LIMIT)) {
+        // The previous iteration went out in full; this one defines a template
+        LoopTemplate made;
+        made.id = g_template_count++;
+        made.numbers = current.numbers;
+        made.holes.resize(current.numbers.size());
+        for (size_t i = 0; i < current.numbers.size(); ++i) {
+            made.holes[i] = previous.numbers[i] != current.numbers[i];
+        }
+
+        std::string text;
+        size_t number = 0;
+        for (char c : current.shape) {
+            if (c != '#') { text += c; continue; }
+            text += made.holes[number] ? "#" : made.numbers[number];
+            ++number;
+        }
+        out.append_literal(",\n{\"template\":");
+        out.append_unsigned(made.id);
+        out.append_literal(",\"text\":\"");
+        out.append_escaped(text.c_str());
+        out.append_literal("\"}");
+
+        templates[current.shape] = std::move(made);
+        it = templates.find(current.shape);
+        matches = true;
+    }
+
+    if (matches) {
+        const unsigned long first_ts = events.front().ts;
+        out.append_literal(",\n{\"tpl\":");
+        out.append_unsigned(it->second.id);
+        out.append_literal(",\"id\":");
+        out.append_unsigned(events.front().id);
+        out.append_literal(",\"ts\":");
+        out.append_unsigned(first_ts);
+        out.append_literal(",\"v\":[");
+        bool first = true;
+        for (size_t i = 0; i < current.numbers.size(); ++i) {
+            if (!it->second.holes[i]) continue;
+            if (!first) out.append_literal(",");
+            out.append(current.numbers[i].c_str(), current.numbers[i].size());
+            first = false;
+        }
+        out.append_literal("],\"dt\":[");
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (i > 0) out.append_literal(",");
+            out.append_unsigned(events[i].ts - first_ts);
+        }
+        out.append_literal("]}");
+        ++g_template_instances;
+        previous.valid = false;
+    } else {
+        for (const auto& e : events) {
+            emit_event(out, e.id, e.type, e.addr, e.func.c_str(), e.depth, e.ts,
+                       e.has_extra ? e.extra.c_str() : nullptr);
+        }
+        previous = std::move(current);
+    }
+    events.clear();
+}
+
+// Where events leave for the file: encoded into `out`, or collected into
+// the current loop iteration
+static void NO_INSTRUMENT output_event(JsonBuffer& out, unsigned long id, const char* type, void* addr,
+                                       const char* func_name, int depth, unsigned long ts, const char* extra) {
+    if (g_templates) {
+        auto& events = get_iteration_events();
+        const bool body_start = strcmp(type, "loop_body_start") == 0;
+        if (g_iteration_open &&
+            (body_start || strcmp(type, "loop_end") == 0 || depth < events.front().depth)) {
+            close_iteration(out);
+        }
+        if (body_start) g_iteration_open = true;
+        if (g_iteration_open) {
+            events.push_back(PendingEvent{type, addr, func_name ? func_name : "unknown", depth, id, ts,
+                                          extra != nullptr, extra ? extra : ""});
+            if (events.size() >= ITERATION_LIMIT) close_iteration(out);
+            return;
+        }
+    }
+    emit_event(out, id, type, addr, func_name, depth, ts, extra);
+}
+
+// ========== REPEATED CALL SUBTREES ==========
+// TRACE_SUBTREES=1 writes a call whose whole subtree (every event from its
+// func_enter to its func_exit) repeats one written earlier as a single
+//   {"type":"call_ref",...,"ref":<id of the first copy's func_enter>,"events":N,"exitTs":T}
+// that stands in for all N events, T being when this call returned. Ids keep counting through the events it
+// replaces, so they stay those of the full trace. The backend expands
+// references again when it reads the trace (trace-subtrees.service.js).
+//
+// Each open call keeps a hash of its events in order, with a finished
+// callee's hash folded in as one value, so the hash is the same whether the
+// callee itself went out in full or as a reference. Events of open calls
+// are held in memory until the outermost one returns, or until too many
+// are waiting; those calls are then written in full. A run killed by a
+// signal loses the events still held.
+
+static bool g_subtrees = false;
+static unsigned long g_subtree_refs = 0;     // references written
+static unsigned long g_subtree_dropped = 0;  // events the trace file is shorter by
+
+static const size_t SUBTREE_PENDING_LIMIT = 4096;
+static const size_t SUBTREE_TABLE_LIMIT = 1u << 20;
+static const unsigned long SUBTREE_MIN_EVENTS = 4;  // a reference saves nothing on a bare call
+static const size_t SUBTREE_WRITTEN = (size_t)-1;
+
+struct SubtreeHash {
+    unsigned long long a, b;
+    bool operator==(const SubtreeHash& other) const { return a == other.a && b == other.b; }
+};
+
+struct SubtreeHashHasher {
+    size_t operator()(const SubtreeHash& h) const { return (size_t)(h.a ^ (h.b >> 1)); }
+};
+
+struct SubtreeFrame {
+    int depth;
+    size_t pending;           // index of its func_enter among the held events, or SUBTREE_WRITTEN
+    unsigned long first_id;
+    SubtreeHash hash;
+};
+
+struct SubtreeCopy {
+    unsigned long first_id;
+    unsigned long events;
+};
+
+static std::vector<SubtreeFrame>& get_subtree_frames() {
+    static auto* s_frames = new std::vector<SubtreeFrame>();
+    return *s_frames;
+}
+static std::vector<PendingEvent>& get_pending_events() {
+    static auto* s_pending = new std::vector<PendingEvent>();
+    return *s_pending;
+}
+static std::unordered_map<SubtreeHash, SubtreeCopy, SubtreeHashHasher>& get_subtree_copies() {
+    static auto* s_copies = new std::unordered_map<SubtreeHash, SubtreeCopy, SubtreeHashHasher>();
+    return *s_copies;
+}
+
+// FNV-1a and a multiply-xorshift lane side by side, 128 bits in all
+static void NO_INSTRUMENT subtree_hash_bytes(SubtreeHash& h, const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < n; ++i) {
+        h.a = (h.a ^ p[i]) * SEMANTIC_HASH_PRIME;
+        h.b = (h.b + p[i] + 1) * 0x9e3779b97f4a7c15ULL;
+        h.b ^= h.b >> 29;
+    }
+}
+
+static void NO_INSTRUMENT subtree_hash_text(SubtreeHash& h, const char* s) {
+    subtree_hash_bytes(h, s, strlen(s) + 1);
+}
+
+static void NO_INSTRUMENT flush_pending_events() {
+    auto& pending = get_pending_events();
+    if (pending.empty()) return;
+    JsonBuffer out;
+    for (const auto& e : pending) {
+        if (e.type[0] == 'c' && strcmp(e.type, "call_ref") == 0) ++g_subtree_refs;
+        output_event(out, e.id, e.type, e.addr, e.func.c_str(), e.depth, e.ts,
+                     e.has_extra ? e.extra.c_str() : nullptr);
+    }
+    write_output(out);
+    pending.clear();
+}
+
+// The innermost open call returned with event `exit_id`
+static void NO_INSTRUMENT finish_subtree(unsigned long exit_id) {
+    auto& frames = get_subtree_frames();
+    const SubtreeFrame frame = frames.back();
+    frames.pop_back();
+    if (!frames.empty()) subtree_hash_bytes(frames.back().hash, &frame.hash, sizeof(frame.hash));
+
+    const unsigned long events = exit_id - frame.first_id + 1;
+    auto& copies = get_subtree_copies();
+    auto it = copies.find(frame.hash);
+    if (it == copies.end()) {
+        if (copies.size() < SUBTREE_TABLE_LIMIT) copies.emplace(frame.hash, SubtreeCopy{frame.first_id, events});
+        return;
+    }
+    if (frame.pending == SUBTREE_WRITTEN || events < SUBTREE_MIN_EVENTS || it->second.events != events) return;
+
+    // The func_enter becomes the reference; the rest of the call is dropped
+    auto& pending = get_pending_events();
+    PendingEvent& ref = pending[frame.pending];
+    JsonBuffer extra;
+    extra.format("\"ref\":%lu,\"events\":%lu,\"exitTs\":%lu", it->second.first_id, events, pending.back().ts);
+    ref.type = "call_ref";
+    ref.has_extra = true;
+    ref.extra.assign(extra.c_str(), extra.size());
+    g_subtree_dropped += pending.size() - frame.pending - 1;
+    pending.erase(pending.begin() + (std::ptrdiff_t)frame.pending + 1, pending.end());
+}
+
+// Takes an event in place of writing it
+static void NO_INSTRUMENT subtree_capture(unsigned long id, const char* type, void* addr, const char* func_name,
+                                          int depth, unsigned long ts, const char* extra) {
+    auto& frames = get_subtree_frames();
+    auto& pending = get_pending_events();
+    if (strcmp(type, "func_enter") == 0) {
+        frames.push_back(SubtreeFrame{depth, pending.size(), id, SubtreeHash{SEMANTIC_HASH_SEED, 0}});
+    }
+    if (!func_name) func_name = "unknown";
+
+    // Outside every call there is nothing to hold back
+    if (frames.empty()) {
+        JsonBuffer event;
+        output_event(event, id, type, addr, func_name, depth, ts, extra);
+        write_output(event);
+        return;
+    }
+
+    SubtreeHash& hash = frames.back().hash;
+    subtree_hash_text(hash, type);
+    subtree_hash_bytes(hash, &addr, sizeof(addr));
+    subtree_hash_text(hash, func_name);
+    subtree_hash_bytes(hash, &depth, sizeof(depth));
+    subtree_hash_bytes(hash, extra ? "+" : "-", 1);
+    if (extra) subtree_hash_text(hash, extra);
+    pending.push_back(PendingEvent{type, addr, func_name, depth, id, ts, extra != nullptr, extra ? extra : ""});
+
+    if (strcmp(type, "func_exit") == 0) {
+        // Calls left by longjmp never return; they still count towards the
+        // hash of the call that does
+        while (frames.size() > 1 && frames.back().depth > depth) {
+            const SubtreeHash left = frames.back().hash;
+            frames.pop_back();
+            subtree_hash_bytes(frames.back().hash, &left, sizeof(left));
+        }
+        if (frames.back().depth == depth) finish_subtree(id);
+    }
+
+    if (frames.empty()) {
+        flush_pending_events();
+    } else if (pending.size() >= SUBTREE_PENDING_LIMIT) {
+        flush_pending_events();
+        for (auto& frame : frames) frame.pending = SUBTREE_WRITTEN;
+    }
+}
+
+static void NO_INSTRUMENT write_json_event(const char* type, void* addr,
+                 const char* func_name, int depth,
+                 const char* extra = nullptr);
+// Writes one event stamped `*at`, or now when `at` is null
+static void NO_INSTRUMENT write_event(const char* type, void* addr, const char* func_name, int depth,
+                                      const char* extra, const unsigned long* at) {
+    if (!g_trace_file || g_depth >= 2048) {
+        return;
+    }
+
+#if defined(TRACER_CAPTURE_IO)
+    // Output produced since the previous event goes in first.
+    if (g_io_capture) capture_program_io();
+#endif
+
+    const bool skeleton = is_skeleton_event(type);
+
+    // A window holds skeleton steps [from, to), each with the detail events
+    // that follow it.
+    if (g_window_active) {
+        if (skeleton && g_skeleton_counter >= g_window_to) finish_window();
+        const bool before = skeleton ? g_skeleton_counter < g_window_from
+                                     : (g_window_from > 0 && g_skeleton_counter <= g_window_from);
+        if (before) {
+            if (skeleton) ++g_skeleton_counter;
+            return;
+        }
+        if (!g_record_detail) {
+            g_record_detail = true;
+            refresh_gate();
+        }
+    }
+
+    {
+        TraceGuard guard;
+
+        if (g_flight_slots) {
+            flight_record(type, addr, func_name, depth, extra);
+            semantic_hash_event(type, func_name, depth, extra);
+            if (skeleton) ++g_skeleton_counter;
+            if (g_max_events > 0 && g_event_counter >= g_max_events) {
+                g_window_stopped = true;
+                refresh_gate();
+            }
+            return;
+        }
+
+        const unsigned long id = g_event_counter++;
+        const unsigned long ts = at ? *at : get_timestamp_us();
+        if (g_subtrees) {
+            subtree_capture(id, type, addr, func_name, depth, ts, extra);
+        } else {
+            JsonBuffer event;
+            output_event(event, id, type, addr, func_name, depth, ts, extra);
+            write_output(event);
+        }
+#if defined(TRACER_COMPRESS)
+        if (g_columns) columns_record(id, type, addr, func_name, depth, ts, extra);
+#endif
+
+        semantic_hash_event(type, func_name, depth, extra);
+        if (skeleton) ++g_skeleton_counter;
+
+        if (g_max_events > 0 && g_event_counter >= g_max_events) {
+            g_window_stopped = true;
+            refresh_gate();
+        }
+    }
+
+    if (g_fork_interval > 0) maybe_fork_checkpoint();
+}
+
+// ========== REDUNDANT EVENTS ==========
+// TRACE_ELIDE=1, or a comma-separated subset of "assigns,blocks,loops",
+// leaves out events that tell the reader nothing new:
+//   assigns  an assign of the value the trace last reported for that
+//            variable in its frame is not written
+//   blocks   a block_enter directly followed by its block_exit is written
+//            as one block_enter with "empty":true and "exitLine"
+//   loops    the loop_iteration_end, loop_condition and loop_body_start
+//            (or loop_end) of one loop that follow each other directly are
+//            written as the last of them, with the condition's result as
+//            "condition" and the iteration that ended as "endedIteration"
+// The backend expands folded events back into both steps. The footer
+// counts what was left out under "elided".
+
+enum ElideMask : unsigned int { ELIDE_ASSIGNS = 1u, ELIDE_BLOCKS = 2u, ELIDE_LOOPS = 4u };
+
+static unsigned int g_elide = 0;
+static unsigned long g_elided_assigns = 0;
+static unsigned long g_elided_blocks = 0;
+static unsigned long g_elided_loops = 0;
+
+static unsigned int NO_INSTRUMENT parse_elide(const char* spec) {
+    if (strcmp(spec, "1") == 0 || strcmp(spec, "all") == 0) return ELIDE_ASSIGNS | ELIDE_BLOCKS | ELIDE_LOOPS;
+    unsigned int mask = 0;
+    while (*spec) {
+        const char* end = strchr(spec, ',');
+        const size_t n = end ? (size_t)(end - spec) : strlen(spec);
+        if (n == 7 && strncmp(spec, "assigns", n) == 0) mask |= ELIDE_ASSIGNS;
+        else if (n == 6 && strncmp(spec, "blocks", n) == 0) mask |= ELIDE_BLOCKS;
+        else if (n == 5 && strncmp(spec, "loops", n) == 0) mask |= ELIDE_LOOPS;
+        spec += n;
+        if (*spec == ',') ++spec;
+    }
+    return mask;
+}
+
+// A block_enter or loop_condition kept back until the next event shows
+// whether it folds into it
+struct HeldEvent {
+    const char* type;
+    int key;     // blockDepth or loopId
+    int depth;
+    int line;
+    int result;  // loop_condition's result, loop_iteration_end's iteration
+    unsigned long ts;
+    std::string func;
+    std::string extra;
+    // A loop_condition can carry the loop_iteration_end just before it
+    int ended_iteration;  // -1 when it does not
+    unsigned long ended_ts;
+    std::string ended_extra;
+};
+
+static bool g_event_held = false;
+
+static HeldEvent& get_held_event() {
+    static auto* s_held = new HeldEvent();
+    return *s_held;
+}
+
+static void NO_INSTRUMENT release_held_event() {
+    g_event_held = false;
+    HeldEvent& held = get_held_event();
+    if (held.ended_iteration >= 0) {
+        write_event("loop_iteration_end", nullptr, held.func.c_str(), held.depth, held.ended_extra.c_str(),
+                    &held.ended_ts);
+    }
+    write_event(held.type, nullptr, held.func.c_str(), held.depth, held.extra.c_str(), &held.ts);
+}
+
+static void NO_INSTRUMENT hold_event(const char* type, int key, int line, int result, const char* extra) {
+    if (g_event_held) release_held_event();
+    HeldEvent& held = get_held_event();
+    held.type = type;
+    held.key = key;
+    held.depth = g_depth;
+    held.line = line;
+    held.result = result;
+    held.ts = get_timestamp_us();
+    held.func = get_current_function();
+    held.extra = extra;
+    held.ended_iteration = -1;
+    g_event_held = true;
+}
+
+// The held event, taken, if it is a `type` for `key` in the current frame
+// (and on `line`, unless that is -1)
+static HeldEvent* NO_INSTRUMENT take_held_event(const char* type, int key, int line) {
+    if (!g_event_held) return nullptr;
+    HeldEvent& held = get_held_event();
+    if (strcmp(held.type, type) != 0 || held.key != key || held.depth != g_depth ||
+        (line >= 0 && held.line != line)) {
+        return nullptr;
+    }
+    g_event_held = false;
+    return &held;
+}
+
+// Holds a loop_condition, together with the loop_iteration_end of the same
+// loop if that is what is held
+static void NO_INSTRUMENT hold_loop_condition(int loopId, int line, int result, const char* extra) {
+    HeldEvent* ended = take_held_event("loop_iteration_end", loopId, line);
+    if (!ended) {
+        hold_event("loop_condition", loopId, line, result, extra);
+        return;
+    }
+    HeldEvent& held = *ended;
+    held.ended_iteration = held.result;
+    held.ended_ts = held.ts;
+    held.ended_extra.swap(held.extra);
+    held.type = "loop_condition";
+    held.result = result;
+    held.ts = get_timestamp_us();
+    held.extra = extra;
+    g_event_held = true;
+}
+
+// Folds a held loop_condition of this loop into the event being built
+static void NO_INSTRUMENT append_held_condition(JsonBuffer& extra, int loopId, int line) {
+    if (HeldEvent* condition = take_held_event("loop_condition", loopId, line)) {
+        ++g_elided_loops;
+        extra.format(",\"condition\":%d", condition->result);
+        if (condition->ended_iteration >= 0) {
+            ++g_elided_loops;
+            extra.format(",\"endedIteration\":%d", condition->ended_iteration);
+        }
+    }
+}
+
+// Whether `value` is what the trace last reported for `name` in the current
+// frame. If not, it is from now on.
+static bool NO_INSTRUMENT assign_unchanged(const char* name, __trace_value value) {
+    if (get_call_stack().empty()) return false;
+    auto& assigned = get_call_stack().back().assignedValues;
+    auto it = assigned.find(name);
+    if (it != assigned.end() && it->second.tag == value.tag && it->second.bits == value.bits) return true;
+    assigned[name] = value;
+    return false;
+}
+
+// Another event reported a value for `name`: a declaration, or a write
+// through a pointer that may belong to any frame
+static void NO_INSTRUMENT forget_assigned(const char* name) {
+    if (!(g_elide & ELIDE_ASSIGNS)) return;
+    for (auto& frame : get_call_stack()) frame.assignedValues.erase(name);
+}
+
+static void NO_INSTRUMENT write_json_event(const char* type, void* addr,
+                 const char* func_name, int depth,
+                 const char* extra) {
+    if (g_event_held) release_held_event();
+    write_event(type, addr, func_name, depth, extra, nullptr);
+}
+
+static PointerInfo* NO_INSTRUMENT findPointerInfo(const std::string& ptrName) {
+    for (auto it = get_call_stack().rbegin(); it != get_call_stack().rend(); ++it) {
+        auto pit = it->pointerAliases.find(ptrName);
+        if (pit != it->pointerAliases.end()) {
+            return &(pit->second);
+        }
+    }
+    
+    auto git = get_pointer_registry().find(ptrName);
+    if (git != get_pointer_registry().end()) {
+        return &(git->second);
+    }
+    
+    return nullptr;
+}
+
+// ========== SHADOW MEMORY ==========
+// Declared scalars and arrays are mirrored, and at scope boundaries (loop
+// iteration end, block exit, function exit) the mirror is compared with live
+// memory. Writes the instrumenter cannot see (scanf into an element, stores
+// through pointers, library calls) come out as "shadow_write" events with the
+// changed element ranges. Traced writes refresh the mirror, so they are not
+// reported twice. The cost follows the tracked bytes, not the number of
+// writes. TRACE_SHADOW=0 turns it off.
+
+struct ShadowRegion {
+    const char* name;           // string literal from the instrumented code
+    unsigned char* address;
+    size_t size;
+    size_t elem_size;
+    unsigned int tag;
+    int dim2, dim3;             // inner array dimensions, 0 when absent
+    int depth;                  // call depth of the owning frame
+    int block;                  // block depth it was declared in
+    std::vector<unsigned char> copy;
+};
+
+static bool g_shadow = true;                        // TRACE_SHADOW=0 disables
+static int g_shadow_block[2048];                    // current block depth per call depth
+static const size_t kShadowMaxBytes = 64 * 1024;    // larger regions are not mirrored
+static const size_t kRangeEventElements = 256;      // values per range event
+
+static std::vector<ShadowRegion>& get_shadow_regions() {
+    static std::vector<ShadowRegion>* s_shadow_regions = new std::vector<ShadowRegion>();
+    return *s_shadow_regions;
+}
+
+// Regions of untyped (class) values are not mirrored: their elements could
+// only be reported as null, and their writes arrive as struct snapshots and
+// container events instead.
+static void NO_INSTRUMENT shadow_register(const char* name, void* address, size_t size, size_t elem_size,
+                                          unsigned int tag, int dim2, int dim3) {
+    if (!g_shadow || !address || size == 0 || size > kShadowMaxBytes || tag == TRACE_T_NONE ||
+        elem_size == 0 || size % elem_size != 0) return;
+    auto& regions = get_shadow_regions();
+    ShadowRegion* r = nullptr;
+    for (auto it = regions.rbegin(); it != regions.rend(); ++it) {
+        if (it->address == address) { r = &*it; break; }
+    }
+    if (!r) {
+        regions.emplace_back();
+        r = &regions.back();
+    }
+    r->name = name;
+    r->address = (unsigned char*)address;
+    r->size = size;
+    r->elem_size = elem_size;
+    r->tag = tag;
+    r->dim2 = dim2;
+    r->dim3 = dim3;
+    r->depth = g_depth;
+    r->block = g_shadow_block[g_depth];
+    r->copy.assign(r->address, r->address + size);
+}
+
+// Innermost region of the current frame with this name
+static ShadowRegion* NO_INSTRUMENT shadow_find(const char* name) {
+    auto& regions = get_shadow_regions();
+    for (auto it = regions.rbegin(); it != regions.rend() && it->depth == g_depth; ++it) {
+        if (strcmp(it->name, name) == 0) return &*it;
+    }
+    return nullptr;
+}
+
+// A traced write: the mirror takes the new bytes so the diff skips them
+static void NO_INSTRUMENT shadow_sync(ShadowRegion* r, size_t offset, size_t size) {
+    if (!r || offset >= r->size) return;
+    if (size > r->size - offset) size = r->size - offset;
+    memcpy(r->copy.data() + offset, r->address + offset, size);
+}
+
+static void NO_INSTRUMENT shadow_sync_address(const void* address) {
+    const unsigned char* p = (const unsigned char*)address;
+    for (auto& r : get_shadow_regions()) {
+        if (p >= r.address && p < r.address + r.size) {
+            const size_t offset = (size_t)(p - r.address) / r.elem_size * r.elem_size;
+            shadow_sync(&r, offset, r.elem_size);
+            return;
+        }
+    }
+}
+
+// A traced write of [address, address + size), in every region it overlaps
+static void NO_INSTRUMENT shadow_sync_range(const void* address, size_t size) {
+    const unsigned char* p = (const unsigned char*)address;
+    for (auto& r : get_shadow_regions()) {
+        if (p >= r.address + r.size || p + size <= r.address) continue;
+        const size_t begin = p > r.address ? (size_t)(p - r.address) : 0;
+        shadow_sync(&r, begin, (size_t)(p + size - r.address) - begin);
+    }
+}
+
+static void NO_INSTRUMENT append_element(std::string& out, const unsigned char* p, size_t elem_size,
+                                         unsigned int tag, const __trace_layout* layout);
+static void NO_INSTRUMENT forget_objects(const void* begin, const void* end);
+
+// Emit the changed element ranges of one region and refresh its mirror
+static void NO_INSTRUMENT shadow_check_region(ShadowRegion& r, const char* boundary, void* where,
+                                              const char* file, int line) {
+    static const char* const vtypes[] = {
+        "none", "i64", "u64", "f64", "f32", "char", "bool", "ptr", "text"
+    };
+    const unsigned char* old = r.copy.data();
+    const size_t es = r.elem_size;
+    size_t offset = g_first_difference(old, r.address, r.size);
+    if (offset >= r.size) return;
+
+    std::string ranges;
+    size_t emitted = 0;
+    bool truncated = false;
+    while (offset < r.size) {
+        const size_t first = offset / es;
+        size_t last = first + 1;
+        while (last * es < r.size && memcmp(old + last * es, r.address + last * es, es) != 0) ++last;
+        if (emitted + (last - first) > kRangeEventElements) {
+            last = first + (kRangeEventElements - emitted);
+            truncated = true;
+        }
+
+        ranges += ranges.empty() ? "{\"at\":" : ",{\"at\":";
+        append_decimal(ranges, first);
+        ranges += ",\"values\":[";
+        for (size_t k = first; k < last; ++k) {
+            if (k > first) ranges += ',';
+            append_element(ranges, r.address + k * es, es, r.tag, nullptr);
+        }
+        ranges += "]}";
+        emitted += last - first;
+        if (truncated) break;
+
+        offset = last * es;
+        if (offset < r.size) offset += g_first_difference(old + offset, r.address + offset, r.size - offset);
+    }
+    memcpy(r.copy.data(), r.address, r.size);
+
+    JsonBuffer head;
+    head.format("\"name\":\"%j\",\"address\":\"%p\",\"elemSize\":%zu,\"vtype\":\"%s\",\"boundary\":\"%s\",\"ranges\":[",
+                r.name, (void*)r.address, es, vtypes[r.tag <= TRACE_T_TEXT ? r.tag : 0], boundary);
+    std::string extra = head.c_str();
+    extra += ranges;
+    extra += ']';
+    if (truncated) extra += ",\"truncated\":true";
+    if (file) {
+        JsonBuffer tail;
+        tail.format(",\"file\":\"%s\",\"line\":%d", json_safe_file(file), line);
+        extra.append(tail.c_str(), tail.size());
+    }
+    forget_assigned(r.name);
+    write_json_event("shadow_write", where ? where : (void*)r.address, get_current_function().c_str(),
+                     g_depth, extra.c_str());
+}
+
+// Compare the regions of frame `depth` (every frame when it is -1: at a
+// function exit, where a callee may have written through a pointer
+// parameter) and drop the current frame's regions that go out of scope:
+// those declared at block depth >= drop_block, or all of them when
+// drop_block is 0. A negative drop_block keeps everything.
+static void NO_INSTRUMENT shadow_boundary(const char* boundary, int depth, int drop_block,
+                                          void* where, const char* file, int line) {
+    auto& regions = get_shadow_regions();
+    if (regions.empty()) return;
+    if (__TRACE_GATE_WORD() & (TRACE_CAT_VARS | TRACE_CAT_ARRAYS)) {
+        for (auto& r : regions) {
+            if (depth < 0 || r.depth == depth) shadow_check_region(r, boundary, where, file, line);
+        }
+    }
+    if (drop_block < 0) return;
+    regions.erase(std::remove_if(regions.begin(), regions.end(), [drop_block](const ShadowRegion& r) {
+        return r.depth > g_depth || (r.depth == g_depth && (drop_block == 0 || r.block >= drop_block));
+    }), regions.end());
+}
+
+extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
+                                           const char* file, int line) __attribute__((no_instrument_function));
+extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
+                                           const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"conditionId\":%d,\"expression\":\"%j\",\"result\":%d,\"file\":\"%s\",\"line\":%d",
+                 conditionId, expression, result, f, line);
+    write_json_event("condition_eval", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
+                                         const char* file, int line) __attribute__((no_instrument_function));
+extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
+                                         const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"conditionId\":%d,\"branchType\":\"%j\",\"file\":\"%s\",\"line\":%d",
+                 conditionId, branchType, f, line);
+    write_json_event("branch_taken", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
+                                         void* address, int dim1, int dim2, int dim3,
+                                         bool isStack, size_t size, size_t elemSize,
+                                         unsigned int elemTag, const char* file, int line) __attribute__((no_instrument_function));
+extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
+                                         void* address, int dim1, int dim2, int dim3,
+                                         bool isStack, size_t size, size_t elemSize,
+                                         unsigned int elemTag, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    get_address_to_name()[address] = name;
+
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    
+    char dims[64];
+    if (dim3 > 0) {
+        snprintf(dims, sizeof(dims), "[%d,%d,%d]", dim1, dim2, dim3);
+    } else if (dim2 > 0) {
+        snprintf(dims, sizeof(dims), "[%d,%d]", dim1, dim2);
+    } else {
+        snprintf(dims, sizeof(dims), "[%d]", dim1);
+    }
+    
+    extra.format("\"name\":\"%j\",\"baseType\":\"%j\",\"dimensions\":%s,\"isStack\":%s,\"file\":\"%s\",\"line\":%d",
+                 name, baseType, dims, isStack ? "true" : "false", f, line);
+    
+    write_json_event("array_create", address, get_current_function().c_str(), g_depth, extra.c_str());
+    
+    ArrayInfo info;
+    info.name = name;
+    info.baseType = baseType;
+    info.address = address;
+    info.dim1 = dim1;
+    info.dim2 = dim2;
+    info.dim3 = dim3;
+    info.isStack = isStack;
+    
+    get_array_registry()[address] = info;
+    if (isStack) shadow_register(name, address, size, elemSize, elemTag, dim2, dim3);
+    TRACER_GUARD_EXIT();
 }
 
 extern "C" void __trace_array_init_string_loc(const char* name, const char* str_literal,
                                                const char* file, int line) __attribute__((no_instrument_function));
 extern "C" void __trace_array_init_string_loc(const char* name, const char* str_literal,
                                                const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    const char* f = json_safe_file(file);
+    const int len = str_literal ? strlen(str_literal) : 0;
+    
+    for (int i = 0; i <= len; i++) {
+        char c = (i < len) ? str_literal[i] : '\0';
+        JsonBuffer extra;
+        extra.format("\"name\":\"%j\",\"indices\":[%d],\"value\":%d,\"char\":\"\\u%04x\",\"file\":\"%s\",\"line\":%d",
+                     name, i, (int)c, (unsigned char)c, f, line);
+        
+        write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+        
+        ArrayElementKey key;
+        key.arrayName = name;
+        key.idx1 = i;
+        key.idx2 = -1;
+        key.idx3 = -1;
+        get_array_element_values()[key] = (long long)c;
+    }
+    if (ShadowRegion* r = shadow_find(name)) shadow_sync(r, 0, r->size);
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_array_init_loc(const char* name, void* values, int count,
+                                       const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    const char* f = json_safe_file(file);
+    int* intValues = static_cast<int*>(values);
+    
+    for (int i = 0; i < count; i++) {
+        JsonBuffer extra;
+        extra.format("\"name\":\"%j\",\"indices\":[%d],\"value\":%d,\"file\":\"%s\",\"line\":%d",
+                     name, i, intValues[i], f, line);
+        
+        write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+        
+        ArrayElementKey key;
+        key.arrayName = name;
+        key.idx1 = i;
+        key.idx2 = -1;
+        key.idx3 = -1;
+        get_array_element_values()[key] = (long long)intValues[i];
+    }
+    if (ShadowRegion* r = shadow_find(name)) shadow_sync(r, 0, r->size);
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
+                                                __trace_value value, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    ArrayElementKey key;
+    key.arrayName = name;
+    key.idx1 = idx1;
+    key.idx2 = idx2;
+    key.idx3 = idx3;
+    
+    get_array_element_values()[key] = typed_value_as_long(value);
+    if (ShadowRegion* r = shadow_find(name)) {
+        const size_t d2 = r->dim2 > 0 ? (size_t)r->dim2 : 1;
+        const size_t d3 = r->dim3 > 0 ? (size_t)r->dim3 : 1;
+        const size_t flat = ((size_t)idx1 * d2 + (size_t)(idx2 > 0 ? idx2 : 0)) * d3 + (size_t)(idx3 > 0 ? idx3 : 0);
+        shadow_sync(r, flat * r->elem_size, r->elem_size);
+    }
+
+    const char* f = json_safe_file(file);
+
+    JsonBuffer extra;
+    extra.append_literal("\"name\":\"");
+    extra.append_escaped(name);
+    extra.append_literal("\",\"indices\":[");
+    extra.append_signed(idx1);
+    if (idx2 >= 0) {
+        extra.append_literal(",");
+        extra.append_signed(idx2);
+    }
+    if (idx3 >= 0) {
+        extra.append_literal(",");
+        extra.append_signed(idx3);
+    }
+    extra.append_literal("],");
+    append_typed_value(extra, value);
+    append_location(extra, f, line);
+
+    write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
+                                          const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_POINTERS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    std::string aliasOfName = "unknown";
+    if (get_address_to_name().count(aliasedAddress)) {
+        aliasOfName = get_address_to_name()[aliasedAddress];
+    }
+    
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"aliasOf\":\"%j\",\"aliasedAddress\":\"%p\",\"decayedFromArray\":%s,\"file\":\"%s\",\"line\":%d",
+                 name, aliasOfName.c_str(), aliasedAddress, decayedFromArray ? "true" : "false", f, line);
+    
+    write_json_event("pointer_alias", aliasedAddress, get_current_function().c_str(), g_depth, extra.c_str());
+    
+    PointerInfo pinfo;
+    pinfo.pointerName = name;
+    pinfo.aliasedAddress = aliasedAddress;
+    pinfo.isHeap = false;
+    pinfo.heapAddress = nullptr;
+    
+    if (!get_call_stack().empty()) {
+        get_call_stack().back().pointerAliases[name] = pinfo;
+    } else {
+        get_pointer_registry()[name] = pinfo;
+    }
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_pointer_deref_write_loc(const char* ptrName, __trace_value value,
+                                                const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_POINTERS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    const char* f = json_safe_file(file);
+
+    PointerInfo* pinfo = findPointerInfo(ptrName);
+
+    std::string targetName = "unknown";
+    bool isHeap = false;
+    void* targetAddress = nullptr;
+
+    if (pinfo) {
+        isHeap = pinfo->isHeap;
+        targetAddress = pinfo->aliasedAddress;
+        if (get_address_to_name().count(targetAddress)) {
+            targetName = get_address_to_name()[targetAddress];
+        }
+        shadow_sync_address(targetAddress);
+    }
+
+    JsonBuffer typed;
+    append_typed_value(typed, value);
+    JsonBuffer extra;
+    extra.append_literal("\"pointerName\":\"");
+    extra.append_escaped(ptrName);
+    extra.append_literal("\",");
+    extra.append(typed.c_str(), typed.size());
+    extra.append_literal(",\"targetName\":\"");
+    extra.append_escaped(targetName.c_str());
+    if (isHeap) extra.append_literal("\",\"isHeap\":true");
+    else extra.append_literal("\",\"isHeap\":false");
+    append_location(extra, f, line);
+    forget_assigned(targetName.c_str());
+    write_json_event("pointer_deref_write", targetAddress, get_current_function().c_str(), g_depth, extra.c_str());
+    
+    if (isHeap) {
+        JsonBuffer heap_extra;
+        heap_extra.append_literal("\"address\":\"");
+        heap_extra.append_pointer(targetAddress);
+        heap_extra.append_literal("\",");
+        heap_extra.append(typed.c_str(), typed.size());
+        append_location(heap_extra, f, line);
+        write_json_event("heap_write", targetAddress, get_current_function().c_str(), g_depth, heap_extra.c_str());
+    }
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_declare_loc(const char* name, const char* type, void* address,
+                                    size_t size, unsigned int tag, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    get_address_to_name()[address] = name;
+    shadow_register(name, address, size, size, tag, 0, 0);
+    forget_objects(address, (const unsigned char*)address + size);
+    forget_assigned(name);
+    
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"varType\":\"%j\",\"value\":null,\"address\":\"%p\",\"file\":\"%s\",\"line\":%d",
+                 name, type, address, f, line);
+    write_json_event("declare", address, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_assign_loc(const char* name, __trace_value value,
+                                   const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    get_variable_values()[name] = typed_value_as_long(value);
+    if (ShadowRegion* r = shadow_find(name)) shadow_sync(r, 0, r->size);
+
+    if ((g_elide & ELIDE_ASSIGNS) && assign_unchanged(name, value)) {
+        ++g_elided_assigns;
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.append_literal("\"name\":\"");
+    extra.append_escaped(name);
+    extra.append_literal("\",");
+    append_typed_value(extra, value);
+    append_location(extra, f, line);
+    write_json_event("assign", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
+                                               const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_POINTERS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    PointerInfo pinfo;
+    pinfo.pointerName = ptrName;
+    pinfo.aliasedAddress = heapAddr;
+    pinfo.isHeap = true;
+    pinfo.heapAddress = heapAddr;
+    
+    if (!get_call_stack().empty()) {
+        get_call_stack().back().pointerAliases[ptrName] = pinfo;
+    }
+    
+    get_pointer_registry()[ptrName] = pinfo;
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_control_flow_loc(const char* controlType, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"controlType\":\"%j\",\"file\":\"%s\",\"line\":%d",
+                 controlType, f, line);
+    write_json_event("control_flow", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_loop_start_loc(int loopId, const char* loopType, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    if (!get_call_stack().empty()) {
+        get_call_stack().back().activeLoops.push_back(loopId);
+        get_call_stack().back().loopIterations[loopId] = 0;
+    }
+    
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"loopId\":%d,\"loopType\":\"%j\",\"file\":\"%s\",\"line\":%d",
+                 loopId, loopType, f, line);
+    write_json_event("loop_start", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_loop_body_start_loc(int loopId, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    int iteration = 0;
+    if (!get_call_stack().empty()) {
+        iteration = ++get_call_stack().back().loopIterations[loopId];
+    }
+    
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
+                 loopId, iteration, f, line);
+    append_held_condition(extra, loopId, line);
+    write_json_event("loop_body_start", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+// Points a frame snapshot can be taken at (see FRAME SNAPSHOTS)
+enum : unsigned int { SNAPSHOT_AT_EXIT = 1u, SNAPSHOT_AT_ITERATION = 2u };
+static unsigned int g_snapshot_points = 0;        // TRACE_SNAPSHOTS
+static unsigned long g_snapshot_every = 1;        // TRACE_SNAPSHOT_EVERY
+static unsigned long g_snapshot_count = 0;
+static void NO_INSTRUMENT frame_snapshot(unsigned int point, const char* at, void* pc);
+
+extern "C" void __trace_loop_iteration_end_loc(int loopId, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    shadow_boundary("loop_iteration_end", g_depth, -1, nullptr, file, line);
+
+    int iteration = 0;
+    if (!get_call_stack().empty()) {
+        iteration = get_call_stack().back().loopIterations[loopId];
+    }
+    
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
+                 loopId, iteration, f, line);
+    if (g_elide & ELIDE_LOOPS) hold_event("loop_iteration_end", loopId, line, iteration, extra.c_str());
+    else write_json_event("loop_iteration_end", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+    frame_snapshot(SNAPSHOT_AT_ITERATION, "iteration", __builtin_return_address(0));
+}
+
+extern "C" void __trace_loop_end_loc(int loopId, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    
+    if (!get_call_stack().empty()) {
+        auto& loops = get_call_stack().back().activeLoops;
+        auto it = std::find(loops.begin(), loops.end(), loopId);
+        if (it != loops.end()) {
+            loops.erase(it);
+        }
+        get_call_stack().back().loopIterations.erase(loopId);
+    }
+
+    shadow_boundary("loop_end", g_depth, -1, nullptr, file, line);
+
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"loopId\":%d,\"file\":\"%s\",\"line\":%d", loopId, f, line);
+    append_held_condition(extra, loopId, line);
+    write_json_event("loop_end", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_loop_condition_loc(int loopId, int result, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"loopId\":%d,\"result\":%d,\"file\":\"%s\",\"line\":%d",
+                 loopId, result, f, line);
+    if (g_elide & ELIDE_LOOPS) hold_loop_condition(loopId, line, result, extra.c_str());
+    else write_json_event("loop_condition", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_return_loc(__trace_value value, const char* returnType,
+                                    const char* destinationSymbol, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CALLS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    append_typed_value(extra, value);
+    extra.append_literal(",\"returnType\":\"");
+    extra.append_escaped(returnType ? returnType : "auto");
+    extra.append_literal("\"");
+    if (destinationSymbol && destinationSymbol[0] != '\0') {
+        extra.append_literal(",\"destinationSymbol\":\"");
+        extra.append_escaped(destinationSymbol);
+        extra.append_literal("\"");
+    }
+    append_location(extra, f, line);
+
+    write_json_event("return", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_block_enter_loc(int blockDepth, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    g_shadow_block[g_depth] = blockDepth;
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d", blockDepth, f, line);
+    if (g_elide & ELIDE_BLOCKS) hold_event("block_enter", blockDepth, line, 0, extra.c_str());
+    else write_json_event("block_enter", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __trace_block_exit_loc(int blockDepth, const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_CONTROL, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    // Locals of the block are compared one last time, then forgotten.
+    shadow_boundary("block_exit", g_depth, blockDepth > 0 ? blockDepth : 1, nullptr, file, line);
+    g_shadow_block[g_depth] = blockDepth > 0 ? blockDepth - 1 : 0;
+
+    // Nothing was written since the matching block_enter
+    if (HeldEvent* enter = take_held_event("block_enter", blockDepth, -1)) {
+        ++g_elided_blocks;
+        JsonBuffer folded;
+        folded.append(enter->extra.data(), enter->extra.size());
+        folded.format(",\"empty\":true,\"exitLine\":%d", line);
+        write_event("block_enter", nullptr, enter->func.c_str(), enter->depth, folded.c_str(), &enter->ts);
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d", blockDepth, f, line);
+    write_json_event("block_exit", nullptr, get_current_function().c_str(), g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_int_loc(const char* name, int value,
+                                   const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"value\":%d,\"type\":\"int\",\"file\":\"%s\",\"line\":%d",
+                 name, value, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_long_loc(const char* name, long long value,
+                                    const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"value\":%lld,\"type\":\"long\",\"file\":\"%s\",\"line\":%d",
+                 name, value, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_double_loc(const char* name, double value,
+                                      const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"value\":%f,\"type\":\"double\",\"file\":\"%s\",\"line\":%d",
+                 name, value, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_ptr_loc(const char* name, void* value,
+                                  const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"value\":\"%p\",\"type\":\"pointer\",\"file\":\"%s\",\"line\":%d",
+                 name, value, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_typed_loc(const char* name, __trace_value value,
+                                    const char* file, int line) {
+    static const char* const type_names[] = {
+        "none", "long", "unsigned", "double", "float", "char", "bool", "pointer"
+    };
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.append_literal("\"name\":\"");
+    extra.append_escaped(name);
+    extra.append_literal("\",");
+    append_typed_value(extra, value);
+    extra.append_literal(",\"varType\":\"");
+    extra.append(type_names[value.tag <= TRACE_T_PTR ? value.tag : 0]);
+    extra.append_literal("\"");
+    append_location(extra, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_str_loc(const char* name, const char* value,
+                                  const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+    const char* f = json_safe_file(file);
+    JsonBuffer extra;
+    extra.format("\"name\":\"%j\",\"value\":\"%j\",\"type\":\"string\",\"file\":\"%s\",\"line\":%d",
+                 name, value, f, line);
+    write_json_event("var", nullptr, name, g_depth, extra.c_str());
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void trace_var_int(const char* name, int value) {
+    trace_var_int_loc(name, value, "unknown", 0);
+}
+extern "C" void trace_var_long(const char* name, long long value) {
+    trace_var_long_loc(name, value, "unknown", 0);
+}
+extern "C" void trace_var_double(const char* name, double value) {
+    trace_var_double_loc(name, value, "unknown", 0);
+}
+extern "C" void trace_var_ptr(const char* name, void* value) {
+    trace_var_ptr_loc(name, value, "unknown", 0);
+}
+extern "C" void trace_var_str(const char* name, const char* value) {
+    trace_var_str_loc(name, value, "unknown", 0);
+}
+
+// ========== STATIC SITES ==========
+// Hooks written by the Clang instrumenter: the name, type, file and line come
+// from the translation unit's site table, and a declaration with an
+// initializer reports its value in the same call.
+extern "C" void __trace_declare_site(const __trace_site* site, void* address, size_t size, unsigned int tag) {
+    __trace_declare_loc(site->name, site->type, address, size, tag, site->file, site->line);
+}
+
+extern "C" void __trace_declare_init_site(const __trace_site* site, void* address, size_t size,
+                                          unsigned int tag, __trace_value value) {
+    __trace_declare_loc(site->name, site->type, address, size, tag, site->file, site->line);
+    __trace_assign_loc(site->name, value, site->file, site->line);
+}
+
+extern "C" void __trace_assign_site(const __trace_site* site, __trace_value value, int line) {
+    __trace_assign_loc(site->name, value, site->file, line);
+}
+
+// ========== IR SITES ==========
+// Hooks inserted by the LLVM pass. An array store arrives as a row-major
+// element index, split here by the dimensions the array was created with.
+extern "C" void __trace_value_site(const __trace_site* site, unsigned long long bits,
+                                   unsigned int tag, int line) {
+    __trace_value value = { bits, tag };
+    __trace_assign_loc(site->name, value, site->file, line);
+}
+
+extern "C" void __trace_array_site(const __trace_site* site, void* base, int dim1, int dim2, int dim3,
+                                   size_t elemSize, unsigned int elemTag) {
+    const size_t count = (size_t)dim1 * (size_t)(dim2 > 0 ? dim2 : 1) * (size_t)(dim3 > 0 ? dim3 : 1);
+    __trace_array_create_loc(site->name, site->type, base, dim1, dim2, dim3, true,
+                             count * elemSize, elemSize, elemTag, site->file, site->line);
+}
+
+extern "C" void __trace_array_store_site(const __trace_site* site, void* base, unsigned long long index,
+                                         unsigned long long bits, unsigned int tag, int line) {
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    TRACER_GUARD_ENTER();
+    int idx1 = (int)index, idx2 = -1, idx3 = -1;
+    auto it = get_array_registry().find(base);
+    if (it != get_array_registry().end()) {
+        const ArrayInfo& info = it->second;
+        if (info.dim3 > 0) {
+            idx3 = (int)(index % info.dim3);
+            idx2 = (int)(index / info.dim3 % info.dim2);
+            idx1 = (int)(index / info.dim3 / info.dim2);
+        } else if (info.dim2 > 0) {
+            idx2 = (int)(index % info.dim2);
+            idx1 = (int)(index / info.dim2);
+        }
+    }
+    TRACER_GUARD_EXIT();
+    __trace_value value = { bits, tag };
+    __trace_array_index_assign_loc(site->name, idx1, idx2, idx3, value, site->file, line);
+}
+
+extern "C" void __trace_return_site(const __trace_site* site, unsigned long long bits,
+                                    unsigned int tag, int line) {
+    __trace_value value = { bits, tag };
+    __trace_return_loc(value, site->type, "", site->file, line);
+}
+
+// ========== STRUCT SNAPSHOTS ==========
+// The bytes of every snapshotted object are kept per address, so a snapshot
+// reports only the fields whose bytes changed. The first snapshot of an
+// address, or one taken through a different layout, reports every field;
+// so does the first after the address was declared again or its frame
+// returned (see forget_objects()).
+
+struct StructSnapshot {
+    const __trace_layout* layout = nullptr;
+    std::vector<unsigned char> bytes;
+};
+
+static std::map<const void*, StructSnapshot>& get_struct_snapshots() {
+    static std::map<const void*, StructSnapshot>* s_struct_snapshots =
+        new std::map<const void*, StructSnapshot>();
+    return *s_struct_snapshots;
+}
+
+static unsigned long long NO_INSTRUMENT load_field_bits(const unsigned char* p, unsigned int size,
+                                                        bool is_signed) {
+    switch (size) {
+        case 1: { uint8_t v; memcpy(&v, p, 1); return is_signed ? (unsigned long long)(int8_t)v : v; }
+        case 2: { uint16_t v; memcpy(&v, p, 2); return is_signed ? (unsigned long long)(int16_t)v : v; }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return is_signed ? (unsigned long long)(int32_t)v : v; }
+        case 8: { uint64_t v; memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
+
+// Up to `limit` bytes of a NUL-terminated buffer as JSON string content
+static void NO_INSTRUMENT append_escaped(std::string& out, const unsigned char* p, size_t limit) {
+    const unsigned char* end = (const unsigned char*)memchr(p, 0, limit);
+    json_escape(out, (const char*)p, end ? (size_t)(end - p) : limit);
+}
+
+// Typed value of a scalar stored in memory
+static __trace_value NO_INSTRUMENT load_typed(const unsigned char* p, unsigned int size, unsigned int tag) {
+    __trace_value v = { 0, tag };
+    if (tag == TRACE_T_F64 && size != 8) {
+        // long double: narrowed the way trace.h narrows values
+        long double ld;
+        memcpy(&ld, p, sizeof(ld) < size ? sizeof(ld) : size);
+        const double d = (double)ld;
+        memcpy(&v.bits, &d, sizeof(d));
+    } else if (tag != TRACE_T_NONE) {
+        v.bits = load_field_bits(p, size, tag == TRACE_T_I64 || tag == TRACE_T_CHAR);
+    }
+    return v;
+}
+
+// `"name":{...}` for one field, in the same form as a typed value
+static void NO_INSTRUMENT append_field(std::string& out, const __trace_field& field,
+                                       const unsigned char* object) {
+    const unsigned char* p = object + field.offset;
+    out += '"';
+    out += field.name;
+    out += "\":{";
+    if (field.tag == TRACE_T_TEXT) {
+        out += "\"value\":\"";
+        append_escaped(out, p, field.size < 256 ? field.size : 256);
+        out += "\",\"vtype\":\"text\"}";
+        return;
+    }
+    append_typed_value(out, load_typed(p, field.size, field.tag));
+    out += '}';
+}
+
+extern "C" void __trace_struct_snapshot_loc(const char* name, const void* object,
+                                            const __trace_layout* layout,
+                                            const char* file, int line) {
+    TRACE_GATE(TRACE_CAT_VARS, line);
+    if (!object || !layout) return;
     TRACER_GUARD_ENTER();
     if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    const std::string f = json_safe_path(file);
-    const int len = str_literal ? strlen(str_literal) : 0;
-    
-    for (int i = 0; i <= len; i++) {
-        char c = (i < len) ? str_literal[i] : '\0';
-        char extra[256];
-        snprintf(extra, sizeof(extra),
-                 "\"name\":\"%s\",\"indices\":[%d],\"value\":%d,\"char\":\"\\u%04x\",\"file\":\"%s\",\"line\":%d",
-                 name, i, (int)c, (unsigned char)c, f.c_str(), line);
-        
-        write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra);
-        
-        ArrayElementKey key;
-        key.arrayName = name;
-        key.idx1 = i;
-        key.idx2 = -1;
-        key.idx3 = -1;
-        get_array_element_values()[key] = (long long)c;
+
+    {
+        const unsigned char* now = (const unsigned char*)object;
+        StructSnapshot& prev = get_struct_snapshots()[object];
+        const bool full = prev.layout != layout || prev.bytes.size() != layout->size;
+
+        const char* f = json_safe_file(file);
+        JsonBuffer head;
+        head.format("\"name\":\"%j\",\"struct\":\"%j\",\"address\":\"%p\",\"full\":%s,",
+                    name, layout->name, object, full ? "true" : "false");
+        std::string extra = head.c_str();
+        // An opaque layout (TRACE_LAYOUT_OPAQUE) has no fields to list
+        if (layout->count == 0) {
+            const bool changed = full || memcmp(prev.bytes.data(), now, layout->size) != 0;
+            extra += changed ? "\"opaque\":true,\"changed\":true," : "\"opaque\":true,\"changed\":false,";
+        }
+        extra += "\"fields\":{";
+        bool first = true;
+        for (unsigned int i = 0; i < layout->count; ++i) {
+            const __trace_field& field = layout->fields[i];
+            if (field.offset + field.size > layout->size) continue;
+            if (!full && memcmp(prev.bytes.data() + field.offset, now + field.offset, field.size) == 0) continue;
+            if (!first) extra += ',';
+            first = false;
+            append_field(extra, field, now);
+        }
+        JsonBuffer tail;
+        tail.format("},\"file\":\"%s\",\"line\":%d", f, line);
+        extra.append(tail.c_str(), tail.size());
+
+        prev.layout = layout;
+        prev.bytes.assign(now, now + layout->size);
+        shadow_sync_range(object, layout->size);
+
+        write_json_event("struct_snapshot", (void*)object, get_current_function().c_str(), g_depth,
+                         extra.c_str());
+    }
+    TRACER_GUARD_EXIT();
+}
+
+// ========== CONTAINERS ==========
+// vector- and string-like containers report their identity (object address),
+// data pointer, size and capacity. The element bytes are mirrored per object
+// so each event carries only the index ranges that changed; a new data
+// pointer is reported with "previousData", which ties the event to the
+// heap_alloc/heap_free pair of the reallocation.
+
+struct ContainerState {
+    const void* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t elem_size = 0;
+    std::vector<unsigned char> bytes;
+};
+
+static std::map<const void*, ContainerState>& get_container_states() {
+    static std::map<const void*, ContainerState>* s_container_states =
+        new std::map<const void*, ContainerState>();
+    return *s_container_states;
+}
+
+// A declaration or a returning frame reuses [begin, end): objects there are
+// new, so their next snapshot or container event is full again. Without a
+// frame address (XRay) a frame's objects are only dropped when the address
+// is declared again.
+static void NO_INSTRUMENT forget_objects(const void* begin, const void* end) {
+    auto& snapshots = get_struct_snapshots();
+    if (!snapshots.empty()) snapshots.erase(snapshots.lower_bound(begin), snapshots.lower_bound(end));
+    auto& containers = get_container_states();
+    if (!containers.empty()) containers.erase(containers.lower_bound(begin), containers.lower_bound(end));
+}
+
+extern "C" void __trace_object_declared_loc(const void* object, size_t size) {
+    TRACER_GUARD_ENTER();
+    forget_objects(object, (const unsigned char*)object + size);
+    TRACER_GUARD_EXIT();
+}
+
+static const size_t kContainerMirrorBytes = 64 * 1024;  // compared per container
+
+// One element as a bare JSON value; floats as their hex bit pattern
+static void NO_INSTRUMENT append_element(std::string& out, const unsigned char* p, size_t elem_size,
+                                         unsigned int tag, const __trace_layout* layout) {
+    if (layout && layout->size == elem_size) {
+        out += '{';
+        for (unsigned int i = 0; i < layout->count; ++i) {
+            if (i) out += ',';
+            append_field(out, layout->fields[i], p);
+        }
+        out += '}';
+        return;
+    }
+    if (tag == TRACE_T_NONE || tag == TRACE_T_TEXT) {
+        out += "null";
+        return;
+    }
+    const __trace_value v = load_typed(p, (unsigned int)elem_size, tag);
+    switch (tag) {
+        case TRACE_T_U64: append_decimal(out, v.bits); break;
+        case TRACE_T_BOOL: out += v.bits ? "true" : "false"; break;
+        case TRACE_T_PTR: out += "\"0x"; append_hex_digits(out, v.bits, 0); out += '"'; break;
+        case TRACE_T_F64: out += '"'; append_hex_digits(out, v.bits, 16); out += '"'; break;
+        case TRACE_T_F32: out += '"'; append_hex_digits(out, v.bits, 8); out += '"'; break;
+        default: append_signed_decimal(out, (long long)v.bits); break;
+    }
+}
+
+extern "C" void __trace_container_loc(const char* name, const char* kind, const void* object,
+                                      const void* data, size_t size, size_t capacity,
+                                      size_t elem_size, unsigned int elem_tag,
+                                      const __trace_layout* elem_layout,
+                                      const char* file, int line) {
+    static const char* const vtypes[] = {
+        "none", "i64", "u64", "f64", "f32", "char", "bool", "ptr", "text"
+    };
+    TRACE_GATE(TRACE_CAT_ARRAYS, line);
+    if (!object || elem_size == 0) return;
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+
+    {
+        ContainerState& prev = get_container_states()[object];
+        const bool first = prev.elem_size != elem_size;
+        // Wide strings are reported as code unit values
+        const bool text = strcmp(kind, "string") == 0 && elem_size == 1;
+        const unsigned char* now = (const unsigned char*)data;
+
+        const size_t mirrored = data ? std::min(size, kContainerMirrorBytes / elem_size) : 0;
+        const size_t known = first ? 0 : prev.bytes.size() / elem_size;
+
+        std::string ranges;
+        size_t emitted = 0;
+        bool truncated = mirrored < size;
+        size_t i = 0;
+        while (i < mirrored) {
+            if (i < known && memcmp(prev.bytes.data() + i * elem_size, now + i * elem_size, elem_size) == 0) {
+                ++i;
+                continue;
+            }
+            size_t j = i + 1;
+            while (j < mirrored && !(j < known && memcmp(prev.bytes.data() + j * elem_size,
+                                                         now + j * elem_size, elem_size) == 0)) {
+                ++j;
+            }
+            if (emitted + (j - i) > kRangeEventElements) {
+                j = i + (kRangeEventElements - emitted);
+                truncated = true;
+            }
+            ranges += ranges.empty() ? "{\"at\":" : ",{\"at\":";
+            append_decimal(ranges, i);
+            ranges += ',';
+            if (text) {
+                ranges += "\"text\":\"";
+                json_escape(ranges, (const char*)now + i, j - i);
+                ranges += '"';
+            } else {
+                ranges += "\"values\":[";
+                for (size_t k = i; k < j; ++k) {
+                    if (k > i) ranges += ',';
+                    append_element(ranges, now + k * elem_size, elem_size, elem_tag, elem_layout);
+                }
+                ranges += ']';
+            }
+            ranges += '}';
+            emitted += j - i;
+            i = j;
+            if (emitted >= kRangeEventElements) break;
+        }
+
+        const bool moved = !first && prev.data != data;
+        if (first || moved || !ranges.empty() || size != prev.size || capacity != prev.capacity) {
+            const char* f = json_safe_file(file);
+            JsonBuffer head;
+            head.format("\"name\":\"%j\",\"kind\":\"%j\",\"address\":\"%p\",\"size\":%zu,"
+                        "\"capacity\":%zu,\"elemSize\":%zu,\"vtype\":\"%s\",",
+                        name, kind, object, size, capacity, elem_size,
+                        elem_layout ? "struct" : vtypes[elem_tag <= TRACE_T_TEXT ? elem_tag : 0]);
+            if (data) head.format("\"data\":\"%p\"", data);
+            else head.append_literal("\"data\":null");
+            if (moved && prev.data) head.format(",\"previousData\":\"%p\"", prev.data);
+            std::string extra = head.c_str();
+            extra += ",\"ranges\":[";
+            extra += ranges;
+            extra += ']';
+            if (truncated) extra += ",\"truncated\":true";
+            JsonBuffer tail;
+            tail.format(",\"file\":\"%s\",\"line\":%d", f, line);
+            extra.append(tail.c_str(), tail.size());
+
+            write_json_event("container", (void*)object, get_current_function().c_str(), g_depth,
+                             extra.c_str());
+        }
+
+        prev.data = data;
+        prev.size = size;
+        prev.capacity = capacity;
+        prev.elem_size = elem_size;
+        // Elements past a full event were not compared: they stay unknown, so
+        // the next event reports them
+        const size_t settled = emitted >= kRangeEventElements ? i : mirrored;
+        if (now) prev.bytes.assign(now, now + settled * elem_size);
+        else prev.bytes.clear();
+        shadow_sync_address(object);
+        if (now) shadow_sync_range(now, mirrored * elem_size);
+    }
+    TRACER_GUARD_EXIT();
+}
+
+// ========== FRAME SNAPSHOTS ==========
+// With TRACE_SNAPSHOTS, locals are read straight from a live frame instead
+// of being reported by source hooks. The executable's DWARF is read once at
+// startup into a table per function: each local's offset from the frame
+// base, its type, and the pc range of the scope declaring it. The call hooks
+// keep every frame's address, and a snapshot at function exit ("exit") or
+// at the end of a loop iteration ("iteration") reports the locals in scope
+// at that pc. TRACE_SNAPSHOT_EVERY=N keeps one snapshot in N.
+//
+// Only locals at a fixed offset from the frame base are known, which is
+// every local of an -O0 build. DWARF scopes a local to its whole block, so
+// one declared further down shows whatever its slot holds. Linux only.
+
+#if defined(__linux__)
+
+static const unsigned int kSnapshotElements = 64;   // array elements per local
+
+struct FrameLocal {
+    std::string name;
+    std::string type;
+    long offset;                  // from the frame base
+    unsigned int size;            // of one element
+    unsigned int tag;
+    unsigned long count;          // elements of an array, 0 for a scalar
+    unsigned long lo, hi;         // pc range of the declaring scope
+};
+
+struct FrameFunction {
+    unsigned long lo, hi;
+    long base_offset;             // frame base = frame pointer + base_offset
+    std::vector<FrameLocal> locals;
+};
+
+// Leaked, so the table is still there for snapshots taken during exit
+static std::vector<FrameFunction>& get_frame_functions() {
+    static std::vector<FrameFunction>* s_frame_functions = new std::vector<FrameFunction>();
+    return *s_frame_functions;
+}
+
+namespace dwarf {
+enum : uint64_t {
+    TAG_array_type = 0x01, TAG_enumeration_type = 0x04, TAG_formal_parameter = 0x05,
+    TAG_lexical_block = 0x0b, TAG_pointer_type = 0x0f, TAG_reference_type = 0x10,
+    TAG_compile_unit = 0x11, TAG_structure_type = 0x13, TAG_typedef = 0x16, TAG_union_type = 0x17,
+    TAG_subrange_type = 0x21, TAG_base_type = 0x24, TAG_const_type = 0x26, TAG_subprogram = 0x2e,
+    TAG_variable = 0x34, TAG_volatile_type = 0x35, TAG_class_type = 0x02,
+    TAG_rvalue_reference_type = 0x42, TAG_atomic_type = 0x47
+};
+enum : uint64_t {
+    AT_location = 0x02, AT_name = 0x03, AT_byte_size = 0x0b, AT_low_pc = 0x11, AT_high_pc = 0x12,
+    AT_upper_bound = 0x2f, AT_count = 0x37, AT_encoding = 0x3e, AT_frame_base = 0x40, AT_type = 0x49,
+    AT_str_offsets_base = 0x72, AT_addr_base = 0x73
+};
+enum : uint64_t {
+    FORM_addr = 0x01, FORM_block2 = 0x03, FORM_block4 = 0x04, FORM_data2 = 0x05, FORM_data4 = 0x06,
+    FORM_data8 = 0x07, FORM_string = 0x08, FORM_block = 0x09, FORM_block1 = 0x0a, FORM_data1 = 0x0b,
+    FORM_flag = 0x0c, FORM_sdata = 0x0d, FORM_strp = 0x0e, FORM_udata = 0x0f, FORM_ref_addr = 0x10,
+    FORM_ref1 = 0x11, FORM_ref2 = 0x12, FORM_ref4 = 0x13, FORM_ref8 = 0x14, FORM_ref_udata = 0x15,
+    FORM_indirect = 0x16, FORM_sec_offset = 0x17, FORM_exprloc = 0x18, FORM_flag_present = 0x19,
+    FORM_strx = 0x1a, FORM_addrx = 0x1b, FORM_ref_sup4 = 0x1c, FORM_strp_sup = 0x1d,
+    FORM_data16 = 0x1e, FORM_line_strp = 0x1f, FORM_ref_sig8 = 0x20, FORM_implicit_const = 0x21,
+    FORM_loclistx = 0x22, FORM_rnglistx = 0x23, FORM_ref_sup8 = 0x24, FORM_strx1 = 0x25,
+    FORM_strx2 = 0x26, FORM_strx3 = 0x27, FORM_strx4 = 0x28, FORM_addrx1 = 0x29, FORM_addrx2 = 0x2a,
+    FORM_addrx3 = 0x2b, FORM_addrx4 = 0x2c
+};
+enum : uint64_t {
+    ATE_boolean = 0x02, ATE_float = 0x04, ATE_signed = 0x05, ATE_signed_char = 0x06,
+    ATE_unsigned = 0x07, ATE_unsigned_char = 0x08
+};
+enum : unsigned char { OP_reg0 = 0x50, OP_breg0 = 0x70, OP_fbreg = 0x91, OP_call_frame_cfa = 0x9c };
+}  // namespace dwarf
+
+#if defined(__x86_64__)
+static const int kFramePointerReg = 6;              // rbp
+static const long kCfaFromFramePointer = 16;        // saved rbp and return address
+#elif defined(__aarch64__)
+static const int kFramePointerReg = 29;             // x29
+static const long kCfaFromFramePointer = LONG_MIN;  // frame record placement varies
+#else
+static const int kFramePointerReg = -1;
+static const long kCfaFromFramePointer = LONG_MIN;
+#endif
+
+struct DwarfSections {
+    const unsigned char* info = nullptr;        size_t info_size = 0;
+    const unsigned char* abbrev = nullptr;      size_t abbrev_size = 0;
+    const unsigned char* str = nullptr;         size_t str_size = 0;
+    const unsigned char* str_offsets = nullptr; size_t str_offsets_size = 0;
+    const unsigned char* addr = nullptr;        size_t addr_size = 0;
+};
+
+// Little-endian cursor over a section; reads past the end set `bad`
+struct DwarfCursor {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool bad = false;
+
+    uint64_t u(int n) {
+        if (end - p < n) { bad = true; p = end; return 0; }
+        uint64_t v = 0;
+        for (int i = 0; i < n; ++i) v |= (uint64_t)p[i] << (8 * i);
+        p += n;
+        return v;
+    }
+    uint64_t uleb() {
+        uint64_t v = 0;
+        for (int shift = 0; p < end; shift += 7) {
+            const unsigned char b = *p++;
+            if (shift < 64) v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        bad = true;
+        return v;
+    }
+    int64_t sleb() {
+        int64_t v = 0;
+        int shift = 0;
+        for (; p < end; ) {
+            const unsigned char b = *p++;
+            if (shift < 64) v |= (int64_t)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                if (shift < 64 && (b & 0x40)) v |= -((int64_t)1 << shift);
+                return v;
+            }
+        }
+        bad = true;
+        return v;
+    }
+    void skip(uint64_t n) {
+        if ((uint64_t)(end - p) < n) { bad = true; p = end; return; }
+        p += n;
+    }
+};
+
+struct DwarfAttrSpec {
+    uint64_t name;
+    uint64_t form;
+    int64_t implicit;
+};
+
+struct DwarfAbbrev {
+    uint64_t tag = 0;
+    bool children = false;
+    std::vector<DwarfAttrSpec> attrs;
+};
+
+struct DwarfValue {
+    uint64_t form = 0;
+    uint64_t u = 0;
+    const unsigned char* block = nullptr;
+    size_t len = 0;
+};
+
+struct DwarfUnit {
+    uint64_t offset = 0;          // of the unit header in .debug_info
+    int addr_size = 8;
+    uint64_t str_offsets_base = 8;
+    uint64_t addr_base = 8;
+};
+
+// A type entry, kept until every unit has been read
+struct DwarfType {
+    uint64_t tag = 0;
+    const char* name = nullptr;
+    uint64_t type = 0;            // referenced type, 0 for none
+    uint64_t byte_size = 0;
+    uint64_t encoding = 0;
+    std::vector<uint64_t> dims;   // array dimensions
+};
+
+// A local whose type is resolved once every unit has been read
+struct PendingLocal {
+    size_t function;
+    const char* name;
+    uint64_t type;
+    long offset;
+    unsigned long lo, hi;
+};
+
+static std::unordered_map<uint64_t, DwarfAbbrev> NO_INSTRUMENT read_abbrevs(const DwarfSections& s,
+                                                                           uint64_t offset) {
+    std::unordered_map<uint64_t, DwarfAbbrev> abbrevs;
+    if (offset >= s.abbrev_size) return abbrevs;
+    DwarfCursor c{ s.abbrev + offset, s.abbrev + s.abbrev_size };
+    while (!c.bad) {
+        const uint64_t code = c.uleb();
+        if (code == 0) break;
+        DwarfAbbrev& a = abbrevs[code];
+        a.tag = c.uleb();
+        a.children = c.u(1) != 0;
+        while (!c.bad) {
+            DwarfAttrSpec spec = { c.uleb(), c.uleb(), 0 };
+            if (spec.name == 0 && spec.form == 0) break;
+            if (spec.form == dwarf::FORM_implicit_const) spec.implicit = c.sleb();
+            a.attrs.push_back(spec);
+        }
+    }
+    return abbrevs;
+}
+
+static void NO_INSTRUMENT read_form(DwarfCursor& c, uint64_t form, int64_t implicit, int addr_size,
+                                    DwarfValue& v) {
+    using namespace dwarf;
+    v.form = form;
+    v.block = nullptr;
+    switch (form) {
+        case FORM_addr: v.u = c.u(addr_size); break;
+        case FORM_data1: case FORM_ref1: case FORM_flag: case FORM_strx1: case FORM_addrx1: v.u = c.u(1); break;
+        case FORM_data2: case FORM_ref2: case FORM_strx2: case FORM_addrx2: v.u = c.u(2); break;
+        case FORM_strx3: case FORM_addrx3: v.u = c.u(3); break;
+        case FORM_data4: case FORM_ref4: case FORM_strp: case FORM_line_strp: case FORM_sec_offset:
+        case FORM_ref_addr: case FORM_ref_sup4: case FORM_strp_sup: case FORM_strx4: case FORM_addrx4:
+            v.u = c.u(4);
+            break;
+        case FORM_data8: case FORM_ref8: case FORM_ref_sig8: case FORM_ref_sup8: v.u = c.u(8); break;
+        case FORM_data16: c.skip(16); break;
+        case FORM_sdata: v.u = (uint64_t)c.sleb(); break;
+        case FORM_udata: case FORM_ref_udata: case FORM_strx: case FORM_addrx:
+        case FORM_loclistx: case FORM_rnglistx:
+            v.u = c.uleb();
+            break;
+        case FORM_string:
+            v.block = c.p;
+            while (c.p < c.end && *c.p) ++c.p;
+            c.skip(1);
+            break;
+        case FORM_block1: v.len = c.u(1); v.block = c.p; c.skip(v.len); break;
+        case FORM_block2: v.len = c.u(2); v.block = c.p; c.skip(v.len); break;
+        case FORM_block4: v.len = c.u(4); v.block = c.p; c.skip(v.len); break;
+        case FORM_block: case FORM_exprloc: v.len = c.uleb(); v.block = c.p; c.skip(v.len); break;
+        case FORM_flag_present: v.u = 1; break;
+        case FORM_implicit_const: v.u = (uint64_t)implicit; break;
+        case FORM_indirect: read_form(c, c.uleb(), implicit, addr_size, v); break;
+        default: c.bad = true; break;
+    }
+}
+
+static const char* NO_INSTRUMENT dwarf_string(const DwarfSections& s, const DwarfUnit& unit,
+                                              const DwarfValue& v) {
+    using namespace dwarf;
+    uint64_t offset;
+    switch (v.form) {
+        case FORM_string: return (const char*)v.block;
+        case FORM_strp: offset = v.u; break;
+        case FORM_strx: case FORM_strx1: case FORM_strx2: case FORM_strx3: case FORM_strx4: {
+            const uint64_t at = unit.str_offsets_base + v.u * 4;
+            if (!s.str_offsets || at + 4 > s.str_offsets_size) return nullptr;
+            DwarfCursor c{ s.str_offsets + at, s.str_offsets + s.str_offsets_size };
+            offset = c.u(4);
+            break;
+        }
+        default: return nullptr;
+    }
+    return s.str && offset < s.str_size ? (const char*)s.str + offset : nullptr;
+}
+
+static uint64_t NO_INSTRUMENT dwarf_address(const DwarfSections& s, const DwarfUnit& unit,
+                                            const DwarfValue& v) {
+    using namespace dwarf;
+    switch (v.form) {
+        case FORM_addrx: case FORM_addrx1: case FORM_addrx2: case FORM_addrx3: case FORM_addrx4: {
+            const uint64_t at = unit.addr_base + v.u * unit.addr_size;
+            if (!s.addr || at + unit.addr_size > s.addr_size) return 0;
+            DwarfCursor c{ s.addr + at, s.addr + s.addr_size };
+            return c.u(unit.addr_size);
+        }
+        default:
+            return v.u;
+    }
+}
+
+// Offset of a DW_OP_fbreg location, or false for any other location
+static bool NO_INSTRUMENT frame_offset(const DwarfValue& v, long& offset) {
+    if (!v.block || v.len < 2 || v.block[0] != dwarf::OP_fbreg) return false;
+    DwarfCursor c{ v.block + 1, v.block + v.len };
+    offset = (long)c.sleb();
+    return !c.bad && c.p == c.end;
+}
+
+// Frame base relative to the frame pointer, or LONG_MIN when it is not
+static long NO_INSTRUMENT frame_base_offset(const DwarfValue& v) {
+    if (!v.block || v.len < 1 || kFramePointerReg < 0) return LONG_MIN;
+    const unsigned char op = v.block[0];
+    if (op == dwarf::OP_reg0 + kFramePointerReg && v.len == 1) return 0;
+    if (op == dwarf::OP_call_frame_cfa && v.len == 1) return kCfaFromFramePointer;
+    if (op == dwarf::OP_breg0 + kFramePointerReg) {
+        DwarfCursor c{ v.block + 1, v.block + v.len };
+        const long offset = (long)c.sleb();
+        return !c.bad && c.p == c.end ? offset : LONG_MIN;
+    }
+    return LONG_MIN;
+}
+
+// The type as the source spells it, e.g. "const char *" or "int[3][4]"
+static std::string NO_INSTRUMENT spell_type(const std::unordered_map<uint64_t, DwarfType>& types,
+                                            uint64_t offset, int depth = 0) {
+    auto it = types.find(offset);
+    if (it == types.end() || depth > 16) return offset ? "?" : "void";
+    const DwarfType& t = it->second;
+    switch (t.tag) {
+        case dwarf::TAG_pointer_type: return spell_type(types, t.type, depth + 1) + " *";
+        case dwarf::TAG_reference_type: return spell_type(types, t.type, depth + 1) + " &";
+        case dwarf::TAG_rvalue_reference_type: return spell_type(types, t.type, depth + 1) + " &&";
+        case dwarf::TAG_const_type: return "const " + spell_type(types, t.type, depth + 1);
+        case dwarf::TAG_volatile_type: return "volatile " + spell_type(types, t.type, depth + 1);
+        case dwarf::TAG_atomic_type: return spell_type(types, t.type, depth + 1);
+        case dwarf::TAG_array_type: {
+            std::string out = spell_type(types, t.type, depth + 1);
+            for (uint64_t d : t.dims) out += "[" + std::to_string(d) + "]";
+            return out;
+        }
+        default: return t.name ? t.name : "?";
+    }
+}
+
+// Tag, element size and element count of a local's type; false for what a
+// snapshot cannot show (classes, pointers to arrays of arrays, ...)
+static bool NO_INSTRUMENT classify_type(const std::unordered_map<uint64_t, DwarfType>& types,
+                                        uint64_t offset, int addr_size, FrameLocal& local) {
+    unsigned long count = 0;
+    for (int depth = 0; depth < 16; ++depth) {
+        auto it = types.find(offset);
+        if (it == types.end()) return false;
+        const DwarfType& t = it->second;
+        switch (t.tag) {
+            case dwarf::TAG_typedef: case dwarf::TAG_const_type:
+            case dwarf::TAG_volatile_type: case dwarf::TAG_atomic_type:
+                offset = t.type;
+                continue;
+            case dwarf::TAG_array_type: {
+                if (count || t.dims.empty()) return false;
+                count = 1;
+                for (uint64_t d : t.dims) count *= d;
+                if (!count) return false;
+                offset = t.type;
+                continue;
+            }
+            case dwarf::TAG_pointer_type: case dwarf::TAG_reference_type:
+            case dwarf::TAG_rvalue_reference_type:
+                local.tag = TRACE_T_PTR;
+                local.size = (unsigned int)addr_size;
+                break;
+            case dwarf::TAG_enumeration_type:
+                local.tag = TRACE_T_I64;
+                local.size = (unsigned int)t.byte_size;
+                break;
+            case dwarf::TAG_base_type:
+                local.size = (unsigned int)t.byte_size;
+                switch (t.encoding) {
+                    case dwarf::ATE_boolean: local.tag = TRACE_T_BOOL; break;
+                    case dwarf::ATE_float: local.tag = t.byte_size == 4 ? TRACE_T_F32 : TRACE_T_F64; break;
+                    case dwarf::ATE_signed: local.tag = TRACE_T_I64; break;
+                    case dwarf::ATE_signed_char: case dwarf::ATE_unsigned_char: local.tag = TRACE_T_CHAR; break;
+                    case dwarf::ATE_unsigned: local.tag = TRACE_T_U64; break;
+                    default: return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        local.count = count;
+        // load_typed() reads up to 8 bytes, or a long double
+        return local.size > 0 && (local.size <= 8 || (local.tag == TRACE_T_F64 && local.size <= 16));
+    }
+    return false;
+}
+
+static void NO_INSTRUMENT read_frame_tables(const DwarfSections& s) {
+    using namespace dwarf;
+    std::vector<FrameFunction>& functions = get_frame_functions();
+    std::unordered_map<uint64_t, DwarfType> types;
+    std::vector<PendingLocal> pending;
+
+    // Scope of an entry with children: the function it belongs to and the
+    // pc range its locals live in
+    struct Scope {
+        uint64_t offset;
+        uint64_t tag;
+        long function;
+        unsigned long lo, hi;
+    };
+
+    uint64_t offset = 0;
+    while (offset + 11 <= s.info_size) {
+        DwarfCursor c{ s.info + offset, s.info + s.info_size };
+        const uint64_t length = c.u(4);
+        if (length >= 0xfffffff0u || length > s.info_size - offset - 4) break;   // 64-bit DWARF
+        const uint64_t next = offset + 4 + length;
+        c.end = s.info + next;
+
+        DwarfUnit unit;
+        unit.offset = offset;
+        const uint64_t version = c.u(2);
+        uint64_t unit_type = 1;   // DW_UT_compile
+        uint64_t abbrev_offset;
+        if (version >= 5) {
+            unit_type = c.u(1);
+            unit.addr_size = (int)c.u(1);
+            abbrev_offset = c.u(4);
+        } else {
+            abbrev_offset = c.u(4);
+            unit.addr_size = (int)c.u(1);
+        }
+        if (version < 2 || version > 5 || (unit_type != 1 && unit_type != 3) ||
+            (unit.addr_size != 4 && unit.addr_size != 8)) {
+            offset = next;
+            continue;
+        }
+
+        const std::unordered_map<uint64_t, DwarfAbbrev> abbrevs = read_abbrevs(s, abbrev_offset);
+        std::vector<Scope> scopes;
+        while (c.p < c.end && !c.bad) {
+            const uint64_t die = (uint64_t)(c.p - s.info);
+            const uint64_t code = c.uleb();
+            if (code == 0) {
+                if (!scopes.empty()) scopes.pop_back();
+                continue;
+            }
+            auto found = abbrevs.find(code);
+            if (found == abbrevs.end()) break;
+            const DwarfAbbrev& a = found->second;
+
+            DwarfValue name, low, high, frame_base, location, type, size, encoding, count, upper;
+            bool has_low = false, has_high = false, has_location = false, has_frame_base = false;
+            bool has_count = false, has_upper = false;
+            for (const DwarfAttrSpec& spec : a.attrs) {
+                DwarfValue v;
+                read_form(c, spec.form, spec.implicit, unit.addr_size, v);
+                switch (spec.name) {
+                    case AT_name: name = v; break;
+                    case AT_low_pc: low = v; has_low = true; break;
+                    case AT_high_pc: high = v; has_high = true; break;
+                    case AT_frame_base: frame_base = v; has_frame_base = true; break;
+                    case AT_location: location = v; has_location = true; break;
+                    case AT_type: type = v; break;
+                    case AT_byte_size: size = v; break;
+                    case AT_encoding: encoding = v; break;
+                    case AT_count: count = v; has_count = true; break;
+                    case AT_upper_bound: upper = v; has_upper = true; break;
+                    case AT_str_offsets_base: unit.str_offsets_base = v.u; break;
+                    case AT_addr_base: unit.addr_base = v.u; break;
+                    default: break;
+                }
+            }
+            if (c.bad) break;
+
+            // References other than DW_FORM_ref_addr are relative to the unit
+            uint64_t type_ref = 0;
+            if (type.form == FORM_ref_addr) type_ref = type.u;
+            else if (type.form) type_ref = unit.offset + type.u;
+
+            const Scope* parent = scopes.empty() ? nullptr : &scopes.back();
+            Scope scope = { die, a.tag, parent ? parent->function : -1,
+                            parent ? parent->lo : 0, parent ? parent->hi : ~0ul };
+            if (has_low && has_high) {
+                scope.lo = (unsigned long)dwarf_address(s, unit, low);
+                const bool address = high.form == FORM_addr || (high.form >= FORM_addrx1 && high.form <= FORM_addrx4) ||
+                                     high.form == FORM_addrx;
+                scope.hi = address ? (unsigned long)dwarf_address(s, unit, high) : scope.lo + (unsigned long)high.u;
+            }
+
+            switch (a.tag) {
+                case TAG_subprogram: {
+                    scope.function = -1;
+                    if (!has_low || !has_high || !has_frame_base) break;
+                    const long base = frame_base_offset(frame_base);
+                    if (base == LONG_MIN) break;
+                    functions.push_back(FrameFunction{ scope.lo, scope.hi, base, {} });
+                    scope.function = (long)functions.size() - 1;
+                    break;
+                }
+                case TAG_variable:
+                case TAG_formal_parameter: {
+                    long at = 0;
+                    const char* text = dwarf_string(s, unit, name);
+                    if (scope.function < 0 || !has_location || !text || !type_ref) break;
+                    if (!frame_offset(location, at)) break;
+                    pending.push_back(PendingLocal{ (size_t)scope.function, text, type_ref, at,
+                                                    scope.lo, scope.hi });
+                    break;
+                }
+                case TAG_subrange_type:
+                    if (parent && parent->tag == TAG_array_type) {
+                        auto array = types.find(parent->offset);
+                        if (array != types.end()) {
+                            array->second.dims.push_back(has_count ? count.u : has_upper ? upper.u + 1 : 0);
+                        }
+                    }
+                    break;
+                case TAG_array_type: case TAG_base_type: case TAG_pointer_type: case TAG_reference_type:
+                case TAG_rvalue_reference_type: case TAG_const_type: case TAG_volatile_type:
+                case TAG_atomic_type: case TAG_typedef: case TAG_enumeration_type: case TAG_structure_type:
+                case TAG_class_type: case TAG_union_type: {
+                    DwarfType& t = types[die];
+                    t.tag = a.tag;
+                    t.name = dwarf_string(s, unit, name);
+                    t.type = type_ref;
+                    t.byte_size = size.u;
+                    t.encoding = encoding.u;
+                    break;
+                }
+                default:
+                    break;
+            }
+            if (a.children) scopes.push_back(scope);
+        }
+        offset = next;
+    }
+
+    for (const PendingLocal& p : pending) {
+        FrameLocal local;
+        local.name = p.name;
+        local.offset = p.offset;
+        local.lo = p.lo;
+        local.hi = p.hi;
+        if (!classify_type(types, p.type, (int)sizeof(void*), local)) continue;
+        local.type = spell_type(types, p.type);
+        functions[p.function].locals.push_back(local);
+    }
+    std::sort(functions.begin(), functions.end(),
+              [](const FrameFunction& a, const FrameFunction& b) { return a.lo < b.lo; });
+}
+
+// Maps the running executable and reads its DWARF
+static void NO_INSTRUMENT load_frame_tables() {
+    const int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(ElfW(Ehdr))) {
+        map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    const unsigned char* base = (const unsigned char*)map;
+    const size_t file_size = (size_t)st.st_size;
+    const ElfW(Ehdr)* eh = (const ElfW(Ehdr)*)base;
+    const bool valid = memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_shoff &&
+                       eh->e_shstrndx < eh->e_shnum &&
+                       eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) <= file_size;
+    if (valid) {
+        const ElfW(Shdr)* sections = (const ElfW(Shdr)*)(base + eh->e_shoff);
+        const ElfW(Shdr)& names = sections[eh->e_shstrndx];
+        DwarfSections s;
+        for (unsigned int i = 0; i < eh->e_shnum; ++i) {
+            const ElfW(Shdr)& sh = sections[i];
+            // Compressed sections (SHF_COMPRESSED) are not read
+            if (sh.sh_type == SHT_NOBITS || (sh.sh_flags & SHF_COMPRESSED)) continue;
+            if (sh.sh_offset + sh.sh_size > file_size || sh.sh_name >= names.sh_size) continue;
+            const char* name = (const char*)base + names.sh_offset + sh.sh_name;
+            const unsigned char* data = base + sh.sh_offset;
+            if (strcmp(name, ".debug_info") == 0) { s.info = data; s.info_size = sh.sh_size; }
+            else if (strcmp(name, ".debug_abbrev") == 0) { s.abbrev = data; s.abbrev_size = sh.sh_size; }
+            else if (strcmp(name, ".debug_str") == 0) { s.str = data; s.str_size = sh.sh_size; }
+            else if (strcmp(name, ".debug_str_offsets") == 0) { s.str_offsets = data; s.str_offsets_size = sh.sh_size; }
+            else if (strcmp(name, ".debug_addr") == 0) { s.addr = data; s.addr_size = sh.sh_size; }
+        }
+        if (s.info && s.abbrev) read_frame_tables(s);
+    }
+    munmap(map, file_size);
+}
+
+static const FrameFunction* NO_INSTRUMENT find_frame_function(unsigned long pc) {
+    const std::vector<FrameFunction>& functions = get_frame_functions();
+    auto it = std::upper_bound(functions.begin(), functions.end(), pc,
+                               [](unsigned long value, const FrameFunction& f) { return value < f.lo; });
+    if (it == functions.begin()) return nullptr;
+    --it;
+    return pc < it->hi ? &*it : nullptr;
+}
+
+static void NO_INSTRUMENT frame_snapshot(unsigned int point, const char* at, void* pc) {
+    if (!(g_snapshot_points & point) || !(__TRACE_GATE_WORD() & TRACE_CAT_VARS)) return;
+    TRACER_GUARD_ENTER();
+    if (!g_trace_file || g_depth <= 0 || g_depth >= 2048 || g_frame_library[g_depth]) {
+        TRACER_GUARD_EXIT();
+        return;
+    }
+    const ShadowFrame& shadow = g_shadow_stack[g_depth];
+    const unsigned long where = (unsigned long)pc - g_user_load_base;
+    const FrameFunction* function = shadow.frame ? find_frame_function(where) : nullptr;
+    if (!function || function->lo != (unsigned long)shadow.func - g_user_load_base ||
+        g_snapshot_count++ % g_snapshot_every != 0) {
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    {
+        const unsigned char* frame_base = (const unsigned char*)shadow.frame + function->base_offset;
+        JsonBuffer head;
+        head.format("\"at\":\"%s\",\"frame\":\"%p\",\"locals\":[", at, (const void*)frame_base);
+        std::string extra = head.c_str();
+        bool first = true;
+        for (const FrameLocal& local : function->locals) {
+            if (where < local.lo || where >= local.hi) continue;
+            const unsigned char* p = frame_base + local.offset;
+            JsonBuffer item;
+            item.format("%s{\"name\":\"%j\",\"type\":\"%j\",", first ? "" : ",",
+                        local.name.c_str(), local.type.c_str());
+            extra += item.c_str();
+            first = false;
+            if (local.count == 0) {
+                append_typed_value(extra, load_typed(p, local.size, local.tag));
+            } else {
+                static const char* const vtypes[] = {
+                    "none", "i64", "u64", "f64", "f32", "char", "bool", "ptr", "text"
+                };
+                const unsigned long shown = local.count < kSnapshotElements ? local.count : kSnapshotElements;
+                extra += "\"elements\":[";
+                for (unsigned long k = 0; k < shown; ++k) {
+                    if (k) extra += ',';
+                    append_element(extra, p + k * local.size, local.size, local.tag, nullptr);
+                }
+                extra += "],\"vtype\":\"";
+                extra += vtypes[local.tag];
+                extra += '"';
+                if (shown < local.count) extra += ",\"truncated\":true";
+            }
+            extra += '}';
+        }
+        extra += ']';
+        // At the snapshot's pc, so addr2line gives its line
+        write_json_event("frame_snapshot", pc, get_current_function().c_str(), g_depth, extra.c_str());
+    }
+    TRACER_GUARD_EXIT();
+}
+
+// "exit,iteration"
+static void NO_INSTRUMENT init_frame_snapshots() {
+    const char* points = std::getenv("TRACE_SNAPSHOTS");
+    if (!points || !*points) return;
+    if (strstr(points, "exit")) g_snapshot_points |= SNAPSHOT_AT_EXIT;
+    if (strstr(points, "iteration")) g_snapshot_points |= SNAPSHOT_AT_ITERATION;
+    const char* every = std::getenv("TRACE_SNAPSHOT_EVERY");
+    if (every && std::strtoul(every, nullptr, 10) > 0) g_snapshot_every = std::strtoul(every, nullptr, 10);
+    if (g_snapshot_points) load_frame_tables();
+    if (get_frame_functions().empty()) g_snapshot_points = 0;
+}
+
+#else
+
+static void NO_INSTRUMENT frame_snapshot(unsigned int, const char*, void*) {}
+static void NO_INSTRUMENT init_frame_snapshots() {}
+
+#endif
+
+// Name of a called function, and whether it lives in a system library
+struct CallSymbol {
+    const char* name;       // demangled; nullptr when dladdr() finds no symbol
+    bool system_object;
+};
+
+static CallSymbol NO_INSTRUMENT call_symbol(void* func) {
+    CallSymbol symbol = { nullptr, false };
+#ifndef _WIN32
+    Dl_info dlinfo{};
+    if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
+        symbol.name = demangle(dlinfo.dli_sname);
+        symbol.system_object = dlinfo.dli_fname &&
+            (strstr(dlinfo.dli_fname, "/usr/") ||
+             strstr(dlinfo.dli_fname, "/lib/") ||
+             strstr(dlinfo.dli_fname, "libc") ||
+             strstr(dlinfo.dli_fname, "libstdc++"));
+    }
+#endif
+    return symbol;
+}
+
+// Call hooks shared by -finstrument-functions and XRay (see XRAY below),
+// which passes the symbol it looked up once for the function id.
+static void NO_INSTRUMENT trace_call_enter(void* func, void* caller, void* frame, const CallSymbol* known) {
+    TRACER_GUARD_ENTER();
+
+    // Prevent depth overflow before emitting
+    if (++g_depth >= 2048) {
+        --g_depth;
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    g_shadow_stack[g_depth].func = func;
+    g_shadow_stack[g_depth].caller = caller;
+    g_shadow_stack[g_depth].frame = frame;
+    g_shadow_stack[g_depth].event = g_event_counter;
+
+    // Static initializers run before main() and are not traced.
+    if (!g_main_started) {
+        if (func == g_main_func) start_main();
+        else ++g_filtered.pre_main_calls;
+    }
+
+    update_call_triggers(func, true);
+    g_frame_recorded[g_depth] = false;
+    g_frame_library[g_depth] = false;
+    g_shadow_block[g_depth] = 0;
+    if (!(__TRACE_GATE_WORD() & TRACE_CAT_CALLS)) {
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    const char* func_name = "main";
+    const CallSymbol symbol = known ? *known : call_symbol(func);
+    if (symbol.name) {
+        func_name = symbol.name;
+
+        if (g_filter_library && is_library_function(func_name)) {
+            ++g_filtered.library_calls;
+            g_frame_library[g_depth] = true;
+            TRACER_GUARD_EXIT();
+            return;
+        }
+
+        // If symbol lives in system libraries, do not drop the event — mark as user_function
+        if (symbol.system_object) func_name = "user_function";
+    }
+
+    // Whatever the caller changed untraced is reported before the call.
+    shadow_boundary("call", g_depth - 1, -1, caller, nullptr, 0);
+
+    {
+        // Scoped so the temporaries are freed while the guard is still held.
+        std::string fn = normalize_function_name(func_name);
+        get_tracked_functions().insert(fn);
+        get_current_function() = fn;
+
+        // Add call frame
+        CallFrame frame;
+        frame.functionName = fn;
+
+        // Check if we are inside a loop or function call context?
+        // We maintain active loops per function frame.
+
+        get_call_stack().push_back(frame);
     }
+    g_frame_recorded[g_depth] = true;
+    
+    JsonBuffer extra;
+    extra.append_literal("\"caller\":\"");
+    extra.append_pointer(caller);
+    extra.append_literal("\"");
+    write_json_event("func_enter", func, func_name, g_depth, extra.c_str());
+
     TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_array_init_loc(const char* name, void* values, int count,
-                                       const char* file, int line) {
+static void NO_INSTRUMENT trace_call_exit(void* func, const CallSymbol* known) {
     TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    const std::string f = json_safe_path(file);
-    int* intValues = static_cast<int*>(values);
-    
-    for (int i = 0; i < count; i++) {
-        char extra[256];
-        snprintf(extra, sizeof(extra),
-                 "\"name\":\"%s\",\"indices\":[%d],\"value\":%d,\"file\":\"%s\",\"line\":%d",
-                 name, i, intValues[i], f.c_str(), line);
-        
-        write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra);
+
+    if (g_depth <= 0) {
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    // The frame's locals die here; a callee may also have written to its
+    // callers' arrays through pointer parameters.
+    if (!g_frame_library[g_depth]) shadow_boundary("func_exit", -1, 0, func, nullptr, 0);
+    if (g_shadow_stack[g_depth].frame) forget_objects(__builtin_frame_address(0), g_shadow_stack[g_depth].frame);
+
+    // Outside the window, and for library frames, only the frame
+    // bookkeeping is kept balanced
+    if (!(__TRACE_GATE_WORD() & TRACE_CAT_CALLS) || g_frame_library[g_depth]) {
+        if (g_frame_recorded[g_depth] && !g_call_stack.empty()) {
+            g_call_stack.pop_back();
+            g_current_function = g_call_stack.empty() ? "main" : g_call_stack.back().functionName;
+        }
+        g_frame_recorded[g_depth] = false;
+        g_frame_library[g_depth] = false;
+        --g_depth;
+        update_call_triggers(func, false);
+        TRACER_GUARD_EXIT();
+        return;
+    }
+
+    const char* func_name = "main";
+    const CallSymbol symbol = known ? *known : call_symbol(func);
+    if (symbol.name) func_name = symbol.system_object ? "user_function" : symbol.name;
+
+    if (g_frame_recorded[g_depth] && !g_call_stack.empty()) {
+        auto& activeLoops = g_call_stack.back().activeLoops;
+        while (!activeLoops.empty()) {
+            int loopId = activeLoops.back();
+            activeLoops.pop_back();
+            
+            JsonBuffer extra;
+            extra.append_literal("\"loopId\":");
+            extra.append_signed(loopId);
+            extra.append_literal(",\"file\":\"unknown\",\"line\":0");
+            write_json_event("loop_end", nullptr, g_current_function.c_str(), g_depth, extra.c_str());
+        }
         
-        ArrayElementKey key;
-        key.arrayName = name;
-        key.idx1 = i;
-        key.idx2 = -1;
-        key.idx3 = -1;
-        get_array_element_values()[key] = (long long)intValues[i];
+        g_call_stack.pop_back();
+    }
+    
+    if (!g_call_stack.empty()) {
+        g_current_function = g_call_stack.back().functionName;
+    } else {
+        g_current_function = "main";
+    }
+
+    write_json_event("func_exit", func, func_name, g_depth);
+    g_frame_recorded[g_depth] = false;
+    --g_depth;
+    update_call_triggers(func, false);
+
+    TRACER_GUARD_EXIT();
+}
+
+extern "C" void __cyg_profile_func_enter(void* func, void* caller)
+    __attribute__((no_instrument_function));
+void __cyg_profile_func_enter(void* func, void* caller) {
+    // Called after the function's prologue, so the frame pointer the hook
+    // saved is the caller's; programs are built with -fno-omit-frame-pointer.
+    void* const frame = *(void* const*)__builtin_frame_address(0);
+    trace_call_enter(func, caller, frame, nullptr);
+}
+
+extern "C" void __cyg_profile_func_exit(void* func, void* caller)
+    __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* func, void* caller) {
+    (void)caller;
+    frame_snapshot(SNAPSHOT_AT_EXIT, "exit", __builtin_return_address(0));
+    trace_call_exit(func, nullptr);
+}
+
+// ========== XRAY ==========
+// With TRACE_XRAY, calls reach the tracer through XRay sleds instead of
+// -finstrument-functions. A sled is a few NOPs until it is patched: they
+// are patched in at startup and out for good once the window stops, so the
+// rest of the run costs no handler calls. The handler gets a dense function
+// id; each function is symbolized once per id instead of on every call.
+#if defined(TRACE_XRAY)
+
+static std::vector<CallSymbol>& get_xray_symbols() {
+    static std::vector<CallSymbol>* s_xray_symbols = new std::vector<CallSymbol>();
+    return *s_xray_symbols;
+}
+static std::vector<bool>& get_xray_resolved() {
+    static std::vector<bool>* s_xray_resolved = new std::vector<bool>();
+    return *s_xray_resolved;
+}
+static bool g_xray_patched = false;
+
+static const CallSymbol* NO_INSTRUMENT xray_symbol(int32_t fid, void* func) {
+    std::vector<CallSymbol>& symbols = get_xray_symbols();
+    std::vector<bool>& resolved = get_xray_resolved();
+    if (fid < 0 || (size_t)fid >= symbols.size()) return nullptr;
+    if (!resolved[fid]) {
+        // demangle() returns a per-thread buffer
+        CallSymbol symbol = call_symbol(func);
+        if (symbol.name) symbol.name = strdup(symbol.name);
+        symbols[fid] = symbol;
+        resolved[fid] = true;
+    }
+    return &symbols[fid];
+}
+
+static void NO_INSTRUMENT xray_handler(int32_t fid, XRayEntryType type) {
+    void* func = (void*)__xray_function_address(fid);
+    if (g_inside_tracer || !func) return;
+    g_inside_tracer = true;
+    const CallSymbol* symbol = xray_symbol(fid, func);
+    g_inside_tracer = false;
+    switch (type) {
+        case XRayEntryType::ENTRY:
+            // The sled runs before the function's frame is set up, and the
+            // trampoline keeps no caller: neither is reported, so XRay
+            // builds take no frame snapshots
+            trace_call_enter(func, nullptr, nullptr, symbol);
+            break;
+        case XRayEntryType::EXIT:
+        case XRayEntryType::TAIL:
+            trace_call_exit(func, symbol);
+            break;
+        default:
+            break;
+    }
+}
+
+// Called by refresh_gate(): sleds stay patched until the window stops
+static void NO_INSTRUMENT xray_sync_patching() {
+    const bool wanted = !g_window_stopped && !g_tracer_disabled;
+    if (wanted == g_xray_patched) return;
+    g_xray_patched = wanted;
+    if (wanted) __xray_patch();
+    else __xray_unpatch();
+}
+
+static void NO_INSTRUMENT start_xray() {
+    const size_t count = __xray_max_function_id() + 1;
+    get_xray_symbols().assign(count, CallSymbol{ nullptr, false });
+    get_xray_resolved().assign(count, false);
+
+    // Functions under -fxray-instruction-threshold have no sled; if main()
+    // is one of them, tracing starts right away.
+    bool main_has_sled = false;
+    for (size_t fid = 1; fid < count; ++fid) {
+        if ((void*)__xray_function_address((int32_t)fid) == g_main_func) main_has_sled = true;
+    }
+    if (!main_has_sled) g_main_started = true;
+
+    __xray_set_handler(xray_handler);
+    xray_sync_patching();
+}
+
+#endif
+
+static void NO_INSTRUMENT write_heap_alloc(void* ptr, const char* via, size_t size) {
+    JsonBuffer extra;
+    extra.append_literal("\"size\":");
+    extra.append_unsigned(size);
+    extra.append_literal(",\"isHeap\":true");
+    write_json_event("heap_alloc", ptr, via, g_depth, extra.c_str());
+}
+
+void* operator new(std::size_t size) __attribute__((no_instrument_function));
+void* operator new(std::size_t size) {
+    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) return std::malloc(size);
+
+    g_inside_tracer = true;
+
+    void* ptr = std::malloc(size);
+    if (ptr && g_trace_file && !g_tracer_disabled) {
+        write_heap_alloc(ptr, "operator new", size);
+    }
+
+    TRACER_GUARD_EXIT();
+    return ptr;
+}
+
+void* operator new[](std::size_t size) __attribute__((no_instrument_function));
+void* operator new[](std::size_t size) {
+    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) return std::malloc(size);
+
+    g_inside_tracer = true;
+
+    void* ptr = std::malloc(size);
+    if (ptr && g_trace_file && !g_tracer_disabled) {
+        write_heap_alloc(ptr, "operator new[]", size);
+    }
+
+    TRACER_GUARD_EXIT();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept __attribute__((no_instrument_function));
+void operator delete(void* ptr) noexcept {
+    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) { std::free(ptr); return; }
+
+    g_inside_tracer = true;
+
+    if (ptr && g_trace_file && !g_tracer_disabled) {
+        write_json_event("heap_free", ptr, "operator delete", g_depth);
+    }
+    std::free(ptr);
+
+    TRACER_GUARD_EXIT();
+}
+
+void operator delete[](void* ptr) noexcept __attribute__((no_instrument_function));
+void operator delete[](void* ptr) noexcept {
+    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) { std::free(ptr); return; }
+
+    g_inside_tracer = true;
+
+    if (ptr && g_trace_file && !g_tracer_disabled) {
+        write_json_event("heap_free", ptr, "operator delete[]", g_depth);
+    }
+    std::free(ptr);
+
+    TRACER_GUARD_EXIT();
+}
+
+#if !defined(_WIN32)
+extern "C" {
+    static void* (*real_malloc)(std::size_t) = nullptr;
+    static void (*real_free)(void*) = nullptr;
+
+#if defined(__GLIBC__)
+    // Until dlsym() has run (static initializers can allocate first) the
+    // allocator is reached directly; std::malloc would be this hook again.
+    void* __libc_malloc(std::size_t);
+    void __libc_free(void*);
+    #define TRACER_FALLBACK_MALLOC __libc_malloc
+    #define TRACER_FALLBACK_FREE __libc_free
+#else
+    #define TRACER_FALLBACK_MALLOC std::malloc
+    #define TRACER_FALLBACK_FREE std::free
+#endif
+
+    static void NO_INSTRUMENT init_malloc_hooks() __attribute__((constructor));
+    static void NO_INSTRUMENT init_malloc_hooks() {
+        real_malloc = (void*(*)(std::size_t))dlsym(RTLD_NEXT, "malloc");
+        real_free   = (void(*)(void*))dlsym(RTLD_NEXT, "free");
+    }
+
+    void* malloc(std::size_t size) __attribute__((no_instrument_function));
+    void* malloc(std::size_t size) {
+        if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) {
+            return real_malloc ? real_malloc(size) : TRACER_FALLBACK_MALLOC(size);
+        }
+
+        g_inside_tracer = true;
+
+        if (!real_malloc) init_malloc_hooks();
+        void* ptr = real_malloc ? real_malloc(size) : TRACER_FALLBACK_MALLOC(size);
+        if (ptr && g_trace_file && !g_tracer_disabled) {
+            write_heap_alloc(ptr, "malloc", size);
+        }
+
+        TRACER_GUARD_EXIT();
+        return ptr;
+    }
+
+    void free(void* ptr) __attribute__((no_instrument_function));
+    void free(void* ptr) {
+        if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048 ||
+        heap_event_filtered(__builtin_return_address(0))) {
+            if (real_free) { real_free(ptr); } else { TRACER_FALLBACK_FREE(ptr); }
+            return;
+        }
+
+        g_inside_tracer = true;
+
+        if (!real_free) init_malloc_hooks();
+        if (ptr && g_trace_file && !g_tracer_disabled) {
+            write_json_event("heap_free", ptr, "free", g_depth);
+        }
+        if (real_free) {
+            real_free(ptr);
+        } else {
+            TRACER_FALLBACK_FREE(ptr);
+        }
+
+        TRACER_GUARD_EXIT();
+    }
+}
+#endif
+
+// ========== NONDETERMINISTIC INPUT HOOKS ==========
+
+#if !defined(_WIN32)
+static void NO_INSTRUMENT record_input(const char* kind, long long a, long long b = 0) {
+    TraceGuard guard;
+    std::fprintf(g_input_log, "%s %lld %lld\n", kind, a, b);
+    ++g_inputs_recorded;
+}
+
+static bool NO_INSTRUMENT replay_input(ReplayQueue& q, long long* out) {
+    if (q.next >= q.values.size()) {
+        ++g_inputs_missing;
+        return false;
+    }
+    *out = q.values[q.next++];
+    ++g_inputs_replayed;
+    return true;
+}
+
+// Only inputs observed by user code are recorded; the tracer's own clock
+// reads happen with g_inside_tracer set.
+#define INPUT_RECORDING() (g_input_log && !g_inside_tracer)
+#define INPUT_REPLAYING() (g_input_replay && !g_inside_tracer)
+
+static inline long long NO_INSTRUMENT virtual_offset_ns() {
+    return __atomic_load_n(&g_virtual_offset_ns, __ATOMIC_RELAXED);
+}
+
+// CPU-time clocks do not move while a program sleeps.
+static void NO_INSTRUMENT advance_virtual_clock(clockid_t clk, struct timespec* ts) {
+    if (clk == CLOCK_PROCESS_CPUTIME_ID || clk == CLOCK_THREAD_CPUTIME_ID || clk < 0) return;
+    const long long ns = (long long)ts->tv_nsec + virtual_offset_ns();
+    ts->tv_sec += (time_t)(ns / 1000000000LL);
+    ts->tv_nsec = (long)(ns % 1000000000LL);
+}
+
+// Returns true when the sleep was virtualized and must not block.
+static bool NO_INSTRUMENT virtual_sleep(const char* call, long long ns) {
+    if ((!g_virtual_time && !g_input_replay) || g_inside_tracer) return false;
+    if (ns < 0) ns = 0;
+    const long long now = g_virtual_time
+        ? __atomic_add_fetch(&g_virtual_offset_ns, ns, __ATOMIC_RELAXED) : 0;
+    __atomic_add_fetch(&g_virtual_sleeps, 1, __ATOMIC_RELAXED);
+
+    if (g_trace_file && (__TRACE_GATE_WORD() & TRACE_CAT_IO)) {
+        g_inside_tracer = true;
+        JsonBuffer extra;
+        extra.append_literal("\"call\":\"");
+        extra.append(call);
+        extra.append_literal("\",\"duration_ns\":");
+        extra.append_signed(ns);
+        extra.append_literal(",\"virtual_ns\":");
+        extra.append_signed(now);
+        write_json_event("sleep", nullptr, call, g_depth, extra.c_str());
+        g_inside_tracer = false;
+    }
+    return true;
+}
+
+extern "C" {
+    static time_t (*real_time)(time_t*) = nullptr;
+    static int (*real_clock_gettime)(clockid_t, struct timespec*) = nullptr;
+    static int (*real_rand)(void) = nullptr;
+    static void (*real_srand)(unsigned int) = nullptr;
+    static pid_t (*real_getpid)(void) = nullptr;
+    static unsigned int (*real_sleep)(unsigned int) = nullptr;
+    static int (*real_usleep)(useconds_t) = nullptr;
+    static int (*real_nanosleep)(const struct timespec*, struct timespec*) = nullptr;
+    static int (*real_clock_nanosleep)(clockid_t, int, const struct timespec*, struct timespec*) = nullptr;
+
+    static void NO_INSTRUMENT init_input_hooks() __attribute__((constructor));
+    static void NO_INSTRUMENT init_input_hooks() {
+        real_time          = (time_t(*)(time_t*))dlsym(RTLD_NEXT, "time");
+        real_clock_gettime = (int(*)(clockid_t, struct timespec*))dlsym(RTLD_NEXT, "clock_gettime");
+        real_rand          = (int(*)(void))dlsym(RTLD_NEXT, "rand");
+        real_srand         = (void(*)(unsigned int))dlsym(RTLD_NEXT, "srand");
+        real_getpid        = (pid_t(*)(void))dlsym(RTLD_NEXT, "getpid");
+        real_sleep         = (unsigned int(*)(unsigned int))dlsym(RTLD_NEXT, "sleep");
+        real_usleep        = (int(*)(useconds_t))dlsym(RTLD_NEXT, "usleep");
+        real_nanosleep     = (int(*)(const struct timespec*, struct timespec*))dlsym(RTLD_NEXT, "nanosleep");
+        real_clock_nanosleep = (int(*)(clockid_t, int, const struct timespec*, struct timespec*))
+                               dlsym(RTLD_NEXT, "clock_nanosleep");
+    }
+
+    time_t time(time_t* out) __attribute__((no_instrument_function));
+    time_t time(time_t* out) {
+        if (!real_time) init_input_hooks();
+        long long v;
+        time_t value;
+        if (INPUT_REPLAYING() && replay_input(get_replay_inputs().time, &v)) {
+            value = (time_t)v;
+        } else {
+            if (g_virtual_time) {
+                // Same second as a virtual CLOCK_REALTIME read
+                struct timespec now;
+                real_clock_gettime(CLOCK_REALTIME, &now);
+                advance_virtual_clock(CLOCK_REALTIME, &now);
+                value = now.tv_sec;
+            } else {
+                value = real_time(nullptr);
+            }
+            if (INPUT_RECORDING()) record_input("time", (long long)value);
+        }
+        if (out) *out = value;
+        return value;
+    }
+
+    int clock_gettime(clockid_t clk, struct timespec* ts) __attribute__((no_instrument_function));
+    int clock_gettime(clockid_t clk, struct timespec* ts) {
+        if (!real_clock_gettime) init_input_hooks();
+        long long sec, nsec;
+        if (INPUT_REPLAYING() &&
+            replay_input(get_replay_inputs().clock_sec, &sec) &&
+            replay_input(get_replay_inputs().clock_nsec, &nsec)) {
+            ts->tv_sec = (time_t)sec;
+            ts->tv_nsec = (long)nsec;
+            return 0;
+        }
+        const int rc = real_clock_gettime(clk, ts);
+        if (rc == 0 && g_virtual_time) advance_virtual_clock(clk, ts);
+        if (rc == 0 && INPUT_RECORDING()) {
+            record_input("clock", (long long)ts->tv_sec, (long long)ts->tv_nsec);
+        }
+        return rc;
+    }
+
+    int rand(void) __attribute__((no_instrument_function));
+    int rand(void) {
+        if (!real_rand) init_input_hooks();
+        long long v;
+        if (INPUT_REPLAYING() && replay_input(get_replay_inputs().rand, &v)) return (int)v;
+        const int value = real_rand();
+        if (INPUT_RECORDING()) record_input("rand", value);
+        return value;
+    }
+
+    void srand(unsigned int seed) __attribute__((no_instrument_function));
+    void srand(unsigned int seed) {
+        if (!real_srand) init_input_hooks();
+        long long v;
+        if (INPUT_REPLAYING() && replay_input(get_replay_inputs().srand, &v)) seed = (unsigned int)v;
+        else if (INPUT_RECORDING()) record_input("srand", seed);
+        real_srand(seed);
+    }
+
+    pid_t getpid(void) __attribute__((no_instrument_function));
+    pid_t getpid(void) {
+        if (!real_getpid) init_input_hooks();
+        long long v;
+        if (INPUT_REPLAYING() && replay_input(get_replay_inputs().pid, &v)) return (pid_t)v;
+        const pid_t value = real_getpid();
+        if (INPUT_RECORDING()) record_input("getpid", value);
+        return value;
+    }
+
+    // glibc's sleep() and usleep() call an internal nanosleep, so each
+    // member of the family is interposed on its own. std::this_thread::
+    // sleep_for reaches nanosleep() through libstdc++.
+    unsigned int sleep(unsigned int seconds) __attribute__((no_instrument_function));
+    unsigned int sleep(unsigned int seconds) {
+        if (!real_sleep) init_input_hooks();
+        if (virtual_sleep("sleep", (long long)seconds * 1000000000LL)) return 0;
+        return real_sleep(seconds);
+    }
+
+    int usleep(useconds_t usec) __attribute__((no_instrument_function));
+    int usleep(useconds_t usec) {
+        if (!real_usleep) init_input_hooks();
+        if (virtual_sleep("usleep", (long long)usec * 1000LL)) return 0;
+        return real_usleep(usec);
+    }
+
+    int nanosleep(const struct timespec* req, struct timespec* rem) __attribute__((no_instrument_function));
+    int nanosleep(const struct timespec* req, struct timespec* rem) {
+        if (!real_nanosleep) init_input_hooks();
+        if (req && virtual_sleep("nanosleep", (long long)req->tv_sec * 1000000000LL + req->tv_nsec)) {
+            if (rem) rem->tv_sec = rem->tv_nsec = 0;
+            return 0;
+        }
+        return real_nanosleep(req, rem);
+    }
+
+    int clock_nanosleep(clockid_t clk, int flags, const struct timespec* req,
+                        struct timespec* rem) __attribute__((no_instrument_function));
+    int clock_nanosleep(clockid_t clk, int flags, const struct timespec* req,
+                        struct timespec* rem) {
+        if (!real_clock_nanosleep) init_input_hooks();
+        if (req) {
+            long long ns = (long long)req->tv_sec * 1000000000LL + req->tv_nsec;
+            if (flags & TIMER_ABSTIME) {
+                // Deadline on the virtual clock the program has been reading
+                struct timespec now;
+                real_clock_gettime(clk, &now);
+                if (g_virtual_time) advance_virtual_clock(clk, &now);
+                ns -= (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+            }
+            if (virtual_sleep("clock_nanosleep", ns)) {
+                if (rem) rem->tv_sec = rem->tv_nsec = 0;
+                return 0;
+            }
+        }
+        return real_clock_nanosleep(clk, flags, req, rem);
     }
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                                long long value, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    ArrayElementKey key;
-    key.arrayName = name;
-    key.idx1 = idx1;
-    key.idx2 = idx2;
-    key.idx3 = idx3;
-    
-    get_array_element_values()[key] = value;
-    
-    const std::string f = json_safe_path(file);
-    
-    char indices[64];
-    if (idx3 >= 0) {
-        snprintf(indices, sizeof(indices), "[%d,%d,%d]", idx1, idx2, idx3);
-    } else if (idx2 >= 0) {
-        snprintf(indices, sizeof(indices), "[%d,%d]", idx1, idx2);
-    } else {
-        snprintf(indices, sizeof(indices), "[%d]", idx1);
+#if defined(TRACER_CAPTURE_IO)
+static int g_stdin_pipe = -1;                           // read end of the fd 0 pipe, for FIONREAD
+static volatile unsigned long long g_stdin_relayed = 0; // bytes written into the pipe
+static unsigned long long g_stdin_reported = 0;         // bytes already recorded as consumed
+static std::string* g_stdin_pending = nullptr;          // relayed but not yet recorded
+static pthread_mutex_t g_stdin_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// stdin is captured at the descriptor level rather than by interposing read():
+// glibc's stdio (scanf, std::cin) reads through an internal entry point that
+// cannot be interposed. A tee thread copies the original stdin into a pipe
+// that replaces fd 0, and into <log>.stdin when recording inputs. With I/O
+// capture on, every chunk is counted into the pipe under g_stdin_lock so the
+// bytes consumed by the program can be worked out at any event.
+static void NO_INSTRUMENT stdin_tee(int source, int sink, int log_fd) {
+    g_inside_tracer = true;  // this thread's allocations are the tracer's
+    // The program may close stdin early; get EPIPE instead of dying.
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &block, nullptr);
+
+    char buf[4096];
+    for (;;) {
+        const ssize_t n = read(source, buf, sizeof(buf));
+        if (n <= 0) break;
+        if (log_fd >= 0 && write(log_fd, buf, (size_t)n) != n) break;
+        ssize_t off = 0;
+        while (off < n) {
+#if defined(TRACER_CAPTURE_IO)
+            // The sink is non-blocking, so the lock is never held while the
+            // pipe is full and the program is busy elsewhere.
+            pthread_mutex_lock(&g_stdin_lock);
+            const ssize_t w = write(sink, buf + off, (size_t)(n - off));
+            if (w > 0 && g_stdin_pending) {
+                g_stdin_pending->append(buf + off, (size_t)w);
+                g_stdin_relayed += (unsigned long long)w;
+            }
+            pthread_mutex_unlock(&g_stdin_lock);
+            if (w < 0 && errno == EAGAIN) {
+                struct pollfd pfd;
+                pfd.fd = sink;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+#else
+            const ssize_t w = write(sink, buf + off, (size_t)(n - off));
+#endif
+            if (w <= 0) break;
+            off += w;
+        }
+        if (off < n) break;
     }
-    
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"indices\":%s,\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-             name, indices, value, f.c_str(), line);
-    
-    write_json_event("array_index_assign", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+    close(sink);
+    if (log_fd >= 0) close(log_fd);
+    close(source);
 }
 
-extern "C" void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
-                                          const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+// Replaces fd 0 with a pipe fed by stdin_tee.
+static bool NO_INSTRUMENT relay_stdin(int log_fd) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+#if defined(TRACER_CAPTURE_IO)
+    if (g_io_capture) {
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);  // best-effort: fewer tee wakeups
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        g_stdin_pending = new std::string();
+        g_stdin_pipe = fcntl(fds[0], F_DUPFD_CLOEXEC, 3);
+    }
+#endif
+    const int source = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    std::thread(stdin_tee, source, fds[1], log_fd).detach();
+    return true;
+}
 
-    std::string aliasOfName = "unknown";
-    if (get_address_to_name().count(aliasedAddress)) {
-        aliasOfName = get_address_to_name()[aliasedAddress];
+static void NO_INSTRUMENT start_input_recording(const char* path) {
+    g_input_log = std::fopen(path, "w");
+    if (!g_input_log) return;
+    // Unbuffered: forked checkpoints must not flush a copy of pending records.
+    setvbuf(g_input_log, NULL, _IONBF, 0);
+
+    std::string stdin_path = std::string(path) + ".stdin";
+    const int log_fd = open(stdin_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (log_fd >= 0 && !relay_stdin(log_fd)) close(log_fd);
+}
+
+static void NO_INSTRUMENT start_input_replay(const char* path) {
+    FILE* in = std::fopen(path, "r");
+    if (!in) return;
+
+    ReplayInputs& r = get_replay_inputs();
+    char kind[16];
+    long long a, b;
+    while (std::fscanf(in, "%15s %lld %lld", kind, &a, &b) == 3) {
+        if (strcmp(kind, "time") == 0) r.time.values.push_back(a);
+        else if (strcmp(kind, "clock") == 0) { r.clock_sec.values.push_back(a); r.clock_nsec.values.push_back(b); }
+        else if (strcmp(kind, "rand") == 0) r.rand.values.push_back(a);
+        else if (strcmp(kind, "srand") == 0) r.srand.values.push_back(a);
+        else if (strcmp(kind, "getpid") == 0) r.pid.values.push_back(a);
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"aliasOf\":\"%s\",\"aliasedAddress\":\"%p\",\"decayedFromArray\":%s,\"file\":\"%s\",\"line\":%d",
-             name, aliasOfName.c_str(), aliasedAddress, decayedFromArray ? "true" : "false", f.c_str(), line);
-    
-    write_json_event("pointer_alias", aliasedAddress, get_current_function().c_str(), g_depth, extra);
-    
-    PointerInfo pinfo;
-    pinfo.pointerName = name;
-    pinfo.aliasedAddress = aliasedAddress;
-    pinfo.isHeap = false;
-    pinfo.heapAddress = nullptr;
-    
-    if (!get_call_stack().empty()) {
-        get_call_stack().back().pointerAliases[name] = pinfo;
-    } else {
-        get_pointer_registry()[name] = pinfo;
+    std::fclose(in);
+    g_input_replay = true;
+
+    std::string stdin_path = std::string(path) + ".stdin";
+    const int fd = open(stdin_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        dup2(fd, STDIN_FILENO);
+        close(fd);
     }
-    TRACER_GUARD_EXIT();
 }
+#endif
 
-extern "C" void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
-                                                const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    const std::string f = json_safe_path(file);
+// ========== PROGRAM I/O CAPTURE (GLIBC) ==========
+// fds 1 and 2 are replaced by pipes. output_relay passes everything that
+// reaches them on to the original descriptors and keeps it until the next
+// event: stdio, write(2), flushes glibc makes on its own and the output of
+// child processes alike. Before each event stdio's buffers are flushed (when
+// __fpending() says they hold anything) and the pipes drained, so output sits
+// in the trace exactly where the program produced it.
+//
+// Input comes through stdin_tee. What the program has consumed so far is
+//   relayed - still in the pipe - still in stdin's buffer
+// so each "stdin" event carries exactly the bytes read since the previous
+// event, whether through stdio, std::cin or read(2).
 
-    PointerInfo* pinfo = findPointerInfo(ptrName);
+#if defined(TRACER_CAPTURE_IO)
+// One of the program's output descriptors, as the tracer sees it
+struct OutputCapture {
+    const char* stream;
+    int fd;                    // STDOUT_FILENO or STDERR_FILENO
+    int pipe;                  // read end, non-blocking; -1 when not captured
+    int sink;                  // the original descriptor
+    std::string* pending;      // relayed, not yet recorded
+};
+static OutputCapture g_outputs[2] = {
+    { "stdout", STDOUT_FILENO, -1, -1, nullptr },
+    { "stderr", STDERR_FILENO, -1, -1, nullptr },
+};
+static pthread_mutex_t g_output_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread bool g_io_draining = false;
 
-    std::string targetName = "unknown";
-    bool isHeap = false;
-    void* targetAddress = nullptr;
+static void NO_INSTRUMENT record_io(const char* stream, const char* data, size_t n) {
+    if (!(__TRACE_GATE_WORD() & TRACE_CAT_IO)) return;
+    std::string extra = "\"text\":\"";
+    json_escape(extra, data, n);
+    extra += "\",\"bytes\":";
+    extra += std::to_string(n);
+    write_json_event(stream, nullptr, stream, g_depth, extra.c_str());
+    ++g_io_events;
+}
 
-    if (pinfo) {
-        isHeap = pinfo->isHeap;
-        targetAddress = pinfo->aliasedAddress;
-        if (get_address_to_name().count(targetAddress)) {
-            targetName = get_address_to_name()[targetAddress];
+// Moves what is in the pipe to the original descriptor and to `pending`.
+// Called with g_output_lock held.
+static void NO_INSTRUMENT relay_output(OutputCapture& o) {
+    char buf[16384];
+    for (;;) {
+        const ssize_t n = read(o.pipe, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        o.pending->append(buf, (size_t)n);
+        for (ssize_t off = 0; off < n;) {
+            const ssize_t w = write(o.sink, buf + off, (size_t)(n - off));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;  // the reader went away; the output stays in the trace
+            off += w;
         }
     }
-    
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"pointerName\":\"%s\",\"value\":%lld,\"targetName\":\"%s\",\"isHeap\":%s,\"file\":\"%s\",\"line\":%d",
-             ptrName, value, targetName.c_str(), isHeap ? "true" : "false", f.c_str(), line);
-    write_json_event("pointer_deref_write", targetAddress, get_current_function().c_str(), g_depth, extra);
-    
-    if (isHeap) {
-        char heap_extra[512];
-        snprintf(heap_extra, sizeof(heap_extra),
-                 "\"address\":\"%p\",\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-                 targetAddress, value, f.c_str(), line);
-        write_json_event("heap_write", targetAddress, get_current_function().c_str(), g_depth, heap_extra);
-    }
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_declare_loc(const char* name, const char* type, void* address,
-                                    const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
+// Keeps output moving while the program runs between events, so a full pipe
+// never blocks it. Ends once every writer is gone.
+static void NO_INSTRUMENT output_relay() {
+    g_inside_tracer = true;  // this thread's allocations are the tracer's
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &block, nullptr);
 
-    get_address_to_name()[address] = name;
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"varType\":\"%s\",\"value\":null,\"address\":\"%p\",\"file\":\"%s\",\"line\":%d",
-             name, type, address, f.c_str(), line);
-    write_json_event("declare", address, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
-}
+    for (;;) {
+        struct pollfd pfds[2];
+        int count = 0;
+        pthread_mutex_lock(&g_output_lock);
+        for (const OutputCapture& o : g_outputs) {
+            if (o.pipe < 0) continue;
+            pfds[count].fd = o.pipe;
+            pfds[count].events = POLLIN;
+            pfds[count].revents = 0;
+            ++count;
+        }
+        pthread_mutex_unlock(&g_output_lock);
+        if (count == 0) return;
+        if (poll(pfds, (nfds_t)count, -1) < 0 && errno != EINTR) return;
 
-extern "C" void __trace_assign_loc(const char* name, long long value,
-                                   const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    get_variable_values()[name] = value;
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("assign", nullptr, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
+        bool open = false;
+        pthread_mutex_lock(&g_output_lock);
+        for (int i = 0; i < count; ++i) {
+            for (OutputCapture& o : g_outputs) {
+                if (o.pipe != pfds[i].fd) continue;
+                relay_output(o);
+                // POLLHUP with nothing left to read: no writer remains
+                if (!(pfds[i].revents & POLLHUP) || (pfds[i].revents & POLLIN)) open = true;
+            }
+        }
+        pthread_mutex_unlock(&g_output_lock);
+        if (!open) return;
+    }
 }
 
-extern "C" void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
-                                               const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    PointerInfo pinfo;
-    pinfo.pointerName = ptrName;
-    pinfo.aliasedAddress = heapAddr;
-    pinfo.isHeap = true;
-    pinfo.heapAddress = heapAddr;
-    
-    if (!get_call_stack().empty()) {
-        get_call_stack().back().pointerAliases[ptrName] = pinfo;
+static void NO_INSTRUMENT lock_outputs() { pthread_mutex_lock(&g_output_lock); }
+static void NO_INSTRUMENT unlock_outputs() { pthread_mutex_unlock(&g_output_lock); }
+
+static void NO_INSTRUMENT start_output_capture() {
+    static bool s_atfork = false;
+    if (!s_atfork) {
+        // A fork() must not leave the child with the lock held by the relay
+        pthread_atfork(lock_outputs, unlock_outputs, unlock_outputs);
+        s_atfork = true;
     }
-    
-    get_pointer_registry()[ptrName] = pinfo;
-    TRACER_GUARD_EXIT();
+    bool started = false;
+    for (OutputCapture& o : g_outputs) {
+        const int sink = fcntl(o.fd, F_DUPFD_CLOEXEC, 3);
+        if (sink < 0) continue;  // closed: nothing to capture
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            close(sink);
+            continue;
+        }
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);  // best-effort: fewer relay wakeups
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        dup2(fds[1], o.fd);  // without FD_CLOEXEC: exec'd children write here too
+        close(fds[1]);
+        o.pipe = fds[0];
+        o.sink = sink;
+        if (!o.pending) o.pending = new std::string();
+        started = true;
+    }
+    if (started) std::thread(output_relay).detach();
 }
 
-extern "C" void __trace_control_flow_loc(const char* controlType, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"controlType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             controlType, f.c_str(), line);
-    write_json_event("control_flow", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+// Puts the original descriptors back behind fds 1 and 2 and passes on what
+// is left in the pipes. `wait` is false from _exit(), which a signal handler
+// may call while this thread holds the lock.
+static void NO_INSTRUMENT stop_output_capture(bool wait) {
+    if (wait) pthread_mutex_lock(&g_output_lock);
+    else if (pthread_mutex_trylock(&g_output_lock) != 0) return;
+    for (OutputCapture& o : g_outputs) {
+        if (o.pipe < 0) continue;
+        dup2(o.sink, o.fd);
+        relay_output(o);
+        close(o.pipe);
+        close(o.sink);
+        o.pipe = o.sink = -1;
+    }
+    pthread_mutex_unlock(&g_output_lock);
 }
 
-extern "C" void __trace_loop_start_loc(int loopId, const char* loopType, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    if (!get_call_stack().empty()) {
-        get_call_stack().back().activeLoops.push_back(loopId);
-        get_call_stack().back().loopIterations[loopId] = 0;
+// A forked checkpoint has its own fds 1 and 2; the pipes are the parent's.
+static void NO_INSTRUMENT drop_output_capture() {
+    for (OutputCapture& o : g_outputs) {
+        if (o.pipe < 0) continue;
+        close(o.pipe);
+        close(o.sink);
+        o.pipe = o.sink = -1;
+        o.pending->clear();
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"loopType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             loopId, loopType, f.c_str(), line);
-    write_json_event("loop_start", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_loop_body_start_loc(int loopId, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    int iteration = 0;
-    if (!get_call_stack().empty()) {
-        iteration = ++get_call_stack().back().loopIterations[loopId];
+static void NO_INSTRUMENT drain_outputs() {
+    // stdio's buffers go into the pipes first
+    if (__fpending(stdout) > 0) fflush(stdout);
+    if (__fpending(stderr) > 0) fflush(stderr);
+
+    std::string text[2];
+    pthread_mutex_lock(&g_output_lock);
+    for (int i = 0; i < 2; ++i) {
+        OutputCapture& o = g_outputs[i];
+        if (o.pipe < 0) continue;
+        relay_output(o);
+        text[i].swap(*o.pending);
+    }
+    pthread_mutex_unlock(&g_output_lock);
+
+    for (int i = 0; i < 2; ++i) {
+        if (!text[i].empty()) record_io(g_outputs[i].stream, text[i].data(), text[i].size());
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, iteration, f.c_str(), line);
-    write_json_event("loop_body_start", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __trace_loop_iteration_end_loc(int loopId, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    int iteration = 0;
-    if (!get_call_stack().empty()) {
-        iteration = get_call_stack().back().loopIterations[loopId];
+static void NO_INSTRUMENT drain_input() {
+    // Nothing is outstanding until the tee relays more input.
+    if (g_stdin_pipe < 0 || g_stdin_relayed == g_stdin_reported) return;
+
+    std::string consumed;
+    pthread_mutex_lock(&g_stdin_lock);
+    int in_pipe = 0;
+    if (ioctl(g_stdin_pipe, FIONREAD, &in_pipe) != 0) in_pipe = 0;
+    // Read without the stream lock: another thread may be blocked in scanf.
+    const long buffered = stdin->_IO_read_end > stdin->_IO_read_ptr
+                              ? (long)(stdin->_IO_read_end - stdin->_IO_read_ptr) : 0;
+    const unsigned long long total = g_stdin_relayed - (unsigned long long)in_pipe - (unsigned long long)buffered;
+    if (total > g_stdin_reported && total <= g_stdin_relayed) {
+        const size_t n = (size_t)(total - g_stdin_reported);
+        consumed.assign(*g_stdin_pending, 0, n);
+        g_stdin_pending->erase(0, n);
+        g_stdin_reported = total;
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, iteration, f.c_str(), line);
-    write_json_event("loop_iteration_end", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+    pthread_mutex_unlock(&g_stdin_lock);
+
+    if (!consumed.empty()) record_io("stdin", consumed.data(), consumed.size());
 }
 
-extern "C" void __trace_loop_end_loc(int loopId, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    
-    if (!get_call_stack().empty()) {
-        auto& loops = get_call_stack().back().activeLoops;
-        auto it = std::find(loops.begin(), loops.end(), loopId);
-        if (it != loops.end()) {
-            loops.erase(it);
+static void NO_INSTRUMENT capture_program_io() {
+    if (g_io_draining) return;
+    g_io_draining = true;
+    drain_input();
+    drain_outputs();
+    g_io_draining = false;
+}
+
+// The backend runs programs with stdin on /dev/null; a tee would only wait
+// there for input that never comes.
+static bool NO_INSTRUMENT stdin_has_input() {
+    struct stat in, null;
+    if (fstat(STDIN_FILENO, &in) != 0) return false;
+    if (!S_ISCHR(in.st_mode)) return true;
+    return stat("/dev/null", &null) != 0 || in.st_rdev != null.st_rdev;
+}
+
+static void NO_INSTRUMENT start_io_capture() {
+    start_output_capture();
+    // Input recording has already put the tee in front of fd 0.
+    if (g_stdin_pipe < 0 && stdin_has_input()) relay_stdin(-1);
+}
+#endif
+
+// ========== COMPRESSED OUTPUT ==========
+// TRACE_COMPRESS=lz4 writes the trace as "TLZ4" followed by blocks of
+// { u32 rawSize, u32 storedSize, data }, each up to 64 KiB of JSON text in
+// LZ4 block format with no references outside the block, so every block
+// decodes on its own (see trace-compression.service.js). The high bit of
+// storedSize marks a block kept uncompressed because it would not shrink.
+// The text is the same as an uncompressed trace. The last, partial block is
+// written on exit, and also on a fatal signal, SIGTERM (the backend's
+// timeout) or _exit(); only SIGKILL loses it.
+
+#if defined(TRACER_COMPRESS)
+static const size_t kCompressBlockSize = 64 * 1024;
+static const size_t kCompressBound = kCompressBlockSize + kCompressBlockSize / 255 + 16;
+static const unsigned int kLz4HashLog = 12;
+
+struct CompressedOutput {
+    int fd;
+    size_t used;
+    unsigned char raw[kCompressBlockSize];
+    unsigned char packed[8 + kCompressBound];
+    uint32_t table[1u << kLz4HashLog];
+};
+
+static bool g_compress_output = false;          // TRACE_COMPRESS=lz4
+static CompressedOutput* g_compressed = nullptr;
+static pid_t g_compressed_owner = 0;            // process that opened it
+
+static inline uint32_t NO_INSTRUMENT lz4_read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned char* NO_INSTRUMENT lz4_put_length(unsigned char* op, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+// One sequence: literals [anchor, anchor + literals), then a match of
+// match_length (>= 4) bytes at `offset` back, or none when offset is 0.
+static unsigned char* NO_INSTRUMENT lz4_put_sequence(unsigned char* op, const unsigned char* anchor,
+                                                     size_t literals, size_t offset, size_t match_length) {
+    const size_t extra = offset ? match_length - 4 : 0;
+    unsigned char* token = op++;
+    *token = (unsigned char)(((literals >= 15 ? 15 : literals) << 4) | (extra >= 15 ? 15 : extra));
+    if (literals >= 15) op = lz4_put_length(op, literals);
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (!offset) return op;
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    if (extra >= 15) op = lz4_put_length(op, extra);
+    return op;
+}
+
+// Greedy LZ4 block compression with a 4 KiB-entry hash of 4-byte prefixes.
+// Keeps the format's end rules: no match starts in the last 12 bytes and
+// the last 5 bytes are always literals. Returns the packed size.
+static size_t NO_INSTRUMENT lz4_compress_block(const unsigned char* src, size_t n, unsigned char* dst,
+                                               uint32_t* table) {
+    const unsigned char* end = src + n;
+    const unsigned char* anchor = src;
+    unsigned char* op = dst;
+    if (n > 12) {
+        memset(table, 0, sizeof(uint32_t) << kLz4HashLog);
+        const unsigned char* match_start_limit = end - 12;
+        const unsigned char* match_end_limit = end - 5;
+        const unsigned char* ip = src + 1;
+        while (ip <= match_start_limit) {
+            const uint32_t sequence = lz4_read32(ip);
+            const uint32_t h = (sequence * 2654435761u) >> (32 - kLz4HashLog);
+            const unsigned char* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > 0xffff || lz4_read32(ref) != sequence) {
+                ++ip;
+                continue;
+            }
+            const unsigned char* m = ip + 4;
+            const unsigned char* r = ref + 4;
+            while (m < match_end_limit && *m == *r) { ++m; ++r; }
+            op = lz4_put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(m - ip));
+            ip = anchor = m;
         }
-        get_call_stack().back().loopIterations.erase(loopId);
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, f.c_str(), line);
-    write_json_event("loop_end", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+    op = lz4_put_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    return (size_t)(op - dst);
 }
 
-extern "C" void __trace_loop_condition_loc(int loopId, int result, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"result\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, result, f.c_str(), line);
-    write_json_event("loop_condition", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+static void NO_INSTRUMENT compressed_write_all(int fd, const unsigned char* p, size_t n) {
+    while (n > 0) {
+        const ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        p += w;
+        n -= (size_t)w;
+    }
 }
 
-extern "C" void __trace_return_loc(long long value, const char* returnType, 
-                                    const char* destinationSymbol, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    
-    if (destinationSymbol && destinationSymbol[0] != '\0') {
-        snprintf(extra, sizeof(extra),
-                 "\"value\":%lld,\"returnType\":\"%s\",\"destinationSymbol\":\"%s\",\"file\":\"%s\",\"line\":%d",
-                 value, returnType ? returnType : "auto", destinationSymbol, f.c_str(), line);
-    } else {
-        snprintf(extra, sizeof(extra),
-                 "\"value\":%lld,\"returnType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-                 value, returnType ? returnType : "auto", f.c_str(), line);
+static void NO_INSTRUMENT compressed_flush_block(CompressedOutput* out) {
+    if (out->used == 0) return;
+    const uint32_t raw_size = (uint32_t)out->used;
+    size_t packed = lz4_compress_block(out->raw, out->used, out->packed + 8, out->table);
+    uint32_t stored = (uint32_t)packed;
+    if (packed >= out->used) {
+        memcpy(out->packed + 8, out->raw, out->used);
+        packed = out->used;
+        stored = (uint32_t)packed | 0x80000000u;
     }
-    
-    write_json_event("return", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+    memcpy(out->packed, &raw_size, 4);
+    memcpy(out->packed + 4, &stored, 4);
+    compressed_write_all(out->fd, out->packed, 8 + packed);
+    out->used = 0;
 }
 
-extern "C" void __trace_block_enter_loc(int blockDepth, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d",
-             blockDepth, f.c_str(), line);
-    write_json_event("block_enter", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+static ssize_t NO_INSTRUMENT compressed_write(void* cookie, const char* buf, size_t size) {
+    CompressedOutput* out = (CompressedOutput*)cookie;
+    size_t done = 0;
+    while (done < size) {
+        size_t n = kCompressBlockSize - out->used;
+        if (n > size - done) n = size - done;
+        memcpy(out->raw + out->used, buf + done, n);
+        out->used += n;
+        done += n;
+        if (out->used == kCompressBlockSize) compressed_flush_block(out);
+    }
+    return (ssize_t)size;
 }
 
-extern "C" void __trace_block_exit_loc(int blockDepth, const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d",
-             blockDepth, f.c_str(), line);
-    write_json_event("block_exit", nullptr, get_current_function().c_str(), g_depth, extra);
-    TRACER_GUARD_EXIT();
+static int NO_INSTRUMENT compressed_close(void* cookie) {
+    CompressedOutput* out = (CompressedOutput*)cookie;
+    compressed_flush_block(out);
+    const int rc = close(out->fd);
+    if (g_compressed == out) g_compressed = nullptr;
+    std::free(out);
+    return rc;
 }
 
-extern "C" void trace_var_int_loc(const char* name, int value,
-                                   const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%d,\"type\":\"int\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
-}
+static void NO_INSTRUMENT flush_compressed_at_death();
 
-extern "C" void trace_var_long_loc(const char* name, long long value,
-                                    const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%lld,\"type\":\"long\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
+static void NO_INSTRUMENT compressed_signal_handler(int sig) {
+    flush_compressed_at_death();
+    // Let the original disposition report the crash
+    signal(sig, SIG_DFL);
+    raise(sig);
 }
 
-extern "C" void trace_var_double_loc(const char* name, double value,
-                                      const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%f,\"type\":\"double\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
+// Handlers the program installs later take over, as they would untraced
+static void NO_INSTRUMENT install_compressed_signal_handlers() {
+    static bool s_installed = false;
+    if (s_installed) return;
+    s_installed = true;
+
+    // Stack overflows are a common crash; the handler needs its own stack
+    static char s_alt_stack[64 * 1024];
+    stack_t ss;
+    ss.ss_sp = s_alt_stack;
+    ss.ss_size = sizeof(s_alt_stack);
+    ss.ss_flags = 0;
+    sigaltstack(&ss, nullptr);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = compressed_signal_handler;
+    sa.sa_flags = SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    const int signals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGBUS, SIGTERM };
+    for (int sig : signals) sigaction(sig, &sa, nullptr);
 }
 
-extern "C" void trace_var_ptr_loc(const char* name, void* value,
-                                  const char* file, int line) {
-    TRACER_GUARD_ENTER();
-    if (!g_trace_file) { TRACER_GUARD_EXIT(); return; }
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":\"%p\",\"type\":\"pointer\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
-    TRACER_GUARD_EXIT();
+static FILE* NO_INSTRUMENT open_compressed_output(const char* path) {
+    CompressedOutput* out = (CompressedOutput*)std::malloc(sizeof(CompressedOutput));
+    if (!out) return nullptr;
+    out->used = 0;
+    out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out->fd < 0) {
+        std::free(out);
+        return nullptr;
+    }
+    compressed_write_all(out->fd, (const unsigned char*)"TLZ4", 4);
+
+    cookie_io_functions_t io;
+    memset(&io, 0, sizeof(io));
+    io.write = compressed_write;
+    io.close = compressed_close;
+    FILE* file = fopencookie(out, "w", io);
+    if (!file) {
+        close(out->fd);
+        std::free(out);
+        return nullptr;
+    }
+    g_compressed = out;
+    g_compressed_owner = (pid_t)syscall(SYS_getpid);
+    install_compressed_signal_handlers();
+    return file;
 }
 
-extern "C" void trace_var_str_loc(const char* name, const char* value,
-                                  const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char escaped[256];
-    int j = 0;
-    for (int i = 0; value && value[i] && i < 250; ++i) {
-        if (value[i] == '"' || value[i] == '\\') escaped[j++] = '\\';
-        escaped[j++] = value[i];
-    }
-    escaped[j] = '\0';
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":\"%s\",\"type\":\"string\",\"file\":\"%s\",\"line\":%d",
-             name, escaped, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+// A forked copy must not write the block it inherited: the parent owns it.
+static void NO_INSTRUMENT drop_compressed_block() {
+    if (g_compressed) g_compressed->used = 0;
 }
 
-extern "C" void trace_var_int(const char* name, int value) {
-    trace_var_int_loc(name, value, "unknown", 0);
+// The process is ending without closing the trace. Only the process that
+// opened the output writes its block; a forked child (of the program or a
+// checkpoint) shares the descriptor, not the block.
+static void NO_INSTRUMENT flush_compressed_at_death() {
+    if (g_compressed && g_compressed_owner == (pid_t)syscall(SYS_getpid)) compressed_flush_block(g_compressed);
 }
-extern "C" void trace_var_long(const char* name, long long value) {
-    trace_var_long_loc(name, value, "unknown", 0);
+
+extern "C" {
+    void _exit(int status) __attribute__((no_instrument_function, noreturn));
+    void _exit(int status) {
+        stop_output_capture(false);
+        flush_compressed_at_death();
+        syscall(SYS_exit_group, status);
+        __builtin_unreachable();
+    }
+
+    void _Exit(int status) noexcept __attribute__((no_instrument_function, noreturn));
+    void _Exit(int status) noexcept {
+        stop_output_capture(false);
+        flush_compressed_at_death();
+        syscall(SYS_exit_group, status);
+        __builtin_unreachable();
+    }
 }
-extern "C" void trace_var_double(const char* name, double value) {
-    trace_var_double_loc(name, value, "unknown", 0);
+#endif
+
+// ========== COLUMNAR OUTPUT ==========
+// TRACE_COLUMNS=1 also writes every event, column by column, to
+// "<output>.cols". Analytics that scan one or two attributes over many
+// events read only those columns (see trace-columns.service.js). The JSON
+// trace is written as usual. The layout, all little endian:
+//
+//   "TCOL" u32 version
+//   records, each starting with a u8 kind:
+//     1 string   u32 id, u32 length, text (JSON-escaped, unquoted)
+//     2 site     u32 id, u32 file string id, i32 line
+//     3 segment  u32 rows, u64 first event id, u8 column count, then per
+//                column: u8 column, u8 width, i64 min, i64 max,
+//                u32 rawSize, u32 storedSize, data
+//
+// A segment holds up to 4096 consecutive events. Each column in it is one
+// LZ4 block of fixed-width values, compressed on its own like the blocks of
+// TRACE_COMPRESS=lz4 (the high bit of storedSize marks stored data). min
+// and max let readers skip a segment without decoding it; a column with no
+// values in the segment has min > max. Strings and sites are written before
+// the first segment that uses them, and ids start over with every file.
+
+#if defined(TRACER_COMPRESS)
+static const unsigned int kColumnVersion = 1;
+static const size_t kColumnRows = 4096;
+static const uint32_t kNoSite = 0xffffffffu;
+static const int64_t kNoValue = INT64_MIN;
+
+enum ColumnId : unsigned char {
+    COLUMN_TYPE,     // u16 string id of the event type
+    COLUMN_SITE,     // u32 site id, kNoSite for events without a line
+    COLUMN_FUNC,     // u32 string id of the function
+    COLUMN_DEPTH,    // i32 call depth
+    COLUMN_VALUE,    // i64 integer "value" member, kNoValue when absent
+    COLUMN_ADDRESS,  // u64 event address
+    COLUMN_TS,       // u32 timestamp, as in the JSON "ts"
+    COLUMN_COUNT
+};
+
+static const unsigned char kColumnWidth[COLUMN_COUNT] = { 2, 4, 4, 4, 8, 8, 4 };
+static const size_t kColumnBound = kColumnRows * 8 + kColumnRows * 8 / 255 + 16;
+
+struct ColumnOutput {
+    int fd;
+    size_t rows;
+    unsigned long first_id;
+    uint16_t type[kColumnRows];
+    uint32_t site[kColumnRows];
+    uint32_t func[kColumnRows];
+    int32_t depth[kColumnRows];
+    int64_t value[kColumnRows];
+    uint64_t address[kColumnRows];
+    uint32_t ts[kColumnRows];
+    JsonBuffer dictionary;  // string and site records not written yet
+    std::unordered_map<std::string_view, uint32_t> strings;
+    std::unordered_map<uint64_t, uint32_t> sites;
+    unsigned char packed[8 + kColumnBound];
+    uint32_t table[1u << kLz4HashLog];
+};
+
+static bool g_column_output = false;  // TRACE_COLUMNS=1
+
+static void NO_INSTRUMENT column_put32(JsonBuffer& out, uint32_t v) {
+    out.append((const char*)&v, sizeof(v));
 }
-extern "C" void trace_var_ptr(const char* name, void* value) {
-    trace_var_ptr_loc(name, value, "unknown", 0);
+
+// Id of an escaped string; a new one is queued in the dictionary
+static uint32_t NO_INSTRUMENT column_string(ColumnOutput* out, const char* s, size_t n) {
+    auto it = out->strings.find(std::string_view(s, n));
+    if (it != out->strings.end()) return it->second;
+
+    char* copy = (char*)tracer_malloc(n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    const uint32_t id = (uint32_t)out->strings.size();
+    out->strings.emplace(std::string_view(copy, n), id);
+
+    out->dictionary.append("\x01", 1);
+    column_put32(out->dictionary, id);
+    column_put32(out->dictionary, (uint32_t)n);
+    out->dictionary.append(copy, n);
+    return id;
 }
-extern "C" void trace_var_str(const char* name, const char* value) {
-    trace_var_str_loc(name, value, "unknown", 0);
+
+static uint32_t NO_INSTRUMENT column_site(ColumnOutput* out, uint32_t file, int line) {
+    const uint64_t key = ((uint64_t)file << 32) | (uint32_t)line;
+    auto it = out->sites.find(key);
+    if (it != out->sites.end()) return it->second;
+
+    const uint32_t id = (uint32_t)out->sites.size();
+    out->sites.emplace(key, id);
+    out->dictionary.append("\x02", 1);
+    column_put32(out->dictionary, id);
+    column_put32(out->dictionary, file);
+    column_put32(out->dictionary, (uint32_t)line);
+    return id;
 }
 
-extern "C" void __cyg_profile_func_enter(void* func, void* caller)
-    __attribute__((no_instrument_function));
-void __cyg_profile_func_enter(void* func, void* caller) {
-    TRACER_GUARD_ENTER();
+// The top-level members of an event's extra text that have a column
+struct ColumnMembers {
+    const char* file = nullptr;
+    size_t file_length = 0;
+    int line = 0;
+    bool has_line = false;
+    int64_t value = kNoValue;
+};
 
-    // Prevent depth overflow before emitting
-    if (++g_depth >= 2048) {
-        --g_depth;
-        TRACER_GUARD_EXIT();
-        return;
+// Integer at `p` if the JSON number there has no fraction or exponent
+static bool NO_INSTRUMENT column_integer(const char* p, int64_t* out) {
+    const char* digits = *p == '-' ? p + 1 : p;
+    if (*digits < '0' || *digits > '9') return false;
+    char* end = nullptr;
+    errno = 0;
+    long long v = strtoll(p, &end, 10);
+    if (errno == ERANGE && *p != '-') {
+        errno = 0;
+        v = (long long)strtoull(p, &end, 10);  // u64 values keep their bits
     }
+    if (errno == ERANGE || *end == '.' || *end == 'e' || *end == 'E') return false;
+    *out = v;
+    return true;
+}
 
-    const char* func_name = "main";
+// "value" holds integers, booleans (as 0/1) and pointers ("0x..."); other
+// values, such as floats (written as "bits"), have no column value.
+static int64_t NO_INSTRUMENT column_value(const char* p) {
+    int64_t v;
+    if (column_integer(p, &v)) return v;
+    if (strncmp(p, "true", 4) == 0) return 1;
+    if (strncmp(p, "false", 5) == 0) return 0;
+    if (p[0] == '"' && p[1] == '0' && p[2] == 'x') return (int64_t)strtoull(p + 3, nullptr, 16);
+    return kNoValue;
+}
 
-#ifndef _WIN32
-    Dl_info dlinfo{};
-    if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
-        func_name = demangle(dlinfo.dli_sname);
-        
-        if (strstr(func_name, "GLOBAL__sub") ||
-            strstr(func_name, "_static_initialization_and_destruction")) {
-            --g_depth;
-            TRACER_GUARD_EXIT();
-            return;
-        }
-        
-        // If symbol lives in system libraries, do not drop the event — mark as user_function
-        if (dlinfo.dli_fname &&
-            (strstr(dlinfo.dli_fname, "/usr/") ||
-             strstr(dlinfo.dli_fname, "/lib/") ||
-             strstr(dlinfo.dli_fname, "libc") ||
-             strstr(dlinfo.dli_fname, "libstdc++"))) {
-            func_name = "user_function";
+static void NO_INSTRUMENT scan_column_members(const char* extra, ColumnMembers& members) {
+    const char* p = extra;
+    int depth = 0;
+    while (*p) {
+        if (*p == '"') {
+            const char* key = p + 1;
+            const char* key_end = json_string_end(key);
+            if (depth == 0 && key_end[0] == '"' && key_end[1] == ':') {
+                const size_t key_length = (size_t)(key_end - key);
+                const char* value = key_end + 2;
+                if (key_length == 4 && memcmp(key, "file", 4) == 0 && *value == '"') {
+                    members.file = value + 1;
+                    members.file_length = (size_t)(json_string_end(value + 1) - members.file);
+                } else if (key_length == 4 && memcmp(key, "line", 4) == 0) {
+                    int64_t line;
+                    if (column_integer(value, &line)) {
+                        members.line = (int)line;
+                        members.has_line = true;
+                    }
+                } else if (key_length == 5 && memcmp(key, "value", 5) == 0) {
+                    members.value = column_value(value);
+                }
+            }
+            p = *key_end ? key_end + 1 : key_end;
+            continue;
         }
+        if (*p == '{' || *p == '[') ++depth;
+        else if (*p == '}' || *p == ']') --depth;
+        ++p;
     }
-#endif
-
-    std::string fn = normalize_function_name(func_name);
-    get_tracked_functions().insert(fn);
-    get_current_function() = fn;
-    
-    // Add call frame
-    CallFrame frame;
-    frame.functionName = fn;
-    
-    // Check if we are inside a loop or function call context?
-    // We maintain active loops per function frame.
-    
-    get_call_stack().push_back(frame);
-    
-    char extra[256];
-    snprintf(extra, sizeof(extra), "\"caller\":\"%p\"", caller);
-    write_json_event("func_enter", func, func_name, g_depth, extra);
-
-    TRACER_GUARD_EXIT();
 }
 
-extern "C" void __cyg_profile_func_exit(void* func, void* caller)
-    __attribute__((no_instrument_function));
-void __cyg_profile_func_exit(void* func, void* caller) {
-    TRACER_GUARD_ENTER();
-
-    if (g_depth <= 0) {
-        TRACER_GUARD_EXIT();
+template <typename T>
+static void NO_INSTRUMENT column_range(const T* values, size_t rows, T none, bool skip_none,
+                                       int64_t* min, int64_t* max) {
+    bool any = false;
+    T lo = 0;
+    T hi = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const T v = values[i];
+        if (skip_none && v == none) continue;
+        if (!any || v < lo) lo = v;
+        if (!any || v > hi) hi = v;
+        any = true;
+    }
+    if (!any) {
+        *min = 1;
+        *max = 0;
         return;
     }
+    *min = (int64_t)lo;
+    *max = (int64_t)hi;
+}
 
-    const char* func_name = "main";
+static void NO_INSTRUMENT column_write_block(ColumnOutput* out, unsigned char column, const void* data) {
+    const size_t raw = out->rows * kColumnWidth[column];
+    int64_t range[2];
+    switch (column) {
+        case COLUMN_TYPE: column_range(out->type, out->rows, (uint16_t)0, false, &range[0], &range[1]); break;
+        case COLUMN_SITE: column_range(out->site, out->rows, kNoSite, true, &range[0], &range[1]); break;
+        case COLUMN_FUNC: column_range(out->func, out->rows, 0u, false, &range[0], &range[1]); break;
+        case COLUMN_DEPTH: column_range(out->depth, out->rows, 0, false, &range[0], &range[1]); break;
+        case COLUMN_VALUE: column_range(out->value, out->rows, kNoValue, true, &range[0], &range[1]); break;
+        case COLUMN_ADDRESS: column_range(out->address, out->rows, (uint64_t)0, false, &range[0], &range[1]); break;
+        default: column_range(out->ts, out->rows, 0u, false, &range[0], &range[1]); break;
+    }
 
-#ifndef _WIN32
-    Dl_info dlinfo{};
-        if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
-            func_name = demangle(dlinfo.dli_sname);
-            
-            if (strstr(func_name, "GLOBAL__sub") || 
-                strstr(func_name, "_static_initialization_and_destruction")) {
-                TRACER_GUARD_EXIT();
-                return;
-            }
+    unsigned char head[2 + 16];
+    head[0] = column;
+    head[1] = kColumnWidth[column];
+    memcpy(head + 2, range, sizeof(range));
+    compressed_write_all(out->fd, head, sizeof(head));
 
-        if (dlinfo.dli_fname &&
-            (strstr(dlinfo.dli_fname, "/usr/") ||
-             strstr(dlinfo.dli_fname, "/lib/"))) {
-            func_name = "user_function";
-        }
+    size_t packed = lz4_compress_block((const unsigned char*)data, raw, out->packed + 8, out->table);
+    uint32_t stored = (uint32_t)packed;
+    if (packed >= raw) {
+        memcpy(out->packed + 8, data, raw);
+        packed = raw;
+        stored = (uint32_t)raw | 0x80000000u;
     }
-#endif
+    const uint32_t raw_size = (uint32_t)raw;
+    memcpy(out->packed, &raw_size, 4);
+    memcpy(out->packed + 4, &stored, 4);
+    compressed_write_all(out->fd, out->packed, 8 + packed);
+}
 
-    if (!g_call_stack.empty()) {
-        auto& activeLoops = g_call_stack.back().activeLoops;
-        while (!activeLoops.empty()) {
-            int loopId = activeLoops.back();
-            activeLoops.pop_back();
-            
-            char extra[128];
-            snprintf(extra, sizeof(extra), "\"loopId\":%d,\"file\":\"unknown\",\"line\":0", loopId);
-            write_json_event("loop_end", nullptr, g_current_function.c_str(), g_depth, extra);
-        }
-        
-        g_call_stack.pop_back();
-    }
-    
-    if (!g_call_stack.empty()) {
-        g_current_function = g_call_stack.back().functionName;
-    } else {
-        g_current_function = "main";
+static void NO_INSTRUMENT column_flush_segment(ColumnOutput* out) {
+    if (out->rows == 0) return;
+    if (out->dictionary.size()) {
+        compressed_write_all(out->fd, (const unsigned char*)out->dictionary.c_str(), out->dictionary.size());
+        out->dictionary.clear();
     }
 
-    write_json_event("func_exit", func, func_name, g_depth);
-    --g_depth;
+    unsigned char head[1 + 4 + 8 + 1];
+    const uint32_t rows = (uint32_t)out->rows;
+    const uint64_t first_id = out->first_id;
+    head[0] = 3;
+    memcpy(head + 1, &rows, 4);
+    memcpy(head + 5, &first_id, 8);
+    head[13] = COLUMN_COUNT;
+    compressed_write_all(out->fd, head, sizeof(head));
 
-    TRACER_GUARD_EXIT();
+    const void* data[COLUMN_COUNT] = { out->type, out->site, out->func, out->depth,
+                                       out->value, out->address, out->ts };
+    for (unsigned char c = 0; c < COLUMN_COUNT; ++c) column_write_block(out, c, data[c]);
+    out->rows = 0;
 }
 
-void* operator new(std::size_t size) __attribute__((no_instrument_function));
-void* operator new(std::size_t size) {
-    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) return std::malloc(size);
+static void NO_INSTRUMENT columns_record(unsigned long id, const char* type, void* addr, const char* func_name,
+                                         int depth, unsigned long ts, const char* extra) {
+    ColumnOutput* out = g_columns;
+    const int saved_errno = errno;  // number parsing must not leak into the program's errno
+    if (out->rows == 0) out->first_id = id;
 
-    g_inside_tracer = true;
+    ColumnMembers members;
+    if (extra) scan_column_members(extra, members);
+    JsonBuffer func;
+    func.append_escaped(func_name ? func_name : "unknown");
 
-    void* ptr = std::malloc(size);
-    if (ptr && g_trace_file && !g_tracer_disabled) {
-        char extra[128];
-        snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-        write_json_event("heap_alloc", ptr, "operator new", g_depth, extra);
+    const size_t row = out->rows;
+    out->type[row] = (uint16_t)column_string(out, type, strlen(type));
+    out->func[row] = column_string(out, func.c_str(), func.size());
+    out->site[row] = kNoSite;
+    if (members.has_line) {
+        const uint32_t file = members.file ? column_string(out, members.file, members.file_length)
+                                           : column_string(out, "", 0);
+        out->site[row] = column_site(out, file, members.line);
     }
+    out->depth[row] = depth;
+    out->value[row] = members.value;
+    out->address[row] = (uint64_t)(uintptr_t)addr;
+    out->ts[row] = (uint32_t)ts;
+    if (++out->rows == kColumnRows) column_flush_segment(out);
+    errno = saved_errno;
+}
 
-    TRACER_GUARD_EXIT();
-    return ptr;
+static void NO_INSTRUMENT open_column_output(const char* path) {
+    char columns_path[4096 + 16];
+    snprintf(columns_path, sizeof(columns_path), "%s.cols", path);
+    const int fd = open(columns_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    void* memory = tracer_malloc(sizeof(ColumnOutput));
+    if (!memory) {
+        close(fd);
+        return;
+    }
+    const bool inside = g_inside_tracer;
+    g_inside_tracer = true;
+    ColumnOutput* out = new (memory) ColumnOutput();
+    g_inside_tracer = inside;
+    out->fd = fd;
+    out->rows = 0;
+    out->first_id = 0;
+
+    unsigned char head[8];
+    memcpy(head, "TCOL", 4);
+    memcpy(head + 4, &kColumnVersion, 4);
+    compressed_write_all(fd, head, sizeof(head));
+    g_columns = out;
 }
 
-void* operator new[](std::size_t size) __attribute__((no_instrument_function));
-void* operator new[](std::size_t size) {
-    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) return std::malloc(size);
+// `flush` is false in a forked copy, which must not write the segment it
+// inherited: the parent owns it.
+static void NO_INSTRUMENT close_column_output(bool flush) {
+    ColumnOutput* out = g_columns;
+    g_columns = nullptr;
+    if (flush) column_flush_segment(out);
+    close(out->fd);
 
+    const bool inside = g_inside_tracer;
     g_inside_tracer = true;
+    for (auto& entry : out->strings) std::free(const_cast<char*>(entry.first.data()));
+    out->~ColumnOutput();
+    g_inside_tracer = inside;
+    tracer_free(out);
+}
+#endif
 
-    void* ptr = std::malloc(size);
-    if (ptr && g_trace_file && !g_tracer_disabled) {
-        char extra[128];
-        snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-        write_json_event("heap_alloc", ptr, "operator new[]", g_depth, extra);
-    }
+// ========== TRACE FILE LIFECYCLE ==========
 
-    TRACER_GUARD_EXIT();
-    return ptr;
+static bool NO_INSTRUMENT open_trace_output(const char* path) {
+#if defined(TRACER_COMPRESS)
+    g_trace_file = g_compress_output ? open_compressed_output(path) : std::fopen(path, "w");
+#else
+    g_trace_file = std::fopen(path, "w");
+#endif
+    if (!g_trace_file) return false;
+    reset_interning();
+#if defined(TRACER_COMPRESS)
+    if (g_column_output) open_column_output(path);
+#endif
+    setvbuf(g_trace_file, NULL, _IONBF, 0);
+    std::fprintf(g_trace_file,
+                 "{\"version\":\"1.0\",\"functions\":[],\"events\":[\n");
+    std::fflush(g_trace_file);
+    return true;
 }
 
-void operator delete(void* ptr) noexcept __attribute__((no_instrument_function));
-void operator delete(void* ptr) noexcept {
-    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) { std::free(ptr); return; }
+// Closes the events array, writes the footer and closes the file.
+// Caller holds the trace mutex.
+static void NO_INSTRUMENT write_trace_footer() {
+    if (g_subtrees) {
+        flush_pending_events();
+        get_subtree_frames().clear();
+    }
+    if (g_templates) {
+        JsonBuffer out;
+        close_iteration(out);
+        write_output(out);
+    }
+#ifndef _WIN32
+    if (g_flight_slots) {
+        g_flight_dumped = 1;
+        std::fflush(g_trace_file);
+        flight_write_events(g_flight_fd);
+    }
+#endif
+    std::fprintf(g_trace_file, "\n],\"tracked_functions\":[");
+    bool first = true;
+    // Access the set via accessor
+    for (const auto& funcName : get_tracked_functions()) {
+        if (!first) std::fprintf(g_trace_file, ",");
+        JsonBuffer name;
+        name.append_escaped(funcName.c_str());
+        std::fprintf(g_trace_file, "\"%s\"", name.c_str());
+        first = false;
+    }
+    std::fprintf(g_trace_file, "],\"total_events\":%lu", g_event_counter);
 
-    g_inside_tracer = true;
+    std::fprintf(g_trace_file, ",\"semantic_hash\":\"%016llx\",\"checkpoint_interval\":%lu,\"checkpoints\":[",
+                 g_semantic_hash, g_checkpoint_interval);
+    first = true;
+    for (const auto& cp : get_hash_checkpoints()) {
+        if (!first) std::fprintf(g_trace_file, ",");
+        std::fprintf(g_trace_file, "{\"event\":%lu,\"hash\":\"%016llx\",\"depth\":%d}",
+                     cp.event, cp.hash, cp.depth);
+        first = false;
+    }
+    std::fprintf(g_trace_file, "]");
 
-    if (ptr && g_trace_file && !g_tracer_disabled) {
-        write_json_event("heap_free", ptr, "operator delete", g_depth);
+    if (!get_fork_checkpoints().empty()) {
+        std::fprintf(g_trace_file, ",\"skeleton_events\":%lu,\"fork_checkpoints\":[", g_skeleton_counter);
+        first = true;
+        for (const auto& cp : get_fork_checkpoints()) {
+            if (!first) std::fprintf(g_trace_file, ",");
+            std::fprintf(g_trace_file, "{\"event\":%lu,\"pid\":%ld,\"fifo\":\"%s\"}",
+                         cp.event, cp.pid, json_safe_path(cp.fifo.c_str()).c_str());
+            first = false;
+        }
+        std::fprintf(g_trace_file, "]");
     }
-    std::free(ptr);
 
-    TRACER_GUARD_EXIT();
-}
+    if (g_window_active) {
+        std::fprintf(g_trace_file, ",\"window\":{\"from\":%lu,\"to\":%lu}", g_window_from, g_window_to);
+    }
 
-void operator delete[](void* ptr) noexcept __attribute__((no_instrument_function));
-void operator delete[](void* ptr) noexcept {
-    if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) { std::free(ptr); return; }
+#ifndef _WIN32
+    if (g_flight_slots) {
+        std::fflush(g_trace_file);
+        flight_write_summary(g_flight_fd, "exit");
+    }
+#endif
 
-    g_inside_tracer = true;
+    std::fprintf(g_trace_file,
+                 ",\"filtered\":{\"pre_main_calls\":%lu,\"pre_main_heap\":%lu,\"library_calls\":%lu,\"library_heap\":%lu}",
+                 g_filtered.pre_main_calls, g_filtered.pre_main_heap,
+                 g_filtered.library_calls, g_filtered.library_heap);
+    if (g_io_capture) std::fprintf(g_trace_file, ",\"io_events\":%lu", g_io_events);
+    if (g_elide) {
+        std::fprintf(g_trace_file, ",\"elided\":{\"assigns\":%lu,\"blocks\":%lu,\"loops\":%lu}",
+                     g_elided_assigns, g_elided_blocks, g_elided_loops);
+    }
+    if (g_subtrees) {
+        std::fprintf(g_trace_file, ",\"subtrees\":{\"refs\":%lu,\"dropped\":%lu}",
+                     g_subtree_refs, g_subtree_dropped);
+    }
+    if (g_templates) {
+        std::fprintf(g_trace_file, ",\"templates\":{\"defined\":%lu,\"instances\":%lu}",
+                     g_template_count, g_template_instances);
+    }
+#ifndef _WIN32
+    if (g_virtual_time) {
+        std::fprintf(g_trace_file, ",\"virtual_time\":{\"sleeps\":%lu,\"skipped_ns\":%lld}",
+                     g_virtual_sleeps, virtual_offset_ns());
+    }
+#endif
 
-    if (ptr && g_trace_file && !g_tracer_disabled) {
-        write_json_event("heap_free", ptr, "operator delete[]", g_depth);
+    if (g_input_log) {
+        std::fprintf(g_trace_file, ",\"inputs\":{\"mode\":\"record\",\"recorded\":%lu}", g_inputs_recorded);
+    } else if (g_input_replay) {
+        std::fprintf(g_trace_file, ",\"inputs\":{\"mode\":\"replay\",\"replayed\":%lu,\"missing\":%lu}",
+                     g_inputs_replayed, g_inputs_missing);
     }
-    std::free(ptr);
 
-    TRACER_GUARD_EXIT();
+    std::fprintf(g_trace_file, "}\n");
+
+#if defined(TRACER_COMPRESS)
+    if (g_columns) close_column_output(true);
+#endif
+    std::fflush(g_trace_file);
+    std::fclose(g_trace_file);
+    g_trace_file = nullptr;  // CRITICAL: Prevent use-after-close
 }
 
-#if !defined(_WIN32)
-extern "C" {
-    static void* (*real_malloc)(std::size_t) = nullptr;
-    static void (*real_free)(void*) = nullptr;
+// ========== FORK CHECKPOINTS (LINUX) ==========
 
-    static void NO_INSTRUMENT init_malloc_hooks() __attribute__((constructor));
-    static void NO_INSTRUMENT init_malloc_hooks() {
-        real_malloc = (void*(*)(std::size_t))dlsym(RTLD_NEXT, "malloc");
-        real_free   = (void(*)(void*))dlsym(RTLD_NEXT, "free");
+#if defined(__linux__)
+static void NO_INSTRUMENT resume_window(unsigned long from, unsigned long to, const char* output) {
+    g_window_active = true;
+    g_window_from = from > g_skeleton_counter ? from : g_skeleton_counter;
+    g_window_to = to;
+    snprintf(g_window_output, sizeof(g_window_output), "%s", output);
+
+    // The window is a trace of its own: fresh ids, hash and checkpoints.
+    g_fork_interval = 0;
+    g_event_counter = 0;
+    g_semantic_hash = SEMANTIC_HASH_SEED;
+    get_hash_checkpoints().clear();
+    get_fork_checkpoints().clear();
+    g_record_detail = g_skeleton_counter >= g_window_from;
+    refresh_gate();
+    g_input_log = nullptr;  // the recording belongs to the original run
+#if defined(TRACER_CAPTURE_IO)
+    g_stdin_pipe = -1;      // so do stdin and its tee, which did not survive fork()
+    if (g_io_capture) start_output_capture();  // the relay did not either
+#endif
+
+    char partial[4096 + 8];
+    snprintf(partial, sizeof(partial), "%s.tmp", g_window_output);
+    if (!open_trace_output(partial)) _exit(3);
+}
+
+// Runs in the frozen copy. Waits on the FIFO for "<from> <to> <output>" or
+// "quit". Each request forks a worker that returns from here into the user
+// program with full tracing; the checkpoint itself stays parked so it can
+// serve further windows until it is told to quit or its TTL expires.
+static void NO_INSTRUMENT park_checkpoint(const char* fifo) {
+    // Detach from the original run's pipes so the backend sees EOF when the
+    // traced process exits, even while checkpoints are still parked. Input
+    // the original run had not read yet is gone for the copy, which is why
+    // the backend uses TRACE_INPUT_LOG instead for programs that read stdin.
+    const int devnull = open("/dev/null", O_RDWR);
+    if (devnull >= 0) {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        if (devnull > STDERR_FILENO) close(devnull);
+    }
+#if defined(TRACER_CAPTURE_IO)
+    drop_output_capture();
+#endif
+    if (g_trace_file) {
+#if defined(TRACER_COMPRESS)
+        drop_compressed_block();
+        if (g_columns) close_column_output(false);
+#endif
+        std::fclose(g_trace_file);
+        g_trace_file = nullptr;
     }
 
-    void* malloc(std::size_t size) __attribute__((no_instrument_function));
-    void* malloc(std::size_t size) {
-        if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) {
-            return real_malloc ? real_malloc(size) : std::malloc(size);
-        }
+    // O_RDWR keeps a writer attached, so poll() never reports a stale hangup
+    // between requests.
+    const int fd = open(fifo, O_RDWR | O_CLOEXEC);
+    if (fd < 0) _exit(0);
 
-        g_inside_tracer = true;
+    char cmd[4352];
+    size_t len = 0;
+    for (;;) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, g_checkpoint_ttl_ms) <= 0) break;
 
-        if (!real_malloc) init_malloc_hooks();
-        void* ptr = real_malloc ? real_malloc(size) : std::malloc(size);
-        if (ptr && g_trace_file && !g_tracer_disabled) {
-            char extra[128];
-            snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-            write_json_event("heap_alloc", ptr, "malloc", g_depth, extra);
-        }
+        const ssize_t n = read(fd, cmd + len, sizeof(cmd) - 1 - len);
+        if (n <= 0) break;
+        len += (size_t)n;
+        cmd[len] = '\0';
 
-        TRACER_GUARD_EXIT();
-        return ptr;
-    }
+        char* nl;
+        while ((nl = strchr(cmd, '\n')) != nullptr) {
+            *nl = '\0';
+            if (strncmp(cmd, "quit", 4) == 0) {
+                close(fd);
+                unlink(fifo);
+                _exit(0);
+            }
 
-    void free(void* ptr) __attribute__((no_instrument_function));
-    void free(void* ptr) {
-        if (g_tracer_disabled || g_inside_tracer || g_depth >= 2048) {
-            if (real_free) { real_free(ptr); } else { std::free(ptr); }
-            return;
+            unsigned long from = 0, to = 0;
+            char output[4096];
+            if (sscanf(cmd, "%lu %lu %4095s", &from, &to, output) == 3 && to > from) {
+                const pid_t worker = fork();
+                if (worker == 0) {
+                    close(fd);
+                    resume_window(from, to, output);
+                    return;
+                }
+                if (worker > 0) waitpid(worker, nullptr, 0);
+            }
+
+            const size_t consumed = (size_t)(nl + 1 - cmd);
+            memmove(cmd, nl + 1, len - consumed + 1);
+            len -= consumed;
         }
+        if (len >= sizeof(cmd) - 1) len = 0;  // drop an oversized request
+    }
 
-        g_inside_tracer = true;
+    close(fd);
+    unlink(fifo);
+    _exit(0);
+}
 
-        if (!real_free) init_malloc_hooks();
-        if (ptr && g_trace_file && !g_tracer_disabled) {
-            write_json_event("heap_free", ptr, "free", g_depth);
-        }
-        if (real_free) {
-            real_free(ptr);
-        } else {
-            std::free(ptr);
-        }
+static void NO_INSTRUMENT maybe_fork_checkpoint() {
+    if (g_window_active || g_skeleton_counter < g_next_fork_at) return;
+    g_next_fork_at = g_skeleton_counter + g_fork_interval;
 
-        TRACER_GUARD_EXIT();
+    // A truncated path would park the checkpoint on some other file
+    char fifo[PATH_MAX];
+    const int n = snprintf(fifo, sizeof(fifo), "%s/ckpt_%ld_%lu.fifo",
+                           g_checkpoint_dir, (long)getpid(), g_skeleton_counter);
+    if (n < 0 || (size_t)n >= sizeof(fifo)) return;
+    if (mkfifo(fifo, 0600) != 0) return;
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        unlink(fifo);
+        return;
     }
+    if (pid == 0) {
+        park_checkpoint(fifo);  // returns only in a resumed worker
+        return;
+    }
+
+    ForkCheckpoint cp;
+    cp.event = g_skeleton_counter;
+    cp.pid = (long)pid;
+    cp.fifo = fifo;
+    get_fork_checkpoints().push_back(cp);
 }
+
+#else
+static void NO_INSTRUMENT maybe_fork_checkpoint() {}
+#endif
+
+// The requested window has been fully recorded: publish it and stop, so the
+// rest of the program is never paid for.
+static void NO_INSTRUMENT finish_window() {
+    g_tracer_disabled = true;
+    {
+        TraceGuard guard;
+        if (g_trace_file) write_trace_footer();
+    }
+    char partial[4096 + 8];
+    snprintf(partial, sizeof(partial), "%s.tmp", g_window_output);
+    std::rename(partial, g_window_output);
+#if defined(TRACER_COMPRESS)
+    if (g_column_output) {
+        char columns[4096 + 16];
+        char partial_columns[4096 + 16];
+        snprintf(columns, sizeof(columns), "%s.cols", g_window_output);
+        snprintf(partial_columns, sizeof(partial_columns), "%s.cols", partial);
+        std::rename(partial_columns, columns);
+    }
 #endif
+    std::fflush(stdout);
+    std::_Exit(0);
+}
 
 extern "C" void __attribute__((constructor)) init_tracer()
     __attribute__((no_instrument_function));
@@ -1112,27 +5813,140 @@ void init_tracer() {
     // Note: No guard here because we want to allow immediate start
     if (g_depth >= 2048) { return; }
 
+    // Tracer setup is tracer work: its allocations are not program heap
+    // and its getpid() is not a program input.
+    g_inside_tracer = true;
+
     // Initialize mutex for thread-safe operations
     #if defined(TRACER_USE_WIN32_CRITICAL_SECTION)
         init_trace_mutex();
     #endif
 
-    setvbuf(stdout, NULL, _IONBF, 0);
-    setvbuf(stderr, NULL, _IONBF, 0);
-
     const char* trace_path = std::getenv("TRACE_OUTPUT");
     if (!trace_path) trace_path = "trace.json";
 
-    g_trace_file = std::fopen(trace_path, "w");
-    if (g_trace_file) {
+    const char* checkpoint_interval = std::getenv("TRACE_CHECKPOINT_INTERVAL");
+    if (checkpoint_interval) g_checkpoint_interval = std::strtoul(checkpoint_interval, nullptr, 10);
+
+    const char* mode = std::getenv("TRACE_MODE");
+    if (mode && strcmp(mode, "skeleton") == 0) g_record_detail = false;
+
+    const char* filter_library = std::getenv("TRACE_FILTER_LIBRARY");
+    if (filter_library && strcmp(filter_library, "0") == 0) g_filter_library = false;
+    const char* shadow = std::getenv("TRACE_SHADOW");
+    if (shadow && strcmp(shadow, "0") == 0) g_shadow = false;
+    // The flight recorder dumps to the file descriptor from a signal
+    // handler, and its ring would drop intern records, so it always writes
+    // plain text.
+    const char* flight_slots = std::getenv("TRACE_FLIGHT_RECORDER");
+    const bool flight_mode = flight_slots && std::strtoul(flight_slots, nullptr, 10) > 0;
+#if defined(TRACER_COMPRESS)
+    const char* compress = std::getenv("TRACE_COMPRESS");
+    g_compress_output = compress && strcmp(compress, "lz4") == 0 && !flight_mode;
+    const char* columns = std::getenv("TRACE_COLUMNS");
+    g_column_output = columns && strcmp(columns, "1") == 0 && !flight_mode;
+#endif
+    const char* intern = std::getenv("TRACE_INTERN");
+    g_intern = intern && strcmp(intern, "1") == 0 && !flight_mode;
+    select_simd_scans();
+#if defined(__linux__)
+    dl_iterate_phdr(find_user_text, nullptr);
+#endif
+    init_frame_snapshots();
+    // Without a way to recognise main() nothing would ever be traced.
+    if (!g_main_func) g_main_started = true;
+#if defined(TRACE_XRAY)
+    start_xray();
+#endif
+
+    init_trace_window();
+
+#if !defined(_WIN32)
+    const char* virtual_time = std::getenv("TRACE_VIRTUAL_TIME");
+    g_virtual_time = virtual_time && strcmp(virtual_time, "1") == 0;
+#endif
+
+#if defined(TRACER_CAPTURE_IO)
+    const char* capture_io = std::getenv("TRACE_CAPTURE_IO");
+    g_io_capture = !(capture_io && strcmp(capture_io, "0") == 0);
+#endif
+
+#if !defined(_WIN32)
+    const char* replay_log = std::getenv("TRACE_REPLAY");
+    const char* input_log = std::getenv("TRACE_INPUT_LOG");
+    if (replay_log) start_input_replay(replay_log);
+    else if (input_log) start_input_recording(input_log);
+#endif
+
+#if defined(TRACER_CAPTURE_IO)
+    if (g_io_capture) start_io_capture();
+#endif
+
+    // Full detail for skeleton steps [TRACE_WINDOW_FROM, TRACE_WINDOW_TO),
+    // then stop. Hooks still run before the window so tracer state is exact.
+    const char* window_to = std::getenv("TRACE_WINDOW_TO");
+    if (window_to) {
+        const char* window_from = std::getenv("TRACE_WINDOW_FROM");
+        g_window_active = true;
+        g_window_from = window_from ? std::strtoul(window_from, nullptr, 10) : 0;
+        g_window_to = std::strtoul(window_to, nullptr, 10);
+        snprintf(g_window_output, sizeof(g_window_output), "%s", trace_path);
+    }
+
+    // Folding changes how many skeleton steps there are, and assigns left
+    // out before a window would be missing from it, so windows get every
+    // event.
+    const char* elide = std::getenv("TRACE_ELIDE");
+    if (elide && !g_window_active) g_elide = parse_elide(elide);
+    if (!g_record_detail) g_elide &= ELIDE_ASSIGNS;
+
+#if defined(__linux__)
+    const char* fork_interval = std::getenv("TRACE_FORK_INTERVAL");
+    if (fork_interval) g_fork_interval = std::strtoul(fork_interval, nullptr, 10);
+
+    const char* checkpoint_ttl = std::getenv("TRACE_CHECKPOINT_TTL");
+    if (checkpoint_ttl) g_checkpoint_ttl_ms = atoi(checkpoint_ttl) * 1000;
+
+    const char* checkpoint_dir = std::getenv("TRACE_CHECKPOINT_DIR");
+    if (checkpoint_dir) {
+        snprintf(g_checkpoint_dir, sizeof(g_checkpoint_dir), "%s", checkpoint_dir);
+    } else {
+        snprintf(g_checkpoint_dir, sizeof(g_checkpoint_dir), "%s", trace_path);
+        char* slash = strrchr(g_checkpoint_dir, '/');
+        if (slash) *slash = '\0';
+        else snprintf(g_checkpoint_dir, sizeof(g_checkpoint_dir), ".");
+    }
+#endif
+
+    // References and templates reach back across the whole trace, so
+    // windows and checkpointed or flight-recorder runs write every event
+    // in full.
+    const char* subtrees = std::getenv("TRACE_SUBTREES");
+    g_subtrees = subtrees && strcmp(subtrees, "1") == 0 && !g_window_active && !flight_mode &&
+                 g_fork_interval == 0;
+    const char* templates = std::getenv("TRACE_TEMPLATES");
+    g_templates = templates && strcmp(templates, "1") == 0 && !g_window_active && !flight_mode &&
+                  g_fork_interval == 0;
+
+    char partial[4096 + 8];
+    snprintf(partial, sizeof(partial), "%s.tmp", trace_path);
+    if (open_trace_output(g_window_active ? partial : trace_path)) {
         g_tracer_disabled = false;
-        setvbuf(g_trace_file, NULL, _IONBF, 0);
-        std::fprintf(g_trace_file,
-                     "{\"version\":\"1.0\",\"functions\":[],\"events\":[\n");
-        std::fflush(g_trace_file);
     } else {
         g_tracer_disabled = true;  // Fail-safe: disable tracer if file open fails
     }
+
+#ifndef _WIN32
+    const char* flight = std::getenv("TRACE_FLIGHT_RECORDER");
+    if (g_trace_file && flight && std::strtoul(flight, nullptr, 10) > 0) {
+        init_flight_recorder(std::strtoul(flight, nullptr, 10));
+    }
+#endif
+
+    // Step 0 checkpoint, so windows starting at the very beginning can be served.
+    if (g_trace_file && g_fork_interval > 0) maybe_fork_checkpoint();
+
+    g_inside_tracer = false;
 }
 
 extern "C" void __attribute__((destructor)) finish_tracer()
@@ -1147,29 +5961,33 @@ void finish_tracer() {
         return;
     }
 
+#if defined(TRACER_CAPTURE_IO)
+    if (g_io_capture) capture_program_io();
+#endif
+
+    // A held block_enter or loop_condition is the program's last event
+    if (g_event_held) release_held_event();
+
     // Disable BEFORE any further work to stop new events
     g_tracer_disabled = true;
 
     {
         TraceGuard guard;
+        write_trace_footer();
+    }
 
-        std::fprintf(g_trace_file, "\n],\"tracked_functions\":[");
-        bool first = true;
-        // Access the set via accessor
-        for (const auto& funcName : get_tracked_functions()) {
-            if (!first) std::fprintf(g_trace_file, ",");
-            std::fprintf(g_trace_file, "\"%s\"", funcName.c_str());
-            first = false;
-        }
-        std::fprintf(g_trace_file, "],\"total_events\":%lu}\n", g_event_counter);
-
-        std::fflush(g_trace_file);
-        std::fclose(g_trace_file);
-        g_trace_file = nullptr;  // CRITICAL: Prevent use-after-close
+    // A windowed run whose program ended before the window did
+    if (g_window_active) {
+        char partial[4096 + 8];
+        snprintf(partial, sizeof(partial), "%s.tmp", g_window_output);
+        std::rename(partial, g_window_output);
     }
 
     std::fflush(stdout);
     std::fflush(stderr);
+#if defined(TRACER_CAPTURE_IO)
+    stop_output_capture(true);
+#endif
 
     TRACER_GUARD_EXIT();
 }
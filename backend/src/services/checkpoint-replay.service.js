@@ -0,0 +1,129 @@
+// backend/src/services/checkpoint-replay.service.js
+import { open, unlink } from 'fs/promises';
+import { constants, existsSync } from 'fs';
+import traceCompression from './trace-compression.service.js';
+
+/**
+ * Fork checkpoints (Linux only)
+ *
+ * In skeleton mode (TRACE_MODE=skeleton) the tracer records only control
+ * flow and function calls, and every TRACE_FORK_INTERVAL skeleton events it
+ * forks a frozen copy of the user process parked on a FIFO. Writing
+ * "<from> <to> <output>" to that FIFO makes the copy fork a worker that
+ * resumes the program with full tracing and writes the events for skeleton
+ * steps [from, to) to <output>. "quit" releases the checkpoint; checkpoints
+ * also exit on their own after TRACE_CHECKPOINT_TTL seconds.
+ *
+ * A parked copy reads stdin from /dev/null, so a window that reads input
+ * would diverge from the original run. generateTrace() does not take
+ * checkpoints for programs that read stdin and records their inputs instead
+ * (see InputReplayService).
+ */
+
+const POLL_INTERVAL_MS = 25;
+const WINDOW_TIMEOUT_MS = 10000;
+
+class CheckpointReplayService {
+    constructor() {
+        this.sessions = new Map(); // sessionId -> { executable, sourceFile, checkpoints, files }
+    }
+
+    isSupported() {
+        return process.platform === 'linux';
+    }
+
+    /**
+     * Latest checkpoint taken at or before skeleton event `from`.
+     * Checkpoints are recorded in increasing event order.
+     */
+    nearestCheckpoint(checkpoints = [], from) {
+        let lo = 0;
+        let hi = checkpoints.length;
+        while (lo < hi) {
+            const mid = (lo + hi) >>> 1;
+            if (checkpoints[mid].event <= from) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo > 0 ? checkpoints[lo - 1] : null;
+    }
+
+    async register(sessionId, session) {
+        await this.release(sessionId);
+        this.sessions.set(sessionId, session);
+    }
+
+    get(sessionId) {
+        return this.sessions.get(sessionId) || null;
+    }
+
+    /**
+     * Write one command line to a checkpoint FIFO. O_NONBLOCK makes the open
+     * fail with ENXIO instead of hanging when the checkpoint has already exited.
+     */
+    async send(fifo, line) {
+        const fh = await open(fifo, constants.O_WRONLY | constants.O_NONBLOCK);
+        try {
+            await fh.write(`${line}\n`);
+        } finally {
+            await fh.close();
+        }
+    }
+
+    /**
+     * Resume the nearest checkpoint and return the parsed window trace.
+     */
+    async collectWindow(sessionId, from, to, outputPath) {
+        const session = this.get(sessionId);
+        if (!session) throw new Error('No checkpoints for this session');
+        if (!(to > from)) throw new Error(`Invalid window [${from}, ${to})`);
+
+        const checkpoint = this.nearestCheckpoint(session.checkpoints, from);
+        if (!checkpoint) throw new Error(`No checkpoint at or before event ${from}`);
+
+        try {
+            await this.send(checkpoint.fifo, `${from} ${to} ${outputPath}`);
+        } catch (e) {
+            throw new Error(`Checkpoint ${checkpoint.event} is no longer available: ${e.message}`);
+        }
+
+        // The worker publishes the file by rename once the window is complete.
+        const deadline = Date.now() + WINDOW_TIMEOUT_MS;
+        while (!existsSync(outputPath)) {
+            if (Date.now() > deadline) {
+                throw new Error(`Window [${from}, ${to}) timed out`);
+            }
+            await new Promise(r => setTimeout(r, POLL_INTERVAL_MS));
+        }
+
+        try {
+            return { checkpoint, trace: await traceCompression.readTrace(outputPath) };
+        } finally {
+            try { await unlink(outputPath); } catch (_) { }
+        }
+    }
+
+    /**
+     * Tell every parked checkpoint of a session to exit and drop its files.
+     */
+    async release(sessionId) {
+        const session = this.sessions.get(sessionId);
+        if (!session) return;
+        this.sessions.delete(sessionId);
+
+        for (const cp of session.checkpoints) {
+            try {
+                await this.send(cp.fifo, 'quit');
+            } catch (_) {
+                try { process.kill(cp.pid, 'SIGKILL'); } catch (_) { }
+                try { await unlink(cp.fifo); } catch (_) { }
+            }
+        }
+        for (const f of session.files || []) {
+            if (f && existsSync(f)) {
+                try { await unlink(f); } catch (_) { }
+            }
+        }
+    }
+}
+
+export default new CheckpointReplayService();
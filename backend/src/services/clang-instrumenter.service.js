@@ -0,0 +1,181 @@
+// backend/src/services/clang-instrumenter.service.js
+import { spawn } from 'child_process';
+import { existsSync, statSync } from 'fs';
+import { mkdir, readFile, unlink, writeFile } from 'fs/promises';
+import path from 'path';
+import { v4 as uuid } from 'uuid';
+import codeInstrumenter from './code-instrumenter.service.js';
+import { toolchainService } from './toolchain.service.js';
+import resourceResolver from './resource-resolver.service.js';
+
+/**
+ * Clang source instrumenter
+ *
+ * On request (options.instrumenter = 'clang'), programs are rewritten by
+ * cpp/instrumenter/trace-instrument.cpp, which places trace.h hooks from
+ * Clang's AST instead of matching lines. The tool
+ * is built once against the bundled toolchain's Clang libraries and kept in
+ * the temp directory until its source changes. Toolchains without them (no
+ * llvm-config, or a failed build) and sources the tool cannot parse go
+ * through the line-based CodeInstrumenter instead.
+ *
+ * Optimized builds are traced by cpp/instrumenter/trace-pass.cpp instead, an
+ * LLVM pass plugin built the same way and loaded by clang with
+ * -fpass-plugin. Without it (Windows, or a failed build) they are not
+ * available, and the tracer compiles at -O0 from instrumented source.
+ */
+
+// Clang libraries used by the tool, most dependent first
+const CLANG_LIBS = [
+    'clangTooling', 'clangFrontend', 'clangDriver', 'clangSerialization', 'clangParse', 'clangSema',
+    'clangAnalysis', 'clangAPINotes', 'clangEdit', 'clangASTMatchers', 'clangAST', 'clangRewrite',
+    'clangLex', 'clangSupport', 'clangBasic'
+];
+
+const EXE = process.platform === 'win32' ? '.exe' : '';
+const SHARED = process.platform === 'darwin' ? '.dylib' : '.so';
+
+class ClangInstrumenter {
+    constructor() {
+        this.projectRoot = resourceResolver.getProjectRoot();
+        this.resourcesRoot = resourceResolver.getResourcesRoot();
+        this.tempRoot = resourceResolver.getTempRoot();
+
+        this.toolSource = this.sourcePath('trace-instrument.cpp');
+        this.toolBinary = path.join(this.tempRoot, 'tools', `trace-instrument${EXE}`);
+        this.toolReady = null;
+        this.passSource = this.sourcePath('trace-pass.cpp');
+        this.passPlugin = path.join(this.tempRoot, 'tools', `trace-pass${SHARED}`);
+        this.passReady = null;
+    }
+
+    /** Dev layout (backend/src/cpp) or prod layout (resources/cpp) */
+    sourcePath(name) {
+        const devSource = path.join(this.projectRoot, 'backend', 'src', 'cpp', 'instrumenter', name);
+        const prodSource = path.join(this.resourcesRoot, 'cpp', 'instrumenter', name);
+        return existsSync(prodSource) ? prodSource : devSource;
+    }
+
+    run(command, args) {
+        return new Promise((resolve, reject) => {
+            const p = spawn(command, args);
+            let out = '';
+            let err = '';
+            p.stdout.on('data', d => out += d.toString());
+            p.stderr.on('data', d => err += d.toString());
+            p.on('close', code => code === 0 ? resolve(out) : reject(new Error(`${path.basename(command)} failed:\n${err}`)));
+            p.on('error', e => reject(e));
+        });
+    }
+
+    /** llvm-config of the bundled toolchain, or null when it has none */
+    llvmConfig() {
+        const file = path.join(path.dirname(toolchainService.getCompiler('cpp')), `llvm-config${EXE}`);
+        return existsSync(file) ? file : null;
+    }
+
+    isStale(output, source) {
+        if (!existsSync(output)) return true;
+        return statSync(output).mtimeMs < statSync(source).mtimeMs;
+    }
+
+    /** Compiler arguments building the tool, given llvm-config's output */
+    buildArgs({ cxxflags, ldflags, libs, systemLibs }, platform = process.platform) {
+        const split = text => text.trim().split(/\s+/).filter(Boolean);
+        const clangLibs = CLANG_LIBS.map(name => `-l${name}`);
+        // GNU ld reads archives once, in order; the Clang libraries refer to each other
+        const grouped = platform === 'linux' ? ['-Wl,--start-group', ...clangLibs, '-Wl,--end-group'] : clangLibs;
+        return [...split(cxxflags), '-O2', this.toolSource, '-o', this.toolBinary,
+            ...split(ldflags), ...grouped, ...split(libs), ...split(systemLibs)];
+    }
+
+    /**
+     * Compiler arguments building the pass plugin. It links no LLVM libraries:
+     * its symbols resolve against the clang that loads it.
+     */
+    passArgs({ cxxflags }, platform = process.platform) {
+        const split = text => text.trim().split(/\s+/).filter(Boolean);
+        const lookup = platform === 'darwin' ? ['-undefined', 'dynamic_lookup'] : [];
+        return [...split(cxxflags), '-O2', '-fPIC', '-shared', this.passSource, '-o', this.passPlugin, ...lookup];
+    }
+
+    /** Arguments instrumenting `sourceFile` into `outputFile`, parsed as the tracer compiles it */
+    toolArgs(sourceFile, outputFile) {
+        return [sourceFile, '-o', outputFile, '--', '-x', 'c++', '-std=c++17', ...toolchainService.getIncludeFlags('cpp')];
+    }
+
+    async buildTool() {
+        if (!existsSync(this.toolSource)) throw new Error(`tool source not found: ${this.toolSource}`);
+        if (!this.isStale(this.toolBinary, this.toolSource)) return this.toolBinary;
+
+        const config = this.llvmConfig();
+        if (!config) throw new Error('the bundled toolchain has no llvm-config');
+        const [cxxflags, ldflags, libs, systemLibs] = await Promise.all(
+            ['--cxxflags', '--ldflags', '--libs', '--system-libs'].map(flag => this.run(config, [flag])));
+
+        await mkdir(path.dirname(this.toolBinary), { recursive: true });
+        const args = this.buildArgs({ cxxflags, ldflags, libs, systemLibs });
+        console.log('[ClangInstrumenter] Building', this.toolBinary);
+        await this.run(toolchainService.getCompiler('cpp'), args);
+        return this.toolBinary;
+    }
+
+    /** Path of the built tool, or null when it cannot be built here */
+    ensureTool() {
+        if (!this.toolReady) {
+            this.toolReady = this.buildTool().catch(error => {
+                console.warn(`[ClangInstrumenter] Using the line-based instrumenter: ${error.message}`);
+                return null;
+            });
+        }
+        return this.toolReady;
+    }
+
+    async buildPass() {
+        if (process.platform === 'win32') throw new Error('clang loads no pass plugins on Windows');
+        if (!existsSync(this.passSource)) throw new Error(`pass source not found: ${this.passSource}`);
+        if (!this.isStale(this.passPlugin, this.passSource)) return this.passPlugin;
+
+        const config = this.llvmConfig();
+        if (!config) throw new Error('the bundled toolchain has no llvm-config');
+        const cxxflags = await this.run(config, ['--cxxflags']);
+
+        await mkdir(path.dirname(this.passPlugin), { recursive: true });
+        console.log('[ClangInstrumenter] Building', this.passPlugin);
+        await this.run(toolchainService.getCompiler('cpp'), this.passArgs({ cxxflags }));
+        return this.passPlugin;
+    }
+
+    /** Path of the built pass plugin, or null when it cannot be built here */
+    ensurePass() {
+        if (!this.passReady) {
+            this.passReady = this.buildPass().catch(error => {
+                console.warn(`[ClangInstrumenter] No optimized traced builds: ${error.message}`);
+                return null;
+            });
+        }
+        return this.passReady;
+    }
+
+    async instrumentCode(code, language = 'cpp') {
+        const tool = await this.ensureTool();
+        if (!tool) return codeInstrumenter.instrumentCode(code, language);
+
+        const id = uuid();
+        const ext = language === 'c' ? 'c' : 'cpp';
+        const sourceFile = path.resolve(path.join(this.tempRoot, `clang_src_${id}.${ext}`));
+        const outputFile = path.resolve(path.join(this.tempRoot, `clang_out_${id}.${ext}`));
+        try {
+            await writeFile(sourceFile, code, 'utf-8');
+            await this.run(tool, this.toolArgs(sourceFile, outputFile));
+            return await readFile(outputFile, 'utf-8');
+        } catch (error) {
+            console.error('⚠️ Clang instrumentation failed, using the line-based instrumenter:', error.message);
+            return codeInstrumenter.instrumentCode(code, language);
+        } finally {
+            await Promise.all([sourceFile, outputFile].map(file => unlink(file).catch(() => {})));
+        }
+    }
+}
+
+export default new ClangInstrumenter();
@@ -219,6 +219,65 @@ class CodeInstrumenter {
     return null;
   }
 
+  /**
+   * Member names declared by one line of a struct body, or [] when the line
+   * is not a plain data member (methods, statics, bitfields, references,
+   * access specifiers). Used to emit TRACE_LAYOUT descriptors.
+   */
+  structFieldNames(trimmed) {
+    if (!trimmed.endsWith(';') || trimmed.includes('(') || trimmed.includes('&')) return [];
+    if (/^(static|typedef|using|friend|template)\b/.test(trimmed)) return [];
+    if (/(^|[^:]):([^:]|$)/.test(trimmed)) return [];
+
+    const decl = trimmed.slice(0, -1).match(/^((?:(?:const|volatile|unsigned|signed|long|short|mutable|struct|union|enum)\s+)*[\w:]+(?:\s*<.*>)?)\s*(.+)$/);
+    if (!decl) return [];
+
+    return this.parseMultiDeclaration(decl[2])
+      .map(d => d.replace(/[={].*$/, '').trim().match(/^[*\s]*(\w+)\s*(\[[^\]]*\]\s*)*$/))
+      .filter(Boolean)
+      .map(m => m[1]);
+  }
+
+  /**
+   * Names declared by a std::vector / std::string declaration statement.
+   */
+  containerDeclarationNames(trimmed) {
+    const decl = trimmed.match(/^(?:static\s+)?(?:std::)?(?:vector\s*<.*>|string|wstring)\s+([^<>]+);$/);
+    if (!decl) return [];
+    return this.parseMultiDeclaration(decl[1])
+      .map(v => this.extractVariableName(v.replace(/[({].*$/, '')))
+      .filter(Boolean);
+  }
+
+  /**
+   * Known containers a statement may change: member mutators, element
+   * writes, whole assignment, and the usual algorithms and input calls.
+   */
+  mutatedContainers(trimmed) {
+    if (!trimmed.endsWith(';') || /^(for|if|while|switch|return)\b/.test(trimmed)) return [];
+    const mutators = 'push_back|emplace_back|pop_back|insert|emplace|erase|resize|reserve|clear|assign|append|swap|shrink_to_fit|replace';
+    return [...this.containerNames].filter(name => {
+      const direct = new RegExp(`^${name}\\s*(?:\\.\\s*(?:${mutators})\\s*\\(|\\[[^\\]]+\\](?:\\s*(?:\\.|->)\\s*\\w+|\\[[^\\]]+\\])*\\s*(?:(?:[+\\-*/%&|^]|<<|>>)?=(?!=)|\\+\\+|--)|\\+?=(?!=))`);
+      const indirect = new RegExp(`\\b${name}\\s*\\.\\s*begin\\s*\\(|>>\\s*${name}\\b|getline\\s*\\([^,]*,\\s*${name}\\b`);
+      return direct.test(trimmed) || indirect.test(trimmed);
+    });
+  }
+
+  /**
+   * The object a member write such as `p.x = 1;` or `p->next->val++;`
+   * changes, as { base, address }: the expression before the last `->`
+   * (written through a pointer), or the variable the `.` chain starts from.
+   */
+  memberWriteTarget(trimmed) {
+    const member = '\\s*\\.\\s*\\w+|\\[[^\\]]+\\]';
+    const write = '\\s*(?:(?:[+\\-*/%&|^]|<<|>>)?=(?!=)[^;]*|\\+\\+|--);$';
+    const arrow = trimmed.match(new RegExp(`^(\\w+(?:${member}|\\s*->\\s*\\w+)*)\\s*->\\s*\\w+(?:${member})*${write}`));
+    if (arrow) return { base: arrow[1], address: `&*(${arrow[1]})` };
+    const dot = trimmed.match(new RegExp(`^(\\w+(?:\\[[^\\]]+\\])?)\\s*\\.\\s*\\w+(?:${member})*${write}`));
+    if (dot) return { base: dot[1], address: `&(${dot[1]})` };
+    return null;
+  }
+
   async injectBeginnerModeTracing(code, language) {
     const lines = code.split('\n');
     const out = [];
@@ -231,6 +290,9 @@ class CodeInstrumenter {
     let currentFunction = 'main';
     let scopeStack = [0];
     let pendingFunctionDef = null;
+    let structLayout = null;
+    this.structLayouts = new Set();
+    this.containerNames = new Set();
     this.functionParams = new Map();
     this.pendingCalls = new Map();
     this.currentScope = 0;
@@ -259,6 +321,18 @@ class CodeInstrumenter {
         inStruct = true;
       }
 
+      // Plain (non-template) structs at global scope get a layout descriptor
+      // so member writes can be traced as struct snapshots.
+      const structHead = !inFunction && globalBraceDepth === 0 && !structLayout &&
+        !trimmed.includes(';') && trimmed.match(/^(?:typedef\s+)?struct(?:\s+(\w+))?\s*(?:\{|$)/);
+      if (structHead) {
+        const previous = out.length > 0 ? out[out.length - 1].trim() : '';
+        if (!previous.startsWith('template')) {
+          inStruct = true;
+          structLayout = { name: structHead[1] || null, fields: [] };
+        }
+      }
+
       if (!inFunction && !inStruct && !inClass) {
         const funcName = this.isFunctionDefinitionStart(line, globalBraceDepth);
         if (funcName) {
@@ -277,12 +351,24 @@ class CodeInstrumenter {
               return { varName, isPointer };
             });
             this.functionParamInfo.set(funcName, paramsInfo);
+            for (const m of paramMatch[1].matchAll(/(?:std::)?(?:vector\s*<[^()]*?>|string|wstring)\s*[&*]?\s*(\w+)\s*(?:,|$)/g)) {
+              this.containerNames.add(m[1]);
+            }
           }
           console.log(`✓ Function definition at line ${i + 1}: ${trimmed.substring(0, 50)}`);
         }
       }
 
       if (!inFunction) {
+        if (globalBraceDepth === 0) {
+          for (const name of this.containerDeclarationNames(trimmed)) this.containerNames.add(name);
+        }
+        if (structLayout && globalBraceDepth === 1) {
+          // offsetof cannot name private members from a file-scope layout
+          if (/^(private|protected)\s*:/.test(trimmed)) structLayout.opaque = true;
+          structLayout.fields.push(...this.structFieldNames(trimmed));
+        }
+
         globalBraceDepth += openBraces - closeBraces;
         // Guard against negative depth which can cause crashes
         if (globalBraceDepth < 0) globalBraceDepth = 0;
@@ -295,6 +381,20 @@ class CodeInstrumenter {
         }
 
         out.push(line);
+
+        if (structLayout && globalBraceDepth === 0 && closeBraces > 0) {
+          const typedefName = trimmed.match(/}\s*(\w+)\s*;/);
+          const name = typedefName ? typedefName[1] : structLayout.name;
+          if (name && structLayout.opaque) {
+            out.push(`TRACE_LAYOUT_OPAQUE(${name});`);
+            this.structLayouts.add(name);
+          } else if (name && structLayout.fields.length > 0) {
+            const fields = structLayout.fields.map(f => `TRACE_FIELD(${name}, ${f})`).join(', ');
+            out.push(`TRACE_LAYOUT(${name}, ${fields});`);
+            this.structLayouts.add(name);
+          }
+          structLayout = null;
+        }
         continue;
       }
 
@@ -369,7 +469,6 @@ class CodeInstrumenter {
       const returnStmt = trimmed.match(/^\s*return\s+([^;]+);/);
       if (returnStmt) {
         const returnValue = returnStmt[1];
-        out.push(`${indent}__trace_output_flush(${i + 1});`);
         out.push(`${indent}__trace_return(${returnValue}, "auto", "", ${i + 1});`);
         out.push(line);
         continue;
@@ -382,6 +481,32 @@ class CodeInstrumenter {
         continue;
       }
 
+      const containerDecl = this.containerDeclarationNames(trimmed);
+      if (containerDecl.length > 0) {
+        out.push(line);
+        for (const name of containerDecl) {
+          this.containerNames.add(name);
+          out.push(`${indent}__trace_container_declare(${name}, ${i + 1});`);
+        }
+        continue;
+      }
+
+      const mutated = this.mutatedContainers(trimmed);
+      if (mutated.length > 0) {
+        out.push(line);
+        for (const name of mutated) {
+          out.push(`${indent}__trace_container(${name}, ${i + 1});`);
+        }
+        continue;
+      }
+
+      const memberWrite = this.structLayouts.size > 0 && this.memberWriteTarget(trimmed);
+      if (memberWrite) {
+        out.push(line);
+        out.push(`${indent}__trace_struct_snapshot(${memberWrite.base}, ${memberWrite.address}, ${i + 1});`);
+        continue;
+      }
+
       const ptrDeref = trimmed.match(/^\s*\*\s*(\w+)\s*=\s*([^;]+);/);
       if (ptrDeref) {
         const [, ptrName, value] = ptrDeref;
@@ -0,0 +1,112 @@
+// backend/src/services/input-replay.service.js
+import { existsSync } from 'fs';
+import { unlink } from 'fs/promises';
+
+/**
+ * Two-pass tracing
+ *
+ * The first run is a skeleton trace (control flow and calls only) with
+ * TRACE_INPUT_LOG set, so the tracer logs every nondeterministic input the
+ * program sees: stdin bytes, time, clock_gettime, rand/srand and getpid.
+ * A window request re-runs the same binary with TRACE_REPLAY pointing at
+ * that log and TRACE_WINDOW_FROM/TRACE_WINDOW_TO set. The second run follows
+ * exactly the same path, records full detail for the requested skeleton
+ * steps only, and exits at the end of the window.
+ */
+
+class InputReplayService {
+    constructor() {
+        this.sessions = new Map(); // sessionId -> { executable, sourceFile, inputLog, events, files }
+    }
+
+    async register(sessionId, session) {
+        await this.release(sessionId);
+        this.sessions.set(sessionId, session);
+    }
+
+    get(sessionId) {
+        return this.sessions.get(sessionId) || null;
+    }
+
+    replayEnv(session, from, to) {
+        return {
+            TRACE_REPLAY: session.inputLog,
+            TRACE_WINDOW_FROM: String(from),
+            TRACE_WINDOW_TO: String(to)
+        };
+    }
+
+    /**
+     * Translate a window request into skeleton steps [from, to).
+     *
+     *   { from, to }                              explicit skeleton range
+     *   { function, invocation = 1 }              n-th call of a function
+     *   { loopId, iteration, occurrence = 1 }     one iteration of a loop, in
+     *                                             its n-th execution
+     *
+     * `events` is the skeleton trace (one event per skeleton step) and
+     * `functionNames` maps func_enter addresses to resolved names.
+     */
+    resolveWindow(events, request = {}, functionNames = new Map()) {
+        if (Number.isInteger(request.from) && Number.isInteger(request.to)) {
+            return { from: request.from, to: request.to };
+        }
+
+        if (request.function) {
+            const wanted = Math.max(1, request.invocation || 1);
+            let seen = 0;
+            for (let i = 0; i < events.length; i++) {
+                const ev = events[i];
+                if (ev.type !== 'func_enter') continue;
+                const name = functionNames.get(ev.addr) || ev.func;
+                if (name !== request.function || ++seen < wanted) continue;
+
+                for (let j = i + 1; j < events.length; j++) {
+                    if (events[j].type === 'func_exit' && events[j].depth === ev.depth) {
+                        return { from: i, to: j + 1 };
+                    }
+                }
+                return { from: i, to: events.length };
+            }
+            return null;
+        }
+
+        if (request.loopId !== undefined && request.iteration !== undefined) {
+            const wanted = Math.max(1, request.occurrence || 1);
+            let seen = 0;
+            for (let i = 0; i < events.length; i++) {
+                const ev = events[i];
+                if (ev.type !== 'loop_body_start' || ev.loopId !== request.loopId ||
+                    ev.iteration !== request.iteration || ++seen < wanted) continue;
+
+                // The iteration ends at its loop_iteration_end, or at loop_end
+                // when the body left the loop early.
+                for (let j = i + 1; j < events.length; j++) {
+                    const e = events[j];
+                    if (e.loopId !== request.loopId || e.depth !== ev.depth) continue;
+                    if (e.type === 'loop_iteration_end' || e.type === 'loop_end') {
+                        return { from: i, to: j + 1 };
+                    }
+                }
+                return { from: i, to: events.length };
+            }
+            return null;
+        }
+
+        return null;
+    }
+
+    async release(sessionId) {
+        const session = this.sessions.get(sessionId);
+        if (!session) return;
+        this.sessions.delete(sessionId);
+
+        for (const f of session.files || []) {
+            if (f && existsSync(f)) {
+                try { await unlink(f); } catch (_) { }
+            }
+        }
+    }
+}
+
+export default new InputReplayService();
@@ -6,13 +6,29 @@ import path from 'path';
 import { v4 as uuid } from 'uuid';
 import { fileURLToPath } from 'url';
 import codeInstrumenter from './code-instrumenter.service.js';
+import clangInstrumenter from './clang-instrumenter.service.js';
 import { toolchainService } from './toolchain.service.js';
 import { tracePlatformAdapter } from './trace-platform-adapter.js';
 import resourceResolver from './resource-resolver.service.js';
+import checkpointReplay from './checkpoint-replay.service.js';
+import inputReplay from './input-replay.service.js';
+import traceCompression from './trace-compression.service.js';
 
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = path.dirname(__filename);
 
+// Skeleton mode: skeleton events between fork checkpoints, seconds a parked checkpoint lives
+const DEFAULT_FORK_INTERVAL = 256;
+const DEFAULT_CHECKPOINT_TTL = 300;
+// Flight recorder: events kept, and the self-imposed timeout (below the 10 s kill)
+const DEFAULT_FLIGHT_EVENTS = 4096;
+const FLIGHT_TIMEOUT_SECONDS = 9;
+// Categories that can be compiled out of the user program (TRACE_CAT_* in trace.h)
+const COMPILE_CATEGORIES = {
+    calls: 0x01, control: 0x02, vars: 0x04, arrays: 0x08, pointers: 0x10,
+    loops: 0x100, blocks: 0x200, branches: 0x400
+};
+
 // --- Custom error classes for clear failure modes ---
 class TraceInstrumentationFailureError extends Error {
     constructor(message) {
@@ -326,7 +342,65 @@ class InstrumentationTracer {
     // the hook symbols by design, and strict checks caused false failures.
     async validateTracerObject(_tracerObj) { return; }
 
-    async compile(code, language = 'cpp') {
+    /**
+     * -DTRACE_CATEGORIES for a list of compile-time categories, e.g.
+     * ['calls', 'loops']. The hooks of all other categories compile to nothing.
+     */
+    categoriesDefine(categories) {
+        let mask = 0;
+        for (const name of categories) {
+            if (!(name in COMPILE_CATEGORIES)) throw new Error(`Unknown trace category: ${name}`);
+            mask |= COMPILE_CATEGORIES[name];
+        }
+        return `-DTRACE_CATEGORIES=0x${mask.toString(16)}u`;
+    }
+
+    /**
+     * With `optimized`, the program is built unchanged at -O1 and traced by
+     * the LLVM pass plugin (see ClangInstrumenter); without the plugin it is
+     * instrumented and built at -O0 as usual. Categories only
+     * thin out the source hooks, so they have no effect on an optimized build.
+     * `instrumenter: 'clang'` places the hooks with the Clang tool instead of
+     * the line-based CodeInstrumenter.
+     *
+     * A build that fails is retried without its least conservative choice,
+     * first XRay, then the pass plugin (at -O0 from instrumented source),
+     * then the Clang tool, so those never cost a working build.
+     */
+    async compile(code, language = 'cpp', { categories = null, optimized = false, xray = null, instrumenter = 'regex' } = {}) {
+        const build = {
+            categories,
+            passPlugin: optimized ? await clangInstrumenter.ensurePass() : null,
+            xray: process.platform === 'linux' ? xray : null,
+            clang: instrumenter === 'clang'
+        };
+        if (build.passPlugin && categories) {
+            console.warn('[Compile] Categories are ignored by the optimized build; they apply again if it falls back to -O0');
+        }
+        const fallbacks = [
+            ['xray', 'XRay build failed, using -finstrument-functions'],
+            ['passPlugin', 'Optimized build failed, using the -O0 instrumented build'],
+            ['clang', 'Clang-instrumented build failed, using the line-based instrumenter']
+        ];
+        for (;;) {
+            try {
+                return await this.compileProgram(code, language, build);
+            } catch (error) {
+                const fallback = fallbacks.find(([option]) => build[option]);
+                if (!fallback) throw error;
+                console.warn(`[Compile] ${fallback[1]}: ${error.message}`);
+                build[fallback[0]] = null;
+            }
+        }
+    }
+
+    /**
+     * With `xray`, calls are traced through XRay sleds instead of
+     * -finstrument-functions (see XRAY in tracer.cpp). xray.threshold is
+     * -fxray-instruction-threshold: functions with fewer instructions get no
+     * sled and are not traced. The default of 1 traces every function.
+     */
+    async compileProgram(code, language, { categories, passPlugin, xray, clang }) {
         const sessionId = uuid();
         const ext = language === 'c' ? 'c' : 'cpp';
         const compiler = toolchainService.getCompiler('cpp');
@@ -343,7 +417,8 @@ class InstrumentationTracer {
             );
         }
 
-        const instrumented = await codeInstrumenter.instrumentCode(code, language);
+        const instrumenter = clang ? clangInstrumenter : codeInstrumenter;
+        const instrumented = passPlugin ? code : await instrumenter.instrumentCode(code, language);
         const sourceFile = path.resolve(path.join(this.tempDir, `src_${sessionId}.${ext}`));
         const userObj = path.resolve(path.join(this.tempDir, `src_${sessionId}.o`));
         const tracerObj = path.resolve(path.join(this.tempDir, `tracer_${sessionId}.o`));
@@ -355,14 +430,19 @@ class InstrumentationTracer {
         await copyFile(this.traceHeader, headerCopy);
 
         // --- Step 1.3 + Phase 2: Normalize user compile flags via adapter ---
-        const rawUserFlags = ['-c', '-g', '-O0', stdFlag, '-fno-omit-frame-pointer',
-            '-finstrument-functions', ...includeFlags, ...toolchainService.getDeterministicFlags(), '-fno-inline'];
-        const normalizedFlags = tracePlatformAdapter.normalizeCompileFlags(rawUserFlags);
+        const optimizeFlags = passPlugin ? ['-O1', `-fpass-plugin=${passPlugin}`] : ['-O0', '-fno-inline'];
+        const callHook = xray ? '-fxray-instrument' : '-finstrument-functions';
+        const callFlags = xray ? [callHook, `-fxray-instruction-threshold=${xray.threshold || 1}`] : [callHook];
+        const rawUserFlags = ['-c', '-g', stdFlag, '-fno-omit-frame-pointer',
+            ...callFlags, ...includeFlags, ...toolchainService.getDeterministicFlags(), ...optimizeFlags];
+        if (categories && !passPlugin) rawUserFlags.push(this.categoriesDefine(categories));
+        const normalizedFlags = tracePlatformAdapter.normalizeCompileFlags(rawUserFlags,
+            { optLevel: passPlugin ? '-O1' : '-O0', callHook });
         const userCompileArgs = [...normalizedFlags, sourceFile, '-o', userObj];
 
-        if (!userCompileArgs.includes('-finstrument-functions')) {
+        if (!userCompileArgs.includes(callHook)) {
             throw new TraceInstrumentationFailureError(
-                '-finstrument-functions missing from user compile flags'
+                `${callHook} missing from user compile flags`
             );
         }
 
@@ -382,6 +462,7 @@ class InstrumentationTracer {
             const disableInstrFlag = compiler.includes('clang') ? null : '-fno-instrument-functions';
             let tracerArgs = ['-c', '-g', '-O0', stdFlag, '-fno-omit-frame-pointer',
                 ...includeFlags, ...toolchainService.getDeterministicFlags(), '-fno-inline', this.tracerCpp, '-o', tracerObj];
+            if (xray) tracerArgs.unshift('-DTRACE_XRAY');
             if (disableInstrFlag) {
                 tracerArgs = [
                     ...tracerArgs.slice(0, tracerArgs.length - 2),
@@ -403,7 +484,10 @@ class InstrumentationTracer {
         await this.validateTracerObject(tracerObj);
 
         const linkArgs = [userObj, tracerObj, '-o', executable, ...linkerFlags];
-        if (process.platform !== 'win32') linkArgs.unshift('-pthread', '-ldl');
+        // -rdynamic lets the tracer name (and filter) functions with dladdr().
+        if (process.platform !== 'win32') linkArgs.unshift('-pthread', '-ldl', '-rdynamic');
+        // Links XRay's runtime, which finds the sleds at startup.
+        if (xray) linkArgs.unshift('-fxray-instrument');
 
         // --- Step 1.2: Log link command ---
         console.log('[Compile] Link command:', compiler, linkArgs.join(' '));
@@ -464,7 +548,66 @@ class InstrumentationTracer {
         }
     }
 
-    async executeInstrumented(executable, traceOutput) {
+    /**
+     * Offset of a function from the executable's load base, as expected by
+     * TRACE_START_FUNC. Static functions stay out of the dynamic symbol
+     * table even with -rdynamic, and C++ names are mangled, so the tracer
+     * cannot look every user function up by name itself.
+     */
+    resolveFunctionOffset(executable, name) {
+        const nmPath = path.join(
+            path.dirname(toolchainService.getCompiler('cpp')),
+            process.platform === 'win32' ? 'llvm-nm.exe' : 'llvm-nm'
+        );
+        for (const bin of [nmPath, 'nm']) {
+            try {
+                const output = execFileSync(bin, ['-C', executable], { encoding: 'utf-8', timeout: 5000 });
+                for (const line of output.split('\n')) {
+                    const m = line.match(/^([0-9a-fA-F]+)\s+[tTwW]\s+(.+)$/);
+                    if (!m) continue;
+                    const sym = m[2].trim();
+                    if (sym === name || sym.startsWith(`${name}(`)) return `0x${m[1].replace(/^0+/, '') || '0'}`;
+                }
+                return null;
+            } catch (_) {
+                // try next candidate
+            }
+        }
+        return null;
+    }
+
+    /**
+     * Environment for frame snapshots (see FRAME SNAPSHOTS in tracer.cpp):
+     * { at: ['exit', 'iteration'], every }. Locals come from the binary's
+     * DWARF, so together with categories that leave out the 'vars' hooks
+     * they still show every local, at a bounded cost per snapshot.
+     */
+    snapshotEnv({ at = ['exit'], every = 1 } = {}) {
+        for (const point of at) {
+            if (point !== 'exit' && point !== 'iteration') throw new Error(`Unknown snapshot point: ${point}`);
+        }
+        return { TRACE_SNAPSHOTS: at.join(','), TRACE_SNAPSHOT_EVERY: String(every) };
+    }
+
+    /**
+     * Environment for a trace window (see TRACE WINDOWS in tracer.cpp):
+     * { startFunction, startLine, maxEvents, depthMin, depthMax, events, paused }
+     */
+    windowEnv(executable, window = {}) {
+        const env = {};
+        if (window.startFunction) {
+            env.TRACE_START_FUNC = this.resolveFunctionOffset(executable, window.startFunction) || window.startFunction;
+        }
+        if (window.startLine > 0) env.TRACE_START_LINE = String(window.startLine);
+        if (window.maxEvents > 0) env.TRACE_MAX_EVENTS = String(window.maxEvents);
+        if (window.depthMin > 0) env.TRACE_DEPTH_MIN = String(window.depthMin);
+        if (window.depthMax > 0) env.TRACE_DEPTH_MAX = String(window.depthMax);
+        if (window.events) env.TRACE_EVENTS = Array.isArray(window.events) ? window.events.join(',') : String(window.events);
+        if (window.paused) env.TRACE_START_PAUSED = '1';
+        return env;
+    }
+
+    async executeInstrumented(executable, traceOutput, extraEnv = {}) {
         const cwd = path.dirname(executable);
         const absExecutable = path.resolve(executable);
 
@@ -483,7 +626,7 @@ class InstrumentationTracer {
             const cmd = absExecutable;
 
             // --- Step 1.5: Merge runtime env (do not overwrite) ---
-            const env = { ...toolchainService.getRuntimeEnv(), TRACE_OUTPUT: traceOutput };
+            const env = { ...toolchainService.getRuntimeEnv(), ...extraEnv, TRACE_OUTPUT: traceOutput };
 
             const proc = spawn(cmd, [], {
                 cwd,
@@ -493,16 +636,9 @@ class InstrumentationTracer {
                 shell: process.platform === 'win32'
             });
 
+            // Ordering comes from the stdout/stderr events in the trace itself.
             let stdout = '', stderr = '';
-            const stdoutChunks = [];
-            const stdoutTimestamps = [];
-
-            proc.stdout.on('data', d => {
-                const chunk = d.toString();
-                stdout += chunk;
-                stdoutChunks.push(chunk);
-                stdoutTimestamps.push(Date.now() * 1000);
-            });
+            proc.stdout.on('data', d => stdout += d.toString());
             proc.stderr.on('data', d => stderr += d.toString());
 
             const timeout = setTimeout(() => {
@@ -513,7 +649,7 @@ class InstrumentationTracer {
             proc.on('close', async (code) => {
                 clearTimeout(timeout);
                 if (code === 0 || code === null) {
-                    resolve({ stdout, stderr, stdoutChunks, stdoutTimestamps });
+                    resolve({ stdout, stderr });
                 } else {
                     // Capture crash diagnostics
                     const debug = {
@@ -556,8 +692,7 @@ class InstrumentationTracer {
         }
 
         try {
-            const txt = await readFile(absTracePath, 'utf-8');
-            const parsed = JSON.parse(txt);
+            const parsed = await traceCompression.readTrace(absTracePath);
             const events = parsed.events || [];
             const functions = parsed.tracked_functions || [];
 
@@ -580,7 +715,19 @@ class InstrumentationTracer {
                 );
             }
 
-            return { events, functions };
+            return {
+                events,
+                functions,
+                semanticHash: parsed.semantic_hash || null,
+                checkpointInterval: parsed.checkpoint_interval || 0,
+                checkpoints: parsed.checkpoints || [],
+                skeletonEvents: parsed.skeleton_events || 0,
+                forkCheckpoints: parsed.fork_checkpoints || [],
+                flightRecorder: parsed.flight_recorder || null,
+                shadowStack: parsed.shadow_stack || [],
+                virtualTime: parsed.virtual_time || null,
+                filtered: parsed.filtered || null
+            };
         } catch (e) {
             if (e instanceof TraceInstrumentationFailureError) throw e;
             console.error('Failed to read/parse trace file:', e.message);
@@ -593,6 +740,7 @@ class InstrumentationTracer {
 
     async convertToSteps(events, executable, sourceFile, programOutput, trackedFunctions, inputLinesMap = null) {
         console.log(`📊 Converting ${events.length} events to beginner-correct steps...`);
+        events = this.expandFoldedEvents(events);
 
         const steps = [];
         let stepIndex = 0;
@@ -601,6 +749,10 @@ class InstrumentationTracer {
         let lastKnownTimestamp = 0;
         let mainStarted = false;
         let currentFunction = 'main';
+        // Latest heap_alloc / heap_free step per address, so container
+        // reallocations can be attributed to their container.
+        const heapAllocSteps = new Map();
+        const heapFreeSteps = new Map();
 
         // Reset state
         this.frameStack = [];
@@ -763,9 +915,30 @@ class InstrumentationTracer {
         mainStarted = true;
         currentFunction = 'main';
 
+        let sawIoEvents = false;
+
         for (let i = 0; i < events.length; i++) {
             const ev = events[i];
             if (ev.type) ev.type = ev.type.toLowerCase();
+            this.decodeTypedValue(ev);
+
+            // Program I/O, recorded by the tracer where it happened. Consecutive
+            // chunks of one stream (e.g. std::cerr flushing per <<) become one step.
+            if (ev.type === 'stdout' || ev.type === 'stderr' || ev.type === 'stdin') {
+                sawIoEvents = true;
+                const target = loopStack.length > 0 ? loopStack[loopStack.length - 1].buffer : steps;
+                const last = target[target.length - 1];
+                if (last && last.eventType === 'output' && last.file === ev.type) {
+                    last.rawText += ev.text;
+                    const { rendered, escapes } = this.parseEscapeSequences(last.rawText);
+                    last.text = rendered;
+                    last.escapeInfo = escapes;
+                    last.explanation = `${ev.type === 'stdin' ? '⌨️ Input' : '📤 Output'}: "${rendered}"`;
+                } else {
+                    target.push(this.createIoStep(ev, stepIndex++, (lastKnownTimestamp += timestampIncrement)));
+                }
+                continue;
+            }
 
             // Get file/line info
             let info;
@@ -1514,6 +1687,148 @@ class InstrumentationTracer {
 
                 step = null;
 
+            } else if (ev.type === 'struct_snapshot') {
+                // Only the first snapshot of an object is full; later ones
+                // carry just the fields whose bytes changed.
+                const fields = {};
+                for (const [field, typed] of Object.entries(ev.fields || {})) {
+                    fields[field] = this.decodeTypedValue(typed).value;
+                }
+                const changes = Object.entries(fields).map(([field, value]) => `${ev.name}.${field} = ${value}`);
+                // Opaque snapshots (structs with private members) list no fields
+                let explanation = changes.join(', ') || `${ev.name} unchanged`;
+                if (ev.opaque) {
+                    explanation = `${ev.name} (${ev.struct}) ${ev.changed ? 'changed' : 'unchanged'}`;
+                } else if (ev.full) {
+                    explanation = `${ev.name} (${ev.struct}) = { ${changes.map(c => c.slice(ev.name.length + 1)).join(', ')} }`;
+                }
+
+                step = {
+                    stepIndex: nextIndex(),
+                    eventType: 'struct_snapshot',
+                    line: info.line,
+                    function: currentFunction,
+                    scope: 'block',
+                    symbol: ev.name,
+                    file: normalizeFile(info.file),
+                    timestamp: nextTime(),
+                    name: ev.name,
+                    structType: ev.struct,
+                    address: ev.address,
+                    full: ev.full === true,
+                    opaque: ev.opaque === true,
+                    fields,
+                    explanation,
+                    internalEvents: [],
+                    ...frameMetadata
+                };
+
+            } else if (ev.type === 'frame_snapshot') {
+                // Every local in scope, read from the live frame
+                // (TRACE_SNAPSHOTS). An inner block's local comes later and
+                // shadows an outer one of the same name.
+                const locals = {};
+                for (const local of ev.locals || []) {
+                    locals[local.name] = local.elements
+                        ? local.elements.map(raw => this.decodeContainerElement(raw, local.vtype))
+                        : this.decodeTypedValue({ ...local }).value;
+                }
+                const shown = Object.entries(locals).map(([name, value]) =>
+                    `${name} = ${Array.isArray(value) ? `[${value.join(', ')}]` : value}`);
+
+                step = {
+                    stepIndex: nextIndex(),
+                    eventType: 'frame_snapshot',
+                    line: info.line,
+                    function: currentFunction,
+                    scope: 'function',
+                    file: normalizeFile(info.file),
+                    timestamp: nextTime(),
+                    at: ev.at,
+                    locals,
+                    explanation: shown.join(', ') || 'no locals',
+                    internalEvents: [],
+                    ...frameMetadata
+                };
+
+            } else if (ev.type === 'shadow_write') {
+                // Memory the program changed without a traced write, found by
+                // comparing the tracer's mirror at a scope boundary.
+                const array = this.arrayRegistry.get(ev.name);
+                for (const range of ev.ranges || []) {
+                    range.values.forEach((raw, k) => {
+                        const value = this.decodeContainerElement(raw, ev.vtype);
+                        const charInfo = ev.vtype === 'char' ? ` ('${String.fromCharCode(value)}')` : '';
+                        const indices = array ? this.unflattenIndex(range.at + k, array.dimensions) : null;
+                        pushStep({
+                            stepIndex: nextIndex(),
+                            eventType: indices ? 'array_index_assign' : 'var_assign',
+                            line: info.line,
+                            function: currentFunction,
+                            scope: 'block',
+                            symbol: ev.name,
+                            file: normalizeFile(info.file),
+                            timestamp: nextTime(),
+                            name: ev.name,
+                            ...(indices ? { indices, memoryRegion: 'stack' } : {}),
+                            value,
+                            untraced: true,
+                            detectedAt: ev.boundary,
+                            explanation: `${ev.name}${indices ? JSON.stringify(indices) : ''} = ${value}${charInfo} (changed without a traced write)`,
+                            internalEvents: [],
+                            ...frameMetadata
+                        });
+                    });
+                }
+                step = null;
+
+            } else if (ev.type === 'container') {
+                const ranges = (ev.ranges || []).map(range => range.text !== undefined
+                    ? range
+                    : { at: range.at, values: range.values.map(v => this.decodeContainerElement(v, ev.vtype)) });
+
+                const allocation = ev.data ? heapAllocSteps.get(ev.data) : null;
+                if (allocation && !allocation.owner) {
+                    allocation.owner = ev.name;
+                    allocation.explanation = `Allocated ${allocation.size} bytes on heap for ${ev.name}`;
+                }
+                const release = ev.previousData ? heapFreeSteps.get(ev.previousData) : null;
+                if (release && !release.owner) {
+                    release.owner = ev.name;
+                    release.explanation = `Freed the old buffer of ${ev.name}`;
+                }
+
+                const changes = ranges.map(range => range.text !== undefined
+                    ? `${ev.name}[${range.at}..] = "${range.text}"`
+                    : `${ev.name}[${range.at}${range.values.length > 1 ? `..${range.at + range.values.length - 1}` : ''}] = ${range.values.map(v => typeof v === 'object' && v !== null ? JSON.stringify(v) : v).join(', ')}`);
+
+                step = {
+                    stepIndex: nextIndex(),
+                    eventType: 'container_update',
+                    line: info.line,
+                    function: currentFunction,
+                    scope: 'block',
+                    symbol: ev.name,
+                    file: normalizeFile(info.file),
+                    timestamp: nextTime(),
+                    name: ev.name,
+                    containerKind: ev.kind,
+                    address: ev.address,
+                    dataAddress: ev.data,
+                    previousDataAddress: ev.previousData || null,
+                    size: ev.size,
+                    capacity: ev.capacity,
+                    elementSize: ev.elemSize,
+                    ranges,
+                    truncated: ev.truncated === true,
+                    explanation: [
+                        ...changes,
+                        `size ${ev.size}, capacity ${ev.capacity}${ev.previousData ? ' (reallocated)' : ''}`
+                    ].join('; '),
+                    internalEvents: [],
+                    ...frameMetadata
+                };
+
             } else if (ev.type === 'heap_write') {
                 step = {
                     stepIndex: nextIndex(),
@@ -1583,6 +1898,7 @@ class InstrumentationTracer {
                 }
 
             } else if (ev.type === 'assign') {
+                const charInfo = ev.char ? ` ('${String.fromCharCode(ev.value)}')` : '';
                 step = {
                     stepIndex: nextIndex(),
                     eventType: 'var_assign',
@@ -1594,7 +1910,7 @@ class InstrumentationTracer {
                     timestamp: nextTime(),
                     name: ev.name,
                     value: ev.value,
-                    explanation: `${ev.name} = ${ev.value}`,
+                    explanation: `${ev.name} = ${ev.value}${charInfo}`,
                     internalEvents: [],
                     ...frameMetadata
                 };
@@ -1635,6 +1951,7 @@ class InstrumentationTracer {
                     internalEvents: [],
                     ...frameMetadata
                 };
+                heapAllocSteps.set(ev.addr, step);
 
             } else if (ev.type === 'heap_free') {
                 step = {
@@ -1651,6 +1968,7 @@ class InstrumentationTracer {
                     internalEvents: [],
                     ...frameMetadata
                 };
+                heapFreeSteps.set(ev.addr, step);
             }
 
             if (step) {
@@ -1667,8 +1985,9 @@ class InstrumentationTracer {
 
         // ==========================================
         // STEP 4: Add output steps BEFORE program_end (deterministic)
+        // Only for traces without I/O events (Windows, TRACE_CAPTURE_IO=0).
         // ==========================================
-        {
+        if (!sawIoEvents) {
             const mainFrame = this.frameStack[0] || { frameId: 'main-0', callDepth: 0, parentFrameId: undefined };
             const frameMetadata = {
                 frameId: mainFrame.frameId,
@@ -1676,50 +1995,26 @@ class InstrumentationTracer {
                 callIndex: this.globalCallIndex++,
                 parentFrameId: mainFrame.parentFrameId
             };
-            // Prefer chunked stdout with timestamps when available
-            if (programOutput && Array.isArray(programOutput.stdoutChunks) && programOutput.stdoutChunks.length > 0) {
-                const combined = programOutput.stdoutChunks.map((text, idx) => ({ text, ts: idx }));
-                combined.sort((a, b) => (a.ts || 0) - (b.ts || 0));
-                for (const chunk of combined) {
-                    const { rendered, escapes } = this.parseEscapeSequences(chunk.text);
-                    steps.push({
-                        stepIndex: stepIndex++,
-                        eventType: 'output',
-                        line: 0,
-                        function: 'output',
-                        scope: 'global',
-                        file: 'stdout',
-                        timestamp: (lastKnownTimestamp += timestampIncrement),
-                        text: rendered,
-                        rawText: chunk.text,
-                        escapeInfo: escapes,
-                        explanation: `📤 Output: "${rendered}"`,
-                        internalEvents: [],
-                        ...frameMetadata
-                    });
-                }
-            } else {
-                // --- Phase 2: Output Normalization (fix empty lines) ---
-                const normalizedLines = tracePlatformAdapter.normalizeOutputEvents(outputLines);
-                for (let i = 0; i < normalizedLines.length; i++) {
-                    const line = normalizedLines[i];
-                    const { rendered, escapes } = this.parseEscapeSequences(line);
-                    steps.push({
-                        stepIndex: stepIndex++,
-                        eventType: 'output',
-                        line: 0,
-                        function: 'output',
-                        scope: 'global',
-                        file: 'stdout',
-                        timestamp: (lastKnownTimestamp += timestampIncrement),
-                        text: rendered,
-                        rawText: line,
-                        escapeInfo: escapes,
-                        explanation: `📤 Output: "${rendered}"`,
-                        internalEvents: [],
-                        ...frameMetadata
-                    });
-                }
+            // --- Phase 2: Output Normalization (fix empty lines) ---
+            const normalizedLines = tracePlatformAdapter.normalizeOutputEvents(outputLines);
+            for (let i = 0; i < normalizedLines.length; i++) {
+                const line = normalizedLines[i];
+                const { rendered, escapes } = this.parseEscapeSequences(line);
+                steps.push({
+                    stepIndex: stepIndex++,
+                    eventType: 'output',
+                    line: 0,
+                    function: 'output',
+                    scope: 'global',
+                    file: 'stdout',
+                    timestamp: (lastKnownTimestamp += timestampIncrement),
+                    text: rendered,
+                    rawText: line,
+                    escapeInfo: escapes,
+                    explanation: `📤 Output: "${rendered}"`,
+                    internalEvents: [],
+                    ...frameMetadata
+                });
             }
         }
 
@@ -1820,6 +2115,114 @@ class InstrumentationTracer {
         return steps;
     }
 
+    /**
+     * Typed values (trace.h) carry a "vtype" tag. Floats arrive as their
+     * IEEE bit pattern in "bits", so the value shown is exactly the one the
+     * program held; chars are marked for rendering.
+     */
+    decodeTypedValue(ev) {
+        if (ev.bits !== undefined && (ev.vtype === 'f64' || ev.vtype === 'f32')) {
+            const view = new DataView(new ArrayBuffer(8));
+            if (ev.vtype === 'f64') {
+                view.setBigUint64(0, BigInt(`0x${ev.bits}`));
+                ev.value = view.getFloat64(0);
+            } else {
+                view.setUint32(0, parseInt(ev.bits, 16));
+                ev.value = view.getFloat32(0);
+            }
+            delete ev.bits;
+        } else if (ev.vtype === 'char') {
+            ev.char = true;
+        }
+        return ev;
+    }
+
+    /**
+     * With TRACE_ELIDE the tracer folds events that follow each other
+     * directly into the last of them: an empty block is one block_enter with
+     * "empty" and "exitLine", and a loop_iteration_end / loop_condition pair
+     * rides on the next loop_body_start or loop_end as "endedIteration" and
+     * "condition". Unfolding them here keeps one step per original event.
+     */
+    expandFoldedEvents(events) {
+        if (!events.some(ev => ev.condition !== undefined || ev.empty)) return events;
+
+        const expanded = [];
+        for (const ev of events) {
+            if (ev.type === 'block_enter' && ev.empty) {
+                const { empty, exitLine, ...enter } = ev;
+                expanded.push(enter, { ...enter, type: 'block_exit', line: exitLine ?? enter.line });
+            } else if ((ev.type === 'loop_body_start' || ev.type === 'loop_end') && ev.condition !== undefined) {
+                const { condition, endedIteration, ...host } = ev;
+                const base = { id: host.id, addr: host.addr, func: host.func, depth: host.depth, ts: host.ts,
+                    loopId: host.loopId, file: host.file, line: host.line };
+                if (endedIteration !== undefined) {
+                    expanded.push({ ...base, type: 'loop_iteration_end', iteration: endedIteration });
+                }
+                expanded.push({ ...base, type: 'loop_condition', result: condition }, host);
+            } else {
+                expanded.push(ev);
+            }
+        }
+        return expanded;
+    }
+
+    /**
+     * Row-major flat index -> per-dimension indices of an array.
+     */
+    unflattenIndex(flat, dimensions = []) {
+        const dims = dimensions.length > 0 ? dimensions : [0];
+        const indices = new Array(dims.length).fill(0);
+        for (let d = dims.length - 1; d > 0; d--) {
+            const extent = dims[d] || 1;
+            indices[d] = flat % extent;
+            flat = Math.floor(flat / extent);
+        }
+        indices[0] = flat;
+        return indices;
+    }
+
+    /**
+     * One element of a container range: floats arrive as hex bit patterns,
+     * struct elements as their fields in typed-value form.
+     */
+    decodeContainerElement(value, vtype) {
+        if (vtype === 'f64' || vtype === 'f32') {
+            return this.decodeTypedValue({ bits: value, vtype }).value;
+        }
+        if (vtype === 'struct' && value) {
+            const fields = {};
+            for (const [field, typed] of Object.entries(value)) {
+                fields[field] = this.decodeTypedValue(typed).value;
+            }
+            return fields;
+        }
+        return value;
+    }
+
+    /**
+     * Output step for a stdout/stderr/stdin trace event. Input is shown the
+     * way a terminal echoes it; `file` names the stream.
+     */
+    createIoStep(ev, stepIndex, timestamp) {
+        const { rendered, escapes } = this.parseEscapeSequences(ev.text || '');
+        return {
+            stepIndex,
+            eventType: 'output',
+            line: 0,
+            function: 'output',
+            scope: 'global',
+            file: ev.type,
+            timestamp,
+            text: rendered,
+            rawText: ev.text || '',
+            escapeInfo: escapes,
+            explanation: `${ev.type === 'stdin' ? '⌨️ Input' : '📤 Output'}: "${rendered}"`,
+            internalEvents: [],
+            ...this.getCurrentFrameMetadata()
+        };
+    }
+
     /**
      * Create output steps from program stdout
      */
@@ -1952,9 +2355,7 @@ class InstrumentationTracer {
         return Array.from(map.values());
     }
 
-    async generateTrace(code, language = 'cpp') {
-        console.log('🚀 Starting trace generation...');
-
+    resetTraceState() {
         this.arrayRegistry.clear();
         this.pointerRegistry.clear();
         this.functionRegistry.clear();
@@ -1963,16 +2364,122 @@ class InstrumentationTracer {
         this.frameStack = [];
         this.globalCallIndex = 0;
         this.frameCounts = new Map();
+    }
+
+    /**
+     * options.mode:
+     *   'skeleton' (Linux only) records control flow and calls only, and
+     *              leaves fork checkpoints parked under options.sessionId.
+     *              A parked checkpoint has no stdin left to read, so a
+     *              program that reads stdin (see readsStdin()) is run in
+     *              'record' mode instead
+     *   'record'   records control flow and calls plus every nondeterministic
+     *              input; windows are produced by a deterministic replay run
+     *   'flight'   keeps only the last options.flightEvents events in memory and
+     *              writes them on exit, crash or timeout with the call stack
+     * For 'skeleton' and 'record', traceWindow() fills in full detail for a
+     * window later.
+     * options.window restricts recording up front (start function or line,
+     * event limit, depth range, event categories); see windowEnv().
+     * options.virtualTime = false makes sleeps block for real again.
+     * options.elide = false keeps unchanged assigns and unfolded loop and
+     * block events in the trace (TRACE_ELIDE).
+     * options.subtrees writes repeated call subtrees as references to
+     * their first copy (TRACE_SUBTREES); readTrace expands them. Off by
+     * default, since a crashing run loses the calls still open.
+     * options.templates writes repeating loop iterations as instances of
+     * a template (TRACE_TEMPLATES), likewise expanded by readTrace and off
+     * by default.
+     * options.categories compiles a lean binary with only those hook
+     * categories (see categoriesDefine()); windows cannot add the rest back.
+     * options.optimized traces an -O1 build through the LLVM pass plugin
+     * where it can be built (see compile()).
+     * options.xray (true or { threshold }) traces calls through XRay sleds on
+     * Linux, unpatched once the window stops (see compileProgram()).
+     * options.instrumenter = 'clang' places the hooks from Clang's AST
+     * rather than by line (see ClangInstrumenter).
+     * options.snapshots reads every local from the live frame at the given
+     * points (see snapshotEnv()).
+     */
+    async generateTrace(code, language = 'cpp', options = {}) {
+        console.log('🚀 Starting trace generation...');
+
+        this.resetTraceState();
 
         const inputLinesMap = this.scanForInputOperations(code);
+        // Parked checkpoints lose stdin, so programs that read it are
+        // windowed by input replay instead.
+        const readsStdin = options.mode === 'skeleton' && this.readsStdin(code);
+        if (readsStdin) console.log('[Trace] Program reads stdin: recording inputs instead of fork checkpoints');
+        const forking = options.mode === 'skeleton' && !readsStdin && checkpointReplay.isSupported();
+        const recording = (options.mode === 'record' || readsStdin) && process.platform !== 'win32';
+        const flight = options.mode === 'flight' && process.platform !== 'win32';
+        const skeleton = forking || recording;
+        let runEnv = {};
+        let inputLog = null;
+        let keepForReplay = false;
 
         let exe, src, traceOut, hdr;
         try {
             ({ executable: exe, sourceFile: src, traceOutput: traceOut, headerCopy: hdr } =
-                await this.compile(code, language));
+                await this.compile(code, language, {
+                    categories: options.categories, optimized: options.optimized, xray: options.xray,
+                    instrumenter: options.instrumenter
+                }));
+
+            if (forking) {
+                runEnv = {
+                    TRACE_MODE: 'skeleton',
+                    TRACE_FORK_INTERVAL: String(options.forkInterval || DEFAULT_FORK_INTERVAL),
+                    TRACE_CHECKPOINT_TTL: String(options.checkpointTtl || DEFAULT_CHECKPOINT_TTL)
+                };
+            } else if (recording) {
+                inputLog = `${exe}.inputs`;
+                runEnv = { TRACE_MODE: 'skeleton', TRACE_INPUT_LOG: inputLog };
+            } else if (flight) {
+                runEnv = {
+                    TRACE_FLIGHT_RECORDER: String(options.flightEvents || DEFAULT_FLIGHT_EVENTS),
+                    TRACE_FLIGHT_TIMEOUT: String(FLIGHT_TIMEOUT_SECONDS)
+                };
+            }
 
-            const { stdout, stderr } = await this.executeInstrumented(exe, traceOut);
-            const { events, functions } = await this.parseTraceFile(traceOut);
+            if (options.window) runEnv = { ...runEnv, ...this.windowEnv(exe, options.window) };
+            // Sleeps move a virtual clock forward instead of holding a worker slot.
+            if (options.virtualTime !== false && process.platform !== 'win32') {
+                runEnv = { ...runEnv, TRACE_VIRTUAL_TIME: '1' };
+            }
+            // Unchanged assigns, empty blocks and per-iteration loop events are
+            // left out or folded; convertToSteps unfolds what it needs.
+            if (options.elide !== false) runEnv = { ...runEnv, TRACE_ELIDE: '1' };
+            if (options.subtrees) runEnv = { ...runEnv, TRACE_SUBTREES: '1' };
+            if (options.templates) runEnv = { ...runEnv, TRACE_TEMPLATES: '1' };
+            if (options.snapshots) runEnv = { ...runEnv, ...this.snapshotEnv(options.snapshots) };
+
+            const { stdout, stderr } = await this.executeInstrumented(exe, traceOut, runEnv);
+            const { events, functions, semanticHash, checkpointInterval, checkpoints,
+                skeletonEvents, forkCheckpoints, flightRecorder, shadowStack, virtualTime, filtered } =
+                await this.parseTraceFile(traceOut);
+
+            // The window traces still need the binary (addr2line) and source.
+            if (forking && forkCheckpoints.length > 0) {
+                await checkpointReplay.register(options.sessionId, {
+                    executable: exe,
+                    sourceFile: src,
+                    checkpoints: forkCheckpoints,
+                    events,
+                    files: [exe, src, hdr]
+                });
+                keepForReplay = true;
+            } else if (recording) {
+                await inputReplay.register(options.sessionId, {
+                    executable: exe,
+                    sourceFile: src,
+                    inputLog,
+                    events,
+                    files: [exe, src, hdr, inputLog, `${inputLog}.stdin`]
+                });
+                keepForReplay = true;
+            }
 
             console.log(`📋 Captured ${events.length} raw events, ${functions.length} functions`);
 
@@ -1987,6 +2494,14 @@ class InstrumentationTracer {
 
             const steps = await this.convertToSteps(events, exe, src, { stdout, stderr }, functions, inputLinesMap);
 
+            // Innermost frame last, as recorded by the tracer's shadow stack
+            const callStackAtEnd = [];
+            for (const frame of shadowStack) {
+                // eslint-disable-next-line no-await-in-loop
+                const info = await this.getLineInfo(exe, frame.func);
+                callStackAtEnd.push({ depth: frame.depth, function: info.function, file: info.file, line: info.line });
+            }
+
             const result = {
                 steps,
                 totalSteps: steps.length,
@@ -2007,6 +2522,17 @@ class InstrumentationTracer {
                     capturedEvents: events.length,
                     emittedSteps: steps.length,
                     programOutput: stdout,
+                    semanticHash,
+                    checkpointInterval,
+                    checkpoints,
+                    traceMode: forking ? 'skeleton' : (recording ? 'record' : (flight ? 'flight' : 'full')),
+                    flightRecorder,
+                    callStackAtEnd,
+                    virtualTime,
+                    // Pre-main and library activity the tracer dropped at the source
+                    runtimeFiltered: filtered,
+                    skeletonEvents,
+                    forkCheckpoints: forkCheckpoints.map(cp => cp.event),
                     timestamp: Date.now()
                 }
             };
@@ -2024,8 +2550,90 @@ class InstrumentationTracer {
             console.error('❌ Trace failed:', e.message);
             throw e;
         } finally {
-            await this.cleanup([exe, src, traceOut, hdr]);
+            await this.cleanup(keepForReplay ? [traceOut] : [exe, src, traceOut, hdr, inputLog, inputLog && `${inputLog}.stdin`]);
+        }
+    }
+
+    /**
+     * Map func_enter addresses of a skeleton trace to source function names.
+     */
+    async resolveFunctionNames(executable, events) {
+        const names = new Map();
+        for (const ev of events) {
+            if (ev.type !== 'func_enter' || names.has(ev.addr)) continue;
+            // eslint-disable-next-line no-await-in-loop
+            const info = await this.getLineInfo(executable, ev.addr);
+            names.set(ev.addr, info && info.function !== 'unknown' ? info.function : ev.func);
         }
+        return names;
+    }
+
+    /**
+     * Full-detail steps for a window of the last skeleton trace of a session:
+     * { from, to } in skeleton steps, { function, invocation } or
+     * { loopId, iteration, occurrence }. Served by a deterministic replay run
+     * ('record' mode) or by resuming the nearest fork checkpoint ('skeleton').
+     */
+    async traceWindow(sessionId, request) {
+        const replay = inputReplay.get(sessionId);
+        const session = replay || checkpointReplay.get(sessionId);
+        if (!session) throw new Error('No skeleton trace for this session');
+
+        const names = request.function
+            ? await this.resolveFunctionNames(session.executable, session.events)
+            : undefined;
+        const window = inputReplay.resolveWindow(session.events, request, names);
+        if (!window || !(window.to > window.from)) {
+            throw new Error('Requested window not found in the skeleton trace');
+        }
+        const { from, to } = window;
+
+        this.resetTraceState();
+
+        const outputPath = path.join(this.tempDir, `window_${uuid()}.json`);
+        let trace;
+        let checkpoint = null;
+        if (replay) {
+            try {
+                await this.executeInstrumented(session.executable, outputPath,
+                    inputReplay.replayEnv(session, from, to));
+                trace = await traceCompression.readTrace(outputPath);
+            } finally {
+                await this.cleanup([outputPath]);
+            }
+        } else {
+            const collected = await checkpointReplay.collectWindow(sessionId, from, to, outputPath);
+            trace = collected.trace;
+            checkpoint = collected.checkpoint.event;
+        }
+
+        const events = trace.events || [];
+        const functions = trace.tracked_functions || [];
+
+        console.log(`🔎 Window [${from}, ${to}) via ${replay ? 'replay' : `checkpoint ${checkpoint}`}: ${events.length} events`);
+
+        const steps = await this.convertToSteps(events, session.executable, session.sourceFile,
+            { stdout: '', stderr: '' }, functions);
+
+        return {
+            from,
+            to,
+            steps,
+            totalSteps: steps.length,
+            metadata: {
+                source: replay ? 'replay' : 'checkpoint',
+                checkpoint,
+                inputs: trace.inputs || null,
+                capturedEvents: events.length,
+                semanticHash: trace.semantic_hash || null,
+                timestamp: Date.now()
+            }
+        };
+    }
+
+    async releaseSession(sessionId) {
+        await checkpointReplay.release(sessionId);
+        await inputReplay.release(sessionId);
     }
 
     async cleanup(files) {
@@ -2036,6 +2644,15 @@ class InstrumentationTracer {
         }
     }
 
+    /**
+     * Whether the program may read stdin. This is a source check and errs
+     * towards yes, since a checkpoint window that reads stdin goes wrong
+     * without any error.
+     */
+    readsStdin(code) {
+        return /\b(?:cin|stdin|STDIN_FILENO|w?scanf|getchar|gets)\b|\bread\s*\(\s*0\s*,/.test(code);
+    }
+
     scanForInputOperations(sourceFile) {
         try {
             if (!existsSync(sourceFile)) {
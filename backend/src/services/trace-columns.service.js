@@ -0,0 +1,186 @@
+// backend/src/services/trace-columns.service.js
+import { open } from 'fs/promises';
+import traceCompression from './trace-compression.service.js';
+
+/**
+ * Columnar trace files
+ *
+ * With TRACE_COLUMNS=1 the tracer also writes "<trace>.cols", the events
+ * split into per-field columns for analytics that scan one attribute over
+ * many events (all depths, all values of a variable, all timestamps):
+ *
+ *   "TCOL" u32 version
+ *   1 string   u32 id, u32 length, text (JSON-escaped, unquoted)
+ *   2 site     u32 id, u32 file string id, i32 line
+ *   3 segment  u32 rows, u64 firstId, u8 columns, then per column
+ *              u8 column, u8 width, i64 min, i64 max, u32 rawSize,
+ *              u32 storedSize, data (one LZ4 block, as in TLZ4 files)
+ *
+ * Segments hold up to 4096 events. Readers fetch only the columns they ask
+ * for, and skip segments whose min/max cannot match a range filter.
+ */
+
+const MAGIC = 'TCOL';
+const STORED_FLAG = 0x80000000;
+const NO_SITE = 0xffffffff;
+const NO_VALUE = -(2n ** 63n);
+
+const COLUMNS = ['type', 'site', 'func', 'depth', 'value', 'address', 'ts'];
+const ARRAY_TYPES = {
+    type: Uint16Array,
+    site: Uint32Array,
+    func: Uint32Array,
+    depth: Int32Array,
+    value: BigInt64Array,
+    address: BigUint64Array,
+    ts: Uint32Array
+};
+
+class TraceColumnsService {
+    constructor() {
+        this.columns = COLUMNS;
+        this.NO_SITE = NO_SITE;
+        this.NO_VALUE = NO_VALUE;
+    }
+
+    /**
+     * Strings, sites and segment directory of a columns file. Column data
+     * is not read.
+     */
+    async readIndex(file) {
+        const handle = await open(file, 'r');
+        try {
+            return await this.indexHandle(handle);
+        } finally {
+            await handle.close();
+        }
+    }
+
+    async indexHandle(handle) {
+        const { size } = await handle.stat();
+        const readAt = async (position, length) => {
+            if (position + length > size) return null;
+            const buffer = Buffer.alloc(length);
+            await handle.read(buffer, 0, length, position);
+            return buffer;
+        };
+
+        const head = await readAt(0, 8);
+        if (!head || head.toString('latin1', 0, 4) !== MAGIC) throw new Error('Not a columnar trace');
+        const index = { version: head.readUInt32LE(4), strings: [], sites: [], segments: [] };
+
+        // A run that died mid-write leaves a partial last record; what
+        // precedes it is kept, as with a cut-off JSON trace.
+        let position = 8;
+        while (position < size) {
+            const kind = (await readAt(position, 1))[0];
+            if (kind === 1) {
+                const h = await readAt(position + 1, 8);
+                if (!h) break;
+                const text = await readAt(position + 9, h.readUInt32LE(4));
+                if (!text) break;
+                index.strings[h.readUInt32LE(0)] = JSON.parse(`"${text.toString('utf-8')}"`);
+                position += 9 + text.length;
+            } else if (kind === 2) {
+                const h = await readAt(position + 1, 12);
+                if (!h) break;
+                index.sites[h.readUInt32LE(0)] = { file: h.readUInt32LE(4), line: h.readInt32LE(8) };
+                position += 13;
+            } else if (kind === 3) {
+                const h = await readAt(position + 1, 13);
+                if (!h) break;
+                const segment = { rows: h.readUInt32LE(0), firstId: Number(h.readBigUInt64LE(4)), columns: {} };
+                const count = h[12];
+                position += 14;
+                for (let i = 0; i < count && position <= size; i++) {
+                    const c = await readAt(position, 26);
+                    if (!c) { position = size + 1; break; }
+                    const name = COLUMNS[c[0]];
+                    const unsigned = name === 'address';
+                    const word = c.readUInt32LE(22);
+                    const storedSize = (word & ~STORED_FLAG) >>> 0;
+                    const entry = {
+                        width: c[1],
+                        min: unsigned ? c.readBigUInt64LE(2) : c.readBigInt64LE(2),
+                        max: unsigned ? c.readBigUInt64LE(10) : c.readBigInt64LE(10),
+                        rawSize: c.readUInt32LE(18),
+                        storedSize,
+                        stored: (word & STORED_FLAG) !== 0,
+                        offset: position + 26
+                    };
+                    if (name) segment.columns[name] = entry;
+                    position = entry.offset + storedSize;
+                }
+                if (position > size) break;
+                index.segments.push(segment);
+            } else {
+                throw new Error(`Unknown record kind ${kind} at offset ${position}`);
+            }
+        }
+
+        // Sites refer to files by string id
+        for (const site of index.sites) {
+            if (site) site.file = index.strings[site.file];
+        }
+        return index;
+    }
+
+    /**
+     * Whether a segment may hold a value in [lo, hi] for each filtered
+     * column. Columns with no values in the segment never match.
+     */
+    segmentMatches(segment, where = {}) {
+        for (const [name, [lo, hi]] of Object.entries(where)) {
+            const column = segment.columns[name];
+            if (!column) return false;
+            if (column.min > column.max) return false;
+            if (column.max < BigInt(lo) || column.min > BigInt(hi)) return false;
+        }
+        return true;
+    }
+
+    decodeColumn(name, entry, data) {
+        const raw = entry.stored ? data : traceCompression.decodeBlock(data, entry.rawSize);
+        // Copy out so the typed array starts on an aligned offset
+        const bytes = new Uint8Array(raw.length);
+        bytes.set(raw);
+        return new ARRAY_TYPES[name](bytes.buffer);
+    }
+
+    /**
+     * Reads the named columns from every segment that passes `where`, a map
+     * of column name to an inclusive [lo, hi] range on its values. Returns
+     * the index and, per segment read, { firstId, rows, columns }. "type"
+     * and "func" hold string ids and "site" holds site ids, resolved through
+     * index.strings and index.sites, with NO_SITE for events without a
+     * line. "value" holds BigInts, with NO_VALUE where the event had none.
+     */
+    async readColumns(file, names, { where = {} } = {}) {
+        for (const name of [...names, ...Object.keys(where)]) {
+            if (!ARRAY_TYPES[name]) throw new Error(`Unknown column: ${name}`);
+        }
+
+        const handle = await open(file, 'r');
+        try {
+            const index = await this.indexHandle(handle);
+            const segments = [];
+            for (const segment of index.segments) {
+                if (!this.segmentMatches(segment, where)) continue;
+                const columns = {};
+                for (const name of names) {
+                    const entry = segment.columns[name];
+                    if (!entry) continue;
+                    const data = Buffer.alloc(entry.storedSize);
+                    await handle.read(data, 0, entry.storedSize, entry.offset);
+                    columns[name] = this.decodeColumn(name, entry, data);
+                }
+                segments.push({ firstId: segment.firstId, rows: segment.rows, columns });
+            }
+            return { index, segments };
+        } finally {
+            await handle.close();
+        }
+    }
+}
+
+export default new TraceColumnsService();
@@ -0,0 +1,162 @@
+// backend/src/services/trace-compression.service.js
+import { createReadStream } from 'fs';
+import { open, readFile } from 'fs/promises';
+import { Transform } from 'stream';
+import traceIntern from './trace-intern.service.js';
+import traceSubtrees from './trace-subtrees.service.js';
+import traceTemplates from './trace-templates.service.js';
+
+/**
+ * Compressed trace files
+ *
+ * With TRACE_COMPRESS=lz4 the tracer writes its JSON through a block
+ * compressor:
+ *
+ *   "TLZ4"                                   file magic
+ *   { u32 rawSize, u32 storedSize, bytes }   repeated, little endian
+ *
+ * Each block holds up to 64 KiB of trace text in LZ4 block format and
+ * references nothing outside itself, so any block can be decoded on its
+ * own. The high bit of storedSize marks a block stored uncompressed.
+ * Readers detect the magic, so plain and compressed traces are read the
+ * same way.
+ */
+
+const MAGIC = Buffer.from('TLZ4', 'latin1');
+const HEADER_SIZE = 8;
+const STORED_FLAG = 0x80000000;
+const MAX_BLOCK_SIZE = 1 << 20;
+
+class TraceCompressionService {
+    isCompressed(head) {
+        return head.length >= MAGIC.length && head.subarray(0, MAGIC.length).equals(MAGIC);
+    }
+
+    /**
+     * Decode one LZ4 block into a buffer of rawSize bytes.
+     */
+    decodeBlock(src, rawSize) {
+        const out = Buffer.allocUnsafe(rawSize);
+        let ip = 0;
+        let op = 0;
+
+        const readLength = (base) => {
+            let length = base;
+            if (base === 15) {
+                let b;
+                do {
+                    if (ip >= src.length) throw new Error('Truncated LZ4 length');
+                    b = src[ip++];
+                    length += b;
+                } while (b === 255);
+            }
+            return length;
+        };
+
+        while (ip < src.length) {
+            const token = src[ip++];
+            const literals = readLength(token >> 4);
+            if (ip + literals > src.length || op + literals > rawSize) throw new Error('LZ4 literals out of range');
+            src.copy(out, op, ip, ip + literals);
+            ip += literals;
+            op += literals;
+            if (ip >= src.length) break;  // the last sequence has no match
+
+            if (ip + 2 > src.length) throw new Error('Truncated LZ4 offset');
+            const offset = src[ip] | (src[ip + 1] << 8);
+            ip += 2;
+            const length = readLength(token & 15) + 4;
+            if (offset === 0 || offset > op || op + length > rawSize) throw new Error('LZ4 match out of range');
+            // Overlapping copies repeat the pattern, so go byte by byte
+            for (let i = 0; i < length; i++, op++) out[op] = out[op - offset];
+        }
+
+        if (op !== rawSize) throw new Error(`LZ4 block decoded to ${op} bytes, expected ${rawSize}`);
+        return out;
+    }
+
+    /**
+     * Transform stream from a compressed trace file to its JSON text.
+     * Blocks are decoded as soon as they are complete.
+     */
+    createDecompressStream() {
+        const service = this;
+        let pending = Buffer.alloc(0);
+        let sawMagic = false;
+
+        return new Transform({
+            transform(chunk, _encoding, callback) {
+                pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+                try {
+                    if (!sawMagic) {
+                        if (pending.length < MAGIC.length) return callback();
+                        if (!service.isCompressed(pending)) throw new Error('Not a compressed trace');
+                        pending = pending.subarray(MAGIC.length);
+                        sawMagic = true;
+                    }
+                    while (pending.length >= HEADER_SIZE) {
+                        const rawSize = pending.readUInt32LE(0);
+                        const word = pending.readUInt32LE(4);
+                        const storedSize = (word & ~STORED_FLAG) >>> 0;
+                        if (rawSize > MAX_BLOCK_SIZE || storedSize > MAX_BLOCK_SIZE) throw new Error('Corrupt trace block header');
+                        if (pending.length < HEADER_SIZE + storedSize) break;
+
+                        const body = pending.subarray(HEADER_SIZE, HEADER_SIZE + storedSize);
+                        this.push((word & STORED_FLAG) ? Buffer.from(body) : service.decodeBlock(body, rawSize));
+                        pending = pending.subarray(HEADER_SIZE + storedSize);
+                    }
+                    callback();
+                } catch (e) {
+                    callback(e);
+                }
+            },
+            flush(callback) {
+                // A run that crashed can leave a partial last block behind;
+                // what was decoded is kept, as with a cut-off plain trace.
+                pending = Buffer.alloc(0);
+                callback();
+            }
+        });
+    }
+
+    /**
+     * Trace file contents as text, whether or not it was compressed.
+     */
+    async readTraceText(file) {
+        const handle = await open(file, 'r');
+        let head;
+        try {
+            head = Buffer.alloc(MAGIC.length);
+            const { bytesRead } = await handle.read(head, 0, MAGIC.length, 0);
+            head = head.subarray(0, bytesRead);
+        } finally {
+            await handle.close();
+        }
+        if (!this.isCompressed(head)) return readFile(file, 'utf-8');
+
+        const chunks = [];
+        await new Promise((resolve, reject) => {
+            const input = createReadStream(file);
+            const decoder = this.createDecompressStream();
+            input.on('error', reject);
+            decoder.on('error', reject);
+            decoder.on('data', chunk => chunks.push(chunk));
+            decoder.on('end', resolve);
+            input.pipe(decoder);
+        });
+        return Buffer.concat(chunks).toString('utf-8');
+    }
+
+    /**
+     * Parsed trace in its plain form: decompressed, with interned strings
+     * resolved (see trace-intern.service.js), loop iteration templates
+     * filled in (see trace-templates.service.js) and repeated calls
+     * expanded (see trace-subtrees.service.js).
+     */
+    async readTrace(file) {
+        const trace = traceIntern.resolve(JSON.parse(await this.readTraceText(file)));
+        return traceSubtrees.resolve(traceTemplates.resolve(trace));
+    }
+}
+
+export default new TraceCompressionService();
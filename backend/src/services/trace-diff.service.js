@@ -0,0 +1,173 @@
+// backend/src/services/trace-diff.service.js
+import traceCompression from './trace-compression.service.js';
+
+/**
+ * Differential tracing
+ *
+ * The tracer folds every event into a rolling semantic hash (type, function,
+ * depth and payload, with addresses, timestamps and session paths removed)
+ * and records a checkpoint every `checkpoint_interval` events. Because the
+ * hash is cumulative, two traces agree on checkpoint k iff (with high
+ * probability) they agree on every event before it, so the first divergent
+ * checkpoint can be found by binary search and only one interval of events
+ * has to be compared structurally.
+ */
+
+// Fields that legitimately differ between two runs of the same program:
+// ids, timestamps, session paths and every field the tracer writes with %p.
+const VOLATILE_FIELDS = new Set([
+    'id', 'ts', 'file', 'addr', 'address', 'aliasedAddress', 'caller', 'data', 'previousData', 'frame'
+]);
+
+class TraceDiffService {
+    /**
+     * Canonical string for an event with run-specific fields removed. A
+     * value is an address only when the event says it is a pointer; program
+     * text such as "0x10" or "(nil)" is compared like any other value.
+     */
+    semanticKey(event) {
+        if (!event) return '';
+        const pointerValue = event.vtype === 'ptr' || event.type === 'pointer';
+        const keys = Object.keys(event).filter(k => !VOLATILE_FIELDS.has(k)).sort();
+        const parts = [];
+        for (const k of keys) {
+            if (k === 'value' && pointerValue) continue;
+            parts.push(`${k}=${JSON.stringify(event[k])}`);
+        }
+        return parts.join('|');
+    }
+
+    /**
+     * Binary search for the first checkpoint whose hash differs.
+     * Returns the number of leading checkpoints the two traces share.
+     */
+    commonCheckpointPrefix(checkpointsA = [], checkpointsB = []) {
+        let lo = 0;
+        let hi = Math.min(checkpointsA.length, checkpointsB.length);
+        while (lo < hi) {
+            const mid = (lo + hi) >>> 1;
+            const a = checkpointsA[mid];
+            const b = checkpointsB[mid];
+            if (a.event === b.event && a.hash === b.hash) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    /**
+     * Reconstruct the call stack active at `index` by walking backwards and
+     * keeping every func_enter that has not been matched by a func_exit.
+     */
+    callStackAt(events, index) {
+        const stack = [];
+        let pendingExits = 0;
+        for (let i = Math.min(index, events.length - 1); i >= 0; i--) {
+            const ev = events[i];
+            if (!ev) continue;
+            if (ev.type === 'func_exit') {
+                pendingExits++;
+            } else if (ev.type === 'func_enter') {
+                if (pendingExits > 0) {
+                    pendingExits--;
+                } else {
+                    stack.push({ function: ev.func, depth: ev.depth, eventIndex: i });
+                }
+            }
+        }
+        return stack.reverse();
+    }
+
+    /**
+     * Locate the first semantically different event of two parsed traces
+     * (objects with `events`, `checkpoints` and `checkpoint_interval`).
+     */
+    findFirstDivergence(traceA, traceB) {
+        const eventsA = traceA.events || [];
+        const eventsB = traceB.events || [];
+        const cpA = traceA.checkpoints || [];
+        const cpB = traceB.checkpoints || [];
+
+        const sameInterval = (traceA.checkpoint_interval || 0) === (traceB.checkpoint_interval || 0);
+        const common = sameInterval ? this.commonCheckpointPrefix(cpA, cpB) : 0;
+
+        if (sameInterval &&
+            traceA.semantic_hash && traceA.semantic_hash === traceB.semantic_hash &&
+            eventsA.length === eventsB.length) {
+            return { identical: true, checkpointsCompared: common, eventIndex: -1 };
+        }
+
+        // Everything before the last shared checkpoint is known to be equal.
+        const windowStart = common > 0 ? cpA[common - 1].event : 0;
+        const limit = Math.max(eventsA.length, eventsB.length);
+
+        for (let i = windowStart; i < limit; i++) {
+            const a = eventsA[i];
+            const b = eventsB[i];
+            if (a && b && this.semanticKey(a) === this.semanticKey(b)) continue;
+
+            return {
+                identical: false,
+                eventIndex: i,
+                windowStart,
+                checkpointsCompared: common,
+                a: a || null,
+                b: b || null,
+                callStackA: this.callStackAt(eventsA, i),
+                callStackB: this.callStackAt(eventsB, i)
+            };
+        }
+
+        // The hashes disagree but no visible field does (the tracer hashes
+        // more than it writes, or an event was dropped from the file). The
+        // runs part within the first mismatching checkpoint's interval;
+        // report its last event rather than calling the traces identical.
+        const checkpoint = common < cpA.length ? cpA[common] : cpB[common];
+        const eventIndex = Math.max(windowStart,
+            (checkpoint ? checkpoint.event : Math.max(eventsA.length, eventsB.length)) - 1);
+        return {
+            identical: false,
+            eventIndex,
+            windowStart,
+            checkpointsCompared: common,
+            hashOnly: true,
+            a: eventsA[eventIndex] || null,
+            b: eventsB[eventIndex] || null,
+            callStackA: this.callStackAt(eventsA, eventIndex),
+            callStackB: this.callStackAt(eventsB, eventIndex)
+        };
+    }
+
+    async diffFiles(pathA, pathB) {
+        const [a, b] = await Promise.all([traceCompression.readTrace(pathA), traceCompression.readTrace(pathB)]);
+        return this.findFirstDivergence(a, b);
+    }
+
+    /**
+     * Human-readable one-paragraph report of a divergence result.
+     */
+    formatReport(result) {
+        if (result.identical) {
+            return `Traces are semantically identical (${result.checkpointsCompared} checkpoints matched).`;
+        }
+        const describe = (ev) => {
+            if (!ev) return '<end of trace>';
+            const where = ev.line ? ` line ${ev.line}` : '';
+            const value = ev.value !== undefined ? ` value=${JSON.stringify(ev.value)}` : '';
+            const name = ev.name ? ` ${ev.name}` : '';
+            return `${ev.type}${name}${value}${where}`;
+        };
+        const stack = (frames) => frames.map(f => f.function).join(' > ') || '<none>';
+        const where = result.hashOnly
+            ? `Divergence within events #${result.windowStart}-#${result.eventIndex} ` +
+              `(semantic hashes differ, no event field does; ${result.checkpointsCompared} checkpoints matched)`
+            : `First divergence at event #${result.eventIndex} ` +
+              `(${result.checkpointsCompared} checkpoints matched, scan started at #${result.windowStart})`;
+        return [
+            where,
+            `  A: ${describe(result.a)}   [stack: ${stack(result.callStackA)}]`,
+            `  B: ${describe(result.b)}   [stack: ${stack(result.callStackB)}]`
+        ].join('\n');
+    }
+}
+
+export default new TraceDiffService();
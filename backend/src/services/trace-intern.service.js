@@ -0,0 +1,47 @@
+// backend/src/services/trace-intern.service.js
+
+/**
+ * Interned trace strings
+ *
+ * With TRACE_INTERN=1 the tracer writes the event members that repeat on
+ * nearly every event (type, func and the top-level file and name) as
+ * integer ids. The first use of a string is announced in the events array
+ * by a record {"intern": id, "s": "..."} placed ahead of the event that
+ * uses it. Ids restart with every trace file.
+ */
+
+const INTERNED_MEMBERS = ['type', 'func', 'file', 'name'];
+
+class TraceInternService {
+    isRecord(entry) {
+        return entry && entry.intern !== undefined && entry.s !== undefined && entry.id === undefined;
+    }
+
+    /**
+     * Replace ids with their strings and drop the records, in place.
+     * Traces without records are returned untouched.
+     */
+    resolve(trace) {
+        const events = trace && trace.events;
+        if (!Array.isArray(events) || !events.some(e => this.isRecord(e))) return trace;
+
+        const strings = [];
+        let kept = 0;
+        for (let i = 0; i < events.length; i++) {
+            const e = events[i];
+            if (this.isRecord(e)) {
+                strings[e.intern] = e.s;
+                continue;
+            }
+            for (const key of INTERNED_MEMBERS) {
+                const v = e[key];
+                if (typeof v === 'number') e[key] = strings[v];
+            }
+            events[kept++] = e;
+        }
+        events.length = kept;
+        return trace;
+    }
+}
+
+export default new TraceInternService();
@@ -16,19 +16,21 @@ class TracePlatformAdapter {
     /**
      * Normalize compiler flags to ensure consistency and proper instrumentation.
      * Enforces: -g, -O0, -fno-omit-frame-pointer, -finstrument-functions
+     * optLevel replaces -O0 for builds traced by the LLVM pass plugin, and
+     * callHook replaces -finstrument-functions for XRay builds.
      */
-    normalizeCompileFlags(userFlags = []) {
+    normalizeCompileFlags(userFlags = [], { optLevel = '-O0', callHook = '-finstrument-functions' } = {}) {
         const requiredFlags = [
             '-g',
-            '-O0',
+            optLevel,
             '-fno-omit-frame-pointer',
-            '-finstrument-functions'
+            callHook
         ];
 
         // Filter out conflicting optimization flags or flags that might break instrumentation
         const safeUserFlags = userFlags.filter(flag => {
-            // Remove optimization flags higher than O0
-            if (/^-O[1-3sfast]/.test(flag)) return false;
+            // Remove optimization flags other than the required level
+            if (/^-O[1-3sfast]/.test(flag) && flag !== optLevel) return false;
             // Remove flags that might omit frame pointers
             if (flag === '-fomit-frame-pointer') return false;
             return true;
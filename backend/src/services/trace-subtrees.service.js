@@ -0,0 +1,67 @@
+// backend/src/services/trace-subtrees.service.js
+
+/**
+ * Repeated call subtrees
+ *
+ * With TRACE_SUBTREES=1 the tracer writes a call whose events repeat, in
+ * full, those of an earlier call as one reference event:
+ *
+ *   {"id": 87, "type": "call_ref", ..., "ref": 60, "events": 11, "exitTs": 5120}
+ *
+ * standing for the 11 events of the call whose func_enter has id 60,
+ * renumbered from 87 and shifted to start at the reference's timestamp.
+ * Copied timestamps never pass exitTs, when the repeated call returned.
+ * Ids in the file are those of the full trace, so the events after a
+ * reference continue at id + events. The first copy may itself contain
+ * references, and may lie inside another reference.
+ */
+
+class TraceSubtreesService {
+    isReference(event) {
+        return event && event.type === 'call_ref' && event.ref !== undefined;
+    }
+
+    /**
+     * Yields the full trace one event at a time, copying referenced calls
+     * as they are reached. Every event yielded is kept for later references
+     * to copy from.
+     */
+    *expand(events) {
+        const full = [];
+        let base = null;
+        for (const event of events) {
+            if (base === null) base = event.id;
+            if (!this.isReference(event)) {
+                full.push(event);
+                yield event;
+                continue;
+            }
+
+            const first = full[event.ref - base];
+            if (!first || event.ref + event.events > event.id) {
+                throw new Error(`Trace reference ${event.id} points outside the events before it`);
+            }
+            const shift = event.ts - first.ts;
+            for (let i = 0; i < event.events; i++) {
+                const source = full[event.ref - base + i];
+                const ts = Math.min(source.ts + shift, event.exitTs ?? Infinity);
+                const copy = { ...source, id: event.id + i, ts };
+                full.push(copy);
+                yield copy;
+            }
+        }
+    }
+
+    /**
+     * Replace references with the events they stand for. Traces without
+     * references are returned untouched.
+     */
+    resolve(trace) {
+        const events = trace && trace.events;
+        if (!Array.isArray(events) || !events.some(e => this.isReference(e))) return trace;
+        trace.events = Array.from(this.expand(events));
+        return trace;
+    }
+}
+
+export default new TraceSubtreesService();
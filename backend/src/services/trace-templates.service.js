@@ -0,0 +1,93 @@
+// backend/src/services/trace-templates.service.js
+
+/**
+ * Loop iteration templates
+ *
+ * With TRACE_TEMPLATES=1 the tracer writes loop iterations that repeat the
+ * shape of an earlier one as template instances. A definition holds the
+ * iteration's events as JSON text, without ids and timestamps, with '#'
+ * (outside strings) where the numbers that vary go:
+ *
+ *   {"template": 0, "text": "[{\"type\":\"loop_body_start\",...,\"iteration\":#},...]"}
+ *   {"tpl": 0, "id": 40, "ts": 1200, "v": [3], "dt": [0, 1]}
+ *
+ * An instance fills the holes with "v" in order. Its events get ids from
+ * "id", one apart or "events" apart after a call_ref, and timestamps "ts"
+ * plus "dt". Template ids restart with every trace file.
+ */
+
+class TraceTemplatesService {
+    isDefinition(entry) {
+        return entry && entry.template !== undefined && typeof entry.text === 'string' && entry.id === undefined;
+    }
+
+    isInstance(entry) {
+        return entry && entry.tpl !== undefined && Array.isArray(entry.v);
+    }
+
+    /** Template text split at its holes */
+    holes(text) {
+        const parts = [];
+        let start = 0;
+        let inString = false;
+        for (let i = 0; i < text.length; i++) {
+            const c = text[i];
+            if (inString) {
+                if (c === '\\') i++;
+                else if (c === '"') inString = false;
+            } else if (c === '"') {
+                inString = true;
+            } else if (c === '#') {
+                parts.push(text.slice(start, i));
+                start = i + 1;
+            }
+        }
+        parts.push(text.slice(start));
+        return parts;
+    }
+
+    instanceEvents(parts, instance) {
+        let text = parts[0];
+        for (let i = 1; i < parts.length; i++) text += String(instance.v[i - 1]) + parts[i];
+
+        let id = instance.id;
+        return JSON.parse(text).map((event, i) => {
+            const { type, addr, func, depth, ...rest } = event;
+            const full = { id, type, addr, func, depth, ts: instance.ts + instance.dt[i], ...rest };
+            id += type === 'call_ref' ? event.events : 1;
+            return full;
+        });
+    }
+
+    /**
+     * Yields the trace's events with each instance replaced by its events,
+     * built when it is reached. Definitions are dropped.
+     */
+    *expand(events) {
+        const templates = new Map();
+        for (const entry of events) {
+            if (this.isDefinition(entry)) {
+                templates.set(entry.template, this.holes(entry.text));
+            } else if (this.isInstance(entry)) {
+                const parts = templates.get(entry.tpl);
+                if (!parts) throw new Error(`Trace template ${entry.tpl} is used before it is defined`);
+                yield* this.instanceEvents(parts, entry);
+            } else {
+                yield entry;
+            }
+        }
+    }
+
+    /**
+     * Replace instances with their events and drop the definitions.
+     * Traces without templates are returned untouched.
+     */
+    resolve(trace) {
+        const events = trace && trace.events;
+        if (!Array.isArray(events) || !events.some(e => this.isDefinition(e))) return trace;
+        trace.events = Array.from(this.expand(events));
+        return trace;
+    }
+}
+
+export default new TraceTemplatesService();
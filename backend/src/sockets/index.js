@@ -47,7 +47,7 @@ export function setupSocketHandlers(io) {
     socket.on(SOCKET_EVENTS.CODE_TRACE_GENERATE, async (data) => {
       try {
         sessionRegistry.touch(socket.id);
-        const { code, language = 'cpp' } = data;
+        const { code, language = 'cpp', mode = 'full', window } = data;
 
         if (!code || !code.trim()) {
           socket.emit(SOCKET_EVENTS.CODE_TRACE_ERROR, {
@@ -80,7 +80,11 @@ export function setupSocketHandlers(io) {
         });
 
         // Generate trace
-        const traceResult = await instrumentationTracer.generateTrace(code, language);
+        const traceResult = await instrumentationTracer.generateTrace(code, language, {
+          mode,
+          window,
+          sessionId: socket.id
+        });
 
         if (!traceResult || !traceResult.steps || traceResult.steps.length === 0) {
           throw new Error('No execution steps generated');
@@ -131,10 +135,45 @@ export function setupSocketHandlers(io) {
       }
     });
 
+    /**
+     * Full-detail steps for a window of this socket's last skeleton trace:
+     * { from, to } in skeleton steps, { function, invocation } or
+     * { loopId, iteration, occurrence }
+     */
+    socket.on(SOCKET_EVENTS.CODE_TRACE_WINDOW_REQUEST, async (data = {}) => {
+      try {
+        sessionRegistry.touch(socket.id);
+        const request = { ...data };
+        for (const key of ['from', 'to', 'invocation', 'loopId', 'iteration', 'occurrence']) {
+          if (request[key] !== undefined) request[key] = Number(request[key]);
+        }
+
+        const explicit = Number.isInteger(request.from) && Number.isInteger(request.to);
+        if (explicit ? (request.from < 0 || request.to <= request.from)
+          : !(request.function || Number.isInteger(request.loopId))) {
+          socket.emit(SOCKET_EVENTS.CODE_TRACE_ERROR, {
+            message: 'Invalid trace window'
+          });
+          return;
+        }
+
+        const window = await instrumentationTracer.traceWindow(socket.id, request);
+        socket.emit(SOCKET_EVENTS.CODE_TRACE_WINDOW, window);
+      } catch (error) {
+        console.error('❌ Trace window error:', error);
+
+        socket.emit(SOCKET_EVENTS.CODE_TRACE_ERROR, {
+          message: error.message || 'Failed to trace window',
+          details: process.env.NODE_ENV === 'development' ? error.stack : undefined
+        });
+      }
+    });
+
     /**
      * Disconnect handler
      */
     socket.on('disconnect', () => {
+      instrumentationTracer.releaseSession(socket.id).catch(() => { });
       sessionRegistry.unregister(socket.id, 'disconnect');
       console.log(`Client disconnected: ${socket.id}`);
     });
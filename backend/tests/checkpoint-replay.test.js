@@ -0,0 +1,26 @@
+import checkpointReplay from '../src/services/checkpoint-replay.service.js';
+import tracer from '../src/services/instrumentation-tracer.service.js';
+
+describe('CheckpointReplayService', () => {
+  const checkpoints = [0, 256, 512, 768].map((event, i) => ({ event, pid: 100 + i, fifo: `/tmp/ckpt_${event}.fifo` }));
+
+  it('picks the latest checkpoint at or before the window start', () => {
+    expect(checkpointReplay.nearestCheckpoint(checkpoints, 0).event).toBe(0);
+    expect(checkpointReplay.nearestCheckpoint(checkpoints, 511).event).toBe(256);
+    expect(checkpointReplay.nearestCheckpoint(checkpoints, 512).event).toBe(512);
+    expect(checkpointReplay.nearestCheckpoint(checkpoints, 5000).event).toBe(768);
+  });
+
+  it('returns null when no checkpoint precedes the window', () => {
+    expect(checkpointReplay.nearestCheckpoint([{ event: 16 }], 3)).toBeNull();
+    expect(checkpointReplay.nearestCheckpoint([], 3)).toBeNull();
+  });
+
+  it('leaves programs that read stdin to input replay', () => {
+    expect(tracer.readsStdin('int n; std::cin >> n;')).toBe(true);
+    expect(tracer.readsStdin('scanf("%d", &n);')).toBe(true);
+    expect(tracer.readsStdin('fgets(buf, sizeof buf, stdin);')).toBe(true);
+    expect(tracer.readsStdin('read(0, buf, 16);')).toBe(true);
+    expect(tracer.readsStdin('printf("%d\\n", fib(10));')).toBe(false);
+  });
+});
@@ -0,0 +1,93 @@
+import path from 'path';
+import clangInstrumenter from '../src/services/clang-instrumenter.service.js';
+import tracer from '../src/services/instrumentation-tracer.service.js';
+
+const config = {
+  cxxflags: '-I/tc/include -std=c++17 -fno-exceptions\n',
+  ldflags: '-L/tc/lib\n',
+  libs: '-lLLVM-18\n',
+  systemLibs: '-lrt -ldl -lm -lz\n'
+};
+
+describe('ClangInstrumenter', () => {
+  it('links the Clang libraries as one group with GNU ld', () => {
+    const args = clangInstrumenter.buildArgs(config, 'linux');
+    const start = args.indexOf('-Wl,--start-group');
+    const end = args.indexOf('-Wl,--end-group');
+
+    expect(args.slice(0, 3)).toEqual(['-I/tc/include', '-std=c++17', '-fno-exceptions']);
+    expect(args[args.indexOf('-o') + 1]).toBe(clangInstrumenter.toolBinary);
+    expect(start).toBeGreaterThan(args.indexOf('-L/tc/lib'));
+    expect(args.slice(start + 1, end)).toContain('-lclangTooling');
+    expect(args.slice(end + 1)).toEqual(['-lLLVM-18', '-lrt', '-ldl', '-lm', '-lz']);
+    expect(clangInstrumenter.buildArgs(config, 'darwin')).not.toContain('-Wl,--start-group');
+  });
+
+  it('parses the program as C++, the way the tracer compiles it', () => {
+    const args = clangInstrumenter.toolArgs('/t/src.c', '/t/out.c');
+    expect(args.slice(0, 7)).toEqual(['/t/src.c', '-o', '/t/out.c', '--', '-x', 'c++', '-std=c++17']);
+    expect(args).toContain('-nostdinc');
+    expect(path.basename(clangInstrumenter.toolSource)).toBe('trace-instrument.cpp');
+  });
+
+  it('builds the pass plugin without linking LLVM', () => {
+    const args = clangInstrumenter.passArgs(config, 'linux');
+    expect(args.slice(0, 3)).toEqual(['-I/tc/include', '-std=c++17', '-fno-exceptions']);
+    expect(args).toContain('-shared');
+    expect(args[args.indexOf('-o') + 1]).toBe(clangInstrumenter.passPlugin);
+    expect(args).not.toContain('-lLLVM-18');
+    expect(clangInstrumenter.passArgs(config, 'darwin').slice(-2)).toEqual(['-undefined', 'dynamic_lookup']);
+    expect(path.basename(clangInstrumenter.passSource)).toBe('trace-pass.cpp');
+  });
+
+  it('falls back to the line-based instrumenter without the tool', async () => {
+    const saved = clangInstrumenter.toolReady;
+    clangInstrumenter.toolReady = Promise.resolve(null);
+    try {
+      const out = await clangInstrumenter.instrumentCode('int main() {\n    int x = 1;\n    return x;\n}', 'cpp');
+      expect(out).toContain('#include "trace.h"');
+      expect(out).toContain('__trace_declare(x, int,');
+    } finally {
+      clangInstrumenter.toolReady = saved;
+    }
+  });
+
+  it('retries a failed clang-instrumented build with the line-based instrumenter', async () => {
+    const saved = tracer.compileProgram;
+    const builds = [];
+    tracer.compileProgram = async (_code, _language, build) => {
+      builds.push({ ...build });
+      if (build.clang) throw new Error('User compile failed');
+      return { executable: 'exe' };
+    };
+    try {
+      expect(await tracer.compile('int main() {}', 'cpp', { instrumenter: 'clang' })).toEqual({ executable: 'exe' });
+      expect(builds.map(build => build.clang)).toEqual([true, null]);
+      await tracer.compile('int main() {}', 'cpp');
+      expect(builds[2].clang).toBe(false);
+    } finally {
+      tracer.compileProgram = saved;
+    }
+  });
+
+  it('retries a failed optimized build at -O0', async () => {
+    const saved = [tracer.compileProgram, clangInstrumenter.passReady];
+    const builds = [];
+    clangInstrumenter.passReady = Promise.resolve('/t/trace-pass.so');
+    tracer.compileProgram = async (_code, _language, build) => {
+      builds.push({ ...build });
+      if (build.passPlugin || build.xray) throw new Error('User compile failed');
+      return { executable: 'exe' };
+    };
+    try {
+      await tracer.compile('int main() {}', 'cpp', { optimized: true, xray: true, categories: ['calls'] });
+      const expected = process.platform === 'linux' ? [true, null, null] : [null, null];
+      expect(builds.map(build => build.xray)).toEqual(expected);
+      expect(builds[0].passPlugin).toBe('/t/trace-pass.so');
+      expect(builds[builds.length - 1].passPlugin).toBe(null);
+      expect(builds[builds.length - 1].categories).toEqual(['calls']);
+    } finally {
+      [tracer.compileProgram, clangInstrumenter.passReady] = saved;
+    }
+  });
+});
@@ -0,0 +1,84 @@
+import instrumenter from '../src/services/code-instrumenter.service.js';
+
+describe('CodeInstrumenter struct layouts', () => {
+  it('collects plain data members only', () => {
+    expect(instrumenter.structFieldNames('int x, y;')).toEqual(['x', 'y']);
+    expect(instrumenter.structFieldNames('struct Node* next;')).toEqual(['next']);
+    expect(instrumenter.structFieldNames('Node *next;')).toEqual(['next']);
+    expect(instrumenter.structFieldNames('char name[16] = "";')).toEqual(['name']);
+    expect(instrumenter.structFieldNames('std::map<int, int> counts;')).toEqual(['counts']);
+    expect(instrumenter.structFieldNames('static int count;')).toEqual([]);
+    expect(instrumenter.structFieldNames('unsigned flag : 1;')).toEqual([]);
+    expect(instrumenter.structFieldNames('int area() const;')).toEqual([]);
+  });
+
+  it('emits a layout after the struct and snapshots member writes', async () => {
+    const code = [
+      'typedef struct {',
+      '    int x;',
+      '    double w;',
+      '} Point;',
+      'int main() {',
+      '    Point p = {1, 0.5};',
+      '    p.x = 3;',
+      '    return 0;',
+      '}'
+    ].join('\n');
+    const out = await instrumenter.injectBeginnerModeTracing(code, 'c');
+
+    expect(out).toContain('TRACE_LAYOUT(Point, TRACE_FIELD(Point, x), TRACE_FIELD(Point, w));');
+    expect(out).toContain('__trace_struct_snapshot(p, &(p), 7);');
+  });
+
+  it('gives a struct with private members an opaque layout', async () => {
+    const code = [
+      'struct Account {',
+      '    int id;',
+      'private:',
+      '    int balance;',
+      '};',
+      'int main() {',
+      '    Account a;',
+      '    a.id = 1;',
+      '    return 0;',
+      '}'
+    ].join('\n');
+    const out = await instrumenter.injectBeginnerModeTracing(code, 'cpp');
+
+    expect(out).toContain('TRACE_LAYOUT_OPAQUE(Account);');
+    expect(out).not.toContain('TRACE_FIELD(Account, balance)');
+    expect(out).toContain('__trace_struct_snapshot(a, &(a), 8);');
+  });
+
+  it('snapshots the object a chained member write changes', () => {
+    expect(instrumenter.memberWriteTarget('p->next->val = x;')).toEqual({ base: 'p->next', address: '&*(p->next)' });
+    expect(instrumenter.memberWriteTarget('p->items[2].x++;')).toEqual({ base: 'p', address: '&*(p)' });
+    expect(instrumenter.memberWriteTarget('a[i].pos.x += 2;')).toEqual({ base: 'a[i]', address: '&(a[i])' });
+    expect(instrumenter.memberWriteTarget('q->a = b->c;')).toEqual({ base: 'q', address: '&*(q)' });
+    expect(instrumenter.memberWriteTarget('x = p->y;')).toBe(null);
+  });
+});
+
+describe('CodeInstrumenter containers', () => {
+  it('traces vector and string declarations and the statements that change them', async () => {
+    const code = [
+      'int main() {',
+      '    std::vector<int> v;',
+      '    std::string s = "hi";',
+      '    v.push_back(1);',
+      '    v[0] += 2;',
+      '    s = s + "!";',
+      '    int n = v.size();',
+      '    return 0;',
+      '}'
+    ].join('\n');
+    const out = await instrumenter.injectBeginnerModeTracing(code, 'cpp');
+
+    expect(out).toContain('__trace_container_declare(v, 2);');
+    expect(out).toContain('__trace_container_declare(s, 3);');
+    expect(out).toContain('__trace_container(v, 4);');
+    expect(out).toContain('__trace_container(v, 5);');
+    expect(out).toContain('__trace_container(s, 6);');
+    expect(out).not.toContain('__trace_container(v, 7);');
+  });
+});
@@ -0,0 +1,35 @@
+import inputReplay from '../src/services/input-replay.service.js';
+
+// Skeleton trace of main() calling work() twice, each running a two-iteration loop
+const ev = (type, depth, extra = {}) => ({ type, depth, func: 'main', addr: '(nil)', ...extra });
+const work = () => [
+  ev('func_enter', 2, { addr: '0x20' }),
+  ev('loop_start', 2, { loopId: 0 }),
+  ev('loop_condition', 2, { loopId: 0 }),
+  ev('loop_body_start', 2, { loopId: 0, iteration: 1 }),
+  ev('loop_iteration_end', 2, { loopId: 0, iteration: 1 }),
+  ev('loop_condition', 2, { loopId: 0 }),
+  ev('loop_body_start', 2, { loopId: 0, iteration: 2 }),
+  ev('loop_end', 2, { loopId: 0 }),
+  ev('return', 2),
+  ev('func_exit', 2, { addr: '0x20' })
+];
+const events = [ev('func_enter', 1, { addr: '0x10' }), ...work(), ...work(), ev('func_exit', 1, { addr: '0x10' })];
+const names = new Map([['0x10', 'main'], ['0x20', 'work']]);
+
+describe('InputReplayService.resolveWindow', () => {
+  it('passes explicit skeleton ranges through', () => {
+    expect(inputReplay.resolveWindow(events, { from: 3, to: 7 })).toEqual({ from: 3, to: 7 });
+  });
+
+  it('covers the n-th invocation of a function up to its matching exit', () => {
+    expect(inputReplay.resolveWindow(events, { function: 'work' }, names)).toEqual({ from: 1, to: 11 });
+    expect(inputReplay.resolveWindow(events, { function: 'work', invocation: 2 }, names)).toEqual({ from: 11, to: 21 });
+    expect(inputReplay.resolveWindow(events, { function: 'work', invocation: 3 }, names)).toBeNull();
+  });
+
+  it('covers one loop iteration, ending at loop_end when the body breaks out', () => {
+    expect(inputReplay.resolveWindow(events, { loopId: 0, iteration: 1 })).toEqual({ from: 4, to: 6 });
+    expect(inputReplay.resolveWindow(events, { loopId: 0, iteration: 2, occurrence: 2 })).toEqual({ from: 17, to: 19 });
+  });
+});
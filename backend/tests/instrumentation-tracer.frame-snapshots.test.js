@@ -0,0 +1,34 @@
+import tracer from '../src/services/instrumentation-tracer.service.js';
+
+describe('InstrumentationTracer frame snapshots', () => {
+  it('decodes every local of a frame snapshot', async () => {
+    const events = [
+      {
+        type: 'frame_snapshot', at: 'exit', func: 'sum', file: 'main.c', line: 9,
+        locals: [
+          { name: 'n', type: 'int', value: 4 },
+          { name: 'avg', type: 'double', bits: '401e000000000000', vtype: 'f64' },
+          { name: 'c', type: 'char', value: 122, vtype: 'char' },
+          { name: 'a', type: 'float[2]', elements: ['3fc00000', '40200000'], vtype: 'f32' },
+          { name: 'n', type: 'int', value: 5 }
+        ]
+      }
+    ];
+
+    const steps = await tracer.convertToSteps(events, 'dummy_exe', 'main.c', { stdout: '', stderr: '' }, [], new Map());
+    const snapshot = steps.find(s => s.eventType === 'frame_snapshot');
+
+    expect(snapshot.at).toBe('exit');
+    expect(snapshot.line).toBe(9);
+    // The inner block's n shadows the outer one
+    expect(snapshot.locals).toEqual({ n: 5, avg: 7.5, c: 122, a: [1.5, 2.5] });
+    expect(snapshot.explanation).toBe('n = 5, avg = 7.5, c = 122, a = [1.5, 2.5]');
+  });
+
+  it('builds the snapshot environment', () => {
+    expect(tracer.snapshotEnv({ at: ['exit', 'iteration'], every: 4 }))
+      .toEqual({ TRACE_SNAPSHOTS: 'exit,iteration', TRACE_SNAPSHOT_EVERY: '4' });
+    expect(tracer.snapshotEnv()).toEqual({ TRACE_SNAPSHOTS: 'exit', TRACE_SNAPSHOT_EVERY: '1' });
+    expect(() => tracer.snapshotEnv({ at: ['entry'] })).toThrow('Unknown snapshot point: entry');
+  });
+});
@@ -64,3 +64,103 @@ describe('InstrumentationTracer loop engine (strict LIFO)', () => {
   });
 });
 
+
+describe('InstrumentationTracer program I/O events', () => {
+  it('places output where the tracer recorded it and merges consecutive chunks', async () => {
+    const events = [
+      { type: 'stdout', text: 'Enter n: ' },
+      { type: 'stdin', text: '3\n' },
+      { type: 'assign', name: 'n', value: 3, file: 'main.c', line: 4 },
+      { type: 'stderr', text: 'warn ' },
+      { type: 'stderr', text: '3\n' },
+      { type: 'assign', name: 'x', value: 9, file: 'main.c', line: 5 },
+      { type: 'stdout', text: 'x = 9\n' }
+    ];
+
+    const steps = await tracer.convertToSteps(
+      events,
+      'dummy_exe',
+      'main.c',
+      { stdout: 'Enter n: x = 9\n', stderr: 'warn 3\n' },
+      [],
+      new Map()
+    );
+
+    const io = steps.filter(s => s.eventType === 'output').map(s => [s.file, s.rawText]);
+    expect(io).toEqual([
+      ['stdout', 'Enter n: '],
+      ['stdin', '3\n'],
+      ['stderr', 'warn 3\n'],
+      ['stdout', 'x = 9\n']
+    ]);
+
+    const idxAssignX = steps.findIndex(s => s.eventType === 'var_assign' && s.line === 5);
+    const idxLastOutput = steps.findIndex(s => s.eventType === 'output' && s.rawText === 'x = 9\n');
+    expect(idxAssignX).toBeGreaterThanOrEqual(0);
+    expect(idxLastOutput).toBeGreaterThan(idxAssignX);
+  });
+});
+
+describe('InstrumentationTracer compile-time categories', () => {
+  it('builds the TRACE_CATEGORIES mask from category names', () => {
+    expect(tracer.categoriesDefine(['calls', 'loops'])).toBe('-DTRACE_CATEGORIES=0x101u');
+    expect(tracer.categoriesDefine(['control', 'vars', 'arrays'])).toBe('-DTRACE_CATEGORIES=0xeu');
+    expect(tracer.categoriesDefine([])).toBe('-DTRACE_CATEGORIES=0x0u');
+  });
+
+  it('rejects unknown categories', () => {
+    expect(() => tracer.categoriesDefine(['heap'])).toThrow('Unknown trace category: heap');
+  });
+});
+
+describe('InstrumentationTracer typed values', () => {
+  it('decodes float bit patterns exactly and marks chars', () => {
+    expect(tracer.decodeTypedValue({ type: 'assign', bits: '400921fb54442d18', vtype: 'f64' }).value)
+      .toBe(Math.PI);
+    expect(tracer.decodeTypedValue({ type: 'assign', bits: '3fc00000', vtype: 'f32' }).value).toBe(1.5);
+    expect(tracer.decodeTypedValue({ type: 'assign', value: 65, vtype: 'char' }).char).toBe(true);
+    expect(tracer.decodeTypedValue({ type: 'assign', value: 7 }).value).toBe(7);
+  });
+});
+
+describe('InstrumentationTracer containers', () => {
+  it('decodes float and struct elements of a range', () => {
+    expect(tracer.decodeContainerElement('3fe0000000000000', 'f64')).toBe(0.5);
+    expect(tracer.decodeContainerElement(42, 'i64')).toBe(42);
+    expect(tracer.decodeContainerElement({ x: { value: 1 }, w: { bits: '3fc00000', vtype: 'f32' } }, 'struct'))
+      .toEqual({ x: 1, w: 1.5 });
+  });
+});
+
+describe('InstrumentationTracer shadow writes', () => {
+  it('maps flat element offsets back to array indices', () => {
+    expect(tracer.unflattenIndex(4, [6])).toEqual([4]);
+    expect(tracer.unflattenIndex(7, [3, 4])).toEqual([1, 3]);
+    expect(tracer.unflattenIndex(23, [2, 3, 4])).toEqual([1, 2, 3]);
+  });
+});
+
+describe('InstrumentationTracer folded events', () => {
+  it('expands an empty block back into enter and exit', () => {
+    const events = tracer.expandFoldedEvents([
+      { id: 1, type: 'block_enter', blockDepth: 1, line: 3, empty: true, exitLine: 4 }
+    ]);
+    expect(events.map(e => [e.type, e.line])).toEqual([['block_enter', 3], ['block_exit', 4]]);
+    expect(events[0].empty).toBeUndefined();
+  });
+
+  it('expands a folded condition and the iteration it ended', () => {
+    const events = tracer.expandFoldedEvents([
+      { id: 2, type: 'loop_body_start', loopId: 7, line: 5, iteration: 2, condition: 1, endedIteration: 1 }
+    ]);
+    expect(events.map(e => e.type)).toEqual(['loop_iteration_end', 'loop_condition', 'loop_body_start']);
+    expect(events[0].iteration).toBe(1);
+    expect(events[1].result).toBe(1);
+    expect(events[2].iteration).toBe(2);
+  });
+
+  it('returns unfolded traces untouched', () => {
+    const events = [{ type: 'loop_condition', loopId: 1, result: 0 }, { type: 'loop_end', loopId: 1 }];
+    expect(tracer.expandFoldedEvents(events)).toBe(events);
+  });
+});
@@ -0,0 +1,88 @@
+import { mkdtempSync, writeFileSync, rmSync } from 'fs';
+import { tmpdir } from 'os';
+import path from 'path';
+import traceColumns from '../src/services/trace-columns.service.js';
+
+const u32 = (v) => { const b = Buffer.alloc(4); b.writeUInt32LE(v >>> 0); return b; };
+const i64 = (v) => { const b = Buffer.alloc(8); b.writeBigInt64LE(BigInt(v)); return b; };
+
+const string = (id, text) => Buffer.concat([Buffer.from([1]), u32(id), u32(Buffer.byteLength(text)), Buffer.from(text)]);
+const site = (id, file, line) => Buffer.concat([Buffer.from([2]), u32(id), u32(file), u32(line)]);
+
+// Columns stored uncompressed: type, site, func, depth, value, address, ts
+const segment = (firstId, rows) => {
+  const column = (id, width, values, write, min, max) => {
+    const data = Buffer.alloc(values.length * width);
+    values.forEach((v, i) => write(data, v, i * width));
+    return Buffer.concat([Buffer.from([id, width]), i64(min), i64(max), u32(data.length),
+      u32((data.length | 0x80000000) >>> 0), data]);
+  };
+  const depths = rows.map(r => r.depth);
+  const values = rows.map(r => r.value ?? null).filter(v => v !== null);
+  const head = Buffer.concat([Buffer.from([3]), u32(rows.length), i64(firstId), Buffer.from([7])]);
+  return Buffer.concat([
+    head,
+    column(0, 2, rows.map(r => r.type), (b, v, o) => b.writeUInt16LE(v, o), 0, 1),
+    column(1, 4, rows.map(r => r.site ?? 0xffffffff), (b, v, o) => b.writeUInt32LE(v, o), 0, 0),
+    column(2, 4, rows.map(() => 2), (b, v, o) => b.writeUInt32LE(v, o), 2, 2),
+    column(3, 4, depths, (b, v, o) => b.writeInt32LE(v, o), Math.min(...depths), Math.max(...depths)),
+    column(4, 8, rows.map(r => r.value ?? -(2n ** 63n)), (b, v, o) => b.writeBigInt64LE(BigInt(v), o),
+      values.length ? Math.min(...values) : 1, values.length ? Math.max(...values) : 0),
+    column(5, 8, rows.map(() => 0n), (b, v, o) => b.writeBigUInt64LE(v, o), 0, 0),
+    column(6, 4, rows.map((_, i) => 100 + i), (b, v, o) => b.writeUInt32LE(v, o), 100, 100 + rows.length - 1)
+  ]);
+};
+
+const file = Buffer.concat([
+  Buffer.from('TCOL'), u32(1),
+  string(0, 'func_enter'), string(1, 'assign'), string(2, 'main'), string(3, 'C:/src/a\\"b.c'),
+  site(0, 3, 7),
+  segment(0, [{ type: 0, depth: 1 }, { type: 1, depth: 1, site: 0, value: 5 }]),
+  segment(2, [{ type: 0, depth: 2 }, { type: 0, depth: 3 }])
+]);
+
+describe('TraceColumnsService', () => {
+  let dir;
+  let colsPath;
+
+  beforeAll(() => {
+    dir = mkdtempSync(path.join(tmpdir(), 'trace-columns-'));
+    colsPath = path.join(dir, 'trace.json.cols');
+    writeFileSync(colsPath, file);
+  });
+
+  afterAll(() => rmSync(dir, { recursive: true, force: true }));
+
+  it('indexes strings, sites and segment statistics without reading column data', async () => {
+    const index = await traceColumns.readIndex(colsPath);
+    expect(index.strings).toEqual(['func_enter', 'assign', 'main', 'C:/src/a"b.c']);
+    expect(index.sites).toEqual([{ file: 'C:/src/a"b.c', line: 7 }]);
+    expect(index.segments.map(s => [s.firstId, s.rows])).toEqual([[0, 2], [2, 2]]);
+    expect(index.segments[1].columns.depth.min).toBe(2n);
+    expect(index.segments[1].columns.value.min > index.segments[1].columns.value.max).toBe(true);
+  });
+
+  it('reads only the requested columns', async () => {
+    const { segments } = await traceColumns.readColumns(colsPath, ['depth', 'value']);
+    expect(Object.keys(segments[0].columns).sort()).toEqual(['depth', 'value']);
+    expect(Array.from(segments[0].columns.depth)).toEqual([1, 1]);
+    expect(Array.from(segments[0].columns.value)).toEqual([traceColumns.NO_VALUE, 5n]);
+    expect(Array.from(segments[1].columns.depth)).toEqual([2, 3]);
+  });
+
+  it('skips segments whose min/max cannot match the range filter', async () => {
+    const deep = await traceColumns.readColumns(colsPath, ['type'], { where: { depth: [3, 100] } });
+    expect(deep.segments.map(s => s.firstId)).toEqual([2]);
+
+    // The second segment has no values at all
+    const valued = await traceColumns.readColumns(colsPath, ['value'], { where: { value: [0, 10] } });
+    expect(valued.segments.map(s => s.firstId)).toEqual([0]);
+  });
+
+  it('keeps the complete segments of a cut-off file', async () => {
+    const cut = path.join(dir, 'cut.cols');
+    writeFileSync(cut, file.subarray(0, file.length - 10));
+    const index = await traceColumns.readIndex(cut);
+    expect(index.segments.map(s => s.firstId)).toEqual([0]);
+  });
+});
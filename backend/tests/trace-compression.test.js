@@ -0,0 +1,72 @@
+import { mkdtempSync, writeFileSync, rmSync } from 'fs';
+import { tmpdir } from 'os';
+import path from 'path';
+import traceCompression from '../src/services/trace-compression.service.js';
+
+const header = (rawSize, storedSize, stored = false) => {
+  const h = Buffer.alloc(8);
+  h.writeUInt32LE(rawSize, 0);
+  h.writeUInt32LE((storedSize | (stored ? 0x80000000 : 0)) >>> 0, 4);
+  return h;
+};
+
+// "abcd", then an 8-byte match 4 back, then the trailing literals
+const packed = Buffer.concat([
+  Buffer.from([0x44]), Buffer.from('abcd'), Buffer.from([4, 0]),
+  Buffer.from([0x50]), Buffer.from('XYZWV')
+]);
+const text = 'abcdabcdabcdXYZWV';
+
+const compressedFile = Buffer.concat([
+  Buffer.from('TLZ4'),
+  header(text.length, packed.length), packed,
+  header(5, 5, true), Buffer.from('plain')
+]);
+
+describe('TraceCompressionService', () => {
+  it('decodes LZ4 sequences, including overlapping matches and long lengths', () => {
+    expect(traceCompression.decodeBlock(packed, text.length).toString()).toBe(text);
+
+    // 20 literals (15 + 5) and a 1-byte-offset match of 4 + 15 + 1 = 20
+    const long = Buffer.concat([
+      Buffer.from([0xff, 5]), Buffer.from('0123456789abcdefghij'),
+      Buffer.from([1, 0, 1]), Buffer.from([0x10]), Buffer.from('!')
+    ]);
+    expect(traceCompression.decodeBlock(long, 41).toString())
+      .toBe('0123456789abcdefghij' + 'j'.repeat(20) + '!');
+  });
+
+  it('rejects matches that reach before the start of the block', () => {
+    const bad = Buffer.concat([Buffer.from([0x10]), Buffer.from('a'), Buffer.from([2, 0])]);
+    expect(() => traceCompression.decodeBlock(bad, 5)).toThrow();
+  });
+
+  it('streams blocks split across arbitrary chunk boundaries', async () => {
+    const decoder = traceCompression.createDecompressStream();
+    const out = [];
+    decoder.on('data', c => out.push(c));
+    const done = new Promise(resolve => decoder.on('end', resolve));
+    for (let i = 0; i < compressedFile.length; i += 3) decoder.write(compressedFile.subarray(i, i + 3));
+    decoder.end();
+    await done;
+    expect(Buffer.concat(out).toString()).toBe(text + 'plain');
+  });
+
+  it('reads plain and compressed trace files the same way', async () => {
+    const dir = mkdtempSync(path.join(tmpdir(), 'trace-compression-'));
+    try {
+      const json = JSON.stringify({ events: [{ id: 0, type: 'assign', name: text }] });
+      const plainPath = path.join(dir, 'plain.json');
+      writeFileSync(plainPath, json);
+
+      const body = Buffer.from(json);
+      const compressedPath = path.join(dir, 'compressed.json');
+      writeFileSync(compressedPath, Buffer.concat([Buffer.from('TLZ4'), header(body.length, body.length, true), body]));
+
+      expect(await traceCompression.readTrace(plainPath)).toEqual(JSON.parse(json));
+      expect(await traceCompression.readTrace(compressedPath)).toEqual(JSON.parse(json));
+    } finally {
+      rmSync(dir, { recursive: true, force: true });
+    }
+  });
+});
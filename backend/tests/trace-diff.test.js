@@ -0,0 +1,95 @@
+import { mkdtempSync, rmSync } from 'fs';
+import { tmpdir } from 'os';
+import path from 'path';
+import traceDiff from '../src/services/trace-diff.service.js';
+
+// Each run compiles its source in a session directory of its own
+const sessions = [];
+let session = 0;
+
+const makeTrace = (values, { interval = 4, hashes } = {}) => {
+  const file = path.join(sessions[session++ % sessions.length], 'src.cpp');
+  const events = [
+    { id: 0, type: 'func_enter', func: 'main', depth: 1, addr: '0x1000', ts: 5, caller: '0x9' },
+    ...values.map((v, i) => ({
+      id: i + 1, type: 'assign', func: 'x', depth: 1, addr: '(nil)', ts: 10 + i,
+      name: 'x', value: v, file, line: 3 + i
+    })),
+    { id: values.length + 1, type: 'func_exit', func: 'main', depth: 1, addr: '0x1000', ts: 99 }
+  ];
+  const checkpoints = [];
+  for (let e = interval, k = 0; e <= events.length; e += interval, k++) {
+    checkpoints.push({ event: e, hash: hashes ? hashes[k] : `h${k}`, depth: 1 });
+  }
+  return { events, checkpoint_interval: interval, checkpoints, semantic_hash: hashes ? hashes[hashes.length - 1] : 'same' };
+};
+
+describe('TraceDiffService', () => {
+  beforeAll(() => {
+    sessions.push(mkdtempSync(path.join(tmpdir(), 'trace-diff-')), mkdtempSync(path.join(tmpdir(), 'trace-diff-')));
+  });
+
+  afterAll(() => sessions.forEach(dir => rmSync(dir, { recursive: true, force: true })));
+
+  it('ignores addresses, timestamps and session paths', () => {
+    const a = makeTrace([1, 2, 3]);
+    const b = makeTrace([1, 2, 3]);
+    b.events[0].addr = '0x2000';
+    b.events[0].caller = '0xdead';
+    const result = traceDiff.findFirstDivergence(a, b);
+    expect(result.identical).toBe(true);
+  });
+
+  it('masks pointer values but compares text that looks like an address', () => {
+    const a = makeTrace([1]);
+    const b = makeTrace([1]);
+    Object.assign(a.events[1], { value: '0x7ffd1000', vtype: 'ptr' });
+    Object.assign(b.events[1], { value: '0x7ffd2000', vtype: 'ptr' });
+    expect(traceDiff.semanticKey(a.events[1])).toBe(traceDiff.semanticKey(b.events[1]));
+
+    a.events[1] = { type: 'stdout', text: 'got 0x10\n' };
+    b.events[1] = { type: 'stdout', text: 'got (nil)\n' };
+    expect(traceDiff.semanticKey(a.events[1])).not.toBe(traceDiff.semanticKey(b.events[1]));
+  });
+
+  it('binary-searches checkpoints and reports the first differing event with its stack', () => {
+    const values = Array.from({ length: 30 }, (_, i) => i);
+    const changed = values.slice();
+    changed[17] = -1;
+    const a = makeTrace(values, { hashes: Array.from({ length: 8 }, (_, k) => `h${k}`) });
+    const b = makeTrace(changed, { hashes: Array.from({ length: 8 }, (_, k) => (k < 4 ? `h${k}` : `x${k}`)) });
+
+    const result = traceDiff.findFirstDivergence(a, b);
+    expect(result.identical).toBe(false);
+    expect(result.checkpointsCompared).toBe(4);
+    expect(result.windowStart).toBe(16);
+    expect(result.eventIndex).toBe(18);
+    expect(result.a.value).toBe(17);
+    expect(result.b.value).toBe(-1);
+    expect(result.callStackA.map(f => f.function)).toEqual(['main']);
+  });
+
+  it('reports a length mismatch as a divergence at the end of the shorter trace', () => {
+    const a = makeTrace([1, 2], { interval: 8 });
+    const b = makeTrace([1, 2, 3], { interval: 8 });
+    b.semantic_hash = 'other';
+    const result = traceDiff.findFirstDivergence(a, b);
+    expect(result.identical).toBe(false);
+    expect(result.eventIndex).toBe(3);
+    expect(result.a.type).toBe('func_exit');
+    expect(result.b.type).toBe('assign');
+  });
+
+  it('reports differing hashes with equal events at the first mismatching checkpoint', () => {
+    const values = Array.from({ length: 10 }, (_, i) => i);
+    const a = makeTrace(values, { hashes: ['h0', 'h1', 'h2'] });
+    const b = makeTrace(values, { hashes: ['h0', 'x1', 'x2'] });
+    const result = traceDiff.findFirstDivergence(a, b);
+    expect(result.identical).toBe(false);
+    expect(result.hashOnly).toBe(true);
+    expect(result.checkpointsCompared).toBe(1);
+    expect(result.windowStart).toBe(4);
+    expect(result.eventIndex).toBe(7);
+    expect(traceDiff.formatReport(result)).toContain('within events #4-#7');
+  });
+});
@@ -0,0 +1,33 @@
+import traceIntern from '../src/services/trace-intern.service.js';
+
+describe('TraceInternService', () => {
+  it('resolves interned members and drops the string records', () => {
+    const trace = {
+      version: '1.0',
+      events: [
+        { intern: 0, s: 'func_enter' },
+        { intern: 1, s: 'main' },
+        { id: 0, type: 0, addr: '0x1', func: 1, depth: 1 },
+        { intern: 2, s: 'assign' },
+        { intern: 3, s: 'x' },
+        { intern: 4, s: 'a.c' },
+        { id: 1, type: 2, func: 1, depth: 1, name: 3, value: 7, file: 4, line: 3 },
+        { id: 2, type: 2, func: 1, depth: 1, name: 3, value: 8, file: 4, line: 4 }
+      ],
+      total_events: 3
+    };
+
+    expect(traceIntern.resolve(trace).events).toEqual([
+      { id: 0, type: 'func_enter', addr: '0x1', func: 'main', depth: 1 },
+      { id: 1, type: 'assign', func: 'main', depth: 1, name: 'x', value: 7, file: 'a.c', line: 3 },
+      { id: 2, type: 'assign', func: 'main', depth: 1, name: 'x', value: 8, file: 'a.c', line: 4 }
+    ]);
+  });
+
+  it('leaves traces without records alone', () => {
+    const events = [{ id: 0, type: 'assign', func: 'main', name: 'x', value: 1 }];
+    const trace = { events };
+    expect(traceIntern.resolve(trace)).toBe(trace);
+    expect(trace.events).toEqual([{ id: 0, type: 'assign', func: 'main', name: 'x', value: 1 }]);
+  });
+});
@@ -0,0 +1,58 @@
+import traceSubtrees from '../src/services/trace-subtrees.service.js';
+
+const call = (id, depth, ts) => [
+  { id, type: 'func_enter', func: 'fib', depth, ts },
+  { id: id + 1, type: 'return', func: 'fib', depth, ts: ts + 2, value: 1 },
+  { id: id + 2, type: 'func_exit', func: 'fib', depth, ts: ts + 4 }
+];
+
+describe('TraceSubtreesService', () => {
+  it('copies a referenced call with new ids and shifted timestamps', () => {
+    const trace = {
+      events: [
+        ...call(0, 1, 100),
+        { id: 3, type: 'call_ref', func: 'fib', depth: 1, ts: 200, ref: 0, events: 3, exitTs: 210 },
+        { id: 6, type: 'func_exit', func: 'main', depth: 0, ts: 220 }
+      ]
+    };
+    const events = traceSubtrees.resolve(trace).events;
+    expect(events.map(e => e.id)).toEqual([0, 1, 2, 3, 4, 5, 6]);
+    expect(events.slice(3, 6).map(e => [e.type, e.ts])).toEqual([['func_enter', 200], ['return', 202], ['func_exit', 204]]);
+  });
+
+  it('expands references inside copies and into the middle of earlier copies', () => {
+    // 0..8: outer call holding two calls; 9: a copy of the outer call;
+    // 18: a copy of the second inner call, which only exists inside 9's copy
+    const events = [
+      { id: 0, type: 'func_enter', func: 'outer', depth: 1, ts: 0 },
+      ...call(1, 2, 1),
+      { id: 4, type: 'call_ref', func: 'fib', depth: 2, ts: 10, ref: 1, events: 3, exitTs: 14 },
+      { id: 7, type: 'assign', func: 'outer', depth: 1, ts: 15, value: 2 },
+      { id: 8, type: 'func_exit', func: 'outer', depth: 1, ts: 16 },
+      { id: 9, type: 'call_ref', func: 'outer', depth: 1, ts: 100, ref: 0, events: 9, exitTs: 116 },
+      { id: 18, type: 'call_ref', func: 'fib', depth: 2, ts: 200, ref: 13, events: 3, exitTs: 204 }
+    ];
+    const full = Array.from(traceSubtrees.expand(events));
+    expect(full.map(e => e.id)).toEqual(Array.from({ length: 21 }, (_, i) => i));
+    expect(full.slice(9, 18).map(e => e.type)).toEqual(full.slice(0, 9).map(e => e.type));
+    expect(full.slice(18).map(e => [e.type, e.depth, e.ts])).toEqual([
+      ['func_enter', 2, 200], ['return', 2, 202], ['func_exit', 2, 204]
+    ]);
+    expect(full.every((e, i) => i === 0 || e.ts >= full[i - 1].ts)).toBe(true);
+  });
+
+  it('keeps copied timestamps within the repeated call', () => {
+    const events = [...call(0, 1, 0), { id: 3, type: 'call_ref', depth: 1, ts: 50, ref: 0, events: 3, exitTs: 51 }];
+    expect(Array.from(traceSubtrees.expand(events)).slice(3).map(e => e.ts)).toEqual([50, 51, 51]);
+  });
+
+  it('rejects references to events not yet seen', () => {
+    const events = [{ id: 0, type: 'call_ref', depth: 1, ts: 0, ref: 5, events: 3 }];
+    expect(() => traceSubtrees.resolve({ events })).toThrow('points outside');
+  });
+
+  it('leaves traces without references alone', () => {
+    const trace = { events: call(0, 1, 0) };
+    expect(traceSubtrees.resolve(trace)).toBe(trace);
+  });
+});
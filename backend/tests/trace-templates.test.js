@@ -0,0 +1,52 @@
+import traceTemplates from '../src/services/trace-templates.service.js';
+
+const text = JSON.stringify([
+  { type: 'loop_body_start', addr: '(nil)', func: 'main', depth: 1, loopId: 0, iteration: '#', file: 'a#.c', line: 6 },
+  { type: 'assign', addr: '(nil)', func: 'x', depth: 1, name: 'x', value: '#', file: 'a#.c', line: 7 }
+]).replace(/"#"/g, '#');
+
+describe('TraceTemplatesService', () => {
+  it('fills holes, ids and timestamps of each instance', () => {
+    const trace = {
+      events: [
+        { id: 0, type: 'func_enter', func: 'main', depth: 1, ts: 5 },
+        { template: 0, text },
+        { tpl: 0, id: 1, ts: 100, v: [2, -7], dt: [0, 3] },
+        { tpl: 0, id: 3, ts: 110, v: [3, 1.5], dt: [0, 1] },
+        { id: 5, type: 'loop_end', func: 'main', depth: 1, ts: 120 }
+      ]
+    };
+    const events = traceTemplates.resolve(trace).events;
+    expect(events.map(e => e.id)).toEqual([0, 1, 2, 3, 4, 5]);
+    expect(events[1]).toEqual({
+      id: 1, type: 'loop_body_start', addr: '(nil)', func: 'main', depth: 1, ts: 100,
+      loopId: 0, iteration: 2, file: 'a#.c', line: 6
+    });
+    expect(events[2].value).toBe(-7);
+    expect([events[4].name, events[4].value, events[4].ts]).toEqual(['x', 1.5, 111]);
+    expect(Object.keys(events[4]).slice(0, 6)).toEqual(['id', 'type', 'addr', 'func', 'depth', 'ts']);
+  });
+
+  it('counts a call_ref inside an instance as the events it stands for', () => {
+    const refText = JSON.stringify([
+      { type: 'loop_body_start', depth: 1 },
+      { type: 'call_ref', depth: 2, ref: 4, events: 5 },
+      { type: 'assign', depth: 1, value: '#' }
+    ]).replace(/"#"/g, '#');
+    const events = Array.from(traceTemplates.expand([
+      { template: 1, text: refText },
+      { tpl: 1, id: 20, ts: 0, v: [9], dt: [0, 1, 2] }
+    ]));
+    expect(events.map(e => e.id)).toEqual([20, 21, 26]);
+  });
+
+  it('rejects instances of unknown templates', () => {
+    expect(() => traceTemplates.resolve({ events: [{ template: 0, text: '[]' }, { tpl: 1, id: 0, ts: 0, v: [], dt: [] }] }))
+      .toThrow('used before it is defined');
+  });
+
+  it('leaves traces without templates alone', () => {
+    const trace = { events: [{ id: 0, type: 'func_enter', ts: 0 }] };
+    expect(traceTemplates.resolve(trace)).toBe(trace);
+  });
+});